@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Keeping the collector's sampling loop off the heap, see alloc.h.
+ */
+
+#include "alloc.h"
+
+#define HEAP_MIN_SHIFT 4		/* 16 bytes */
+#define HEAP_MAX_SHIFT 17		/* 128 KiB, larger goes to malloc */
+#define HEAP_HEADER 8			/* keeps blocks 8 byte aligned */
+#define HEAP_PRIME 2			/* blocks per size class up front */
+
+// A block on a free list reuses its payload for the link.
+struct HeapBlock
+{
+	struct HeapBlock *next;
+};
+
+static struct HeapBlock *HeapFree[HEAP_MAX_SHIFT + 1];
+static pthread_mutex_t HeapLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static int HeapShift(int n)
+{
+	int shift = HEAP_MIN_SHIFT;
+
+	while (shift <= HEAP_MAX_SHIFT && (1 << shift) < n)
+		++shift;
+	return shift;
+}
+
+
+
+static int HeapRoundup(int n)
+{
+	int shift = HeapShift(n);
+
+	return shift <= HEAP_MAX_SHIFT ? 1 << shift : (n + 7) & ~7;
+}
+
+
+
+// Every block starts with its usable size.
+static int HeapSize(void *p)
+{
+	return p ? *(int *)((char *)p - HEAP_HEADER) : 0;
+}
+
+
+
+static void *HeapMalloc(int n)
+{
+	const int size = HeapRoundup(n);
+	const int shift = HeapShift(size);
+	char *block = NULL;
+
+	if (shift <= HEAP_MAX_SHIFT)
+        {
+		pthread_mutex_lock(&HeapLock);
+		if (HeapFree[shift])
+                {
+			block = (char *)HeapFree[shift];
+			HeapFree[shift] = HeapFree[shift]->next;
+		}
+		pthread_mutex_unlock(&HeapLock);
+		if (block)
+			return block;
+	}
+
+	if (!(block = malloc(HEAP_HEADER + size)))
+		return NULL;
+	*(int *)block = size;
+	return block + HEAP_HEADER;
+}
+
+
+
+static void HeapRelease(void *p)
+{
+	if (!p)
+		return;
+
+	const int shift = HeapShift(HeapSize(p));
+
+	if (shift > HEAP_MAX_SHIFT)
+        {
+		free((char *)p - HEAP_HEADER);
+		return;
+	}
+
+	pthread_mutex_lock(&HeapLock);
+	((struct HeapBlock *)p)->next = HeapFree[shift];
+	HeapFree[shift] = p;
+	pthread_mutex_unlock(&HeapLock);
+}
+
+
+
+static void *HeapRealloc(void *p, int n)
+{
+	void *q;
+
+	if (HeapRoundup(n) == HeapSize(p))
+		return p;
+	if (!(q = HeapMalloc(n)))
+		return NULL;
+
+	memcpy(q, p, HeapSize(p) < n ? HeapSize(p) : n);
+	HeapRelease(p);
+	return q;
+}
+
+
+
+// A B-tree split takes a scratch buffer sized by the depth of the tree, so
+// growing tables first ask for 8 or 16 KiB long after the first sweeps,
+// sometimes while another block of that size is in use.  Every size class
+// starts with HEAP_PRIME blocks, about 512 KiB in all.
+static int HeapInit(void *unused)
+{
+	for (int shift = HEAP_MIN_SHIFT; shift <= HEAP_MAX_SHIFT; ++shift)
+        {
+		for (int i = 0; i < HEAP_PRIME; ++i)
+                {
+			char *block = malloc(HEAP_HEADER + (1 << shift));
+
+			if (!block)
+				return SQLITE_NOMEM;
+			*(int *)block = 1 << shift;
+			HeapRelease(block + HEAP_HEADER);
+		}
+	}
+	return SQLITE_OK;
+}
+
+
+
+static void HeapShutdown(void *unused)
+{
+}
+
+
+
+int TemperSqliteHeapInit(void)
+{
+	static const sqlite3_mem_methods methods = {
+		HeapMalloc, HeapRelease, HeapRealloc, HeapSize, HeapRoundup,
+		HeapInit, HeapShutdown, NULL
+	};
+	int header = 0;
+	int rc;
+
+	rc = sqlite3_config(SQLITE_CONFIG_MALLOC, &methods);
+	if (rc != SQLITE_OK)
+		return rc;
+
+	// Pages come out of one block SQLite allocates up front and shares
+	// between all connections of the process, so it holds the caches of
+	// TEMPER_SQLITE_CONNECTIONS of them at TEMPER_SQLITE_PAGES pages each.
+	// Pages past it come from the free lists.
+	rc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header);
+	if (rc != SQLITE_OK)
+		return rc;
+
+	return sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 4096 + header,
+	                      TEMPER_SQLITE_PAGES * TEMPER_SQLITE_CONNECTIONS);
+}
+
+
+
+#if defined TEMPER_ALLOC_COUNT
+
+/*
+ * The collector's own malloc family counts and forwards to glibc, which
+ * also catches the allocations of the shared libraries it loads.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *p);
+
+static __thread uint64_t allocations;
+
+
+
+void *malloc(size_t size)
+{
+	++allocations;
+	return __libc_malloc(size);
+}
+
+
+
+void *calloc(size_t count, size_t size)
+{
+	++allocations;
+	return __libc_calloc(count, size);
+}
+
+
+
+void *realloc(void *p, size_t size)
+{
+	++allocations;
+	return __libc_realloc(p, size);
+}
+
+
+
+void *memalign(size_t alignment, size_t size)
+{
+	++allocations;
+	return __libc_memalign(alignment, size);
+}
+
+
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+
+
+int posix_memalign(void **p, size_t alignment, size_t size)
+{
+	*p = memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+
+
+
+uint64_t TemperAllocCount(void)
+{
+	return allocations;
+}
+
+#endif
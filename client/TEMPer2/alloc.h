@@ -0,0 +1,47 @@
+#ifndef TEMPER_ALLOC_H
+#define TEMPER_ALLOC_H
+
+/*
+ * Keeping the collector's sampling loop off the heap.
+ *
+ * SQLite allocates and frees for every statement and transaction.
+ * TemperSqliteHeapInit() gives it free lists per size class that start
+ * with a few blocks each and keep every block handed back, and a
+ * preallocated page cache, so once the first sweeps have warmed them up
+ * storing a row no longer reaches malloc, not even when a growing table
+ * splits a page.
+ * The page cache is one pool for the whole process, shared by the
+ * collector's connections and those of the sketch stage and the backup.
+ *
+ * Build with `make ALLOC_COUNT=1` to count every malloc, calloc, realloc
+ * and memalign made by the calling thread, including those made inside
+ * SQLite and libusb.  Otherwise the count is always 0 and costs nothing.
+ * Such a build of temper exits with status 6 when a sweep allocated after
+ * the first TEMPER_ALLOC_WARMUP of them.
+ */
+
+#include <stdint.h>
+
+#if !defined TEMPER_SQLITE_PAGES
+#define TEMPER_SQLITE_PAGES 128	/* cache_size of each connection */
+#endif
+
+#if !defined TEMPER_SQLITE_CONNECTIONS
+#define TEMPER_SQLITE_CONNECTIONS 5	/* open at once, sharing the pool */
+#endif
+
+#if !defined TEMPER_ALLOC_WARMUP
+#define TEMPER_ALLOC_WARMUP 10	/* steady sweeps allowed to allocate */
+#endif
+
+// Call before any other SQLite function.  Returns an SQLite result code.
+int TemperSqliteHeapInit(void);
+
+#if defined TEMPER_ALLOC_COUNT
+// Allocations made so far by the calling thread.
+uint64_t TemperAllocCount(void);
+#else
+#define TemperAllocCount() ((uint64_t)0)
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Online backup of the collector's database, see backup.h.
+ */
+
+#include "backup.h"
+#include "logger.h"
+#include "timestamp.h"
+
+
+
+int BackupInit(Backup *b, const char *source, const char *spec, int64_t now)
+{
+	const char *colon = strrchr(spec, ':');
+	size_t length = strlen(spec);
+	long seconds = BACKUP_PERIOD_DEFAULT;
+
+	memset(b, 0, sizeof(*b));
+	if (colon && colon[1] && strspn(colon + 1, "0123456789") ==
+	    strlen(colon + 1))
+        {
+		seconds = atol(colon + 1);
+		length = colon - spec;
+	}
+	if (!length || length >= sizeof(b->path) || seconds <= 0)
+		return -EINVAL;
+
+	memcpy(b->path, spec, length);
+	b->source = source;
+	b->period = (int64_t)seconds * TEMPER_NS_PER_SEC;
+	b->next = now;
+	return 0;
+}
+
+
+
+// Open both ends and pin the snapshot to copy.
+static int BackupBegin(Backup *b)
+{
+	int rc = sqlite3_open_v2(b->source, &b->from, SQLITE_OPEN_READONLY,
+	                         NULL);
+
+	// The read transaction starts with the first read and lasts until
+	// BackupEnd(), every step copies from the same snapshot.  Both ends
+	// keep small caches, the page cache pool is shared (alloc.h).
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(b->from, "PRAGMA cache_size = 16; BEGIN;"
+		                  "SELECT COUNT(*) FROM sqlite_master;", 0, 0,
+		                  NULL);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_open(b->path, &b->to);
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(b->to, "PRAGMA cache_size = 16;", 0, 0, NULL);
+	if (rc == SQLITE_OK &&
+	    !(b->copy = sqlite3_backup_init(b->to, "main", b->from, "main")))
+		rc = sqlite3_errcode(b->to);
+
+	if (rc != SQLITE_OK)
+		LogMessage(TEMPER_LOG_WARN, -1, "backup: %s",
+		           sqlite3_errmsg(b->to ? b->to : b->from));
+	return rc;
+}
+
+
+
+static void BackupEnd(Backup *b, int rc, int64_t now)
+{
+	const int pages = b->copy ? sqlite3_backup_pagecount(b->copy) : 0;
+
+	if (b->copy && sqlite3_backup_finish(b->copy) != SQLITE_OK &&
+	    rc == SQLITE_DONE)
+		rc = sqlite3_errcode(b->to);
+	if (rc == SQLITE_DONE)
+        {
+		++b->done;
+		LogMessage(TEMPER_LOG_INFO, -1, "backup: %d pages in %.1f s",
+		           pages, (double)(now - b->started) / TEMPER_NS_PER_SEC);
+	}
+	else
+        {
+		++b->failed;
+		LogMessage(TEMPER_LOG_WARN, -1, "backup failed: %s",
+		           sqlite3_errstr(rc));
+	}
+
+	sqlite3_close(b->to);
+	sqlite3_exec(b->from, "COMMIT;", 0, 0, NULL);
+	sqlite3_close(b->from);
+	b->copy = NULL;
+	b->to = NULL;
+	b->from = NULL;
+
+	// Keep to the period, but never start again straight away.
+	b->next = b->started + b->period;
+	if (b->next <= now)
+		b->next = now + b->period;
+}
+
+
+
+int BackupStep(Backup *b, int64_t now, int64_t deadline)
+{
+	int rc;
+
+	if (!b->copy)
+        {
+		if (now < b->next)
+			return 0;
+
+		b->started = now;
+		rc = BackupBegin(b);
+		if (rc != SQLITE_OK)
+                {
+			BackupEnd(b, rc, now);
+			return 0;
+		}
+	}
+
+	// Stop when the slowest step so far would no longer fit.
+	do
+        {
+		int64_t before = now;
+
+		rc = sqlite3_backup_step(b->copy, BACKUP_PAGES);
+		now = TemperClockNow();
+		if (now - before > b->step)
+			b->step = now - before;
+	} while (rc == SQLITE_OK && now + b->step < deadline);
+
+	// Busy or locked only means the destination is in use, try again
+	// between the next sweeps.
+	if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+		return 1;
+
+	BackupEnd(b, rc, now);
+	return 0;
+}
+
+
+
+void BackupClose(Backup *b)
+{
+	if (b->copy)
+		BackupEnd(b, sqlite3_backup_step(b->copy, -1), TemperClockNow());
+}
@@ -0,0 +1,55 @@
+#ifndef TEMPER_BACKUP_H
+#define TEMPER_BACKUP_H
+
+/*
+ * Online backup of the collector's database, copied a few pages at a time
+ * between sweeps.
+ *
+ * A backup reads through its own connection, which holds one read
+ * transaction from the first page to the last.  With the database in WAL
+ * mode that is a snapshot: the collector keeps inserting while it is
+ * copied, the copy is the database as it was when the backup started, and
+ * it never has to restart because rows came in.  The destination is only
+ * replaced once the last page is in.
+ */
+
+#include <sqlite3.h>
+#include <stdint.h>
+
+#if !defined BACKUP_PAGES
+#define BACKUP_PAGES 64			/* pages per sqlite3_backup_step() */
+#endif
+
+#define BACKUP_PERIOD_DEFAULT 3600	/* seconds between backups */
+
+struct Backup
+{
+	const char *source;		/* the database file */
+	char path[256];			/* where the copy goes */
+	int64_t period;			/* ns between backup starts */
+	int64_t next;			/* ns, when the next one starts */
+	int64_t started;		/* ns, start of the one in progress */
+	int64_t step;			/* ns, slowest step seen */
+	sqlite3 *from;			/* holds the snapshot being copied */
+	sqlite3 *to;
+	sqlite3_backup *copy;		/* NULL between backups */
+	uint64_t done;			/* totals */
+	uint64_t failed;
+};
+typedef struct Backup Backup;
+
+// Back up source as described by spec, "path" or "path:seconds" for the
+// time between backups.  The first one starts right away.  Returns 0 or
+// -EINVAL for a bad spec.
+int BackupInit(Backup *b, const char *source, const char *spec, int64_t now);
+
+// Start a backup if one is due and copy pages until done or until another
+// step would run past deadline, at least one step either way.  Errors are
+// logged and the backup is tried again a period later; the collector never
+// waits on it.  Returns 1 while a backup is in progress, else 0.
+int BackupStep(Backup *b, int64_t now, int64_t deadline);
+
+// Finish a backup in progress, however long it takes, and free everything.
+void BackupClose(Backup *b);
+
+#endif
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * The collector's runtime state in a small file, see checkpoint.h.
+ */
+
+#include "checkpoint.h"
+#include "timestamp.h"
+
+
+
+int CheckpointSpec(const char *spec, char *path, size_t size,
+                   int64_t *period)
+{
+	const char *colon = strrchr(spec, ':');
+	size_t length = strlen(spec);
+	long seconds = CHECKPOINT_PERIOD_DEFAULT;
+
+	if (colon && colon[1] && strspn(colon + 1, "0123456789") ==
+	    strlen(colon + 1))
+        {
+		seconds = atol(colon + 1);
+		length = colon - spec;
+	}
+	if (!length || length >= size || seconds <= 0)
+		return -EINVAL;
+
+	memcpy(path, spec, length);
+	path[length] = '\0';
+	*period = (int64_t)seconds * TEMPER_NS_PER_SEC;
+	return 0;
+}
+
+
+
+static void CheckpointPut(Checkpoint *c, const void *data, size_t size)
+{
+	// A short write need not set errno.
+	if (size && fwrite(data, size, 1, c->f) != 1 && !c->error)
+		c->error = errno ? -errno : -EIO;
+}
+
+
+
+int CheckpointBegin(Checkpoint *c, const char *path)
+{
+	const uint32_t version = CHECKPOINT_VERSION;
+
+	memset(c, 0, sizeof(*c));
+	if (strlen(path) >= sizeof(c->path))
+		return -ENAMETOOLONG;
+	strcpy(c->path, path);
+	snprintf(c->tmp, sizeof(c->tmp), "%s.new", path);
+
+	if (!(c->f = fopen(c->tmp, "wb")))
+		return -errno;
+
+	CheckpointPut(c, CHECKPOINT_MAGIC, 4);
+	CheckpointPut(c, &version, sizeof(version));
+	return 0;
+}
+
+
+
+void CheckpointRecordBegin(Checkpoint *c, uint32_t tag)
+{
+	const uint32_t size = 0;
+
+	CheckpointPut(c, &tag, sizeof(tag));
+	c->record = ftell(c->f);
+	CheckpointPut(c, &size, sizeof(size));
+}
+
+
+
+// Go back and fill in the size now that it is known.
+void CheckpointRecordEnd(Checkpoint *c)
+{
+	const long end = ftell(c->f);
+	const uint32_t size = end - c->record - sizeof(size);
+
+	if (end < 0 || fseek(c->f, c->record, SEEK_SET) < 0)
+        {
+		if (!c->error)
+			c->error = -errno;
+		return;
+	}
+	CheckpointPut(c, &size, sizeof(size));
+	if (fseek(c->f, end, SEEK_SET) < 0 && !c->error)
+		c->error = -errno;
+}
+
+
+
+void CheckpointRecord(Checkpoint *c, uint32_t tag, const void *data,
+                      uint32_t size)
+{
+	CheckpointPut(c, &tag, sizeof(tag));
+	CheckpointPut(c, &size, sizeof(size));
+	CheckpointPut(c, data, size);
+}
+
+
+
+FILE *CheckpointFile(Checkpoint *c)
+{
+	return c->f;
+}
+
+
+
+int CheckpointCommit(Checkpoint *c)
+{
+	// No fsync: a checkpoint is only worth anything if it is recent, so
+	// surviving a crash of the collector is what matters.
+	if (fclose(c->f) != 0 && !c->error)
+		c->error = -errno;
+	c->f = NULL;
+	if (!c->error && rename(c->tmp, c->path) < 0)
+		c->error = -errno;
+	if (c->error)
+		unlink(c->tmp);
+	return c->error;
+}
+
+
+
+void CheckpointAbort(Checkpoint *c)
+{
+	if (c->f)
+		fclose(c->f);
+	c->f = NULL;
+	unlink(c->tmp);
+}
+
+
+
+int CheckpointLoad(const char *path, CheckpointFct fct, void *arg)
+{
+	FILE *f = fopen(path, "rb");
+	unsigned char *data;
+	long size;
+	int ret = 0;
+
+	if (!f)
+		return -errno;
+	if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET) < 0)
+        {
+		ret = -errno;
+		fclose(f);
+		return ret;
+	}
+	if (!(data = malloc(size ? size : 1)))
+        {
+		fclose(f);
+		return -ENOMEM;
+	}
+	if (size && fread(data, size, 1, f) != 1)
+		ret = -EIO;
+	fclose(f);
+
+	uint32_t version = 0;
+	if (!ret && size >= 8)
+		memcpy(&version, data + 4, sizeof(version));
+	if (!ret && (size < 8 || memcmp(data, CHECKPOINT_MAGIC, 4) ||
+	             version != CHECKPOINT_VERSION))
+		ret = -EPROTO;
+
+	for (long at = 8; !ret && at < size; )
+        {
+		uint32_t tag, length;
+
+		if (size - at < 8)
+                {
+			ret = -EPROTO;
+			break;
+		}
+		memcpy(&tag, data + at, sizeof(tag));
+		memcpy(&length, data + at + 4, sizeof(length));
+		at += 8;
+		if (length > size - at)
+                {
+			ret = -EPROTO;
+			break;
+		}
+		if (fct(arg, tag, data + at, length))
+			break;
+		at += length;
+	}
+
+	free(data);
+	return ret;
+}
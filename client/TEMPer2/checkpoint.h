@@ -0,0 +1,63 @@
+#ifndef TEMPER_CHECKPOINT_H
+#define TEMPER_CHECKPOINT_H
+
+/*
+ * The collector's runtime state in a small file, so a restarted collector
+ * carries on where the last one stopped.
+ *
+ * The file is "TCKP", a version, then records of a tag, a size and that
+ * many bytes.  Records hold structs as they are in memory, so a checkpoint
+ * is only read back by the same build; a record of the wrong size is
+ * skipped.  A new checkpoint is written next to the old one and renamed
+ * over it, so a crash at any point leaves one or the other.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CHECKPOINT_MAGIC "TCKP"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_PERIOD_DEFAULT 10	/* seconds */
+
+struct Checkpoint
+{
+	FILE *f;
+	long record;			/* offset of the open record's size */
+	int error;			/* first write error, negative errno */
+	char path[256];
+	char tmp[264];
+};
+typedef struct Checkpoint Checkpoint;
+
+// Split "path[:seconds]" into path, at most size bytes, and the period in
+// ns.  Returns 0 or -EINVAL.
+int CheckpointSpec(const char *spec, char *path, size_t size,
+                   int64_t *period);
+
+// Start writing a checkpoint that will replace path.  Returns 0 or a
+// negative errno.
+int CheckpointBegin(Checkpoint *c, const char *path);
+
+// Write a whole record.
+void CheckpointRecord(Checkpoint *c, uint32_t tag, const void *data,
+                      uint32_t size);
+
+// Or open one, write its contents to CheckpointFile() and close it.
+void CheckpointRecordBegin(Checkpoint *c, uint32_t tag);
+void CheckpointRecordEnd(Checkpoint *c);
+FILE *CheckpointFile(Checkpoint *c);
+
+// Replace the old checkpoint with the new one, or throw the new one away.
+// Commit returns 0 or the first error seen while writing.
+int CheckpointCommit(Checkpoint *c);
+void CheckpointAbort(Checkpoint *c);
+
+// Called for every record in the file.  Return non zero to stop.
+typedef int (*CheckpointFct)(void *arg, uint32_t tag, const void *data,
+                             uint32_t size);
+
+// Read path and hand its records to fct.  Returns 0, -ENOENT when there is
+// no checkpoint, -EPROTO when it isn't one, or another negative errno.
+int CheckpointLoad(const char *path, CheckpointFct fct, void *arg);
+
+#endif
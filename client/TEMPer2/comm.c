@@ -4,6 +4,7 @@
 #include <strings.h>
 #include <usb.h>
 #include <errno.h>
+#include <pthread.h>
 
 /*
  * Temper.c by Robert Kavaler (c) 2009 (relavak.com)
@@ -41,6 +42,50 @@
 
 /* #define debugit */
 
+typedef int (*TemperConvertFct)(Temper*, int16_t word, TemperData* dst);
+
+struct Product 
+{
+        uint16_t                vendor;
+        uint16_t                id;
+        const char              *name;
+        TemperConvertFct        convert[2]; /* Arbitrary limit ? */
+};
+
+struct Temper 
+{
+        usb_dev_handle *handle;
+        int debug;
+        int timeout;
+        const struct Product    *product;
+        int serial_index;       /* iSerialNumber, 0 if there is none */
+        int serial_len;         /* cached serial, 0 until read */
+        char serial[64];
+};
+
+// One TEMPer device found on the bus.
+struct TemperDevice
+{
+        struct usb_device       *dev;       /* NULL for a hole */
+        const struct Product    *product;
+        unsigned long           address;    /* bus << 8 | device, 0: hole */
+};
+
+struct TemperContext 
+{
+        unsigned                generation; /* of the bus list scanned */
+        int                     count;
+        struct TemperDevice     *devices;
+};
+
+/* libusb-0.1 has a single bus list per process: walk or rescan it only
+ * while holding BusLock.  BusGeneration counts rescans, as a rescan frees
+ * the usb_device structures of devices that went away.
+ */
+static pthread_mutex_t BusLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned BusGeneration;
+static int BusInitialized;
+
 static int TEMPer2V13ToTemperature(Temper*,int16_t word, TemperData* dst);
 static int TEMPerHUMToTemperature(Temper*,int16_t word, TemperData* dst);
 static int TEMPerHUMToHumidity(Temper*,int16_t word, TemperData* dst);
@@ -73,9 +118,9 @@ static const unsigned ProductCount = sizeof(ProductList)/sizeof(struct Product);
 
 
 
-Temper * TemperCreate(struct usb_device *dev, int timeout, int debug, 
-                       const struct Product* product
-                     )
+static Temper * TemperCreate(struct usb_device *dev, int timeout, int debug, 
+                              const struct Product* product, int *err
+                            )
 {
 #ifdef debugit
         printf("%s\n","TemperCreate entered...");
@@ -95,15 +140,21 @@ Temper * TemperCreate(struct usb_device *dev, int timeout, int debug,
 	}
 
 	t = calloc(1, sizeof(*t)); // Use calloc to initialize memory to 0.
-	t->device = dev;
+	if(!t)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
 	t->timeout = timeout;
 	t->debug = debug;
 	t->product = product;
+	t->serial_index = dev->descriptor.iSerialNumber;
 
-	t->handle = usb_open(t->device);
+	t->handle = usb_open(dev);
 	if(!t->handle) 
         {
 		free(t);
+		*err = -ENODEV;
 		return NULL; // No handle created for product.
 	}
         // Create a Temper instance for Temper t. *****************************
@@ -179,6 +230,7 @@ Temper * TemperCreate(struct usb_device *dev, int timeout, int debug,
         {
 		usb_close(t->handle);
 		free(t);
+		*err = -EBUSY;
 		return NULL; // No Temper device to return.
 	}
 
@@ -188,15 +240,29 @@ Temper * TemperCreate(struct usb_device *dev, int timeout, int debug,
 
 
 
-/* Counter the number of Temper2 temperature sensors and Humidity sensors
- * and return the count.
- */
-int TemperCount ()
+// The product entry dev is, NULL if it isn't a TEMPer device.
+static const struct Product *TemperMatch(const struct usb_device *dev)
 {
-#ifdef debugit
-    printf ("%s\n","TemperCount entered...");
-#endif
+	for(unsigned i = 0; i < ProductCount; ++i) 
+        {
+		if(dev->descriptor.idVendor == ProductList[i].vendor &&
+		   dev->descriptor.idProduct == ProductList[i].id) 
+                {
+			return &ProductList[i];
+		}
+	}
 
+	return NULL;
+}
+
+
+
+/* Walk the bus list for TEMPer devices, writing up to max of them into
+ * devices (which may be NULL) and returning how many there are.  Caller
+ * holds BusLock.
+ */
+static int TemperScan(struct TemperDevice *devices, int max)
+{
     struct usb_bus *bus;
     int number_tempers = 0; 
 
@@ -205,15 +271,19 @@ int TemperCount ()
          struct usb_device * dev;
          for(dev=bus->devices; dev; dev=dev->next)
          {
-		for(unsigned i = 0; i < ProductCount; ++i) 
-                {
-		      if(dev->descriptor.idVendor == ProductList[i].vendor &&
-		         dev->descriptor.idProduct == ProductList[i].id) 
-                      {
-                         ++number_tempers;
-                      }
-
-                 } // Done checking each device against product list.
+              const struct Product *product = TemperMatch(dev);
+
+              if (product)
+              {
+                   if (number_tempers < max)
+                   {
+                        devices[number_tempers].dev = dev;
+                        devices[number_tempers].product = product;
+                        devices[number_tempers].address =
+                             (unsigned long)bus->location << 8 | dev->devnum;
+                   }
+                   ++number_tempers;
+              }
 
           } // Done stepping through all USB devices on a bus.
 
@@ -224,6 +294,24 @@ int TemperCount ()
 
 
 
+/* Counter the number of Temper2 temperature sensors and Humidity sensors
+ * and return the count.
+ */
+int TemperCount ()
+{
+#ifdef debugit
+    printf ("%s\n","TemperCount entered...");
+#endif
+
+    pthread_mutex_lock(&BusLock);
+    int number_tempers = TemperScan(NULL, 0);
+    pthread_mutex_unlock(&BusLock);
+
+    return number_tempers;
+}
+
+
+
 Temper * TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug)
 {
 #ifdef debugit
@@ -231,14 +319,16 @@ Temper * TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug)
 #endif
 
 	struct usb_bus *bus;
-	int n;
+	Temper *t = NULL;
+	int n, err;
 
+	pthread_mutex_lock(&BusLock);
 	n = 0;
-	for(bus=usb_get_busses(); bus; bus=bus->next) 
+	for(bus=usb_get_busses(); bus && !t; bus=bus->next) 
         {
 	    struct usb_device *dev;
 
-	    for(dev=bus->devices; dev; dev=dev->next) 
+	    for(dev=bus->devices; dev && !t; dev=dev->next) 
             {
 		if(debug) 
                 {
@@ -246,38 +336,249 @@ Temper * TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug)
 			       dev->descriptor.idVendor,
 			       dev->descriptor.idProduct);
 		}
-		for(unsigned i = 0; i < ProductCount; ++i) 
+
+		const struct Product *product = TemperMatch(dev);
+		if(product) 
                 {
-			if(dev->descriptor.idVendor == ProductList[i].vendor 
-                        && dev->descriptor.idProduct == ProductList[i].id) 
+			if(debug) 
                         {
-				if(debug) 
-                                {
-				    printf("Found deviceNum %d\n", n);
-				}
-
-				if(n == deviceNum) 
-                                {
-                                   if ( dev )
-				   { return TemperCreate(dev, timeout,
-	       			   		       debug,
-						       &ProductList[i]
-                                                      );
-                                   }
-				}
-
-				n++;
-
-                                // Put the current sensor in a list here.
+			    printf("Found deviceNum %d\n", n);
 			}
 
-		} // Done looping through Temper products.
+			if(n == deviceNum) 
+                        {
+			    t = TemperCreate(dev, timeout, debug, product, &err);
+			}
+
+			n++;
+		}
 
 	    } // Done looping through all USB devices.
 
 	} // Done looping through all USB busses.
+	pthread_mutex_unlock(&BusLock);
 
-	return NULL; // There aren't any TEMPer2 devices.
+	return t; // NULL if there isn't such a TEMPer2 device.
+}
+
+
+
+int TemperVersion(void)
+{
+	return TEMPER_VERSION;
+}
+
+
+
+const char *TemperStrError(int err)
+{
+	return strerror(err < 0 ? -err : err);
+}
+
+
+
+int TemperSupports(unsigned vendor, unsigned product)
+{
+	for(unsigned i = 0; i < ProductCount; ++i) 
+        {
+		if(vendor == ProductList[i].vendor &&
+		   product == ProductList[i].id) 
+			return 1;
+	}
+
+	return 0;
+}
+
+
+
+/* Match the bus list against the context.  A device still plugged in
+ * keeps its number, one that went away leaves a hole and a new one takes
+ * the first hole or goes on the end.  Caller holds BusLock.
+ */
+static int TemperContextSnapshot(TemperContext *ctx)
+{
+	int count = TemperScan(NULL, 0);
+	struct TemperDevice *found = NULL, *devices;
+	int slots = ctx->count;
+
+	if (count > 0)
+        {
+		found = calloc(count, sizeof(*found));
+		if (!found)
+			return -ENOMEM;
+		TemperScan(found, count);
+	}
+
+	// Every old number plus every device found is the most needed.
+	devices = calloc(slots + count ? slots + count : 1, sizeof(*devices));
+	if (!devices)
+        {
+		free(found);
+		return -ENOMEM;
+	}
+
+	for (int i = 0; i < slots; ++i)
+        {
+		for (int j = 0; ctx->devices[i].dev && j < count; ++j)
+                {
+			if (found[j].dev &&
+			    found[j].address == ctx->devices[i].address)
+                        {
+				devices[i] = found[j];
+				found[j].dev = NULL;
+				break;
+			}
+		}
+	}
+
+	int hole = 0;
+	for (int j = 0; j < count; ++j)
+        {
+		if (!found[j].dev)
+			continue;
+		while (hole < slots && devices[hole].dev)
+			++hole;
+		if (hole == slots)
+			++slots;
+		devices[hole] = found[j];
+	}
+
+	while (slots > 0 && !devices[slots - 1].dev)
+		--slots;
+
+	free(found);
+	free(ctx->devices);
+	ctx->devices = devices;
+	ctx->count = slots;
+	ctx->generation = BusGeneration;
+	return slots;
+}
+
+
+
+TemperContext *TemperContextCreate(int *err)
+{
+	TemperContext *ctx = calloc(1, sizeof(*ctx));
+
+	if (!ctx)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	*err = TemperContextRescan(ctx);
+	if (*err < 0)
+        {
+		TemperContextFree(ctx);
+		return NULL;
+	}
+
+	*err = 0;
+	return ctx;
+}
+
+
+
+int TemperContextRescan(TemperContext *ctx)
+{
+	int ret;
+
+	pthread_mutex_lock(&BusLock);
+	if (!BusInitialized)
+        {
+		usb_init();
+		BusInitialized = 1;
+	}
+	usb_find_busses();
+	usb_find_devices();
+	++BusGeneration;
+	ret = TemperContextSnapshot(ctx);
+	pthread_mutex_unlock(&BusLock);
+
+	return ret;
+}
+
+
+
+void TemperContextFree(TemperContext *ctx)
+{
+	if (ctx)
+        {
+		free(ctx->devices);
+		free(ctx);
+	}
+}
+
+
+
+int TemperContextCount(const TemperContext *ctx)
+{
+	return ctx->count;
+}
+
+
+
+int TemperContextPresent(const TemperContext *ctx, int deviceNum)
+{
+	return deviceNum >= 0 && deviceNum < ctx->count &&
+	       ctx->devices[deviceNum].dev != NULL;
+}
+
+
+
+Temper *TemperContextOpen(TemperContext *ctx, int deviceNum, int timeout,
+                          int debug, int *err)
+{
+	Temper *t = NULL;
+
+	pthread_mutex_lock(&BusLock);
+
+	// Another context rescanned, our usb_device pointers may be gone.
+	if (ctx->generation != BusGeneration)
+        {
+		*err = TemperContextSnapshot(ctx);
+		if (*err < 0)
+			goto done;
+	}
+
+	if (!TemperContextPresent(ctx, deviceNum))
+        {
+		*err = -ENODEV;
+		goto done;
+	}
+
+	if (debug)
+        {
+		printf("Found deviceNum %d\n", deviceNum);
+	}
+	*err = 0;
+	t = TemperCreate(ctx->devices[deviceNum].dev, timeout, debug,
+	                 ctx->devices[deviceNum].product, err);
+
+done:
+	pthread_mutex_unlock(&BusLock);
+	return t;
+}
+
+
+
+const char *TemperGetProductName(const Temper *t)
+{
+	return t->product->name;
+}
+
+
+
+int TemperGetTimeout(const Temper *t)
+{
+	return t->timeout;
+}
+
+
+
+void TemperSetTimeout(Temper *t, int timeout)
+{
+	t->timeout = timeout;
 }
 
 
@@ -334,7 +635,7 @@ int TemperSendCommand8(Temper *t,
         {
            printf("sending bytes %02x, %02x, %02x, %02x, ", a, b, c, d);
            printf("%02x, %02x, %02x, %02x ", e, f, g, h);
-           printf("(buffer len = %d)\n", sizeof(buf));
+           printf("(buffer len = %d)\n", (int)sizeof(buf));
 	}
 
 	ret = usb_control_msg(t->handle, 0x21, 9, 0x200, 0x01,
@@ -342,8 +643,11 @@ int TemperSendCommand8(Temper *t,
 
 	if(ret != sizeof(buf)) 
         {
-		perror("usb_control_msg failed");
-		return -1;
+		if(t->debug) 
+                {
+			printf("usb_control_msg failed: %d\n", ret);
+		}
+		return ret < 0 ? ret : -EIO;
 	}
 
 	return 0;
@@ -367,7 +671,7 @@ int TemperSendCommand2(Temper *t, int a, int b)
 	if(t->debug) 
         {
 		printf("sending bytes %02x, %02x (buffer len = %d)\n",
-		       a, b, sizeof(buf));
+		       a, b, (int)sizeof(buf));
 	}
 
 	ret = usb_control_msg(t->handle, 0x21, 9, 0x201, 0x00,
@@ -375,8 +679,11 @@ int TemperSendCommand2(Temper *t, int a, int b)
 
 	if(ret != sizeof(buf)) 
         {
-		perror("usb_control_msg failed");
-		return -1;
+		if(t->debug) 
+                {
+			printf("usb_control_msg failed: %d\n", ret);
+		}
+		return ret < 0 ? ret : -EIO;
 	}
 
 	return 0;
@@ -500,9 +807,9 @@ int TemperGetData(Temper *t, struct TemperData *data, unsigned int count)
 	unsigned char buf[8];
 	int ret = TemperInterruptRead(t, buf, sizeof(buf));
 
-	for(int i = 0; i < count; ++i) 
+	for(unsigned int i = 0; i < count; ++i) 
         {
-		if ((2*i+3) < ret) 
+		if (ret > 0 && 2*i+3 < (unsigned int)ret) 
                 {
 			int16_t word = ((int8_t)buf[2*i+2] << 8) | buf[2*i+3];
 			t->product->convert[i](t, word, &data[i]);
@@ -528,14 +835,22 @@ int TemperGetSerialNumber(Temper* t, char* buf, unsigned int len)
 	if (len == 0)
 		return -EINVAL;
 
-	if (t->device->descriptor.iSerialNumber == 0) 
+	if (t->serial_index == 0) 
         {
 		buf[0] = 0;
 		return -ENOENT;
 	}
 
-	return usb_get_string_simple(t->handle,
-				     t->device->descriptor.iSerialNumber,
-				     buf, len
-                                    );
+	// The serial number doesn't change, ask the device only once.
+	if (t->serial_len == 0)
+        {
+		int ret = usb_get_string_simple(t->handle, t->serial_index,
+		                                t->serial, sizeof(t->serial));
+		if (ret < 0)
+			return ret;
+		t->serial_len = ret;
+	}
+
+	snprintf(buf, len, "%.*s", t->serial_len, t->serial);
+	return (unsigned)t->serial_len < len ? t->serial_len : (int)len - 1;
 }
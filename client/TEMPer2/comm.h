@@ -31,6 +31,25 @@
  * 
  */
 
+#include <stdint.h>
+
+/*
+ * libtemper API version.  The major number is the shared library's soname
+ * (libtemper.so.2) and changes only when existing calls or structures
+ * change incompatibly; minor releases only add.
+ *
+ * Thread safety: libusb-0.1 keeps one bus list per process, every call
+ * that walks or rescans it takes a lock inside libtemper.  A TemperContext
+ * and a Temper may each be used by one thread at a time; different Tempers
+ * may be read concurrently from different threads.  Errors are returned as
+ * negative errno values, nothing is printed unless debug was asked for.
+ */
+#define TEMPER_VERSION_MAJOR 2
+#define TEMPER_VERSION_MINOR 4
+#define TEMPER_VERSION_PATCH 0
+#define TEMPER_VERSION ((TEMPER_VERSION_MAJOR << 16) | \
+                        (TEMPER_VERSION_MINOR << 8) | TEMPER_VERSION_PATCH)
+
 struct TemperData 
 {
 	float value;
@@ -48,36 +67,55 @@ typedef struct TemperData TemperData;
 				   "" \
 	                         )
 
-struct Temper 
-{
-        struct usb_device *device;
-        usb_dev_handle *handle;
-        int debug;
-        int timeout;
-        const struct Product    *product;
-};
+// An open TEMPer device, opaque from version 1.
 typedef struct Temper Temper;
 
-typedef int (*TemperConvertFct)(Temper*, int16_t word, TemperData* dst);
+// The TEMPer devices found by one scan of the USB bus.
+typedef struct TemperContext TemperContext;
 
-struct Product 
-{
-        uint16_t                vendor;
-        uint16_t                id;
-        const char              *name;
-        TemperConvertFct        convert[2]; /* Arbitrary limit ? */
-};
+// TEMPER_VERSION of the library actually loaded.
+int TemperVersion(void);
 
-// Count the number of temperature and humidity sensors hooked to the USB
-// and return as an int.
-int TemperCount();
+// Text for a negative errno returned by any Temper call.
+const char *TemperStrError(int err);
 
-Temper *TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug);
+// Scan the USB bus for TEMPer devices.  Returns NULL and sets *err on
+// failure.
+TemperContext *TemperContextCreate(int *err);
+
+// Scan the bus again, devices may have come or gone.  A device keeps its
+// number for as long as it stays plugged in: one that went away leaves a
+// hole, a new one takes the lowest hole or the next number.  Returns
+// TemperContextCount() or a negative errno.
+int TemperContextRescan(TemperContext *ctx);
+
+void TemperContextFree(TemperContext *ctx);
+
+// Numbers in use after the last scan, holes included.
+int TemperContextCount(const TemperContext *ctx);
+
+// Non zero if deviceNum is a device and not a hole.
+int TemperContextPresent(const TemperContext *ctx, int deviceNum);
+
+// Non zero if the USB vendor and product ids are a TEMPer this library
+// reads, e.g. to pick hotplug events worth a rescan.
+int TemperSupports(unsigned vendor, unsigned product);
+
+// Open device deviceNum of the last scan.  timeout is in ms.  Returns
+// NULL and sets *err on failure.
+Temper *TemperContextOpen(TemperContext *ctx, int deviceNum, int timeout,
+                          int debug, int *err);
 
 void TemperFree(Temper *t);
 
-int TempterGetOtherStuff(Temper *t, char *buf, int length);
+const char *TemperGetProductName(const Temper *t);
+
+int TemperGetTimeout(const Temper *t);
+
+void TemperSetTimeout(Temper *t, int timeout);
 
+// The following return 0 or the byte count on success, a negative errno
+// on failure.
 int TemperSendCommand8(Temper *t, int a, int b, int c, int d, 
                                   int e, int f, int g, int h
                       );
@@ -88,6 +126,17 @@ int TemperGetData(Temper *t, TemperData *data, unsigned int count);
 
 int TemperInterruptRead(Temper* t, unsigned char *buf, unsigned int len);
 
+// Read once from the device, later calls are answered from a copy.
 int TemperGetSerialNumber(Temper* t, char* buf, unsigned int len);
 
+// Before version 1: these use one process wide context scanned by the
+// caller with usb_init(), usb_find_busses() and usb_find_devices() from
+// <usb.h>, which comm.h leaves to the caller to include.
+
+// Count the number of temperature and humidity sensors hooked to the USB
+// and return as an int.
+int TemperCount();
+
+Temper *TemperCreateFromDeviceNumber(int deviceNum, int timeout, int debug);
+
 #endif
@@ -0,0 +1,227 @@
+#include <math.h>
+#include <string.h>
+
+/*
+ * Write side compression of sensor rows, see compress.h.
+ */
+
+#include "compress.h"
+#include "timestamp.h"
+
+
+
+static void CompressOpenDoor(Compressor *c)
+{
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		c->low[i] = -HUGE_VAL;
+		c->high[i] = HUGE_VAL;
+	}
+}
+
+
+
+// Make r the last stored row.
+static void CompressArchive(Compressor *c, const TemperReading *r)
+{
+	c->archive = *r;
+	c->have_archive = 1;
+	c->have_held = 0;
+	CompressOpenDoor(c);
+}
+
+
+
+void CompressInit(Compressor *c, const CompressConfig *config)
+{
+	memset(c, 0, sizeof(*c));
+	c->config = config;
+	CompressOpenDoor(c);
+}
+
+
+
+// Narrow the swinging door with r.  Returns 0 without touching the door
+// when r can not lie on a line from the archived row within the bound.
+static int CompressNarrow(Compressor *c, const TemperReading *r)
+{
+	const double e = c->config->deviation;
+	const double dt = (double)(r->timestamp - c->archive.timestamp);
+	double low[TEMPER_CHANNELS], high[TEMPER_CHANNELS];
+
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		const double dv = (double)r->value[i] - c->archive.value[i];
+
+		if (dt <= 0) // Same instant as the archive, no slope to speak of.
+                {
+			if (fabs(dv) > e)
+				return 0;
+			low[i] = c->low[i];
+			high[i] = c->high[i];
+			continue;
+		}
+
+		low[i] = fmax(c->low[i], (dv - e) / dt);
+		high[i] = fmin(c->high[i], (dv + e) / dt);
+		if (low[i] > high[i])
+			return 0; // The door has closed.
+	}
+
+	memcpy(c->low, low, sizeof(low));
+	memcpy(c->high, high, sizeof(high));
+	return 1;
+}
+
+
+
+// The held reading moved onto the middle of the door, which keeps every
+// reading since the archive within the bound of the stored segment.
+static void CompressFit(const Compressor *c, TemperReading *out)
+{
+	const double dt = (double)(c->held.timestamp - c->archive.timestamp);
+
+	*out = c->held;
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		if (dt > 0)
+                {
+			const double slope = (c->low[i] + c->high[i]) / 2;
+			out->value[i] = c->archive.value[i] + slope * dt;
+		}
+		else
+                {
+			out->value[i] = c->archive.value[i];
+		}
+	}
+}
+
+
+
+static int CompressHeartbeatDue(const Compressor *c, const TemperReading *r)
+{
+	return c->config->heartbeat > 0 &&
+	       r->timestamp - c->archive.timestamp >=
+	       c->config->heartbeat * TEMPER_NS_PER_SEC;
+}
+
+
+
+int CompressPush(Compressor *c, const TemperReading *in, TemperReading *out)
+{
+	int n = 0;
+
+	if (!c->have_archive || c->config->mode == COMPRESS_NONE)
+        {
+		CompressArchive(c, in);
+		out[n++] = *in;
+		return n;
+	}
+
+	if (c->config->mode == COMPRESS_DEADBAND)
+        {
+		int moved = CompressHeartbeatDue(c, in);
+
+		for (int i = 0; i < TEMPER_CHANNELS && !moved; ++i)
+                {
+			moved = fabs((double)in->value[i] - c->archive.value[i])
+			        > c->config->deviation;
+		}
+		if (moved)
+                {
+			CompressArchive(c, in);
+			out[n++] = *in;
+		}
+		return n;
+	}
+
+	// Swinging door.
+	if (!CompressNarrow(c, in))
+        {
+		if (c->have_held)
+                {
+			CompressFit(c, &out[n]);
+			CompressArchive(c, &out[n]);
+			++n;
+		}
+		if (!CompressNarrow(c, in)) // A jump at the same instant.
+                {
+			CompressArchive(c, in);
+			out[n++] = *in;
+			return n;
+		}
+	}
+
+	c->held = *in;
+	c->have_held = 1;
+
+	if (CompressHeartbeatDue(c, in))
+        {
+		CompressFit(c, &out[n]);
+		CompressArchive(c, &out[n]);
+		++n;
+	}
+
+	return n;
+}
+
+
+
+int CompressFlush(Compressor *c, TemperReading *out)
+{
+	if (!c->have_held)
+		return 0;
+
+	CompressFit(c, out);
+	CompressArchive(c, out);
+	return 1;
+}
+
+
+
+void CompressReconstruct(const CompressConfig *config,
+                         const TemperReading *before,
+                         const TemperReading *after,
+                         int64_t timestamp, TemperReading *out)
+{
+	*out = *before;
+	out->timestamp = timestamp;
+
+	if (config->mode != COMPRESS_SWINGING_DOOR || !after ||
+	    after->timestamp <= before->timestamp)
+		return; // Sample and hold.
+
+	const double f = (double)(timestamp - before->timestamp) /
+	                 (double)(after->timestamp - before->timestamp);
+
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		out->value[i] = before->value[i] +
+		                f * (after->value[i] - before->value[i]);
+	}
+}
+
+
+
+const char *CompressModeToString(enum CompressMode mode)
+{
+	switch (mode)
+        {
+	case COMPRESS_DEADBAND:		return "deadband";
+	case COMPRESS_SWINGING_DOOR:	return "swing";
+	default:			return "none";
+	}
+}
+
+
+
+int CompressModeFromString(const char *name)
+{
+	if (strcmp(name, "none") == 0)
+		return COMPRESS_NONE;
+	if (strcmp(name, "deadband") == 0)
+		return COMPRESS_DEADBAND;
+	if (strcmp(name, "swing") == 0)
+		return COMPRESS_SWINGING_DOOR;
+	return -1;
+}
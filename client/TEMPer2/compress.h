@@ -0,0 +1,71 @@
+#ifndef TEMPER_COMPRESS_H
+#define TEMPER_COMPRESS_H
+
+/*
+ * Write side compression of sensor rows.
+ *
+ * Deadband:        a row is stored when any channel moved more than
+ *                  `deviation` away from the last stored row.  Readers
+ *                  reconstruct by holding the last stored row.
+ *
+ * Swinging door:   rows are stored at the ends of straight segments that
+ *                  stay within `deviation` of every reading in between.
+ *                  Readers reconstruct by linear interpolation between the
+ *                  two stored rows around the wanted time.
+ *
+ * Both modes also store a heartbeat row when `heartbeat` seconds have
+ * passed since the last stored row, so a quiet sensor is still seen alive.
+ */
+
+#include "reading.h"
+
+enum CompressMode
+{
+	COMPRESS_NONE,		/* store every reading */
+	COMPRESS_DEADBAND,
+	COMPRESS_SWINGING_DOOR,
+};
+
+struct CompressConfig
+{
+	enum CompressMode mode;
+	float deviation;	/* error bound in channel units */
+	long heartbeat;		/* seconds, 0 disables */
+};
+typedef struct CompressConfig CompressConfig;
+
+// Per sensor state, one for every device being sampled.
+struct Compressor
+{
+	const CompressConfig *config;
+	int have_archive;		/* archive holds the last stored row */
+	TemperReading archive;
+	int have_held;			/* held is the newest unstored reading */
+	TemperReading held;
+	double low[TEMPER_CHANNELS];	/* swinging door slopes, per ns */
+	double high[TEMPER_CHANNELS];
+};
+typedef struct Compressor Compressor;
+
+void CompressInit(Compressor *c, const CompressConfig *config);
+
+// Feed one reading.  Rows that must be stored are written to out (which
+// must have room for two) and their number is returned.
+int CompressPush(Compressor *c, const TemperReading *in, TemperReading *out);
+
+// Emit the pending reading, if any, before shutting down.  Returns 0 or 1.
+int CompressFlush(Compressor *c, TemperReading *out);
+
+// Rebuild the value at `timestamp` from the stored rows on either side of
+// it.  `after` may be NULL past the newest stored row.
+void CompressReconstruct(const CompressConfig *config,
+                         const TemperReading *before,
+                         const TemperReading *after,
+                         int64_t timestamp, TemperReading *out);
+
+const char *CompressModeToString(enum CompressMode mode);
+
+// Parse "none", "deadband" or "swing", returns -1 if unknown.
+int CompressModeFromString(const char *name);
+
+#endif
@@ -0,0 +1,652 @@
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Derived sensors, see derive.h.
+ */
+
+#include "derive.h"
+#include "logger.h"
+
+#define DERIVE_TEXT 160			/* bytes of a definition */
+
+// Magnus formula over water, good to 0.35 degrees from -45 to 60 C.
+#define DERIVE_MAGNUS_B 17.62
+#define DERIVE_MAGNUS_C 243.12
+
+enum DeriveOp
+{
+	DERIVE_CONST,			/* value, the same for every device */
+	DERIVE_CHANNEL,			/* channel of each device */
+	DERIVE_AT,			/* channel of one device */
+	DERIVE_ADD,
+	DERIVE_SUB,
+	DERIVE_MUL,
+	DERIVE_DIV,
+	DERIVE_NEG,
+	DERIVE_ABS,
+	DERIVE_LOWER,			/* min(a,b) */
+	DERIVE_HIGHER,			/* max(a,b) */
+	DERIVE_DEWPOINT,
+	DERIVE_MEAN,			/* reductions over the devices */
+	DERIVE_SUM,
+	DERIVE_MIN,
+	DERIVE_MAX_OF,
+};
+
+struct DeriveStep
+{
+	enum DeriveOp op;
+	int device;
+	int channel;
+	double value;
+};
+
+struct Definition
+{
+	char text[DERIVE_TEXT];
+	char name[DERIVE_NAME];
+	int device[TEMPER_MAX_DEVICES];	/* what DERIVE_CHANNEL reads */
+	unsigned lanes;
+	struct DeriveStep step[DERIVE_STEPS];
+	unsigned steps;
+	int per_device;			/* one derived sensor per device */
+	int first;			/* number of its first derived sensor */
+};
+
+struct DeriveOutput
+{
+	char name[DERIVE_NAME + 8];
+	const struct Definition *def;
+};
+
+struct Derive
+{
+	struct Definition def[DERIVE_MAX];
+	unsigned def_count;
+	struct DeriveOutput out[DERIVE_MAX];
+	unsigned out_count;
+
+	// The sweep being derived from, NAN where there is no reading.
+	double value[TEMPER_MAX_DEVICES][TEMPER_CHANNELS];
+	int64_t when[TEMPER_MAX_DEVICES];
+	double stack[DERIVE_STACK][TEMPER_MAX_DEVICES];
+};
+
+struct DeriveParser
+{
+	const char *p;
+	struct Definition *def;
+	int depth;
+	int vector[DERIVE_STACK];	/* entries that vary by device */
+	int failed;
+};
+
+
+
+static void DeriveSkip(struct DeriveParser *ps)
+{
+	while (isspace((unsigned char)*ps->p))
+		++ps->p;
+}
+
+
+
+static int DeriveAccept(struct DeriveParser *ps, char c)
+{
+	DeriveSkip(ps);
+	if (*ps->p != c)
+		return 0;
+	++ps->p;
+	return 1;
+}
+
+
+
+// Read an identifier into buf, empty if there is none.
+static void DeriveWord(struct DeriveParser *ps, char *buf, size_t size)
+{
+	size_t n = 0;
+
+	DeriveSkip(ps);
+	while ((isalnum((unsigned char)*ps->p) || *ps->p == '_') &&
+	       n + 1 < size)
+		buf[n++] = *ps->p++;
+	buf[n] = '\0';
+	if (isalnum((unsigned char)*ps->p) || *ps->p == '_')
+		ps->failed = 1;
+}
+
+
+
+static int DeriveDevice(struct DeriveParser *ps)
+{
+	char *end;
+	long device;
+
+	DeriveSkip(ps);
+	device = strtol(ps->p, &end, 10);
+	if (end == ps->p || !isdigit((unsigned char)*ps->p) ||
+	    device >= TEMPER_MAX_DEVICES)
+		ps->failed = 1;
+	ps->p = end;
+	return ps->failed ? 0 : device;
+}
+
+
+
+// Append a step, keeping track of the stack it leaves.
+static void DeriveEmit(struct DeriveParser *ps, enum DeriveOp op, int device,
+                       int channel, double value)
+{
+	struct Definition *def = ps->def;
+	int pops = 0, vector = 0;
+
+	switch (op)
+        {
+	case DERIVE_CONST:
+	case DERIVE_AT:
+		break;
+	case DERIVE_CHANNEL:
+		vector = 1;
+		if (!def->lanes)	// Whose channel?
+			ps->failed = 1;
+		break;
+	case DERIVE_NEG:
+	case DERIVE_ABS:
+		pops = 1;
+		break;
+	case DERIVE_MEAN:
+	case DERIVE_SUM:
+	case DERIVE_MIN:
+	case DERIVE_MAX_OF:
+		pops = 1;
+		vector = -1;
+		break;
+	default:
+		pops = 2;
+		break;
+	}
+
+	if (ps->failed || ps->depth < pops || def->steps == DERIVE_STEPS ||
+	    ps->depth - pops + 1 > DERIVE_STACK)
+        {
+		ps->failed = 1;
+		return;
+	}
+
+	for (int i = 0; i < pops; ++i)
+		vector |= ps->vector[--ps->depth] && vector >= 0;
+	ps->vector[ps->depth++] = vector > 0;
+
+	struct DeriveStep *s = &def->step[def->steps++];
+	s->op = op;
+	s->device = device;
+	s->channel = channel;
+	s->value = value;
+}
+
+
+
+static void DeriveExpr(struct DeriveParser *ps);
+
+
+
+// A function call, after its name.
+static void DeriveCall(struct DeriveParser *ps, const char *name)
+{
+	static const struct
+	{
+		const char *name;
+		int args;
+		enum DeriveOp op;
+	} functions[] = {
+		{ "abs", 1, DERIVE_ABS },
+		{ "min", 2, DERIVE_LOWER },
+		{ "max", 2, DERIVE_HIGHER },
+		{ "dewpoint", 2, DERIVE_DEWPOINT },
+		{ "mean", 1, DERIVE_MEAN },
+		{ "sum", 1, DERIVE_SUM },
+		{ "min", 1, DERIVE_MIN },
+		{ "max", 1, DERIVE_MAX_OF },
+	};
+	int args = 0;
+
+	if (!DeriveAccept(ps, ')'))
+        {
+		do
+                {
+			DeriveExpr(ps);
+			++args;
+		} while (!ps->failed && DeriveAccept(ps, ','));
+		if (!DeriveAccept(ps, ')'))
+			ps->failed = 1;
+	}
+
+	for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); ++i)
+        {
+		if (!strcmp(name, functions[i].name) &&
+		    args == functions[i].args)
+                {
+			DeriveEmit(ps, functions[i].op, 0, 0, 0);
+			return;
+		}
+	}
+	ps->failed = 1;
+}
+
+
+
+static void DerivePrimary(struct DeriveParser *ps)
+{
+	char word[16];
+
+	DeriveSkip(ps);
+	if (DeriveAccept(ps, '('))
+        {
+		DeriveExpr(ps);
+		if (!DeriveAccept(ps, ')'))
+			ps->failed = 1;
+		return;
+	}
+
+	if (isdigit((unsigned char)*ps->p) || *ps->p == '.')
+        {
+		char *end;
+		double value = strtod(ps->p, &end);
+
+		ps->p = end;
+		DeriveEmit(ps, DERIVE_CONST, 0, 0, value);
+		return;
+	}
+
+	DeriveWord(ps, word, sizeof(word));
+	if (!word[0])
+        {
+		ps->failed = 1;
+		return;
+	}
+	if (DeriveAccept(ps, '('))
+        {
+		DeriveCall(ps, word);
+		return;
+	}
+
+	int channel = !strcmp(word, "inner") ? 0 : !strcmp(word, "outer") ? 1
+	                                                                 : -1;
+	if (channel < 0)
+		ps->failed = 1;
+	else if (DeriveAccept(ps, '@'))
+		DeriveEmit(ps, DERIVE_AT, DeriveDevice(ps), channel, 0);
+	else
+		DeriveEmit(ps, DERIVE_CHANNEL, 0, channel, 0);
+}
+
+
+
+static void DeriveUnary(struct DeriveParser *ps)
+{
+	if (DeriveAccept(ps, '-'))
+        {
+		DeriveUnary(ps);
+		DeriveEmit(ps, DERIVE_NEG, 0, 0, 0);
+	}
+	else
+		DerivePrimary(ps);
+}
+
+
+
+static void DeriveTerm(struct DeriveParser *ps)
+{
+	DeriveUnary(ps);
+	while (!ps->failed)
+        {
+		if (DeriveAccept(ps, '*'))
+                {
+			DeriveUnary(ps);
+			DeriveEmit(ps, DERIVE_MUL, 0, 0, 0);
+		}
+		else if (DeriveAccept(ps, '/'))
+                {
+			DeriveUnary(ps);
+			DeriveEmit(ps, DERIVE_DIV, 0, 0, 0);
+		}
+		else
+			break;
+	}
+}
+
+
+
+static void DeriveExpr(struct DeriveParser *ps)
+{
+	DeriveTerm(ps);
+	while (!ps->failed)
+        {
+		if (DeriveAccept(ps, '+'))
+                {
+			DeriveTerm(ps);
+			DeriveEmit(ps, DERIVE_ADD, 0, 0, 0);
+		}
+		else if (DeriveAccept(ps, '-'))
+                {
+			DeriveTerm(ps);
+			DeriveEmit(ps, DERIVE_SUB, 0, 0, 0);
+		}
+		else
+			break;
+	}
+}
+
+
+
+// Parse "name[devices]=expression" into def.  Returns 0 or -EINVAL.
+static int DeriveParse(struct Definition *def, const char *spec)
+{
+	struct DeriveParser ps = { spec, def, 0, { 0 }, 0 };
+
+	if (strlen(spec) >= sizeof(def->text))
+		return -EINVAL;
+	strcpy(def->text, spec);
+
+	DeriveWord(&ps, def->name, sizeof(def->name));
+	if (!def->name[0])
+		return -EINVAL;
+
+	// Devices, single ones or ranges like 0-3.
+	if (DeriveAccept(&ps, '['))
+        {
+		do
+                {
+			int low = DeriveDevice(&ps);
+			int high = DeriveAccept(&ps, '-') ? DeriveDevice(&ps)
+			                                  : low;
+
+			for (int n = low; n <= high && !ps.failed; ++n)
+                        {
+				if (def->lanes == TEMPER_MAX_DEVICES)
+					ps.failed = 1;
+				else
+					def->device[def->lanes++] = n;
+			}
+		} while (!ps.failed && DeriveAccept(&ps, ','));
+		if (!DeriveAccept(&ps, ']') || !def->lanes)
+			ps.failed = 1;
+	}
+
+	if (!DeriveAccept(&ps, '='))
+		return -EINVAL;
+	DeriveExpr(&ps);
+	DeriveSkip(&ps);
+	if (ps.failed || *ps.p || ps.depth != 1)
+		return -EINVAL;
+
+	def->per_device = ps.vector[0];
+	return 0;
+}
+
+
+
+Derive *DeriveOpen(const char *const *specs, unsigned count, int *err)
+{
+	Derive *d = calloc(1, sizeof(*d));
+
+	if (!d)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	*err = count > DERIVE_MAX ? -ENOSPC : 0;
+	for (unsigned i = 0; i < count && !*err; ++i)
+        {
+		struct Definition *def = &d->def[d->def_count++];
+		unsigned outputs;
+
+		*err = DeriveParse(def, specs[i]);
+		if (*err)
+                {
+			LogMessage(TEMPER_LOG_ERROR, -1, "bad derived sensor: %.30s",
+			           specs[i]);
+			break;
+		}
+
+		outputs = def->per_device ? def->lanes : 1;
+		if (d->out_count + outputs > DERIVE_MAX)
+                {
+			*err = -ENOSPC;
+			break;
+		}
+
+		def->first = DERIVE_BASE + d->out_count;
+		for (unsigned l = 0; l < outputs; ++l)
+                {
+			struct DeriveOutput *out = &d->out[d->out_count++];
+
+			out->def = def;
+			strcpy(out->name, def->name);
+			if (def->per_device)
+				sprintf(out->name + strlen(out->name), "[%d]",
+				        def->device[l]);
+		}
+	}
+
+	if (*err)
+        {
+		free(d);
+		return NULL;
+	}
+	return d;
+}
+
+
+
+unsigned DeriveCount(const Derive *d)
+{
+	return d->out_count;
+}
+
+
+
+int DeriveSensor(const Derive *d, unsigned i, const char **name,
+                 const char **definition)
+{
+	*name = d->out[i].name;
+	*definition = d->out[i].def->text;
+	return DERIVE_BASE + i;
+}
+
+
+
+static double DeriveDewpoint(double t, double rh)
+{
+	const double g = log(rh / 100) +
+	                 DERIVE_MAGNUS_B * t / (DERIVE_MAGNUS_C + t);
+
+	return DERIVE_MAGNUS_C * g / (DERIVE_MAGNUS_B - g);
+}
+
+
+
+// Reduce the n values of x, skipping NANs.  NAN if there are none.
+static double DeriveReduce(enum DeriveOp op, const double *x, unsigned n)
+{
+	double r = op == DERIVE_MIN ? INFINITY : op == DERIVE_MAX_OF ? -INFINITY
+	                                                             : 0;
+	unsigned seen = 0;
+
+	for (unsigned l = 0; l < n; ++l)
+        {
+		if (isnan(x[l]))
+			continue;
+		++seen;
+		if (op == DERIVE_MIN)
+			r = fmin(r, x[l]);
+		else if (op == DERIVE_MAX_OF)
+			r = fmax(r, x[l]);
+		else
+			r += x[l];
+	}
+
+	if (!seen)
+		return NAN;
+	return op == DERIVE_MEAN ? r / seen : r;
+}
+
+
+
+// Run def over the sweep, leaving one value per device in d->stack[0].
+static void DeriveRun(Derive *d, const struct Definition *def)
+{
+	const unsigned n = def->lanes ? def->lanes : 1;
+	int sp = 0;
+
+	for (unsigned i = 0; i < def->steps; ++i)
+        {
+		const struct DeriveStep *s = &def->step[i];
+		double *top = d->stack[sp];
+		double *a = sp >= 2 ? d->stack[sp - 2] : NULL;
+		double *b = sp >= 1 ? d->stack[sp - 1] : NULL;
+		double v;
+
+		switch (s->op)
+                {
+		case DERIVE_CONST:
+		case DERIVE_AT:
+			v = s->op == DERIVE_CONST ? s->value
+			                          : d->value[s->device][s->channel];
+			for (unsigned l = 0; l < n; ++l)
+				top[l] = v;
+			++sp;
+			break;
+		case DERIVE_CHANNEL:
+			for (unsigned l = 0; l < n; ++l)
+				top[l] = d->value[def->device[l]][s->channel];
+			++sp;
+			break;
+		case DERIVE_NEG:
+			for (unsigned l = 0; l < n; ++l)
+				b[l] = -b[l];
+			break;
+		case DERIVE_ABS:
+			for (unsigned l = 0; l < n; ++l)
+				b[l] = fabs(b[l]);
+			break;
+		case DERIVE_MEAN:
+		case DERIVE_SUM:
+		case DERIVE_MIN:
+		case DERIVE_MAX_OF:
+			v = DeriveReduce(s->op, b, n);
+			for (unsigned l = 0; l < n; ++l)
+				b[l] = v;
+			break;
+		case DERIVE_ADD:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] += b[l];
+			--sp;
+			break;
+		case DERIVE_SUB:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] -= b[l];
+			--sp;
+			break;
+		case DERIVE_MUL:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] *= b[l];
+			--sp;
+			break;
+		case DERIVE_DIV:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] /= b[l];
+			--sp;
+			break;
+		case DERIVE_LOWER:	// NAN if either is, unlike fmin().
+			for (unsigned l = 0; l < n; ++l)
+				a[l] = a[l] < b[l] || isnan(a[l]) ? a[l] : b[l];
+			--sp;
+			break;
+		case DERIVE_HIGHER:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] = a[l] > b[l] || isnan(a[l]) ? a[l] : b[l];
+			--sp;
+			break;
+		case DERIVE_DEWPOINT:
+			for (unsigned l = 0; l < n; ++l)
+				a[l] = DeriveDewpoint(a[l], b[l]);
+			--sp;
+			break;
+		}
+	}
+}
+
+
+
+static int DeriveProcess(void *state, const TemperReading *rows,
+                         unsigned count, PipelineNode *out)
+{
+	Derive *d = state;
+	int64_t newest = INT64_MIN;
+
+	for (int s = 0; s < TEMPER_MAX_DEVICES; ++s)
+        {
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+			d->value[s][c] = NAN;
+		d->when[s] = INT64_MIN;
+	}
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		const int s = rows[i].sensor;
+
+		PipelineEmit(out, &rows[i]);
+		if (s < 0 || s >= TEMPER_MAX_DEVICES)
+			continue;
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+			d->value[s][c] = rows[i].value[c];
+		d->when[s] = rows[i].timestamp;
+		if (rows[i].timestamp > newest)
+			newest = rows[i].timestamp;
+	}
+	if (newest == INT64_MIN)
+		return 0;
+
+	for (unsigned i = 0; i < d->def_count; ++i)
+        {
+		const struct Definition *def = &d->def[i];
+		const unsigned outputs = def->per_device ? def->lanes : 1;
+		TemperReading r = { 0 };
+
+		DeriveRun(d, def);
+		for (unsigned l = 0; l < outputs; ++l)
+                {
+			const int64_t when = def->per_device
+			                   ? d->when[def->device[l]] : INT64_MIN;
+
+			if (!isfinite(d->stack[0][l]))
+				continue;
+			r.sensor = def->first + l;
+			r.timestamp = when != INT64_MIN ? when : newest;
+			r.value[0] = d->stack[0][l];
+			r.value[1] = NAN;
+			PipelineEmit(out, &r);
+		}
+	}
+
+	return 0;
+}
+
+
+
+static void DeriveClose(void *state)
+{
+	free(state);
+}
+
+const PipelineOps DeriveOps = {
+	"derive", DeriveProcess, NULL, DeriveClose, NULL, NULL
+};
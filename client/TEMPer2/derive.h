@@ -0,0 +1,54 @@
+#ifndef TEMPER_DERIVE_H
+#define TEMPER_DERIVE_H
+
+/*
+ * Derived sensors: expressions over the channels of the physical ones,
+ * worked out in the pipeline every sweep.
+ *
+ * A definition is a name, optionally the devices it runs over, and an
+ * expression:
+ *
+ *     delta[3]=outer-inner             TEMPer2 outer minus inner
+ *     dew[2,5]=dewpoint(inner,outer)   TEMPerHumi temperature and humidity
+ *     rack_a[0-2,4]=mean(inner)        one value for a group of devices
+ *     diff=inner@1-inner@0             channels of named devices
+ *
+ * `inner` and `outer` are a channel of each device listed, `inner@n` of
+ * device n.  There are + - * /, numbers, parentheses, abs(x), min(a,b),
+ * max(a,b), dewpoint(temperature,humidity) and the group reductions
+ * mean(x), sum(x), min(x), max(x), which skip devices without a reading.
+ *
+ * The expression is compiled once and run a step at a time across all the
+ * devices of a definition, on the readings of the sweep.  An expression
+ * that depends on the device gives one derived sensor per device, else
+ * one for the definition.  Derived sensors are numbered from DERIVE_BASE
+ * in the order defined and their readings carry the value in channel 0,
+ * stamped like the device's reading, or the newest of the sweep for one
+ * per definition.  A value that can't be worked out, say for a device that
+ * wasn't read, is not emitted.
+ */
+
+#include "pipeline.h"
+
+#define DERIVE_BASE 1000		/* number of the first derived sensor */
+#define DERIVE_MAX 64			/* derived sensors at most */
+#define DERIVE_STEPS 64			/* compiled steps per expression */
+#define DERIVE_STACK 8			/* depth of the evaluation stack */
+#define DERIVE_NAME 48
+
+typedef struct Derive Derive;
+
+extern const PipelineOps DeriveOps;
+
+// Compile count definitions.  Returns the state for DeriveOps, or NULL
+// with *err set, -EINVAL for a bad definition after logging which.
+Derive *DeriveOpen(const char *const *specs, unsigned count, int *err);
+
+// How many derived sensors there are.
+unsigned DeriveCount(const Derive *d);
+
+// The i-th derived sensor's number, name like "dew[2]" and definition.
+int DeriveSensor(const Derive *d, unsigned i, const char **name,
+                 const char **definition);
+
+#endif
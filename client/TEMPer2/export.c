@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Columnar export files of TEMPer history, see export.h.
+ */
+
+#include "export.h"
+#include "query.h"
+
+// Columns of a batch, channel i is TEMPER_EXPORT_VALUE + i.
+#define TEMPER_EXPORT_SENSOR 0
+#define TEMPER_EXPORT_TIME 1
+#define TEMPER_EXPORT_VALUE 2
+
+// Where a column is decoded from.
+struct TemperExportInput
+{
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;			/* ran past end */
+};
+
+
+
+static uint8_t *TemperExportPut(uint8_t *p, uint64_t v, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+		*p++ = v >> (8 * i);
+	return p;
+}
+
+
+
+static uint64_t TemperExportGet(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+
+	for (int i = 0; i < bytes; ++i)
+		v |= (uint64_t)p[i] << (8 * i);
+	return v;
+}
+
+
+
+static uint8_t *TemperExportVarint(uint8_t *p, uint64_t v)
+{
+	while (v >= 0x80)
+        {
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+
+
+// Small negative numbers to small varints and back.
+static uint64_t TemperExportZigzag(uint64_t v)
+{
+	return (v << 1) ^ (0 - (v >> 63));
+}
+
+
+
+static uint64_t TemperExportUnzigzag(uint64_t v)
+{
+	return (v >> 1) ^ (0 - (v & 1));
+}
+
+
+
+static uint32_t TemperExportBits(float f)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+
+
+static uint8_t *TemperExportRaw(const TemperReading *rows, unsigned count,
+                                int column, uint8_t *p)
+{
+	for (unsigned i = 0; i < count; ++i)
+        {
+		if (column == TEMPER_EXPORT_SENSOR)
+			p = TemperExportPut(p, (uint32_t)rows[i].sensor, 4);
+		else if (column == TEMPER_EXPORT_TIME)
+			p = TemperExportPut(p, rows[i].timestamp, 8);
+		else
+			p = TemperExportPut(p, TemperExportBits(
+				rows[i].value[column - TEMPER_EXPORT_VALUE]), 4);
+	}
+	return p;
+}
+
+
+
+static uint8_t *TemperExportRuns(const TemperReading *rows, unsigned count,
+                                 uint8_t *p)
+{
+	for (unsigned i = 0, run; i < count; i += run)
+        {
+		for (run = 1; i + run < count &&
+		              rows[i + run].sensor == rows[i].sensor; ++run)
+			;
+		p = TemperExportVarint(p, TemperExportZigzag(
+			(uint64_t)(int64_t)rows[i].sensor));
+		p = TemperExportVarint(p, run);
+	}
+	return p;
+}
+
+
+
+// Unsigned arithmetic, so any timestamps wrap the same way both ways.
+static uint8_t *TemperExportDelta(const TemperReading *rows, unsigned count,
+                                  uint8_t *p)
+{
+	uint64_t last = 0, step = 0;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		const uint64_t v = rows[i].timestamp;
+		const uint64_t d = v - last;
+
+		p = TemperExportVarint(p, TemperExportZigzag(d - step));
+		step = i ? d : 0;
+		last = v;
+	}
+	return p;
+}
+
+
+
+static uint8_t *TemperExportXor(const TemperReading *rows, unsigned count,
+                                int channel, uint8_t *p)
+{
+	uint32_t last = 0;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		const uint32_t bits = TemperExportBits(rows[i].value[channel]);
+		uint32_t x = bits ^ last;
+		int trailing = 0, kept = 1;
+
+		last = bits;
+		if (!x)
+                {
+			*p++ = 0;
+			continue;
+		}
+		for (; !(x & 0xff); x >>= 8)
+			++trailing;
+		while (kept < 4 - trailing && (x >> (8 * kept)))
+			++kept;
+		*p++ = trailing << 4 | kept;
+		p = TemperExportPut(p, x, kept);
+	}
+	return p;
+}
+
+
+
+// Write one column as codec, length and data.  Returns the end of it.
+static uint8_t *TemperExportColumn(const TemperReading *rows, unsigned count,
+                                   int column, uint8_t *p)
+{
+	uint8_t *const data = p + 5;
+	const size_t raw = (size_t)count *
+	                   (column == TEMPER_EXPORT_TIME ? 8 : 4);
+	uint8_t *end;
+	int codec;
+
+	if (column == TEMPER_EXPORT_SENSOR)
+        {
+		codec = TEMPER_EXPORT_RUNS;
+		end = TemperExportRuns(rows, count, data);
+	}
+	else if (column == TEMPER_EXPORT_TIME)
+        {
+		codec = TEMPER_EXPORT_DELTA;
+		end = TemperExportDelta(rows, count, data);
+	}
+	else
+        {
+		codec = TEMPER_EXPORT_XOR;
+		end = TemperExportXor(rows, count, column - TEMPER_EXPORT_VALUE,
+		                      data);
+	}
+
+	if ((size_t)(end - data) >= raw)
+        {
+		codec = TEMPER_EXPORT_RAW;
+		end = TemperExportRaw(rows, count, column, data);
+	}
+
+	p[0] = codec;
+	TemperExportPut(p + 1, end - data, 4);
+	return end;
+}
+
+
+
+void TemperExportHeader(unsigned channels, uint8_t buf[TEMPER_EXPORT_HEADER])
+{
+	memcpy(buf, TEMPER_EXPORT_MAGIC, 4);
+	TemperExportPut(buf + 4, TEMPER_EXPORT_VERSION, 4);
+	TemperExportPut(buf + 8, channels ? channels : TEMPER_QUERY_ALL, 4);
+	TemperExportPut(buf + 12, TEMPER_EXPORT_BATCH, 4);
+}
+
+
+
+int TemperExportCheckHeader(const uint8_t buf[TEMPER_EXPORT_HEADER])
+{
+	const uint64_t channels = TemperExportGet(buf + 8, 4);
+
+	if (memcmp(buf, TEMPER_EXPORT_MAGIC, 4) ||
+	    TemperExportGet(buf + 4, 4) != TEMPER_EXPORT_VERSION ||
+	    TemperExportGet(buf + 12, 4) > TEMPER_EXPORT_BATCH ||
+	    !channels || channels & ~(uint64_t)TEMPER_QUERY_ALL)
+		return -EPROTO;
+	return channels;
+}
+
+
+
+// Worst cases per row: 8 bytes of sensor runs, a 10 byte varint of
+// time and 5 bytes per channel.
+size_t TemperExportBound(unsigned count)
+{
+	return 8 + (2 + TEMPER_CHANNELS) * 5 +
+	       (size_t)count * (8 + 10 + 5 * TEMPER_CHANNELS);
+}
+
+
+
+size_t TemperExportEncode(const TemperReading *rows, unsigned count,
+                          unsigned channels, uint8_t *buf)
+{
+	uint8_t *p = buf + 8;
+
+	if (!channels)
+		channels = TEMPER_QUERY_ALL;
+
+	p = TemperExportColumn(rows, count, TEMPER_EXPORT_SENSOR, p);
+	p = TemperExportColumn(rows, count, TEMPER_EXPORT_TIME, p);
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+		if (channels & (1u << i))
+			p = TemperExportColumn(rows, count,
+			                       TEMPER_EXPORT_VALUE + i, p);
+
+	TemperExportPut(buf, count, 4);
+	TemperExportPut(buf + 4, p - buf - 8, 4);
+	return p - buf;
+}
+
+
+
+static uint64_t TemperExportReadVarint(struct TemperExportInput *in)
+{
+	uint64_t v = 0;
+
+	for (int shift = 0; shift < 64; shift += 7)
+        {
+		if (in->p == in->end)
+			break;
+		const uint8_t b = *in->p++;
+
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+	in->bad = 1;
+	return 0;
+}
+
+
+
+static uint64_t TemperExportRead(struct TemperExportInput *in, int bytes)
+{
+	if (in->end - in->p < bytes)
+        {
+		in->bad = 1;
+		return 0;
+	}
+	in->p += bytes;
+	return TemperExportGet(in->p - bytes, bytes);
+}
+
+
+
+static void TemperExportSet(TemperReading *r, int column, uint64_t v)
+{
+	if (column == TEMPER_EXPORT_SENSOR)
+		r->sensor = (int32_t)v;
+	else if (column == TEMPER_EXPORT_TIME)
+		r->timestamp = (int64_t)v;
+	else
+        {
+		const uint32_t bits = v;
+
+		memcpy(&r->value[column - TEMPER_EXPORT_VALUE], &bits,
+		       sizeof(bits));
+	}
+}
+
+
+
+// Decode a column's values into rows.  Returns 0 or -EPROTO.
+static int TemperExportDecodeColumn(TemperReading *rows, unsigned count,
+                                    int column, int codec,
+                                    struct TemperExportInput *in)
+{
+	uint64_t last = 0, step = 0;
+	unsigned i = 0;
+
+	if (codec == TEMPER_EXPORT_RAW)
+        {
+		for (; i < count; ++i)
+			TemperExportSet(&rows[i], column, TemperExportRead(in,
+				column == TEMPER_EXPORT_TIME ? 8 : 4));
+	}
+	else if (codec == TEMPER_EXPORT_RUNS && column == TEMPER_EXPORT_SENSOR)
+        {
+		while (i < count && !in->bad)
+                {
+			const uint64_t v = TemperExportUnzigzag(
+				TemperExportReadVarint(in));
+			const uint64_t run = TemperExportReadVarint(in);
+
+			if (!run || run > count - i)
+				return -EPROTO;
+			for (const unsigned end = i + run; i < end; ++i)
+				TemperExportSet(&rows[i], column, v);
+		}
+	}
+	else if (codec == TEMPER_EXPORT_DELTA && column == TEMPER_EXPORT_TIME)
+        {
+		for (; i < count; ++i)
+                {
+			const uint64_t v = last + step + TemperExportUnzigzag(
+				TemperExportReadVarint(in));
+
+			step = i ? v - last : 0;
+			last = v;
+			TemperExportSet(&rows[i], column, v);
+		}
+	}
+	else if (codec == TEMPER_EXPORT_XOR && column >= TEMPER_EXPORT_VALUE)
+        {
+		for (; i < count; ++i)
+                {
+			const uint8_t control = TemperExportRead(in, 1);
+			const int trailing = control >> 4, kept = control & 0xf;
+
+			if (control && (!kept || trailing + kept > 4))
+				return -EPROTO;
+			last ^= TemperExportRead(in, kept) << (8 * trailing);
+			TemperExportSet(&rows[i], column, last);
+		}
+	}
+	else
+		return -EPROTO;
+
+	return in->bad || in->p != in->end ? -EPROTO : 0;
+}
+
+
+
+int TemperExportDecode(const uint8_t *buf, size_t size, unsigned channels,
+                       TemperReading *rows, size_t *used)
+{
+	if (size < 8)
+		return -EAGAIN;
+
+	const uint64_t count = TemperExportGet(buf, 4);
+	const uint64_t bytes = TemperExportGet(buf + 4, 4);
+	struct TemperExportInput in = { buf + 8, buf + 8, 0 };
+	const uint8_t *const end = buf + 8 + bytes;
+
+	if (count > TEMPER_EXPORT_BATCH)
+		return -EPROTO;
+	if (size - 8 < bytes)
+		return -EAGAIN;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                {
+			rows[i].value[c] = NAN;
+			rows[i].unit[c] = 0;
+		}
+	}
+
+	for (int column = 0; column < TEMPER_EXPORT_VALUE + TEMPER_CHANNELS;
+	     ++column)
+        {
+		if (column >= TEMPER_EXPORT_VALUE &&
+		    !(channels & (1u << (column - TEMPER_EXPORT_VALUE))))
+			continue;
+		if (end - in.end < 5)
+			return -EPROTO;
+
+		const int codec = in.end[0];
+		const uint64_t length = TemperExportGet(in.end + 1, 4);
+
+		in.p = in.end + 5;
+		if ((uint64_t)(end - in.p) < length)
+			return -EPROTO;
+		in.end = in.p + length;
+		if (TemperExportDecodeColumn(rows, count, column, codec, &in))
+			return -EPROTO;
+	}
+	if (in.end != end)
+		return -EPROTO;
+
+	*used = 8 + bytes;
+	return count;
+}
@@ -0,0 +1,70 @@
+#ifndef TEMPER_EXPORT_H
+#define TEMPER_EXPORT_H
+
+/*
+ * Columnar export files of TEMPer history, written by temper_export.
+ *
+ * A file is a 16 byte header, "TCOL" then uint32 version, channel mask
+ * and TEMPER_EXPORT_BATCH, followed by batches of at most that many rows.
+ * A batch is uint32 rows and uint32 bytes, the size of what follows: one
+ * column each of sensor, timestamp and every channel in the mask, as a
+ * uint8 codec, a uint32 length and the encoded values.  Everything is
+ * little endian.
+ *
+ *   TEMPER_EXPORT_RAW    int32 sensor, int64 ns or float32 bits per row
+ *   TEMPER_EXPORT_RUNS   sensor runs: zigzag varint value, varint length
+ *   TEMPER_EXPORT_DELTA  timestamps: zigzag varints of the first value,
+ *                        then of each change in the difference between
+ *                        neighbours, 0 for a steady sampling interval
+ *   TEMPER_EXPORT_XOR    channels: the bits of each value xor the last
+ *                        one's, as a byte of (trailing zero bytes << 4 |
+ *                        bytes kept) and the bytes kept, 0 for a repeat
+ *
+ * The writer falls back to RAW for any column its codec doesn't shrink.
+ * Batches hold rows sensor by sensor in time order, like TemperQueryRun()
+ * hands them out.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "reading.h"
+
+#define TEMPER_EXPORT_MAGIC "TCOL"
+#define TEMPER_EXPORT_VERSION 1
+#define TEMPER_EXPORT_HEADER 16		/* bytes, the file header */
+
+#if !defined TEMPER_EXPORT_BATCH
+#define TEMPER_EXPORT_BATCH 65536	/* rows per batch at most */
+#endif
+
+enum TemperExportCodec
+{
+	TEMPER_EXPORT_RAW,
+	TEMPER_EXPORT_RUNS,
+	TEMPER_EXPORT_DELTA,
+	TEMPER_EXPORT_XOR,
+};
+
+// Write the file header for the TEMPER_QUERY_* channels mask into buf.
+void TemperExportHeader(unsigned channels, uint8_t buf[TEMPER_EXPORT_HEADER]);
+
+// Check a file header and return its channel mask, or -EPROTO.
+int TemperExportCheckHeader(const uint8_t buf[TEMPER_EXPORT_HEADER]);
+
+// Most bytes a batch of count rows can take.
+size_t TemperExportBound(unsigned count);
+
+// Encode count rows, at most TEMPER_EXPORT_BATCH, as one batch into buf,
+// which must have TemperExportBound(count) bytes.  Returns its size.
+size_t TemperExportEncode(const TemperReading *rows, unsigned count,
+                          unsigned channels, uint8_t *buf);
+
+// Decode the batch at the start of size bytes into rows, which must have
+// room for TEMPER_EXPORT_BATCH.  Channels not in the mask are NAN.
+// Returns how many rows and sets *used to the batch size, -EAGAIN when
+// size doesn't hold all of it yet or -EPROTO when it is corrupt.
+int TemperExportDecode(const uint8_t *buf, size_t size, unsigned channels,
+                       TemperReading *rows, size_t *used);
+
+#endif
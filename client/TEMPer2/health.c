@@ -0,0 +1,98 @@
+#include <string.h>
+
+/*
+ * Per device circuit breaker, see health.h.
+ */
+
+#include "health.h"
+
+
+
+void HealthInit(DeviceHealth *h, const HealthConfig *config)
+{
+	memset(h, 0, sizeof(*h));
+	h->config = config;
+	h->backoff = config->backoff_min;
+}
+
+
+
+int HealthShouldTry(DeviceHealth *h, int64_t now)
+{
+	if (h->state != HEALTH_OPEN)
+		return 1;
+
+	if (now < h->retry_at)
+        {
+		++h->skipped;
+		return 0;
+	}
+
+	h->state = HEALTH_HALF_OPEN;
+	return 1;
+}
+
+
+
+int HealthTimeout(const DeviceHealth *h, int timeout)
+{
+	if (h->state == HEALTH_HALF_OPEN && h->config->probe_timeout < timeout)
+		return h->config->probe_timeout;
+	return timeout;
+}
+
+
+
+int HealthSuccess(DeviceHealth *h, int64_t now)
+{
+	const int changed = h->state != HEALTH_CLOSED;
+
+	++h->reads;
+	h->state = HEALTH_CLOSED;
+	h->failed = 0;
+	h->backoff = h->config->backoff_min;
+	h->last_ok = now;
+	return changed;
+}
+
+
+
+int HealthFailure(DeviceHealth *h, int64_t now, int error)
+{
+	++h->reads;
+	++h->failures;
+	++h->failed;
+	h->last_error = error;
+
+	switch (h->state)
+        {
+	case HEALTH_HALF_OPEN: // The probe failed, wait twice as long.
+		h->backoff *= 2;
+		if (h->backoff > h->config->backoff_max)
+			h->backoff = h->config->backoff_max;
+		break;
+	case HEALTH_CLOSED:
+		if (h->failed < h->config->failures)
+			return 0;
+		break;
+	default:
+		return 0;
+	}
+
+	h->state = HEALTH_OPEN;
+	h->retry_at = now + h->backoff;
+	return 1;
+}
+
+
+
+const char *HealthStateToString(enum HealthState state)
+{
+	switch (state)
+        {
+	case HEALTH_CLOSED:	return "closed";
+	case HEALTH_OPEN:	return "open";
+	case HEALTH_HALF_OPEN:	return "half-open";
+	default:		return "unknown";
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef TEMPER_HEALTH_H
+#define TEMPER_HEALTH_H
+
+/*
+ * Per device circuit breaker.
+ *
+ * CLOSED     the device is read every sweep.
+ * OPEN       after `failures` reads in a row went wrong the device is left
+ *            alone until its backoff has passed.
+ * HALF_OPEN  one probe with a short timeout; success closes the circuit,
+ *            failure opens it again with twice the backoff.
+ *
+ * A hung sensor then costs a probe every few minutes instead of a full
+ * timeout every sweep.
+ */
+
+#include <stdint.h>
+
+enum HealthState
+{
+	HEALTH_CLOSED,
+	HEALTH_OPEN,
+	HEALTH_HALF_OPEN,
+};
+
+struct HealthConfig
+{
+	unsigned failures;		/* in a row before opening */
+	int64_t backoff_min;		/* ns */
+	int64_t backoff_max;		/* ns */
+	int probe_timeout;		/* ms, USB timeout of a probe */
+};
+typedef struct HealthConfig HealthConfig;
+
+#define HEALTH_CONFIG_DEFAULT \
+	{ 3, 5 * 1000000000LL, 300 * 1000000000LL, 100 }
+
+struct DeviceHealth
+{
+	const HealthConfig *config;
+	enum HealthState state;
+	unsigned failed;		/* in a row */
+	int64_t backoff;		/* ns, current */
+	int64_t retry_at;		/* ns, when OPEN may probe */
+	int64_t last_ok;		/* ns */
+	int last_error;
+	uint64_t reads;			/* totals */
+	uint64_t failures;
+	uint64_t skipped;		/* sweeps spent OPEN */
+};
+typedef struct DeviceHealth DeviceHealth;
+
+void HealthInit(DeviceHealth *h, const HealthConfig *config);
+
+// Whether to talk to the device this sweep.  An OPEN device whose backoff
+// has passed goes HALF_OPEN and gets its probe.
+int HealthShouldTry(DeviceHealth *h, int64_t now);
+
+// USB timeout in ms to use for the next read.
+int HealthTimeout(const DeviceHealth *h, int timeout);
+
+// Record the outcome of a read.  Both return 1 when the state changed.
+int HealthSuccess(DeviceHealth *h, int64_t now);
+int HealthFailure(DeviceHealth *h, int64_t now, int error);
+
+const char *HealthStateToString(enum HealthState state);
+
+#endif
@@ -0,0 +1,173 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+/*
+ * TEMPer devices coming and going, see hotplug.h.
+ */
+
+#include "comm.h"
+#include "hotplug.h"
+#include "logger.h"
+
+#define HOTPLUG_KERNEL_GROUP 1		/* uevents as the kernel sends them */
+
+
+
+int HotplugOpen(Hotplug *h, const char *path)
+{
+	memset(h, 0, sizeof(*h));
+	h->fd = -1;
+
+	if (path)
+        {
+		h->simulated = 1;
+		h->fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		return h->fd < 0 ? -errno : 0;
+	}
+
+	struct sockaddr_nl addr = { 0 };
+	int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+	                NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = HOTPLUG_KERNEL_GROUP;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+		const int ret = -errno;
+
+		close(fd);
+		return ret;
+	}
+
+	h->fd = fd;
+	return 0;
+}
+
+
+
+// One event, its fields separated by '\0'.  Returns 1 if it added or
+// removed a TEMPer, else 0.
+static int HotplugEvent(Hotplug *h, char *event, size_t length)
+{
+	const char *action = "", *subsystem = "", *devtype = "";
+	unsigned vendor = 0, product = 0;
+
+	event[length] = '\0';
+	for (char *field = event; field < event + length;
+	     field += strlen(field) + 1)
+        {
+		if (!strncmp(field, "ACTION=", 7))
+			action = field + 7;
+		else if (!strncmp(field, "SUBSYSTEM=", 10))
+			subsystem = field + 10;
+		else if (!strncmp(field, "DEVTYPE=", 8))
+			devtype = field + 8;
+		else if (!strncmp(field, "PRODUCT=", 8))
+			sscanf(field + 8, "%x/%x", &vendor, &product);
+	}
+
+	// The interfaces come and go with the device, count it once.
+	if (strcmp(subsystem, "usb") || strcmp(devtype, "usb_device") ||
+	    !TemperSupports(vendor, product))
+		return 0;
+
+	if (!strcmp(action, "add"))
+		++h->added;
+	else if (!strcmp(action, "remove"))
+		++h->removed;
+	else
+		return 0;
+
+	LogMessage(TEMPER_LOG_DEBUG, -1, "hotplug %s %04x:%04x", action,
+	           vendor, product);
+	return 1;
+}
+
+
+
+// Whole lines of a file, split into fields like a uevent.
+static int HotplugLines(Hotplug *h)
+{
+	int changes = 0;
+	ssize_t got;
+
+	while ((got = read(h->fd, h->buffer + h->length,
+	                   sizeof(h->buffer) - 1 - h->length)) > 0)
+        {
+		char *line = h->buffer, *end;
+
+		h->length += got;
+		while ((end = memchr(line, '\n', h->buffer + h->length - line)))
+                {
+			for (char *c = line; c < end; ++c)
+				if (*c == ' ' || *c == '\t')
+					*c = '\0';
+			changes += HotplugEvent(h, line, end - line);
+			line = end + 1;
+		}
+
+		h->length -= line - h->buffer;
+		memmove(h->buffer, line, h->length);
+		if (h->length == sizeof(h->buffer) - 1) // Too long, drop it.
+                {
+			++h->lost;
+			++changes;
+			h->length = 0;
+		}
+	}
+
+	return changes;
+}
+
+
+
+int HotplugPoll(Hotplug *h)
+{
+	int changes = 0;
+
+	if (h->fd < 0)
+		return 0;
+	if (h->simulated)
+		return HotplugLines(h);
+
+	for (;;)
+        {
+		struct sockaddr_nl from;
+		socklen_t size = sizeof(from);
+		ssize_t got = recvfrom(h->fd, h->buffer, sizeof(h->buffer) - 1,
+		                       0, (struct sockaddr *)&from, &size);
+
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0 && errno == ENOBUFS) // The socket overflowed.
+                {
+			++h->lost;
+			++changes;
+			continue;
+		}
+		if (got < 0)
+			break;
+
+		// Only the kernel speaks for the kernel.
+		if (size == sizeof(from) && from.nl_pid == 0)
+			changes += HotplugEvent(h, h->buffer, got);
+	}
+
+	return changes;
+}
+
+
+
+void HotplugClose(Hotplug *h)
+{
+	if (h->fd >= 0)
+		close(h->fd);
+	h->fd = -1;
+}
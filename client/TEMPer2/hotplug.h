@@ -0,0 +1,44 @@
+#ifndef TEMPER_HOTPLUG_H
+#define TEMPER_HOTPLUG_H
+
+/*
+ * TEMPer devices coming and going, as the kernel announces them.
+ *
+ * libusb-0.1 has no hotplug callbacks, so the collector listens to the
+ * kernel's uevents on a netlink socket and only rescans the bus after a
+ * TEMPer was added or removed.  The events can come from a file or FIFO
+ * instead, one per line with the fields separated by spaces:
+ *
+ *     ACTION=add SUBSYSTEM=usb DEVTYPE=usb_device PRODUCT=c45/7401/1
+ *
+ * which is how a test plugs in and pulls out devices that aren't there.
+ */
+
+#include <stdint.h>
+
+#define HOTPLUG_BUFFER 8192		/* bytes, the longest event */
+
+struct Hotplug
+{
+	int fd;				/* -1 when not listening */
+	int simulated;			/* lines from a file, not netlink */
+	unsigned length;		/* bytes of a partial line */
+	char buffer[HOTPLUG_BUFFER];
+	uint64_t added;			/* totals */
+	uint64_t removed;
+	uint64_t lost;			/* overflows, taken as changes */
+};
+typedef struct Hotplug Hotplug;
+
+// Listen to the kernel, or read events from path when it isn't NULL.
+// Returns 0 or a negative errno; the Hotplug is then closed and
+// HotplugPoll() never reports a change.
+int HotplugOpen(Hotplug *h, const char *path);
+
+// Read the events pending, without waiting.  Returns how many added or
+// removed a TEMPer, or a lost event could have, 0 if none did.
+int HotplugPoll(Hotplug *h);
+
+void HotplugClose(Hotplug *h);
+
+#endif
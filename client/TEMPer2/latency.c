@@ -0,0 +1,87 @@
+#include <math.h>
+#include <string.h>
+
+/*
+ * Per device USB timeouts learned from observed latency, see latency.h.
+ */
+
+#include "latency.h"
+#include "timestamp.h"
+
+#define LATENCY_WARMUP 16	/* answers before the timeout adapts */
+#define LATENCY_DECAY 512	/* halve the histogram this often */
+#define LATENCY_BASE 0.25	/* ms, top of bucket 0 */
+
+
+
+// Upper bound in ms of bucket i.
+static double LatencyBucketTop(int i)
+{
+	return LATENCY_BASE * exp2(i / 4.0);
+}
+
+
+
+void LatencyInit(DeviceLatency *l, const LatencyConfig *config)
+{
+	memset(l, 0, sizeof(*l));
+	l->config = config;
+	l->timeout = config->ceiling;
+}
+
+
+
+void LatencyRecord(DeviceLatency *l, int64_t ns)
+{
+	const double ms = (double)ns / TEMPER_NS_PER_MS;
+	int i = 0;
+
+	if (ms > LATENCY_BASE)
+		i = (int)ceil(4.0 * log2(ms / LATENCY_BASE));
+	if (i >= LATENCY_BUCKETS)
+		i = LATENCY_BUCKETS - 1;
+
+	++l->bucket[i];
+	++l->answers;
+
+	// Let old behaviour fade so a device that slows down is followed.
+	if (++l->samples == LATENCY_DECAY)
+        {
+		l->samples = 0;
+		for (int b = 0; b < LATENCY_BUCKETS; ++b)
+                {
+			l->bucket[b] /= 2;
+			l->samples += l->bucket[b];
+		}
+	}
+
+	if (l->answers < LATENCY_WARMUP)
+		return;
+
+	const LatencyConfig *cfg = l->config;
+	double timeout = LatencyQuantile(l, cfg->quantile) * cfg->factor
+	                 + cfg->margin;
+
+	if (timeout < cfg->floor)
+		timeout = cfg->floor;
+	if (timeout > cfg->ceiling)
+		timeout = cfg->ceiling;
+	l->timeout = (int)ceil(timeout);
+}
+
+
+
+double LatencyQuantile(const DeviceLatency *l, double q)
+{
+	const double wanted = q * l->samples;
+	double seen = 0;
+
+	for (int i = 0; i < LATENCY_BUCKETS; ++i)
+        {
+		seen += l->bucket[i];
+		if (seen >= wanted && seen > 0)
+			return LatencyBucketTop(i);
+	}
+
+	return LatencyBucketTop(LATENCY_BUCKETS - 1);
+}
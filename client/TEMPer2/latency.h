@@ -0,0 +1,50 @@
+#ifndef TEMPER_LATENCY_H
+#define TEMPER_LATENCY_H
+
+/*
+ * Per device USB timeouts learned from how fast the device answers.
+ *
+ * Response times go into a decaying histogram with logarithmic buckets.
+ * The timeout is a high quantile of it times a factor plus a margin, kept
+ * between a floor and a ceiling.  Until enough answers have been seen the
+ * ceiling is used.
+ */
+
+#include <stdint.h>
+
+#define LATENCY_BUCKETS 64	/* 0.25 ms to 16 s, four per octave */
+
+struct LatencyConfig
+{
+	int floor;			/* ms */
+	int ceiling;			/* ms */
+	double quantile;		/* e.g. 0.99 */
+	double factor;
+	int margin;			/* ms */
+};
+typedef struct LatencyConfig LatencyConfig;
+
+#define LATENCY_CONFIG_DEFAULT { 20, 1000, 0.99, 2.0, 10 }
+
+struct DeviceLatency
+{
+	const LatencyConfig *config;
+	uint32_t bucket[LATENCY_BUCKETS];
+	uint32_t samples;		/* in the histogram, decays */
+	uint64_t answers;		/* all time */
+	int timeout;			/* ms, what the next read uses */
+	uint64_t timeouts;		/* reads that timed out */
+	uint64_t retries;		/* reads retried at the ceiling */
+	uint64_t false_timeouts;	/* retries that then succeeded */
+};
+typedef struct DeviceLatency DeviceLatency;
+
+void LatencyInit(DeviceLatency *l, const LatencyConfig *config);
+
+// Record one answer that took ns and recompute the timeout.
+void LatencyRecord(DeviceLatency *l, int64_t ns);
+
+// Response time in ms below which a fraction q of the answers came.
+double LatencyQuantile(const DeviceLatency *l, double q);
+
+#endif
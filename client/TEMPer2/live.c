@@ -0,0 +1,507 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The collector's latest and recent readings in a memory mapped file, see
+ * live.h.
+ *
+ * File layout, all sizes fixed when the collector creates it:
+ *
+ *   header | latest reading slot * slots | ring * slots
+ *
+ * and each ring, starting on a cache line:
+ *
+ *   written count, padded to 64 bytes | int64 timestamp[depth] |
+ *   float value0[depth] | float value1[depth]
+ *
+ * Reading n (counting from 0) of a sensor lives at index n % depth.  The
+ * writer overwrites the oldest reading before it bumps `written`, so of
+ * the last depth readings only depth - 1 can be trusted at any time.
+ */
+
+#include "live.h"
+
+#define TEMPER_LIVE_LINE 64
+
+struct TemperLiveSlot
+{
+	uint32_t seq;			/* odd while being written */
+	uint32_t published;		/* 1 once a reading is in */
+	TemperReading reading;
+};
+
+struct TemperLiveHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slot_size;
+	uint32_t depth;
+	uint32_t ring_size;		/* bytes per sensor */
+	uint64_t ring_offset;		/* bytes from the start of the file */
+	struct TemperLiveSlot slot[];
+};
+
+struct TemperLiveRing
+{
+	uint64_t written;
+	char pad[TEMPER_LIVE_LINE - sizeof(uint64_t)];
+};
+
+struct TemperLive
+{
+	struct TemperLiveHeader *map;
+	size_t size;
+};
+
+
+
+static size_t TemperLiveAlign(size_t size)
+{
+	return (size + TEMPER_LIVE_LINE - 1) & ~(size_t)(TEMPER_LIVE_LINE - 1);
+}
+
+
+
+static struct TemperLiveRing *TemperLiveRingOf(const TemperLive *live,
+                                               int sensor)
+{
+	return (struct TemperLiveRing *)((char *)live->map +
+	                                 live->map->ring_offset +
+	                                 (size_t)sensor * live->map->ring_size);
+}
+
+
+
+static int64_t *TemperLiveTimes(struct TemperLiveRing *ring)
+{
+	return (int64_t *)(ring + 1);
+}
+
+
+
+static float *TemperLiveValues(struct TemperLiveRing *ring, unsigned depth,
+                               int channel)
+{
+	return (float *)(TemperLiveTimes(ring) + depth) + (size_t)channel * depth;
+}
+
+
+
+static TemperLive *TemperLiveMap(int fd, size_t size, int prot, int *err)
+{
+	TemperLive *live = calloc(1, sizeof(*live));
+
+	if (!live)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	live->size = size;
+	live->map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+	if (live->map == MAP_FAILED)
+        {
+		*err = -errno;
+		free(live);
+		return NULL;
+	}
+
+	*err = 0;
+	return live;
+}
+
+
+
+TemperLive *TemperLiveCreate(const char *path, unsigned depth, int *err)
+{
+	const size_t ring_offset = TemperLiveAlign(sizeof(struct TemperLiveHeader) +
+	                           TEMPER_MAX_DEVICES *
+	                           sizeof(struct TemperLiveSlot));
+	const size_t ring_size = depth ? TemperLiveAlign(sizeof(struct TemperLiveRing) +
+	                         depth * (sizeof(int64_t) +
+	                                  TEMPER_CHANNELS * sizeof(float))) : 0;
+	const size_t size = ring_offset + TEMPER_MAX_DEVICES * ring_size;
+	char temp[PATH_MAX];
+	int fd;
+
+	if (depth == 1 || ring_size > UINT32_MAX)
+        {
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	// Readers may still have the last file mapped, shrinking it under
+	// them would kill them with SIGBUS.  The new one is built aside and
+	// renamed over it, they keep the old one until they reopen.
+	if (snprintf(temp, sizeof(temp), "%s.XXXXXX", path) >=
+	    (int)sizeof(temp))
+        {
+		*err = -ENAMETOOLONG;
+		return NULL;
+	}
+	fd = mkstemp(temp);
+	if (fd < 0)
+        {
+		*err = -errno;
+		return NULL;
+	}
+	if (fchmod(fd, 0644) < 0 || ftruncate(fd, size) < 0)
+        {
+		*err = -errno;
+		close(fd);
+		unlink(temp);
+		return NULL;
+	}
+
+	TemperLive *live = TemperLiveMap(fd, size, PROT_READ | PROT_WRITE, err);
+	close(fd);
+	if (!live)
+        {
+		unlink(temp);
+		return NULL;
+	}
+
+	live->map->slots = TEMPER_MAX_DEVICES;
+	live->map->slot_size = sizeof(struct TemperLiveSlot);
+	live->map->depth = depth;
+	live->map->ring_size = ring_size;
+	live->map->ring_offset = ring_offset;
+	live->map->version = TEMPER_LIVE_VERSION;
+	__atomic_store_n(&live->map->magic, TEMPER_LIVE_MAGIC, __ATOMIC_RELEASE);
+
+	if (rename(temp, path) < 0)
+        {
+		*err = -errno;
+		unlink(temp);
+		TemperLiveClose(live);
+		return NULL;
+	}
+	return live;
+}
+
+
+
+TemperLive *TemperLiveOpen(const char *path, int *err)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+        {
+		*err = -errno;
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 ||
+	    (size_t)st.st_size < sizeof(struct TemperLiveHeader))
+        {
+		*err = -EINVAL;
+		close(fd);
+		return NULL;
+	}
+
+	TemperLive *live = TemperLiveMap(fd, st.st_size, PROT_READ, err);
+	close(fd);
+	if (!live)
+		return NULL;
+
+	const struct TemperLiveHeader *h = live->map;
+	if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != TEMPER_LIVE_MAGIC ||
+	    h->version != TEMPER_LIVE_VERSION ||
+	    h->slot_size != sizeof(struct TemperLiveSlot) ||
+	    sizeof(*h) + (size_t)h->slots * h->slot_size > h->ring_offset ||
+	    h->ring_offset + (size_t)h->slots * h->ring_size > live->size)
+        {
+		*err = -EPROTO;
+		TemperLiveClose(live);
+		return NULL;
+	}
+
+	return live;
+}
+
+
+
+void TemperLiveClose(TemperLive *live)
+{
+	if (live)
+        {
+		munmap(live->map, live->size);
+		free(live);
+	}
+}
+
+
+
+int TemperLiveSlots(const TemperLive *live)
+{
+	return live->map->slots;
+}
+
+
+
+unsigned TemperLiveDepth(const TemperLive *live)
+{
+	return live->map->depth;
+}
+
+
+
+void TemperLivePublish(TemperLive *live, const TemperReading *r)
+{
+	if (r->sensor < 0 || (unsigned)r->sensor >= live->map->slots)
+		return;
+
+	struct TemperLiveSlot *slot = &live->map->slot[r->sensor];
+	uint32_t seq = slot->seq;
+
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot->reading, r, sizeof(*r));
+	slot->published = 1;
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+
+	const unsigned depth = live->map->depth;
+	if (!depth)
+		return;
+
+	struct TemperLiveRing *ring = TemperLiveRingOf(live, r->sensor);
+	const uint64_t written = ring->written;
+	const unsigned i = written % depth;
+
+	TemperLiveTimes(ring)[i] = r->timestamp;
+	for (int c = 0; c < TEMPER_CHANNELS; ++c)
+		TemperLiveValues(ring, depth, c)[i] = r->value[c];
+	__atomic_store_n(&ring->written, written + 1, __ATOMIC_RELEASE);
+}
+
+
+
+int TemperLiveRead(const TemperLive *live, int sensor, TemperReading *r)
+{
+	if (sensor < 0 || (unsigned)sensor >= live->map->slots)
+		return 0;
+
+	const struct TemperLiveSlot *slot = &live->map->slot[sensor];
+	uint32_t before, after, published;
+	unsigned tries = 0;
+
+	for (;;)
+        {
+		before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		memcpy(r, &slot->reading, sizeof(*r));
+		published = slot->published;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+		if (!(before & 1) && before == after)
+			break;
+
+		// A collector that died half way through leaves seq odd.
+		if (++tries == TEMPER_LIVE_RETRIES)
+			return -EAGAIN;
+		sched_yield();
+	}
+
+	return published;
+}
+
+
+
+// Oldest reading number that can't be being overwritten, given a count.
+static uint64_t TemperLiveFirst(uint64_t written, unsigned depth)
+{
+	return written >= depth ? written - depth + 1 : 0;
+}
+
+
+
+// First reading number in [lo, hi) at or after t, hi if none.
+static uint64_t TemperLiveSearch(struct TemperLiveRing *ring, unsigned depth,
+                                 uint64_t lo, uint64_t hi, int64_t t)
+{
+	const int64_t *times = TemperLiveTimes(ring);
+
+	while (lo < hi)
+        {
+		uint64_t mid = lo + (hi - lo) / 2;
+
+		if (times[mid % depth] < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+
+// Find readings [*a, *b) of sensor in [from, to).  Returns the ring, or
+// NULL when the sensor has none.
+static struct TemperLiveRing *TemperLiveWindow(const TemperLive *live,
+                                               int sensor, int64_t from,
+                                               int64_t to, uint64_t *a,
+                                               uint64_t *b)
+{
+	const unsigned depth = live->map->depth;
+
+	if (!depth || sensor < 0 || (unsigned)sensor >= live->map->slots)
+		return NULL;
+
+	struct TemperLiveRing *ring = TemperLiveRingOf(live, sensor);
+	const uint64_t written = __atomic_load_n(&ring->written,
+	                                         __ATOMIC_ACQUIRE);
+	const uint64_t first = TemperLiveFirst(written, depth);
+
+	*a = TemperLiveSearch(ring, depth, first, written, from);
+	*b = TemperLiveSearch(ring, depth, *a, written, to);
+	return ring;
+}
+
+
+
+// Was reading a overwritten while we looked?  The writer replaces the
+// oldest first, so if a survived everything after it did too.
+static int TemperLiveLapped(struct TemperLiveRing *ring, unsigned depth,
+                            uint64_t a)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return a < TemperLiveFirst(__atomic_load_n(&ring->written,
+	                                           __ATOMIC_RELAXED), depth);
+}
+
+
+
+int64_t TemperLiveOldest(const TemperLive *live, int sensor)
+{
+	const unsigned depth = live->map->depth;
+	struct TemperLiveRing *ring;
+	uint64_t a, b;
+	int64_t oldest;
+
+	do
+        {
+		if (!(ring = TemperLiveWindow(live, sensor, INT64_MIN, INT64_MAX,
+		                              &a, &b)) || a == b)
+			return INT64_MAX;
+		oldest = TemperLiveTimes(ring)[a % depth];
+	} while (TemperLiveLapped(ring, depth, a));
+
+	return oldest;
+}
+
+
+
+unsigned TemperLiveRange(const TemperLive *live, int sensor, int64_t from,
+                         int64_t to, TemperReading *rows, unsigned max)
+{
+	const unsigned depth = live->map->depth;
+	struct TemperLiveRing *ring;
+	TemperReading latest;
+	uint64_t a, b;
+	unsigned n;
+
+	if (TemperLiveRead(live, sensor, &latest) <= 0)
+		memset(&latest, 0, sizeof(latest));
+	do
+        {
+		if (!(ring = TemperLiveWindow(live, sensor, from, to, &a, &b)))
+			return 0;
+
+		const int64_t *times = TemperLiveTimes(ring);
+		n = b - a < max ? b - a : max;
+		for (unsigned i = 0; i < n; ++i)
+                {
+			const unsigned k = (a + i) % depth;
+
+			rows[i].timestamp = times[k];
+			rows[i].sensor = sensor;
+			for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                        {
+				rows[i].value[c] =
+					TemperLiveValues(ring, depth, c)[k];
+				rows[i].unit[c] = latest.unit[c];
+			}
+		}
+	} while (TemperLiveLapped(ring, depth, a));
+
+	return n;
+}
+
+
+
+// Fold readings [a, b) of one contiguous stretch of a channel into stats,
+// counting the numbers in n.  Filtered readings are NAN and left out.
+static void TemperLiveFold(const float *values, unsigned a, unsigned b,
+                           float *min, float *max, double *sum, unsigned *n)
+{
+	for (unsigned i = a; i < b; ++i)
+        {
+		if (isnan(values[i]))
+			continue;
+		*min = values[i] < *min ? values[i] : *min;
+		*max = values[i] > *max ? values[i] : *max;
+		*sum += values[i];
+		++*n;
+	}
+}
+
+
+
+unsigned TemperLiveSummary(const TemperLive *live, int sensor, int64_t from,
+                           int64_t to, TemperLiveStats *stats)
+{
+	const unsigned depth = live->map->depth;
+	struct TemperLiveRing *ring;
+	uint64_t a, b;
+
+	do
+        {
+		memset(stats, 0, sizeof(*stats));
+		if (!(ring = TemperLiveWindow(live, sensor, from, to, &a, &b)) ||
+		    a == b)
+			return 0;
+
+		const unsigned start = a % depth;
+		const unsigned end = b % depth;	/* may wrap below start */
+
+		stats->count = b - a;
+		stats->first = TemperLiveTimes(ring)[start];
+		stats->last = TemperLiveTimes(ring)[(b - 1) % depth];
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                {
+			const float *values = TemperLiveValues(ring, depth, c);
+			double sum = 0;
+			unsigned n = 0;
+
+			stats->min[c] = INFINITY;
+			stats->max[c] = -INFINITY;
+			if (start < end)
+                        {
+				TemperLiveFold(values, start, end, &stats->min[c],
+				               &stats->max[c], &sum, &n);
+			}
+			else
+                        {
+				TemperLiveFold(values, start, depth,
+				               &stats->min[c], &stats->max[c],
+				               &sum, &n);
+				TemperLiveFold(values, 0, end, &stats->min[c],
+				               &stats->max[c], &sum, &n);
+			}
+			if (!n)
+				stats->min[c] = stats->max[c] = NAN;
+			stats->mean[c] = n ? sum / n : NAN;
+		}
+	} while (TemperLiveLapped(ring, depth, a));
+
+	return stats->count;
+}
@@ -0,0 +1,91 @@
+#ifndef TEMPER_LIVE_H
+#define TEMPER_LIVE_H
+
+/*
+ * The collector's latest and recent readings of every sensor, shared
+ * through a memory mapped file (e.g. /dev/shm/temper.live).
+ *
+ * One collector writes, any number of processes read without locks: every
+ * latest reading slot has a sequence number that is odd while the slot is
+ * being written, readers retry until they see the same even number before
+ * and after copying, or give up after TEMPER_LIVE_RETRIES tries.
+ *
+ * Each sensor also has a ring of its last `depth` readings, kept as
+ * separate timestamp and channel arrays so a scan over a window touches
+ * only the memory it needs.  The writer bumps a count after adding a
+ * reading; readers check the count again after scanning and retry if the
+ * writer lapped what they read.  Readers never hold up the collector.
+ */
+
+#include <stdint.h>
+
+#include "reading.h"
+
+#define TEMPER_LIVE_MAGIC 0x56494c54	/* "TLIV" */
+#define TEMPER_LIVE_VERSION 2
+
+#if !defined TEMPER_LIVE_RETRIES
+#define TEMPER_LIVE_RETRIES 1000	/* tries at a slot being written */
+#endif
+
+#if !defined TEMPER_LIVE_DEPTH
+#define TEMPER_LIVE_DEPTH 4096	/* default readings kept per sensor */
+#endif
+
+typedef struct TemperLive TemperLive;
+
+// Summary of a window of readings.
+struct TemperLiveStats
+{
+	unsigned count;
+	int64_t first;			/* ns, oldest reading */
+	int64_t last;			/* ns, newest reading */
+	float min[TEMPER_CHANNELS];
+	float max[TEMPER_CHANNELS];
+	float mean[TEMPER_CHANNELS];
+};
+typedef struct TemperLiveStats TemperLiveStats;
+
+// Create the file for writing, with rings of depth readings per sensor, 0
+// for none.  A file already at path is replaced, not reused, so processes
+// that still have it mapped keep reading it safely until they reopen.
+// Returns NULL and sets *err to a negative errno on failure.
+TemperLive *TemperLiveCreate(const char *path, unsigned depth, int *err);
+
+// Map an existing file for reading.
+TemperLive *TemperLiveOpen(const char *path, int *err);
+
+void TemperLiveClose(TemperLive *live);
+
+// Number of sensor slots in the file.
+int TemperLiveSlots(const TemperLive *live);
+
+// Readings kept per sensor, 0 without rings.
+unsigned TemperLiveDepth(const TemperLive *live);
+
+// Collector side, publish r as the latest reading of r->sensor and add it
+// to the sensor's ring.  Timestamps must not go backwards per sensor.
+void TemperLivePublish(TemperLive *live, const TemperReading *r);
+
+// Copy the latest reading of sensor.  Returns 1, 0 when the collector
+// hasn't published one, or -EAGAIN when the slot stayed half written for
+// TEMPER_LIVE_RETRIES tries, as a collector that died while writing it
+// leaves it.
+int TemperLiveRead(const TemperLive *live, int sensor, TemperReading *r);
+
+// Timestamp of the oldest reading in sensor's ring, INT64_MAX if empty.
+// Anything older has to come from the database.
+int64_t TemperLiveOldest(const TemperLive *live, int sensor);
+
+// Copy up to max ring readings of sensor with from <= timestamp < to,
+// oldest first.  Returns how many.
+unsigned TemperLiveRange(const TemperLive *live, int sensor, int64_t from,
+                         int64_t to, TemperReading *rows, unsigned max);
+
+// Count, min, max and mean of the ring readings of sensor with
+// from <= timestamp < to.  NAN channels are left out of min, max and mean,
+// which are NAN for a channel with no numbers.  Returns the count.
+unsigned TemperLiveSummary(const TemperLive *live, int sensor, int64_t from,
+                           int64_t to, TemperLiveStats *stats);
+
+#endif
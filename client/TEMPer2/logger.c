@@ -0,0 +1,434 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Buffered logging for the collector, see logger.h.
+ */
+
+#include "logger.h"
+#include "timestamp.h"
+
+#if !defined TEMPER_LOG_SLOTS
+#define TEMPER_LOG_SLOTS 4096	/* must be a power of two */
+#endif
+
+#define LOG_RATE_KEYS 64
+
+// One ring slot.  seq tells producers and the consumer whose turn it is
+// (bounded multi-producer queue after Dmitry Vyukov).
+struct LogSlot
+{
+	uint64_t seq;
+	LogRecord record;
+};
+
+struct LogRate
+{
+	int sensor;
+	int code;
+	int64_t last;
+	uint32_t suppressed;
+};
+
+enum LogLevel LogThreshold = TEMPER_LOG_INFO;
+
+static struct LogSlot slots[TEMPER_LOG_SLOTS];
+static uint64_t tail;			/* next slot to fill */
+static uint64_t head;			/* next slot to drain, writer only */
+static uint64_t dropped;
+
+static struct LogRate rates[LOG_RATE_KEYS];
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static FILE *log_out;
+static enum LogFormat log_format;
+static pthread_t writer;
+static int running;
+static int stopping;
+
+static const char *LevelNames[] = { "error", "warn", "info", "debug" };
+static const char *KindNames[] = { "message", "reading", "stored", "device" };
+static const char *UnitNames[] = { "", "%RH", "°C" }; /* enum Unit order */
+
+
+
+// Copy r into the ring.  This is all the caller pays for a log line.
+static void LogPush(const LogRecord *r)
+{
+	uint64_t pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	struct LogSlot *slot;
+
+	for (;;)
+        {
+		slot = &slots[pos & (TEMPER_LOG_SLOTS - 1)];
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(seq - pos);
+
+		if (diff == 0)
+                {
+			if (__atomic_compare_exchange_n(&tail, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED,
+			                                __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0) // Full, the writer is behind.
+                {
+			__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else
+                {
+			pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(&slot->record, r, sizeof(*r));
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+
+
+static int LogPop(LogRecord *r)
+{
+	struct LogSlot *slot = &slots[head & (TEMPER_LOG_SLOTS - 1)];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1)
+		return 0;
+
+	memcpy(r, &slot->record, sizeof(*r));
+	__atomic_store_n(&slot->seq, head + TEMPER_LOG_SLOTS, __ATOMIC_RELEASE);
+	++head;
+	return 1;
+}
+
+
+
+static void LogInit(LogRecord *r, enum LogLevel level, enum LogKind kind,
+                    int sensor)
+{
+	memset(r, 0, sizeof(*r));
+	r->timestamp = TemperClockNow();
+	r->level = level;
+	r->kind = kind;
+	r->sensor = sensor;
+}
+
+
+
+// JSON string body with quotes, backslashes and control bytes escaped.
+static void LogWriteEscaped(FILE *out, const char *s)
+{
+	for (; *s; ++s)
+        {
+		unsigned char ch = *s;
+
+		if (ch == '"' || ch == '\\')
+			fprintf(out, "\\%c", ch);
+		else if (ch < 0x20)
+			fprintf(out, "\\u%04x", ch);
+		else
+			fputc(ch, out);
+	}
+}
+
+
+
+static void LogWriteText(FILE *out, const LogRecord *r)
+{
+	char when[32];
+
+	fprintf(out, "%s %s", TemperClockFormat(r->timestamp, when, sizeof(when)),
+	        LevelNames[r->level]);
+	if (r->sensor >= 0)
+		fprintf(out, " sensor %d", r->sensor);
+
+	switch (r->kind)
+        {
+	case LOG_KIND_READING:
+		fprintf(out, " RET: %d", r->code);
+		/* fall through */
+	case LOG_KIND_STORED:
+		fprintf(out, " %s", KindNames[r->kind]);
+		for (int i = 0; i < TEMPER_CHANNELS; ++i)
+			fprintf(out, ";%f %s", r->value[i], UnitNames[r->unit[i] % 3]);
+		break;
+	default:
+		fprintf(out, " %s", r->text);
+		break;
+	}
+
+	if (r->repeat)
+		fprintf(out, " (%u more suppressed)", r->repeat);
+	fputc('\n', out);
+}
+
+
+
+static void LogWriteJson(FILE *out, const LogRecord *r)
+{
+	fprintf(out, "{\"ts\":%lld,\"level\":\"%s\",\"kind\":\"%s\"",
+	        (long long)r->timestamp, LevelNames[r->level],
+	        KindNames[r->kind]);
+	if (r->sensor >= 0)
+		fprintf(out, ",\"sensor\":%d", r->sensor);
+
+	if (r->kind == LOG_KIND_READING || r->kind == LOG_KIND_STORED)
+        {
+		if (r->kind == LOG_KIND_READING)
+			fprintf(out, ",\"ret\":%d", r->code);
+		// Filtered channels are NAN, and JSON has no NaN or infinity.
+		fputs(",\"values\":[", out);
+		for (int i = 0; i < TEMPER_CHANNELS; ++i)
+                {
+			if (!isfinite(r->value[i]))
+				fprintf(out, "%snull", i ? "," : "");
+			else
+				fprintf(out, "%s%f", i ? "," : "", r->value[i]);
+		}
+		fputc(']', out);
+	}
+	else
+        {
+		if (r->code)
+			fprintf(out, ",\"code\":%d", r->code);
+		fputs(",\"text\":\"", out);
+		LogWriteEscaped(out, r->text);
+		fputc('"', out);
+	}
+
+	if (r->repeat)
+		fprintf(out, ",\"suppressed\":%u", r->repeat);
+	fputs("}\n", out);
+}
+
+
+
+static void LogWrite(const LogRecord *r)
+{
+	switch (log_format)
+        {
+	case LOG_FORMAT_BINARY:
+		fwrite(r, sizeof(*r), 1, log_out);
+		break;
+	case LOG_FORMAT_JSON:
+		LogWriteJson(log_out, r);
+		break;
+	default:
+		LogWriteText(log_out, r);
+		break;
+	}
+}
+
+
+
+static void *LogWriter(void *unused)
+{
+	const struct timespec idle = { 0, 20 * 1000 * 1000 };
+	uint64_t reported = 0;
+	LogRecord r;
+
+	for (;;)
+        {
+		int done = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+
+		while (LogPop(&r))
+			LogWrite(&r);
+
+		uint64_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+		if (lost != reported)
+                {
+			LogInit(&r, TEMPER_LOG_WARN, LOG_KIND_MESSAGE, -1);
+			snprintf(r.text, sizeof(r.text),
+			         "%llu log records dropped",
+			         (unsigned long long)(lost - reported));
+			LogWrite(&r);
+			reported = lost;
+		}
+
+		fflush(log_out);
+		if (done)
+			break;
+		nanosleep(&idle, NULL);
+	}
+
+	return NULL;
+}
+
+
+
+int LogStart(FILE *out, enum LogLevel level, enum LogFormat format)
+{
+	if (running)
+		return EBUSY;
+
+	for (uint64_t i = 0; i < TEMPER_LOG_SLOTS; ++i)
+		slots[i].seq = i;
+
+	log_out = out;
+	log_format = format;
+	LogThreshold = level;
+
+	if (format == LOG_FORMAT_BINARY)
+        {
+		const uint32_t size = sizeof(LogRecord);
+
+		fwrite("TLOG", 4, 1, out);
+		fwrite(&size, sizeof(size), 1, out);
+	}
+
+	int err = pthread_create(&writer, NULL, LogWriter, NULL);
+	if (err)
+		return err;
+
+	running = 1;
+	atexit(LogStop);
+	return 0;
+}
+
+
+
+void LogStop(void)
+{
+	if (!running)
+		return;
+
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+	running = 0;
+	stopping = 0;
+}
+
+
+
+void LogReading(enum LogLevel level, const TemperReading *r, int ret)
+{
+	LogRecord record;
+
+	if (!LogEnabled(level))
+		return;
+
+	LogInit(&record, level, LOG_KIND_READING, r->sensor);
+	record.timestamp = r->timestamp;
+	record.code = ret;
+	memcpy(record.value, r->value, sizeof(record.value));
+	memcpy(record.unit, r->unit, sizeof(record.unit));
+	LogPush(&record);
+}
+
+
+
+void LogStored(const TemperReading *r)
+{
+	LogRecord record;
+
+	if (!LogEnabled(TEMPER_LOG_DEBUG))
+		return;
+
+	LogInit(&record, TEMPER_LOG_DEBUG, LOG_KIND_STORED, r->sensor);
+	record.timestamp = r->timestamp;
+	memcpy(record.value, r->value, sizeof(record.value));
+	memcpy(record.unit, r->unit, sizeof(record.unit));
+	LogPush(&record);
+}
+
+
+
+void LogDevice(int sensor, const char *product, const char *serial)
+{
+	LogRecord record;
+
+	if (!LogEnabled(TEMPER_LOG_DEBUG))
+		return;
+
+	LogInit(&record, TEMPER_LOG_DEBUG, LOG_KIND_DEVICE, sensor);
+	snprintf(record.text, sizeof(record.text), "%s;%s", product, serial);
+	LogPush(&record);
+}
+
+
+
+void LogMessage(enum LogLevel level, int sensor, const char *fmt, ...)
+{
+	LogRecord record;
+	va_list ap;
+
+	if (!LogEnabled(level))
+		return;
+
+	LogInit(&record, level, LOG_KIND_MESSAGE, sensor);
+	va_start(ap, fmt);
+	vsnprintf(record.text, sizeof(record.text), fmt, ap);
+	va_end(ap);
+	LogPush(&record);
+}
+
+
+
+int LogError(int sensor, int code, const char *text)
+{
+	const unsigned key = ((unsigned)sensor * 31u + (unsigned)code)
+	                     % LOG_RATE_KEYS;
+	struct LogRate *rate = &rates[key];
+	LogRecord record;
+
+	LogInit(&record, TEMPER_LOG_ERROR, LOG_KIND_MESSAGE, sensor);
+	record.code = code;
+
+	pthread_mutex_lock(&rate_lock);
+	if (rate->last && rate->sensor == sensor && rate->code == code &&
+	    record.timestamp - rate->last <
+	    TEMPER_LOG_RATE_WINDOW * TEMPER_NS_PER_SEC)
+        {
+		++rate->suppressed;
+		pthread_mutex_unlock(&rate_lock);
+		return 0;
+	}
+	if (rate->sensor == sensor && rate->code == code)
+		record.repeat = rate->suppressed;
+	rate->sensor = sensor;
+	rate->code = code;
+	rate->last = record.timestamp;
+	rate->suppressed = 0;
+	pthread_mutex_unlock(&rate_lock);
+
+	snprintf(record.text, sizeof(record.text), "%s", text);
+	LogPush(&record);
+	return 1;
+}
+
+
+
+uint64_t LogDropped(void)
+{
+	return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+
+
+int LogLevelFromString(const char *name)
+{
+	for (int i = 0; i < 4; ++i)
+        {
+		if (strcmp(name, LevelNames[i]) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+
+int LogFormatFromString(const char *name)
+{
+	if (strcmp(name, "text") == 0)
+		return LOG_FORMAT_TEXT;
+	if (strcmp(name, "json") == 0)
+		return LOG_FORMAT_JSON;
+	if (strcmp(name, "binary") == 0)
+		return LOG_FORMAT_BINARY;
+	return -1;
+}
@@ -0,0 +1,93 @@
+#ifndef TEMPER_LOGGER_H
+#define TEMPER_LOGGER_H
+
+/*
+ * Buffered logging for the collector.
+ *
+ * Callers only copy a fixed size record into a lock-free ring; a background
+ * thread formats the records as text, JSON lines or raw binary and writes
+ * them out.  When the ring is full records are dropped and counted rather
+ * than making the sampling loop wait.  Safe to call from any thread once
+ * LogStart() has returned.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "reading.h"
+
+enum LogLevel
+{
+	TEMPER_LOG_ERROR,
+	TEMPER_LOG_WARN,
+	TEMPER_LOG_INFO,
+	TEMPER_LOG_DEBUG,
+};
+
+enum LogFormat
+{
+	LOG_FORMAT_TEXT,
+	LOG_FORMAT_JSON,
+	LOG_FORMAT_BINARY,	/* "TLOG", record size, then LogRecords */
+};
+
+enum LogKind
+{
+	LOG_KIND_MESSAGE,	/* text */
+	LOG_KIND_READING,	/* code is the TemperGetData return value */
+	LOG_KIND_STORED,	/* row written to the database */
+	LOG_KIND_DEVICE,	/* text is "product;serial" */
+};
+
+#define LOG_TEXT_LEN 56
+
+struct LogRecord
+{
+	int64_t timestamp;		/* nanoseconds since the epoch */
+	uint8_t level;
+	uint8_t kind;
+	uint8_t unit[TEMPER_CHANNELS];
+	int32_t sensor;			/* -1 when not about a sensor */
+	int32_t code;
+	uint32_t repeat;		/* errors suppressed before this one */
+	float value[TEMPER_CHANNELS];
+	char text[LOG_TEXT_LEN];
+};
+typedef struct LogRecord LogRecord;
+
+#if !defined TEMPER_LOG_RATE_WINDOW
+#define TEMPER_LOG_RATE_WINDOW 60	/* seconds between repeated errors */
+#endif
+
+extern enum LogLevel LogThreshold;
+
+#define LogEnabled(level) ((level) <= LogThreshold)
+
+// Start the writer thread, records are written to out.  Registers LogStop()
+// with atexit().  Returns 0 or an errno value.
+int LogStart(FILE *out, enum LogLevel level, enum LogFormat format);
+
+// Drain everything queued so far and stop the writer thread.
+void LogStop(void);
+
+void LogReading(enum LogLevel level, const TemperReading *r, int ret);
+
+void LogStored(const TemperReading *r);
+
+void LogDevice(int sensor, const char *product, const char *serial);
+
+void LogMessage(enum LogLevel level, int sensor, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+
+// Log an error at most once per TEMPER_LOG_RATE_WINDOW for each sensor and
+// code pair.  Returns 1 if it was queued, 0 if it was suppressed.
+int LogError(int sensor, int code, const char *text);
+
+// Records lost because the ring was full.
+uint64_t LogDropped(void);
+
+int LogLevelFromString(const char *name);
+
+int LogFormatFromString(const char *name);
+
+#endif
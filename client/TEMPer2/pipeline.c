@@ -0,0 +1,517 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Batched reading pipeline, see pipeline.h.
+ *
+ * A node's statistics are written by the thread running it and by the
+ * thread feeding it, and read by whoever asks for a report, so they are
+ * only touched with relaxed atomics.
+ */
+
+#include "logger.h"
+#include "pipeline.h"
+#include "timestamp.h"
+
+static void PipelineDeliver(PipelineNode *n, const TemperReading *rows,
+                            unsigned count);
+
+
+
+static void StatAdd(int64_t *stat, int64_t value)
+{
+	__atomic_fetch_add(stat, value, __ATOMIC_RELAXED);
+}
+
+
+
+static void StatCount(uint64_t *stat, uint64_t value)
+{
+	__atomic_fetch_add(stat, value, __ATOMIC_RELAXED);
+}
+
+
+
+static void PipelineFail(Pipeline *p, int error)
+{
+	int none = 0;
+
+	if (error)
+		__atomic_compare_exchange_n(&p->error, &none, error, 0,
+		                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+
+void PipelineInit(Pipeline *p)
+{
+	memset(p, 0, sizeof(*p));
+}
+
+
+
+int PipelineAdd(Pipeline *p, int sink, const PipelineOps *ops, void *state,
+                int flags)
+{
+	if (p->count == PIPELINE_MAX_NODES || p->started)
+		return -ENOSPC;
+
+	PipelineNode *n = &p->nodes[p->count++];
+
+	n->ops = ops;
+	n->state = state;
+	n->flags = flags;
+	n->sink = sink;
+	n->pipeline = p;
+
+	if (sink)
+		return 0;
+
+	// Chain the stage after the last one.
+	if (!p->first_stage)
+        {
+		p->first_stage = n;
+		return 0;
+	}
+	PipelineNode *last = p->first_stage;
+	while (last->next)
+		last = last->next;
+	last->next = n;
+	return 0;
+}
+
+
+
+int PipelineSpecFlags(char *spec)
+{
+	size_t len = strlen(spec);
+
+	if (len >= 5 && !strcmp(spec + len - 5, "+drop"))
+        {
+		spec[len - 5] = '\0';
+		return PIPELINE_THREAD | PIPELINE_DROP;
+	}
+	if (len >= 1 && spec[len - 1] == '+')
+        {
+		spec[len - 1] = '\0';
+		return PIPELINE_THREAD;
+	}
+	return 0;
+}
+
+
+
+// Pass what a stage emitted on to the next stage, or to every sink.
+static void PipelineForward(PipelineNode *n)
+{
+	Pipeline *p = n->pipeline;
+
+	if (!n->out.count)
+		return;
+
+	if (n->next)
+        {
+		PipelineDeliver(n->next, n->out.rows, n->out.count);
+	}
+	else
+        {
+		for (unsigned i = 0; i < p->count; ++i)
+			if (p->nodes[i].sink)
+				PipelineDeliver(&p->nodes[i], n->out.rows,
+				                n->out.count);
+	}
+	n->out.count = 0;
+}
+
+
+
+void PipelineEmit(PipelineNode *out, const TemperReading *r)
+{
+	if (out->sink)
+		return;
+
+	out->out.rows[out->out.count++] = *r;
+	StatCount(&out->stats.rows_out, 1);
+	if (out->out.count == PIPELINE_BATCH)
+		PipelineForward(out);
+}
+
+
+
+// Process a batch in the calling thread, then pass the result on.
+static void PipelineRun(PipelineNode *n, const TemperReading *rows,
+                        unsigned count)
+{
+	const int64_t start = TemperClockNow();
+	int ret;
+
+	n->saved = 0;
+	ret = n->ops->process(n->state, rows, count, n);
+	const int64_t took = TemperClockNow() - start;
+
+	PipelineFail(n->pipeline, ret);
+	StatCount(&n->stats.batches, 1);
+	StatCount(&n->stats.rows_in, count);
+	StatAdd(&n->stats.busy, took);
+	if (took > __atomic_load_n(&n->stats.longest, __ATOMIC_RELAXED))
+		__atomic_store_n(&n->stats.longest, took, __ATOMIC_RELAXED);
+
+	PipelineForward(n);
+}
+
+
+
+static void PipelineEnqueue(PipelineNode *n, const TemperReading *rows,
+                            unsigned count)
+{
+	pthread_mutex_lock(&n->lock);
+	if (n->queued == PIPELINE_QUEUE)
+        {
+		if (n->flags & PIPELINE_DROP)
+                {
+			pthread_mutex_unlock(&n->lock);
+			StatCount(&n->stats.dropped, count);
+			return;
+		}
+
+		const int64_t start = TemperClockNow();
+		while (n->queued == PIPELINE_QUEUE)
+			pthread_cond_wait(&n->drained, &n->lock);
+		StatAdd(&n->stats.blocked, TemperClockNow() - start);
+	}
+
+	PipelineBatch *b = &n->queue[(n->head + n->queued) % PIPELINE_QUEUE];
+	memcpy(b->rows, rows, count * sizeof(*rows));
+	b->count = count;
+	b->queued = TemperClockNow();
+	++n->queued;
+	pthread_cond_signal(&n->ready);
+	pthread_mutex_unlock(&n->lock);
+}
+
+
+
+static void PipelineDeliver(PipelineNode *n, const TemperReading *rows,
+                            unsigned count)
+{
+	if (n->queue)
+		PipelineEnqueue(n, rows, count);
+	else
+		PipelineRun(n, rows, count);
+}
+
+
+
+// A threaded node works on the batch at the head of its queue, which stays
+// queued until it is done so draining waits for it too.
+static void *PipelineThread(void *arg)
+{
+	PipelineNode *n = arg;
+
+	pthread_mutex_lock(&n->lock);
+	for (;;)
+        {
+		while (!n->queued && !n->stopping)
+			pthread_cond_wait(&n->ready, &n->lock);
+		if (!n->queued)
+			break;
+
+		PipelineBatch *b = &n->queue[n->head];
+		pthread_mutex_unlock(&n->lock);
+
+		StatAdd(&n->stats.waited, TemperClockNow() - b->queued);
+		PipelineRun(n, b->rows, b->count);
+
+		pthread_mutex_lock(&n->lock);
+		n->head = (n->head + 1) % PIPELINE_QUEUE;
+		--n->queued;
+		pthread_cond_broadcast(&n->drained);
+	}
+	pthread_mutex_unlock(&n->lock);
+
+	return NULL;
+}
+
+
+
+// Let a threaded node's thread finish its queue, join it and free the
+// queue.  From then on the node runs inline.
+static void PipelineStop(PipelineNode *n)
+{
+	if (!n->queue)
+		return;
+
+	pthread_mutex_lock(&n->lock);
+	n->stopping = 1;
+	pthread_cond_signal(&n->ready);
+	pthread_mutex_unlock(&n->lock);
+	pthread_join(n->thread, NULL);
+
+	pthread_cond_destroy(&n->drained);
+	pthread_cond_destroy(&n->ready);
+	pthread_mutex_destroy(&n->lock);
+	free(n->queue);
+	n->queue = NULL;
+}
+
+
+
+int PipelineStart(Pipeline *p)
+{
+	int ret = 0;
+	unsigned i;
+
+	p->since = TemperClockNow();
+	for (i = 0; i < p->count && !ret; ++i)
+        {
+		PipelineNode *n = &p->nodes[i];
+
+		if (!(n->flags & PIPELINE_THREAD))
+			continue;
+
+		n->queue = calloc(PIPELINE_QUEUE, sizeof(*n->queue));
+		if (!n->queue)
+                {
+			ret = -ENOMEM;
+			break;
+		}
+		pthread_mutex_init(&n->lock, NULL);
+		pthread_cond_init(&n->ready, NULL);
+		pthread_cond_init(&n->drained, NULL);
+		ret = -pthread_create(&n->thread, NULL, PipelineThread, n);
+		if (ret)
+                {
+			pthread_cond_destroy(&n->drained);
+			pthread_cond_destroy(&n->ready);
+			pthread_mutex_destroy(&n->lock);
+			free(n->queue);
+			n->queue = NULL;
+		}
+	}
+
+	// All or none, the threads already running are stopped again.
+	if (ret)
+        {
+		while (i-- > 0)
+			PipelineStop(&p->nodes[i]);
+		return ret;
+	}
+
+	p->started = 1;
+	return 0;
+}
+
+
+
+int PipelineSubmit(Pipeline *p, const TemperReading *rows, unsigned count)
+{
+	if (p->first_stage)
+        {
+		PipelineDeliver(p->first_stage, rows, count);
+	}
+	else
+        {
+		for (unsigned i = 0; i < p->count; ++i)
+			if (p->nodes[i].sink)
+				PipelineDeliver(&p->nodes[i], rows, count);
+	}
+
+	return __atomic_load_n(&p->error, __ATOMIC_RELAXED);
+}
+
+
+
+static void PipelineDrain(PipelineNode *n)
+{
+	if (!n->queue)
+		return;
+
+	pthread_mutex_lock(&n->lock);
+	while (n->queued)
+		pthread_cond_wait(&n->drained, &n->lock);
+	pthread_mutex_unlock(&n->lock);
+}
+
+
+
+// Once everything upstream has drained the node is idle, so its flush can
+// run in the calling thread.
+static void PipelineFlush(PipelineNode *n)
+{
+	PipelineDrain(n);
+	if (n->ops->flush && !n->saved)
+		PipelineFail(n->pipeline, n->ops->flush(n->state, n));
+	PipelineForward(n);
+}
+
+
+
+// Saved per node: uint32 index, the name, uint32 size, what save wrote.
+#define PIPELINE_NAME_SIZE 16
+
+int PipelineSave(Pipeline *p, FILE *f)
+{
+	int ret = 0;
+
+	// In pipeline order, so each node is idle before the next one's turn
+	// and has passed on everything it emitted.
+	for (PipelineNode *n = p->first_stage; n; n = n->next)
+		PipelineDrain(n);
+	for (unsigned i = 0; i < p->count; ++i)
+		PipelineDrain(&p->nodes[i]);
+
+	for (uint32_t i = 0; i < p->count && !ret; ++i)
+        {
+		PipelineNode *n = &p->nodes[i];
+		char name[PIPELINE_NAME_SIZE] = { 0 };
+		uint32_t size = 0;
+
+		if (!n->ops->save)
+			continue;
+
+		strncpy(name, n->ops->name, sizeof(name) - 1);
+		const long at = ftell(f);
+		if (fwrite(&i, sizeof(i), 1, f) != 1 ||
+		    fwrite(name, sizeof(name), 1, f) != 1 ||
+		    fwrite(&size, sizeof(size), 1, f) != 1)
+			return errno ? -errno : -EIO;
+
+		if ((ret = n->ops->save(n->state, f)) < 0)
+			break;
+
+		const long end = ftell(f);
+		size = end - at - sizeof(i) - sizeof(name) - sizeof(size);
+		if (end < 0 ||
+		    fseek(f, at + sizeof(i) + sizeof(name), SEEK_SET) < 0 ||
+		    fwrite(&size, sizeof(size), 1, f) != 1 ||
+		    fseek(f, end, SEEK_SET) < 0)
+			return errno ? -errno : -EIO;
+		n->saved = 1;
+	}
+
+	return ret;
+}
+
+
+
+int PipelineRestore(Pipeline *p, const void *data, size_t size)
+{
+	const unsigned char *at = data, *end = at + size;
+	const size_t head = 4 + PIPELINE_NAME_SIZE + 4;
+	int restored = 0;
+
+	while (at < end)
+        {
+		char name[PIPELINE_NAME_SIZE];
+		uint32_t i, length;
+
+		if ((size_t)(end - at) < head)
+			return -EPROTO;
+		memcpy(&i, at, 4);
+		memcpy(name, at + 4, sizeof(name));
+		memcpy(&length, at + 4 + sizeof(name), 4);
+		at += head;
+		if (length > (size_t)(end - at))
+			return -EPROTO;
+
+		PipelineNode *n = i < p->count ? &p->nodes[i] : NULL;
+		name[sizeof(name) - 1] = '\0';
+		if (n && n->ops->restore && !strcmp(name, n->ops->name) &&
+		    length)
+                {
+			FILE *f = fmemopen((void *)at, length, "rb");
+			int ret = f ? n->ops->restore(n->state, f) : -errno;
+
+			if (f)
+				fclose(f);
+			if (ret < 0)
+				LogMessage(TEMPER_LOG_WARN, -1, "%s not restored: %s",
+				           name, strerror(-ret));
+			else
+				++restored;
+		}
+		at += length;
+	}
+
+	return restored;
+}
+
+
+
+void PipelineReport(Pipeline *p)
+{
+	const double seconds = (double)(TemperClockNow() - p->since) /
+	                       TEMPER_NS_PER_SEC;
+
+	for (unsigned i = 0; i < p->count; ++i)
+        {
+		PipelineNode *n = &p->nodes[i];
+		PipelineStats s;
+
+		s.batches = __atomic_load_n(&n->stats.batches, __ATOMIC_RELAXED);
+		s.rows_in = __atomic_load_n(&n->stats.rows_in, __ATOMIC_RELAXED);
+		s.rows_out = __atomic_load_n(&n->stats.rows_out,
+		                             __ATOMIC_RELAXED);
+		s.dropped = __atomic_load_n(&n->stats.dropped, __ATOMIC_RELAXED);
+		s.busy = __atomic_load_n(&n->stats.busy, __ATOMIC_RELAXED);
+		s.longest = __atomic_load_n(&n->stats.longest, __ATOMIC_RELAXED);
+		s.waited = __atomic_load_n(&n->stats.waited, __ATOMIC_RELAXED);
+		s.blocked = __atomic_load_n(&n->stats.blocked, __ATOMIC_RELAXED);
+
+		// Log records are short, threaded nodes are marked with the
+		// "+" of their spec.
+		LogMessage(TEMPER_LOG_INFO, -1, "%s %s%s: %llu in, %llu out, %.1f/s",
+		           n->sink ? "sink" : "stage", n->ops->name,
+		           n->flags & PIPELINE_THREAD ? "+" : "",
+		           (unsigned long long)s.rows_in,
+		           (unsigned long long)(n->sink ? s.rows_in : s.rows_out),
+		           seconds > 0 ? s.rows_in / seconds : 0.0);
+		LogMessage(TEMPER_LOG_INFO, -1, "%s: %.3f ms/batch, longest %.3f ms",
+		           n->ops->name,
+		           s.batches ? (double)s.busy / s.batches /
+		                       TEMPER_NS_PER_MS : 0.0,
+		           (double)s.longest / TEMPER_NS_PER_MS);
+		if (n->flags & PIPELINE_THREAD)
+                {
+			LogMessage(TEMPER_LOG_INFO, -1,
+			           "%s: queued %.3f ms, blocked %.1f ms",
+			           n->ops->name,
+			           s.batches ? (double)s.waited / s.batches /
+			                       TEMPER_NS_PER_MS : 0.0,
+			           (double)s.blocked / TEMPER_NS_PER_MS);
+		}
+		if (s.dropped)
+                {
+			LogMessage(TEMPER_LOG_WARN, -1, "%s: %llu rows dropped",
+			           n->ops->name, (unsigned long long)s.dropped);
+		}
+	}
+}
+
+
+
+int PipelineClose(Pipeline *p)
+{
+	// Stages first, in order, so what each one holds back reaches the
+	// next before that one is flushed.  Then the sinks.
+	for (PipelineNode *n = p->first_stage; n; n = n->next)
+		PipelineFlush(n);
+	for (unsigned i = 0; i < p->count; ++i)
+		if (p->nodes[i].sink)
+			PipelineFlush(&p->nodes[i]);
+
+	for (unsigned i = 0; i < p->count; ++i)
+        {
+		PipelineNode *n = &p->nodes[i];
+
+		PipelineStop(n);
+		if (n->ops->close)
+			n->ops->close(n->state);
+	}
+
+	p->count = 0;
+	p->first_stage = NULL;
+	p->started = 0;
+	return p->error;
+}
@@ -0,0 +1,160 @@
+#ifndef TEMPER_PIPELINE_H
+#define TEMPER_PIPELINE_H
+
+/*
+ * Readings flow from the sampling loop through a chain of stages into any
+ * number of sinks.
+ *
+ *   sampling loop -> stage -> stage -> ... -+-> sink
+ *                                           +-> sink
+ *
+ * Rows travel in batches.  A stage or sink runs inline, in the thread that
+ * hands it a batch, or on its own thread behind a bounded queue of
+ * PIPELINE_QUEUE batches.  A full queue blocks the thread feeding it
+ * (backpressure) unless the node was added with PIPELINE_DROP, then the
+ * batch is dropped and counted.  Everything is allocated by PipelineAdd()
+ * and PipelineStart(), passing a batch along allocates nothing.
+ *
+ * Every node counts its rows, how long it spends per batch and, if
+ * threaded, how long batches wait in its queue.  See PipelineReport().
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "reading.h"
+
+#if !defined PIPELINE_BATCH
+#define PIPELINE_BATCH 64		/* rows per batch */
+#endif
+
+#if !defined PIPELINE_QUEUE
+#define PIPELINE_QUEUE 16		/* batches queued per threaded node */
+#endif
+
+#define PIPELINE_MAX_NODES 16
+
+#define PIPELINE_THREAD 0x1		/* run on its own thread */
+#define PIPELINE_DROP   0x2		/* drop batches rather than block */
+
+typedef struct PipelineNode PipelineNode;
+typedef struct Pipeline Pipeline;
+
+// What a stage or sink does.  Stages pass rows on with PipelineEmit(),
+// sinks don't.  Return 0, or an error code (negative errno or an SQLite
+// result) which fails the pipeline.
+struct PipelineOps
+{
+	const char *name;
+	int (*process)(void *state, const TemperReading *rows, unsigned count,
+	               PipelineNode *out);
+	// No more input, emit what is held back.  May be NULL.
+	int (*flush)(void *state, PipelineNode *out);
+	// Free the state.  May be NULL.
+	void (*close)(void *state);
+	// Write what a restarted collector needs to carry on to f, and read
+	// it back into a fresh node.  Return 0 or a negative errno.  May be
+	// NULL, the node then starts over.
+	int (*save)(void *state, FILE *f);
+	int (*restore)(void *state, FILE *f);
+};
+typedef struct PipelineOps PipelineOps;
+
+struct PipelineBatch
+{
+	unsigned count;
+	int64_t queued;			/* ns, when it entered a queue */
+	TemperReading rows[PIPELINE_BATCH];
+};
+typedef struct PipelineBatch PipelineBatch;
+
+struct PipelineStats
+{
+	uint64_t batches;
+	uint64_t rows_in;
+	uint64_t rows_out;		/* emitted, stages only */
+	uint64_t dropped;		/* rows dropped at a full queue */
+	int64_t busy;			/* ns spent processing */
+	int64_t longest;		/* ns, slowest batch */
+	int64_t waited;			/* ns batches spent queued */
+	int64_t blocked;		/* ns the feeder waited on a full queue */
+};
+typedef struct PipelineStats PipelineStats;
+
+struct PipelineNode
+{
+	const PipelineOps *ops;
+	void *state;
+	int flags;
+	int sink;
+	int saved;			/* state unchanged since PipelineSave() */
+	Pipeline *pipeline;
+	PipelineNode *next;		/* next stage, NULL feeds the sinks */
+	PipelineBatch out;		/* rows emitted, not yet passed on */
+	PipelineStats stats;
+
+	// Threaded nodes only.
+	PipelineBatch *queue;
+	unsigned head;
+	unsigned queued;
+	int busy;
+	int stopping;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;		/* a batch was queued, or stopping */
+	pthread_cond_t drained;		/* room in the queue, or idle */
+};
+
+struct Pipeline
+{
+	PipelineNode nodes[PIPELINE_MAX_NODES];
+	unsigned count;
+	PipelineNode *first_stage;	/* NULL goes straight to the sinks */
+	int started;
+	int error;			/* first error of any node */
+	int64_t since;			/* ns, PipelineStart() */
+};
+
+void PipelineInit(Pipeline *p);
+
+// Append a stage, or a sink when sink is set.  Stages run in the order
+// they are added, every sink sees everything the last stage emits.
+// Returns 0 or -ENOSPC.
+int PipelineAdd(Pipeline *p, int sink, const PipelineOps *ops, void *state,
+                int flags);
+
+// Strip a trailing "+" (own thread) or "+drop" (own thread, drop when
+// full) from a stage or sink spec and return the flags it asked for.
+int PipelineSpecFlags(char *spec);
+
+// Start the threads.  Returns 0 or a negative errno, then none are left
+// running and PipelineClose() runs every node inline.
+int PipelineStart(Pipeline *p);
+
+// Feed a batch of count <= PIPELINE_BATCH rows.  Returns the first error
+// the pipeline has seen, threaded nodes report theirs on a later call.
+int PipelineSubmit(Pipeline *p, const TemperReading *rows, unsigned count);
+
+// Pass one row on from a stage.
+void PipelineEmit(PipelineNode *out, const TemperReading *r);
+
+// Log every node's statistics.
+void PipelineReport(Pipeline *p);
+
+// Wait for the queues to drain and write the state of every node that
+// can save it to f, see PipelineOps.  Returns 0 or the first error.
+int PipelineSave(Pipeline *p, FILE *f);
+
+// Restore what PipelineSave() wrote into the nodes of an identically built
+// pipeline, before PipelineStart().  Nodes that don't match where they
+// sit are left fresh.  Returns how many nodes were restored, or -EPROTO.
+int PipelineRestore(Pipeline *p, const void *data, size_t size);
+
+// Flush every stage in order, wait for the queues to drain, stop the
+// threads and close the nodes.  Nodes whose state PipelineSave() wrote
+// and that saw nothing since are not flushed: a restarted collector
+// carries on with what they hold.  Returns the first error seen.
+int PipelineClose(Pipeline *p);
+
+#endif
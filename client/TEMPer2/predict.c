@@ -0,0 +1,219 @@
+#include <math.h>
+#include <string.h>
+
+/*
+ * Streaming over-temperature forecasts and sanity checks, see predict.h.
+ */
+
+#include "predict.h"
+#include "timestamp.h"
+
+#define PREDICT_WARMUP 8	/* readings before any judgement */
+
+/* enum Unit from comm.h */
+#define UNIT_UNAVAILABLE 0
+#define UNIT_REL_HUM 1
+
+
+
+void PredictInit(PredictModel *m, const PredictConfig *config)
+{
+	memset(m, 0, sizeof(*m));
+	m->config = config;
+}
+
+
+
+// Add (t, v) to the window, dropping the oldest when full.
+static void PredictWindowPush(struct PredictChannel *c, double t, double v)
+{
+	if (c->count == TEMPER_PREDICT_WINDOW)
+        {
+		const double ot = c->t[c->head], ov = c->v[c->head];
+
+		c->st -= ot;
+		c->sv -= ov;
+		c->stt -= ot * ot;
+		c->stv -= ot * ov;
+	}
+	else
+        {
+		++c->count;
+	}
+
+	c->t[c->head] = t;
+	c->v[c->head] = v;
+	c->st += t;
+	c->sv += v;
+	c->stt += t * t;
+	c->stv += t * v;
+
+	// Once per lap rebuild the sums so rounding can't creep in.
+	if (++c->head == TEMPER_PREDICT_WINDOW)
+        {
+		c->head = 0;
+		c->st = c->sv = c->stt = c->stv = 0;
+		for (unsigned i = 0; i < c->count; ++i)
+                {
+			c->st += c->t[i];
+			c->sv += c->v[i];
+			c->stt += c->t[i] * c->t[i];
+			c->stv += c->t[i] * c->v[i];
+		}
+	}
+}
+
+
+
+// Least squares line through the window evaluated at t.  Returns 0 when
+// the window can't define a slope yet.
+static int PredictFit(const struct PredictChannel *c, double t,
+                      double *slope, double *level)
+{
+	const double n = c->count;
+	const double d = n * c->stt - c->st * c->st;
+
+	if (c->count < PREDICT_WARMUP || d <= 0)
+		return 0;
+
+	*slope = (n * c->stv - c->st * c->sv) / d;
+	*level = c->sv / n + *slope * (t - c->st / n);
+	return 1;
+}
+
+
+
+static int PredictValid(unsigned unit, float value)
+{
+	if (unit == UNIT_UNAVAILABLE || isnan(value))
+		return 0;
+	if (unit == UNIT_REL_HUM)
+		return value >= -5.0 && value <= 105.0;
+	return value >= -55.0 && value <= 150.0;
+}
+
+
+
+static void PredictChannelUpdate(const PredictConfig *cfg,
+                                 struct PredictChannel *c, double t,
+                                 float value, unsigned unit,
+                                 PredictResult *res)
+{
+	unsigned flags = 0;
+
+	res->limit = unit == UNIT_REL_HUM ? cfg->humidity_limit
+	                                  : cfg->temp_limit;
+	res->slope = 0;
+	res->eta = -1;
+
+	if (!PredictValid(unit, value))
+        {
+		flags = c->flags | PREDICT_INVALID;
+		goto done;
+	}
+
+	// Stuck: a real sensor's last bit flickers now and then.
+	if (c->seen == 0 || value != c->last)
+        {
+		c->last = value;
+		c->same_since = t;
+	}
+	else if (cfg->stuck_seconds > 0 &&
+	         t - c->same_since >= cfg->stuck_seconds)
+        {
+		flags |= PREDICT_STUCK;
+	}
+
+	// Spike: far from the EWMA, unless it keeps happening, then it is a
+	// real step and the model follows it.
+	const double sigma = fmax(sqrt(c->var), cfg->min_sigma);
+	const double dev = value - c->mean;
+
+	if (c->seen >= PREDICT_WARMUP && fabs(dev) > cfg->spike_sigma * sigma &&
+	    ++c->outliers < 3)
+        {
+		flags |= PREDICT_SPIKE;
+		flags |= c->flags & (PREDICT_FORECAST | PREDICT_OVER);
+		goto done;
+	}
+	c->outliers = 0;
+
+	if (c->seen == 0)
+        {
+		c->mean = value;
+		c->var = 0;
+	}
+	else
+        {
+		c->mean += cfg->alpha * dev;
+		c->var = (1 - cfg->alpha) * (c->var + cfg->alpha * dev * dev);
+	}
+	if (c->seen < PREDICT_WARMUP)
+		++c->seen;
+	PredictWindowPush(c, t, value);
+
+	if (res->limit == 0)
+		goto done;
+
+	// Over the limit, with some hysteresis before it clears.
+	if (value >= res->limit ||
+	    ((c->flags & PREDICT_OVER) && value > res->limit - cfg->hysteresis))
+		flags |= PREDICT_OVER;
+
+	double slope, level;
+	if (PredictFit(c, t, &slope, &level))
+        {
+		res->slope = slope;
+		if (level >= res->limit)
+			res->eta = 0;
+		else if (slope > 0)
+			res->eta = (res->limit - level) / slope;
+
+		if (!(flags & PREDICT_OVER) && res->eta >= 0 &&
+		    res->eta <= cfg->horizon)
+			flags |= PREDICT_FORECAST;
+	}
+
+done:
+	res->flags = flags;
+	res->raised = flags & ~c->flags;
+	res->cleared = c->flags & ~flags;
+	c->flags = flags;
+}
+
+
+
+int PredictUpdate(PredictModel *m, const TemperReading *r,
+                  PredictResult *result)
+{
+	int changed = 0;
+
+	if (!m->base)
+		m->base = r->timestamp;
+
+	const double t = (double)(r->timestamp - m->base) / TEMPER_NS_PER_SEC;
+
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		PredictChannelUpdate(m->config, &m->channel[i], t, r->value[i],
+		                     r->unit[i], &result[i]);
+		changed |= result[i].raised || result[i].cleared;
+	}
+
+	return changed;
+}
+
+
+
+const char *PredictFlagToString(unsigned flag)
+{
+	switch (flag)
+        {
+	case PREDICT_FORECAST:	return "forecast";
+	case PREDICT_OVER:	return "over limit";
+	case PREDICT_SPIKE:	return "spike";
+	case PREDICT_STUCK:	return "stuck";
+	case PREDICT_INVALID:	return "invalid";
+	default:		return "unknown";
+	}
+}
@@ -0,0 +1,90 @@
+#ifndef TEMPER_PREDICT_H
+#define TEMPER_PREDICT_H
+
+/*
+ * Streaming over-temperature forecasts and sanity checks per sensor.
+ *
+ * Every channel keeps an EWMA of its level and spread and a least squares
+ * line over the last TEMPER_PREDICT_WINDOW readings, both updated in
+ * constant time and memory per reading.  The line gives the time left
+ * until the channel reaches its limit; the EWMA spots spikes from
+ * corrupted reads, and a value that never changes spots a stuck sensor.
+ */
+
+#include "reading.h"
+
+#if !defined TEMPER_PREDICT_WINDOW
+#define TEMPER_PREDICT_WINDOW 64	/* readings in the regression */
+#endif
+
+enum PredictFlag
+{
+	PREDICT_FORECAST = 0x01,	/* limit reached within the horizon */
+	PREDICT_OVER     = 0x02,	/* at or above the limit */
+	PREDICT_SPIKE    = 0x04,	/* far outside the usual spread */
+	PREDICT_STUCK    = 0x08,	/* same raw value for too long */
+	PREDICT_INVALID  = 0x10,	/* unavailable or impossible value */
+};
+
+struct PredictConfig
+{
+	float temp_limit;		/* °C, 0 disables */
+	float humidity_limit;		/* %RH, 0 disables */
+	float hysteresis;		/* below the limit before OVER clears */
+	double horizon;			/* seconds of warning wanted */
+	double alpha;			/* EWMA weight of a new reading */
+	double spike_sigma;		/* spike beyond this many deviations */
+	double min_sigma;		/* sensor resolution, floors the spread */
+	double stuck_seconds;		/* 0 disables */
+};
+typedef struct PredictConfig PredictConfig;
+
+#define PREDICT_CONFIG_DEFAULT \
+	{ 0.0, 0.0, 0.5, 900.0, 0.05, 6.0, 0.0625, 6 * 3600.0 }
+
+struct PredictChannel
+{
+	double mean;			/* EWMA level */
+	double var;			/* EWMA spread */
+	unsigned seen;			/* readings accepted, saturates */
+	unsigned outliers;		/* spikes in a row */
+
+	double t[TEMPER_PREDICT_WINDOW];	/* seconds since base */
+	double v[TEMPER_PREDICT_WINDOW];
+	unsigned head, count;
+	double st, sv, stt, stv;	/* running regression sums */
+
+	float last;			/* last raw value */
+	double same_since;		/* when it last changed */
+	unsigned flags;			/* enum PredictFlag now raised */
+};
+
+struct PredictModel
+{
+	const PredictConfig *config;
+	int64_t base;			/* ns, time 0 of the window */
+	struct PredictChannel channel[TEMPER_CHANNELS];
+};
+typedef struct PredictModel PredictModel;
+
+struct PredictResult
+{
+	unsigned flags;			/* raised after this reading */
+	unsigned raised;		/* flags that went up just now */
+	unsigned cleared;		/* flags that went down just now */
+	float limit;
+	double slope;			/* units per second */
+	double eta;			/* seconds to the limit, < 0 if never */
+};
+typedef struct PredictResult PredictResult;
+
+void PredictInit(PredictModel *m, const PredictConfig *config);
+
+// Feed a reading, fills one result per channel.  Returns non zero when a
+// flag went up or down on any channel.
+int PredictUpdate(PredictModel *m, const TemperReading *r,
+                  PredictResult *result);
+
+const char *PredictFlagToString(unsigned flag);
+
+#endif
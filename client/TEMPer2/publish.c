@@ -0,0 +1,459 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * The publish sink, see publish.h.
+ */
+
+#include "logger.h"
+#include "publish.h"
+#include "subscribe.h"
+
+#define PUBLISH_OUT 4096		/* bytes encoded ahead of the socket */
+#define PUBLISH_JSON_MAX 128		/* bytes, the longest JSON line */
+
+struct Subscriber
+{
+	int fd;
+	int subscribed;			/* the request line has come */
+	TemperSubscription request;
+	int sensors[TEMPER_SUB_SENSORS];
+	char line[TEMPER_SUB_REQUEST_MAX];
+	unsigned line_length;
+
+	// Filled by the sink, emptied by the publisher, under the lock.
+	TemperReading *queue;
+	unsigned head;
+	unsigned count;
+	uint64_t dropped;		/* since the last notice */
+
+	// The publisher's only.
+	char out[PUBLISH_OUT];
+	unsigned out_start;
+	unsigned out_length;
+};
+
+struct Publish
+{
+	char path[108];
+	int listen_fd;
+	int wake[2];			/* the sink pokes the publisher */
+	int stopping;
+	int started;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	struct Subscriber *subs[PUBLISH_SUBSCRIBERS];
+	unsigned count;
+	uint64_t dropped;		/* totals */
+	uint64_t refused;
+};
+
+
+
+static int PublishWants(const struct Subscriber *s, const TemperReading *r)
+{
+	if (!s->request.sensors)
+		return 1;
+	for (unsigned i = 0; i < s->request.sensor_count; ++i)
+		if (s->request.sensors[i] == r->sensor)
+			return 1;
+	return 0;
+}
+
+
+
+// Copy each batch to the subscribers that want it.  A full queue loses
+// its oldest reading.
+static int PublishProcess(void *state, const TemperReading *rows,
+                          unsigned count, PipelineNode *out)
+{
+	struct Publish *p = state;
+	int queued = 0;
+
+	pthread_mutex_lock(&p->lock);
+	for (unsigned i = 0; i < p->count; ++i)
+        {
+		struct Subscriber *s = p->subs[i];
+
+		for (unsigned j = 0; s->subscribed && j < count; ++j)
+                {
+			if (!PublishWants(s, &rows[j]))
+				continue;
+			if (s->count == PUBLISH_QUEUE)
+                        {
+				s->head = (s->head + 1) % PUBLISH_QUEUE;
+				--s->count;
+				++s->dropped;
+				++p->dropped;
+			}
+			s->queue[(s->head + s->count++) % PUBLISH_QUEUE] =
+				rows[j];
+			queued = 1;
+		}
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	// A full pipe means the publisher has been woken already.
+	if (queued && write(p->wake[1], "", 1) < 0 && errno != EAGAIN)
+		LogError(-1, -errno, "publish wake failed");
+	return 0;
+}
+
+
+
+static unsigned PublishEncode(const struct Subscriber *s,
+                              const TemperReading *r, char *buf)
+{
+	const unsigned channels = s->request.channels ? s->request.channels
+	                                              : TEMPER_QUERY_ALL;
+	TemperReading copy = *r;
+	int at;
+
+	for (int c = 0; c < TEMPER_CHANNELS; ++c)
+        {
+		copy.unit[c] = 0;
+		if (!(channels & (1u << c)))
+			copy.value[c] = NAN;
+	}
+
+	if (s->request.format == TEMPER_SUB_BINARY)
+        {
+		memcpy(buf, &copy, sizeof(copy));
+		return sizeof(copy);
+	}
+
+	// JSON has no infinities or NaN.  %.9g gives a float back exactly and
+	// keeps the line short whatever the value.
+	at = snprintf(buf, PUBLISH_JSON_MAX, "{\"ts\":%lld,\"sensor\":%d,"
+	              "\"values\":[", (long long)copy.timestamp, copy.sensor);
+	for (int c = 0; c < TEMPER_CHANNELS && at < PUBLISH_JSON_MAX; ++c)
+        {
+		if (!isfinite(copy.value[c]))
+			at += snprintf(buf + at, PUBLISH_JSON_MAX - at, "%snull",
+			               c ? "," : "");
+		else
+			at += snprintf(buf + at, PUBLISH_JSON_MAX - at, "%s%.9g",
+			               c ? "," : "", copy.value[c]);
+	}
+	if (at < PUBLISH_JSON_MAX)
+		at += snprintf(buf + at, PUBLISH_JSON_MAX - at, "]}\n");
+	return at < PUBLISH_JSON_MAX ? at : 0;
+}
+
+
+
+// Move what the queue holds into the output buffer, a drop notice first.
+static void PublishFill(struct Publish *p, struct Subscriber *s)
+{
+	const unsigned room = PUBLISH_JSON_MAX > sizeof(TemperReading) ?
+	                      PUBLISH_JSON_MAX : sizeof(TemperReading);
+
+	if (s->out_start)
+        {
+		s->out_length -= s->out_start;
+		memmove(s->out, s->out + s->out_start, s->out_length);
+		s->out_start = 0;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	if (s->dropped && s->out_length + room <= sizeof(s->out))
+        {
+		TemperReading notice = { 0 };
+		char *at = s->out + s->out_length;
+
+		if (s->request.format == TEMPER_SUB_BINARY)
+                {
+			notice.timestamp = s->dropped;
+			notice.sensor = TEMPER_SUB_DROPPED;
+			memcpy(at, &notice, sizeof(notice));
+			s->out_length += sizeof(notice);
+		}
+		else
+                {
+			s->out_length += snprintf(at, room, "{\"dropped\":%llu}\n",
+			                          (unsigned long long)s->dropped);
+		}
+		s->dropped = 0;
+	}
+	while (s->count && s->out_length + room <= sizeof(s->out))
+        {
+		s->out_length += PublishEncode(s, &s->queue[s->head],
+		                               s->out + s->out_length);
+		s->head = (s->head + 1) % PUBLISH_QUEUE;
+		--s->count;
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+
+
+// Returns 0, or -1 when the subscriber has to go.
+static int PublishWrite(struct Publish *p, struct Subscriber *s)
+{
+	PublishFill(p, s);
+	while (s->out_start < s->out_length)
+        {
+		ssize_t sent = send(s->fd, s->out + s->out_start,
+		                    s->out_length - s->out_start,
+		                    MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		s->out_start += sent;
+		if (s->out_start == s->out_length)
+			PublishFill(p, s);
+	}
+	return 0;
+}
+
+
+
+// The request line, then nothing but the hang up.  Returns 1 when the
+// request is complete, 0, or -1 when the subscriber has to go.
+static int PublishRead(struct Subscriber *s)
+{
+	char discard[64];
+	ssize_t got;
+
+	if (s->subscribed)
+        {
+		got = recv(s->fd, discard, sizeof(discard), MSG_DONTWAIT);
+		return got == 0 || (got < 0 && errno != EAGAIN) ? -1 : 0;
+	}
+
+	got = recv(s->fd, s->line + s->line_length,
+	           sizeof(s->line) - 1 - s->line_length, MSG_DONTWAIT);
+	if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR))
+		return -1;
+	if (got < 0)
+		return 0;
+
+	s->line_length += got;
+	s->line[s->line_length] = '\0';
+
+	char *end = strchr(s->line, '\n');
+	if (!end)
+		return s->line_length == sizeof(s->line) - 1 ? -1 : 0;
+	*end = '\0';
+	if (TemperSubParse(s->line, &s->request, s->sensors) < 0)
+		return -1;
+
+	if (s->request.format == TEMPER_SUB_BINARY)
+        {
+		const uint32_t version = TEMPER_SUB_VERSION;
+		const uint32_t size = sizeof(TemperReading);
+
+		memcpy(s->out, TEMPER_SUB_MAGIC, 4);
+		memcpy(s->out + 4, &version, 4);
+		memcpy(s->out + 8, &size, 4);
+		s->out_length = 12;
+	}
+	if (s->request.sensors)
+		s->request.sensors = s->sensors;
+	LogMessage(TEMPER_LOG_INFO, -1, "subscriber %d: %s", s->fd, s->line);
+	return 1;
+}
+
+
+
+static void PublishAccept(struct Publish *p)
+{
+	struct Subscriber *s;
+	int fd = accept(p->listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if (p->count == PUBLISH_SUBSCRIBERS ||
+	    !(s = calloc(1, sizeof(*s))) ||
+	    !(s->queue = calloc(PUBLISH_QUEUE, sizeof(*s->queue))))
+        {
+		if (p->count < PUBLISH_SUBSCRIBERS)
+			free(s);
+		++p->refused;
+		close(fd);
+		LogMessage(TEMPER_LOG_WARN, -1, "subscriber refused");
+		return;
+	}
+
+	s->fd = fd;
+	pthread_mutex_lock(&p->lock);
+	p->subs[p->count++] = s;
+	pthread_mutex_unlock(&p->lock);
+}
+
+
+
+static void PublishDrop(struct Publish *p, unsigned i)
+{
+	struct Subscriber *s = p->subs[i];
+
+	pthread_mutex_lock(&p->lock);
+	p->subs[i] = p->subs[--p->count];
+	pthread_mutex_unlock(&p->lock);
+
+	LogMessage(TEMPER_LOG_INFO, -1, "subscriber %d gone", s->fd);
+	close(s->fd);
+	free(s->queue);
+	free(s);
+}
+
+
+
+static void *PublishLoop(void *arg)
+{
+	struct Publish *p = arg;
+	struct pollfd fds[2 + PUBLISH_SUBSCRIBERS];
+
+	for (;;)
+        {
+		unsigned n = p->count;
+		char drain[64];
+
+		fds[0] = (struct pollfd){ p->wake[0], POLLIN, 0 };
+		fds[1] = (struct pollfd){ p->listen_fd, POLLIN, 0 };
+		pthread_mutex_lock(&p->lock);
+		for (unsigned i = 0; i < n; ++i)
+                {
+			const struct Subscriber *s = p->subs[i];
+			const int pending = s->out_start < s->out_length ||
+			                    s->count || s->dropped;
+
+			fds[2 + i] = (struct pollfd){
+				s->fd, POLLIN | (pending ? POLLOUT : 0), 0
+			};
+		}
+		pthread_mutex_unlock(&p->lock);
+
+		if (poll(fds, 2 + n, -1) < 0 && errno != EINTR)
+			break;
+
+		if (fds[0].revents)
+			while (read(p->wake[0], drain, sizeof(drain)) > 0)
+				;
+		if (__atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE))
+			break;
+
+		// Backwards, PublishDrop() moves the last one into the gap.
+		for (unsigned i = n; i-- > 0; )
+                {
+			struct Subscriber *s = p->subs[i];
+			const short events = fds[2 + i].revents;
+			int ret = 0;
+
+			if (events & POLLIN)
+				ret = PublishRead(s);
+			if (ret >= 0 && (events & (POLLERR | POLLHUP)))
+				ret = -1;
+			if (ret > 0)
+                        {
+				pthread_mutex_lock(&p->lock);
+				s->subscribed = 1;
+				pthread_mutex_unlock(&p->lock);
+			}
+			if (ret >= 0 && s->subscribed)
+				ret = PublishWrite(p, s);
+			if (ret < 0)
+				PublishDrop(p, i);
+		}
+
+		if (fds[1].revents & POLLIN)
+			PublishAccept(p);
+	}
+
+	return NULL;
+}
+
+
+
+static void PublishClose(void *state)
+{
+	struct Publish *p = state;
+
+	if (p->started)
+        {
+		__atomic_store_n(&p->stopping, 1, __ATOMIC_RELEASE);
+		if (write(p->wake[1], "", 1) < 0 && errno != EAGAIN)
+			LogError(-1, -errno, "publish wake failed");
+		pthread_join(p->thread, NULL);
+	}
+	if (p->dropped || p->refused)
+		LogMessage(TEMPER_LOG_INFO, -1, "publish: %llu dropped, %llu "
+		           "refused", (unsigned long long)p->dropped,
+		           (unsigned long long)p->refused);
+
+	while (p->count)
+		PublishDrop(p, p->count - 1);
+	if (p->listen_fd >= 0)
+        {
+		close(p->listen_fd);
+		unlink(p->path);
+	}
+	for (int i = 0; i < 2; ++i)
+		if (p->wake[i] >= 0)
+			close(p->wake[i]);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+
+
+void *PublishOpen(const char *path, int *err)
+{
+	struct sockaddr_un addr = { 0 };
+	struct Publish *p;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+        {
+		*err = -ENAMETOOLONG;
+		return NULL;
+	}
+	if (!(p = calloc(1, sizeof(*p))))
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+	strcpy(p->path, path);
+	p->listen_fd = p->wake[0] = p->wake[1] = -1;
+	pthread_mutex_init(&p->lock, NULL);
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (pipe(p->wake) < 0 ||
+	    fcntl(p->wake[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(p->wake[1], F_SETFL, O_NONBLOCK) < 0 ||
+	    (p->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+	                           SOCK_CLOEXEC, 0)) < 0 ||
+	    bind(p->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(p->listen_fd, 16) < 0)
+        {
+		*err = -errno;
+		PublishClose(p);
+		return NULL;
+	}
+
+	if ((*err = -pthread_create(&p->thread, NULL, PublishLoop, p)))
+        {
+		PublishClose(p);
+		return NULL;
+	}
+
+	p->started = 1;
+	return p;
+}
+
+
+
+const PipelineOps PublishOps = {
+	"publish", PublishProcess, NULL, PublishClose, NULL, NULL
+};
@@ -0,0 +1,30 @@
+#ifndef TEMPER_PUBLISH_H
+#define TEMPER_PUBLISH_H
+
+/*
+ * The publish sink: readings streamed to subscribers on a Unix socket, see
+ * subscribe.h for the protocol and the client side.
+ *
+ * The sink only copies each batch into a bounded queue per subscriber and
+ * wakes the publisher's own thread, which serves every subscriber from
+ * one poll() loop.  A subscriber that falls behind loses its oldest
+ * readings, never the collector its time.
+ */
+
+#include "pipeline.h"
+
+#if !defined PUBLISH_QUEUE
+#define PUBLISH_QUEUE 1024		/* readings queued per subscriber */
+#endif
+
+#if !defined PUBLISH_SUBSCRIBERS
+#define PUBLISH_SUBSCRIBERS 64		/* at once, more are turned away */
+#endif
+
+extern const PipelineOps PublishOps;
+
+// Listen on path, replacing a socket left behind.  Returns the state for
+// PublishOps, or NULL and sets *err.
+void *PublishOpen(const char *path, int *err);
+
+#endif
@@ -0,0 +1,797 @@
+#include <math.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Reading TEMPer history back out of the sensors table, see query.h.
+ */
+
+#include "live.h"
+#include "query.h"
+#include "sketch.h"
+#include "timestamp.h"
+
+// Collectors before timestamp_ns noted the start of a run in seconds.
+#define TEMPER_QUERY_SINCE_SECONDS 100000000000LL
+
+// How the collector stored rows from since on, see the compression table.
+enum TemperQueryHow
+{
+	TEMPER_QUERY_EVERY,		/* every reading */
+	TEMPER_QUERY_HOLD,		/* deadband, a row holds until the next */
+	TEMPER_QUERY_LINE,		/* swinging door, straight between rows */
+};
+
+struct TemperQueryRun
+{
+	int64_t since;			/* time column units */
+	enum TemperQueryHow how;
+};
+
+struct TemperQueryDb
+{
+	sqlite3 *db;
+	int64_t scale;			/* ns per unit of the time column */
+	sqlite3_stmt *next_sensor;
+	sqlite3_stmt *bounds;
+	sqlite3_stmt *range;
+	sqlite3_stmt *before;
+	sqlite3_stmt *downsample;
+	sqlite3_stmt *sketches;		/* prepared on first use */
+	const TemperLive *live;		/* recent readings, may be NULL */
+	struct TemperQueryRun *runs;	/* read at each downsampling query */
+	unsigned run_count;
+	unsigned run_max;
+	TemperReading rows[TEMPER_QUERY_BATCH];
+};
+
+// A stored row, times in time column units.
+struct TemperQueryPoint
+{
+	int64_t t;
+	double value[TEMPER_CHANNELS];
+};
+
+// Sums of one downsampling bucket, over time.
+struct TemperQueryBucket
+{
+	int64_t index;
+	int64_t first;			/* span covered, time column units */
+	int64_t last;
+	double sum[TEMPER_CHANNELS];
+	double span[TEMPER_CHANNELS];
+};
+
+// Downsampling one sensor's compressed rows.
+struct TemperQueryRebuild
+{
+	TemperQueryDb *q;
+	int sensor;
+	unsigned channels;
+	int64_t from;
+	int64_t to;
+	int64_t width;
+	struct TemperQueryBucket bucket;	/* index -1 while empty */
+	unsigned n;			/* rows in q->rows */
+	TemperQueryFct fct;
+	void *arg;
+};
+
+
+
+static int TemperQueryPrepare(TemperQueryDb *q, const char *fmt,
+                              const char *column, sqlite3_stmt **stmt)
+{
+	char sql[400];
+
+	snprintf(sql, sizeof(sql), fmt, column, column, column, column,
+	         column, column, column);
+	return sqlite3_prepare_v2(q->db, sql, -1, stmt, NULL);
+}
+
+
+
+TemperQueryDb *TemperQueryOpen(const char *filename, int *rc)
+{
+	TemperQueryDb *q = calloc(1, sizeof(*q));
+	const char *column = "timestamp_ns";
+
+	if (!q)
+        {
+		*rc = SQLITE_NOMEM;
+		return NULL;
+	}
+
+	*rc = sqlite3_open_v2(filename, &q->db, SQLITE_OPEN_READWRITE, NULL);
+	if (*rc != SQLITE_OK)
+        {
+		sqlite3_close(q->db);
+		*rc = sqlite3_open_v2(filename, &q->db, SQLITE_OPEN_READONLY,
+		                      NULL);
+	}
+	if (*rc != SQLITE_OK)
+		goto fail;
+
+	// With the collector's database in WAL mode readers hardly ever
+	// wait, this covers the rest.
+	sqlite3_busy_timeout(q->db, TEMPER_QUERY_BUSY_TIMEOUT);
+
+	// Databases from before timestamp_ns only have whole seconds.
+	q->scale = 1;
+	if (sqlite3_exec(q->db, "SELECT timestamp_ns FROM sensors LIMIT 0",
+	                 0, 0, NULL) != SQLITE_OK)
+        {
+		column = "timestamp";
+		q->scale = TEMPER_NS_PER_SEC;
+	}
+
+	*rc = TemperQueryPrepare(q,
+		"SELECT MIN(Id) FROM sensors WHERE Id > ?1;",
+		column, &q->next_sensor);
+	if (*rc == SQLITE_OK)
+		*rc = TemperQueryPrepare(q,
+			"SELECT MIN(%s), MAX(%s) FROM sensors WHERE Id = ?1;",
+			column, &q->bounds);
+	if (*rc == SQLITE_OK)
+		*rc = TemperQueryPrepare(q,
+			"SELECT %s, inner_temp, outer_temp FROM sensors"
+			" WHERE Id = ?1 AND %s >= ?2 AND %s < ?3 ORDER BY %s;",
+			column, &q->range);
+	if (*rc == SQLITE_OK)
+		*rc = TemperQueryPrepare(q,
+			"SELECT %s, inner_temp, outer_temp FROM sensors"
+			" WHERE Id = ?1 AND %s < ?2 ORDER BY %s DESC LIMIT 1;",
+			column, &q->before);
+	if (*rc == SQLITE_OK)
+		*rc = TemperQueryPrepare(q,
+			"SELECT MIN(%s) + (MAX(%s) - MIN(%s)) / 2, AVG(inner_temp),"
+			" AVG(outer_temp) FROM sensors"
+			" WHERE Id = ?1 AND %s >= ?2 AND %s < ?3"
+			" GROUP BY (%s - ?2) / ?4 ORDER BY 1;",
+			column, &q->downsample);
+	if (*rc == SQLITE_OK)
+		return q;
+
+fail:
+	TemperQueryClose(q);
+	return NULL;
+}
+
+
+
+void TemperQueryClose(TemperQueryDb *q)
+{
+	if (q)
+        {
+		sqlite3_finalize(q->next_sensor);
+		sqlite3_finalize(q->bounds);
+		sqlite3_finalize(q->range);
+		sqlite3_finalize(q->before);
+		sqlite3_finalize(q->downsample);
+		sqlite3_finalize(q->sketches);
+		sqlite3_close(q->db);
+		free(q->runs);
+		free(q);
+	}
+}
+
+
+
+// ns bound to time column units, rounding up keeps ">= from" and "< to"
+// exact for whole second columns.
+static int64_t TemperQueryScale(const TemperQueryDb *q, int64_t ns)
+{
+	if (q->scale == 1)
+		return ns;
+	if (ns <= INT64_MIN + q->scale)
+		return INT64_MIN / q->scale;
+
+	int64_t units = ns / q->scale;
+	return units + (ns % q->scale > 0);
+}
+
+
+
+// Returns 1 with *next set to the lowest sensor number above after, 0 when
+// there are no more.
+static int TemperQueryNextSensor(TemperQueryDb *q, int after, int *next)
+{
+	int found = 0;
+
+	sqlite3_bind_int(q->next_sensor, 1, after);
+	if (sqlite3_step(q->next_sensor) == SQLITE_ROW &&
+	    sqlite3_column_type(q->next_sensor, 0) != SQLITE_NULL)
+        {
+		*next = sqlite3_column_int(q->next_sensor, 0);
+		found = 1;
+	}
+	sqlite3_reset(q->next_sensor);
+	return found;
+}
+
+
+
+void TemperQueryAttachLive(TemperQueryDb *q, const TemperLive *live)
+{
+	q->live = live;
+}
+
+
+
+// Copy the ring readings of sensor from the live file into q->rows after
+// the n already there, feeding full batches to fct.  Returns SQLITE_DONE,
+// or SQLITE_ABORT when fct asked to stop.
+static int TemperQueryLive(TemperQueryDb *q, const TemperQuery *query,
+                           int sensor, int64_t from, unsigned n,
+                           TemperQueryFct fct, void *arg)
+{
+	const unsigned channels = query->channels ? query->channels
+	                                          : TEMPER_QUERY_ALL;
+	for (;;)
+        {
+		const unsigned max = TEMPER_QUERY_BATCH - n;
+		TemperReading *rows = &q->rows[n];
+		unsigned got = TemperLiveRange(q->live, sensor, from, query->to,
+		                               rows, max);
+
+		for (unsigned r = 0; r < got; ++r)
+                {
+			for (int i = 0; i < TEMPER_CHANNELS; ++i)
+                        {
+				if (!(channels & (1u << i)))
+					rows[r].value[i] = NAN;
+				rows[r].unit[i] = 0;
+			}
+		}
+		if (got < max)
+                {
+			n += got;
+			break;
+		}
+
+		from = rows[got - 1].timestamp + 1;
+		if (fct(arg, q->rows, TEMPER_QUERY_BATCH))
+			return SQLITE_ABORT;
+		n = 0;
+	}
+
+	if (n && fct(arg, q->rows, n))
+		return SQLITE_ABORT;
+	return SQLITE_DONE;
+}
+
+
+
+// Read the compression table into q->runs, oldest first.  A database
+// without one has every reading stored.
+static int TemperQueryLoadRuns(TemperQueryDb *q)
+{
+	sqlite3_stmt *stmt;
+	int rc;
+
+	q->run_count = 0;
+	if (sqlite3_prepare_v2(q->db,
+	                       "SELECT since, mode FROM compression"
+	                       " ORDER BY since;", -1, &stmt, NULL) != SQLITE_OK)
+		return SQLITE_OK;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+		const char *mode = (const char *)sqlite3_column_text(stmt, 1);
+		int64_t since = sqlite3_column_int64(stmt, 0);
+		struct TemperQueryRun *run;
+
+		if (q->run_count == q->run_max)
+                {
+			unsigned max = q->run_max ? 2 * q->run_max : 16;
+
+			run = realloc(q->runs, max * sizeof(*run));
+			if (!run)
+                        {
+				rc = SQLITE_NOMEM;
+				break;
+			}
+			q->runs = run;
+			q->run_max = max;
+		}
+
+		if (since < TEMPER_QUERY_SINCE_SECONDS)
+			since *= TEMPER_NS_PER_SEC;
+		run = &q->runs[q->run_count++];
+		run->since = since / q->scale;
+		run->how = !mode ? TEMPER_QUERY_EVERY
+		         : !strcmp(mode, "deadband") ? TEMPER_QUERY_HOLD
+		         : !strcmp(mode, "swing") ? TEMPER_QUERY_LINE
+		         : TEMPER_QUERY_EVERY;
+	}
+
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+
+// Index of the run in effect at t, -1 before the first.
+static int TemperQueryRunAt(const TemperQueryDb *q, int64_t t)
+{
+	int i = -1;
+
+	while (i + 1 < (int)q->run_count && q->runs[i + 1].since <= t)
+		++i;
+	return i;
+}
+
+
+
+// Whether any rows in [from, to) may have been stored compressed.
+static int TemperQueryCompressed(const TemperQueryDb *q, int64_t from,
+                                 int64_t to)
+{
+	for (unsigned i = 0; i < q->run_count; ++i)
+        {
+		const int64_t end = i + 1 < q->run_count ? q->runs[i + 1].since
+		                                         : INT64_MAX;
+
+		if (q->runs[i].how != TEMPER_QUERY_EVERY &&
+		    q->runs[i].since < to && end > from)
+			return 1;
+	}
+	return 0;
+}
+
+
+
+static void TemperQueryPointOf(sqlite3_stmt *stmt, struct TemperQueryPoint *p)
+{
+	p->t = sqlite3_column_int64(stmt, 0);
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+		p->value[i] = sqlite3_column_type(stmt, 1 + i) == SQLITE_NULL
+		            ? NAN : sqlite3_column_double(stmt, 1 + i);
+}
+
+
+
+// Pass the bucket being summed on as a row, if there is one.  Returns non
+// zero when fct asked to stop.
+static int TemperQueryFlushBucket(struct TemperQueryRebuild *rb)
+{
+	const struct TemperQueryBucket *b = &rb->bucket;
+	TemperReading *r;
+
+	if (b->index < 0)
+		return 0;
+	rb->bucket.index = -1;
+
+	r = &rb->q->rows[rb->n++];
+	r->timestamp = (b->first + (b->last - b->first) / 2) * rb->q->scale;
+	r->sensor = rb->sensor;
+	for (int i = 0; i < TEMPER_CHANNELS; ++i)
+        {
+		r->value[i] = (rb->channels & (1u << i)) && b->span[i] > 0
+		            ? (float)(b->sum[i] / b->span[i]) : NAN;
+		r->unit[i] = 0;
+	}
+
+	if (rb->n < TEMPER_QUERY_BATCH)
+		return 0;
+	rb->n = 0;
+	return rb->fct(rb->arg, rb->q->rows, TEMPER_QUERY_BATCH);
+}
+
+
+
+// Add the readings rebuilt over [t0, t1) from stored row a, and b after it
+// when they lie on a line, to the buckets.  Returns non zero when fct asked
+// to stop.
+static int TemperQuerySpan(struct TemperQueryRebuild *rb,
+                           const struct TemperQueryPoint *a,
+                           const struct TemperQueryPoint *b,
+                           int64_t t0, int64_t t1)
+{
+	struct TemperQueryBucket *bucket = &rb->bucket;
+
+	if (t0 < rb->from)
+		t0 = rb->from;
+	if (t1 > rb->to)
+		t1 = rb->to;
+
+	while (t0 < t1)
+        {
+		const int64_t index = (t0 - rb->from) / rb->width;
+		int64_t end = rb->from + (index + 1) * rb->width;
+
+		if (end > t1)
+			end = t1;
+		if (index != bucket->index)
+                {
+			if (TemperQueryFlushBucket(rb))
+				return 1;
+			memset(bucket, 0, sizeof(*bucket));
+			bucket->index = index;
+			bucket->first = t0;
+		}
+		bucket->last = end - 1;
+
+		for (int i = 0; i < TEMPER_CHANNELS; ++i)
+                {
+			double v0 = a->value[i], v1 = v0;
+
+			if (b && b->t > a->t)
+                        {
+				const double slope = (b->value[i] - a->value[i]) /
+				                     (double)(b->t - a->t);
+
+				v0 += slope * (double)(t0 - a->t);
+				v1 += slope * (double)(end - a->t);
+			}
+			if (isnan(v0) || isnan(v1))
+				continue;
+			bucket->sum[i] += (v0 + v1) / 2 * (double)(end - t0);
+			bucket->span[i] += (double)(end - t0);
+		}
+		t0 = end;
+	}
+	return 0;
+}
+
+
+
+// The readings between stored row a and the next one, b, or NULL after
+// the newest.  They only go up to the next run, which was stored on its
+// own.
+static int TemperQuerySegment(struct TemperQueryRebuild *rb,
+                              const struct TemperQueryPoint *a,
+                              const struct TemperQueryPoint *b)
+{
+	const TemperQueryDb *q = rb->q;
+	const int run = TemperQueryRunAt(q, a->t);
+	int64_t end = b ? b->t : a->t + 1;
+
+	if (run + 1 < (int)q->run_count && q->runs[run + 1].since > a->t &&
+	    q->runs[run + 1].since < end)
+        {
+		end = q->runs[run + 1].since;
+		b = NULL;
+	}
+	if (run < 0 || q->runs[run].how != TEMPER_QUERY_LINE)
+		b = NULL;	// Held until the next row.
+
+	return TemperQuerySpan(rb, a, b, a->t, end);
+}
+
+
+
+// Downsample one sensor whose rows were stored compressed: the readings
+// are rebuilt between the stored rows the way CompressReconstruct() does
+// and averaged over time in each bucket, so a row that stood for an hour
+// of readings weighs an hour.  Returns like TemperQuerySensor().
+static int TemperQueryRebuildSensor(TemperQueryDb *q, const TemperQuery *query,
+                                    int sensor, int64_t from, int64_t to,
+                                    int64_t width, TemperQueryFct fct,
+                                    void *arg)
+{
+	struct TemperQueryRebuild rb = { q, sensor, 0, from, to, width,
+	                                 { -1, 0, 0, { 0 }, { 0 } }, 0, fct,
+	                                 arg };
+	struct TemperQueryPoint a, b;
+	int have = 0, stop = 0;
+	int rc;
+
+	rb.channels = query->channels ? query->channels : TEMPER_QUERY_ALL;
+
+	// The row before from still holds at from.
+	sqlite3_bind_int(q->before, 1, sensor);
+	sqlite3_bind_int64(q->before, 2, from);
+	rc = sqlite3_step(q->before);
+	if (rc == SQLITE_ROW)
+        {
+		TemperQueryPointOf(q->before, &a);
+		have = 1;
+	}
+	sqlite3_reset(q->before);
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+		return rc;
+
+	sqlite3_bind_int(q->range, 1, sensor);
+	sqlite3_bind_int64(q->range, 2, from);
+	sqlite3_bind_int64(q->range, 3, to);
+	while (!stop && (rc = sqlite3_step(q->range)) == SQLITE_ROW)
+        {
+		TemperQueryPointOf(q->range, &b);
+		if (have)
+			stop = TemperQuerySegment(&rb, &a, &b);
+		a = b;
+		have = 1;
+	}
+	sqlite3_reset(q->range);
+	if (stop)
+		return SQLITE_ABORT;
+	if (rc != SQLITE_DONE)
+		return rc;
+
+	if ((have && TemperQuerySegment(&rb, &a, NULL)) ||
+	    TemperQueryFlushBucket(&rb) || (rb.n && fct(arg, q->rows, rb.n)))
+		return SQLITE_ABORT;
+	return SQLITE_DONE;
+}
+
+
+
+// Stream one sensor's rows to fct.  Returns SQLITE_DONE when finished,
+// SQLITE_ABORT when fct asked to stop, or an SQLite error.
+static int TemperQuerySensor(TemperQueryDb *q, const TemperQuery *query,
+                             int sensor, TemperQueryFct fct, void *arg)
+{
+	const unsigned channels = query->channels ? query->channels
+	                                          : TEMPER_QUERY_ALL;
+	int64_t from = TemperQueryScale(q, query->from);
+	int64_t to = TemperQueryScale(q, query->to);
+	int64_t oldest = INT64_MAX;	/* first reading to take from the ring */
+	sqlite3_stmt *stmt = q->range;
+	unsigned n = 0;
+	int rc;
+
+	// Raw rows the ring still holds come from memory, the disk only
+	// answers for what is older.
+	if (q->live && !query->points)
+        {
+		oldest = TemperLiveOldest(q->live, sensor);
+		if (oldest < query->from)
+			oldest = query->from;
+		if (oldest < query->to)
+			to = TemperQueryScale(q, oldest);
+	}
+
+	if (query->points)
+        {
+		// Buckets span what the sensor has, not an open ended range.
+		sqlite3_bind_int(q->bounds, 1, sensor);
+		rc = sqlite3_step(q->bounds);
+		if (rc == SQLITE_ROW &&
+		    sqlite3_column_type(q->bounds, 0) != SQLITE_NULL)
+                {
+			int64_t first = sqlite3_column_int64(q->bounds, 0);
+			int64_t last = sqlite3_column_int64(q->bounds, 1);
+
+			if (from < first)
+				from = first;
+			if (to > last)
+				to = last + 1;
+		}
+		sqlite3_reset(q->bounds);
+		if (rc != SQLITE_ROW)
+			return rc;
+		if (to <= from)
+			return SQLITE_DONE;
+
+		int64_t width = (to - from + query->points - 1) / query->points;
+
+		if (width < 1)
+			width = 1;
+		if (TemperQueryCompressed(q, from, to))
+			return TemperQueryRebuildSensor(q, query, sensor, from, to,
+			                                width, fct, arg);
+
+		stmt = q->downsample;
+		sqlite3_bind_int64(stmt, 4, width);
+	}
+
+	sqlite3_bind_int(stmt, 1, sensor);
+	sqlite3_bind_int64(stmt, 2, from);
+	sqlite3_bind_int64(stmt, 3, to);
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        {
+		TemperReading *r = &q->rows[n++];
+
+		r->timestamp = sqlite3_column_int64(stmt, 0) * q->scale;
+		r->sensor = sensor;
+		for (int i = 0; i < TEMPER_CHANNELS; ++i)
+                {
+			r->value[i] = (channels & (1u << i))
+			            ? (float)sqlite3_column_double(stmt, 1 + i)
+			            : NAN;
+			r->unit[i] = 0;
+		}
+
+		if (n == TEMPER_QUERY_BATCH)
+                {
+			if (fct(arg, q->rows, n))
+                        {
+				rc = SQLITE_ABORT;
+				break;
+			}
+			n = 0;
+		}
+	}
+	sqlite3_reset(stmt);
+
+	if (rc == SQLITE_DONE && oldest < query->to)
+		return TemperQueryLive(q, query, sensor, oldest, n, fct, arg);
+	if (rc == SQLITE_DONE && n && fct(arg, q->rows, n))
+		rc = SQLITE_ABORT;
+
+	return rc;
+}
+
+
+
+int TemperQueryRun(TemperQueryDb *q, const TemperQuery *query,
+                   TemperQueryFct fct, void *arg)
+{
+	int rc = sqlite3_exec(q->db, "BEGIN;", 0, 0, NULL);
+
+	// One read transaction, so every sensor comes from the same snapshot
+	// even while the collector inserts.
+	if (rc != SQLITE_OK)
+		return rc;
+	rc = query->points ? TemperQueryLoadRuns(q) : SQLITE_OK;
+	rc = rc == SQLITE_OK ? SQLITE_DONE : rc;
+
+	if (query->sensors)
+        {
+		for (unsigned i = 0; i < query->sensor_count && rc == SQLITE_DONE;
+		     ++i)
+			rc = TemperQuerySensor(q, query, query->sensors[i], fct, arg);
+	}
+	else
+        {
+		int sensor = -1;
+
+		while (rc == SQLITE_DONE &&
+		       TemperQueryNextSensor(q, sensor, &sensor))
+			rc = TemperQuerySensor(q, query, sensor, fct, arg);
+	}
+
+	sqlite3_exec(q->db, "COMMIT;", 0, 0, NULL);
+	return (rc == SQLITE_DONE || rc == SQLITE_ABORT) ? SQLITE_OK : rc;
+}
+
+
+
+// Merge one sensor's sketches of a channel.
+static int TemperQuerySketchSensor(TemperQueryDb *q, const TemperQuery *query,
+                                   int sensor, int channel,
+                                   TemperSketch *sketch)
+{
+	int rc;
+
+	sqlite3_bind_int(q->sketches, 1, sensor);
+	sqlite3_bind_int(q->sketches, 2, channel);
+	sqlite3_bind_int64(q->sketches, 3, query->from);
+	sqlite3_bind_int64(q->sketches, 4, query->to);
+	while ((rc = sqlite3_step(q->sketches)) == SQLITE_ROW)
+		TemperSketchDecode(sketch, sqlite3_column_blob(q->sketches, 0),
+		                   sqlite3_column_bytes(q->sketches, 0));
+	sqlite3_reset(q->sketches);
+	return rc;
+}
+
+
+
+int TemperQuerySketch(TemperQueryDb *q, const TemperQuery *query,
+                      int channel, TemperSketch *sketch)
+{
+	int rc = SQLITE_OK;
+
+	if (!q->sketches)
+		rc = sqlite3_prepare_v2(q->db,
+			"SELECT sketch FROM sketches WHERE Id = ?1 AND"
+			" channel = ?2 AND bucket >= ?3 AND bucket < ?4;",
+			-1, &q->sketches, NULL);
+	if (rc != SQLITE_OK)
+		return rc;
+
+	rc = sqlite3_exec(q->db, "BEGIN;", 0, 0, NULL);
+	if (rc != SQLITE_OK)
+		return rc;
+	rc = SQLITE_DONE;
+
+	if (query->sensors)
+        {
+		for (unsigned i = 0; i < query->sensor_count && rc == SQLITE_DONE;
+		     ++i)
+			rc = TemperQuerySketchSensor(q, query, query->sensors[i],
+			                             channel, sketch);
+	}
+	else
+        {
+		int sensor = -1;
+
+		while (rc == SQLITE_DONE &&
+		       TemperQueryNextSensor(q, sensor, &sensor))
+			rc = TemperQuerySketchSensor(q, query, sensor, channel,
+			                             sketch);
+	}
+
+	sqlite3_exec(q->db, "COMMIT;", 0, 0, NULL);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+
+int TemperQuerySensors(TemperQueryDb *q, int *sensors, unsigned max)
+{
+	int sensor = -1;
+	int n = 0;
+
+	while (TemperQueryNextSensor(q, sensor, &sensor))
+        {
+		if ((unsigned)n < max)
+			sensors[n] = sensor;
+		++n;
+	}
+
+	return n;
+}
+
+
+
+// Widen *first and *last to the rows of one sensor.
+static int TemperQueryBoundsSensor(TemperQueryDb *q, int sensor,
+                                   int64_t *first, int64_t *last)
+{
+	int rc;
+
+	sqlite3_bind_int(q->bounds, 1, sensor);
+	rc = sqlite3_step(q->bounds);
+	if (rc == SQLITE_ROW &&
+	    sqlite3_column_type(q->bounds, 0) != SQLITE_NULL)
+        {
+		int64_t low = sqlite3_column_int64(q->bounds, 0);
+		int64_t high = sqlite3_column_int64(q->bounds, 1);
+
+		if (low * q->scale < *first)
+			*first = low * q->scale;
+		if (high * q->scale > *last)
+			*last = high * q->scale;
+	}
+	sqlite3_reset(q->bounds);
+	return rc == SQLITE_ROW ? SQLITE_DONE : rc;
+}
+
+
+
+int TemperQueryBounds(TemperQueryDb *q, const TemperQuery *query,
+                      int64_t *first, int64_t *last)
+{
+	int rc = SQLITE_DONE;
+
+	*first = INT64_MAX;
+	*last = INT64_MIN;
+	if (query->to <= query->from)
+		return SQLITE_DONE;
+
+	if (query->sensors)
+        {
+		for (unsigned i = 0; i < query->sensor_count && rc == SQLITE_DONE;
+		     ++i)
+			rc = TemperQueryBoundsSensor(q, query->sensors[i], first,
+			                             last);
+	}
+	else
+        {
+		int sensor = -1;
+
+		while (rc == SQLITE_DONE &&
+		       TemperQueryNextSensor(q, sensor, &sensor))
+			rc = TemperQueryBoundsSensor(q, sensor, first, last);
+	}
+	if (rc != SQLITE_DONE)
+		return rc;
+
+	if (*first < query->from)
+		*first = query->from;
+	if (*last >= query->to)
+		*last = query->to - 1;
+	return *first <= *last ? SQLITE_OK : SQLITE_DONE;
+}
+
+
+
+const char *TemperQueryError(TemperQueryDb *q)
+{
+	return sqlite3_errmsg(q->db);
+}
@@ -0,0 +1,99 @@
+#ifndef TEMPER_QUERY_H
+#define TEMPER_QUERY_H
+
+/*
+ * Reading TEMPer history back out of the sensors table.
+ *
+ * Every range is answered per sensor through the (Id, timestamp_ns) index
+ * with statements prepared once per TemperQueryDb.  Rows are handed to the
+ * caller in batches out of a buffer owned by the TemperQueryDb, so no
+ * memory is allocated per row; copy what you want to keep.
+ *
+ * Downsampling averages the stored rows of each bucket.  Over a run the
+ * collector stored compressed (the compression table) it averages the
+ * readings rebuilt between them instead, weighted by time, as a sensor
+ * that sat still for an hour is a single row.  Nothing is ever written,
+ * the collector creates the index.
+ *
+ * A TemperQueryDb is one SQLite connection: use one per thread.  Each
+ * TemperQueryRun() reads from one snapshot of the database, with the
+ * collector's database in WAL mode that neither waits for nor holds up
+ * its inserts.
+ */
+
+#include <stdint.h>
+
+#include "reading.h"
+
+#define TEMPER_QUERY_INNER 0x1	/* inner_temp, value[0] */
+#define TEMPER_QUERY_OUTER 0x2	/* outer_temp, value[1] */
+#define TEMPER_QUERY_ALL   (TEMPER_QUERY_INNER | TEMPER_QUERY_OUTER)
+
+#if !defined TEMPER_QUERY_BUSY_TIMEOUT
+#define TEMPER_QUERY_BUSY_TIMEOUT 2000	/* ms to wait on a locked database */
+#endif
+
+#if !defined TEMPER_QUERY_BATCH
+#define TEMPER_QUERY_BATCH 256	/* rows per callback */
+#endif
+
+struct TemperQuery
+{
+	int64_t from;			/* ns, inclusive */
+	int64_t to;			/* ns, exclusive */
+	const int *sensors;		/* NULL for every sensor */
+	unsigned sensor_count;
+	unsigned channels;		/* TEMPER_QUERY_* mask, 0 means all */
+	unsigned points;		/* average down to this many rows per
+					   sensor, 0 returns raw rows */
+};
+typedef struct TemperQuery TemperQuery;
+
+// Receives rows in time order, sensor by sensor.  Channels not asked for
+// are NAN and unit is always TEMPER_UNAVAILABLE.  Return non zero to stop.
+typedef int (*TemperQueryFct)(void *arg, const TemperReading *rows,
+                              unsigned count);
+
+typedef struct TemperQueryDb TemperQueryDb;
+
+// Open a database written by temper.  Returns NULL and sets *rc to an
+// SQLite result code on failure.
+TemperQueryDb *TemperQueryOpen(const char *filename, int *rc);
+
+void TemperQueryClose(TemperQueryDb *q);
+
+// Run q and feed the result to fct.  Returns SQLITE_OK, also when fct
+// stopped early, or the SQLite error.
+int TemperQueryRun(TemperQueryDb *q, const TemperQuery *query,
+                   TemperQueryFct fct, void *arg);
+
+// Sensor numbers present in the database, up to max of them written to
+// sensors.  Returns how many there are, which may be more than max.
+int TemperQuerySensors(TemperQueryDb *q, int *sensors, unsigned max);
+
+// Earliest and latest timestamp, in ns, of query's sensors, clamped to its
+// range.  Returns SQLITE_OK, SQLITE_DONE when there are no rows, or the
+// SQLite error.
+int TemperQueryBounds(TemperQueryDb *q, const TemperQuery *query,
+                      int64_t *first, int64_t *last);
+
+struct TemperSketch;
+
+// Merge the stored quantile sketches (see sketch.h) of channel, 0 for
+// inner_temp and 1 for outer_temp, over query's sensors and range into
+// sketch.  Buckets count when their start is in [from, to), so the range
+// is rounded to the collector's sketch buckets, an hour by default.
+// points is ignored.  Returns SQLITE_OK or the SQLite error, e.g. when
+// the database has no sketches table.
+int TemperQuerySketch(TemperQueryDb *q, const TemperQuery *query,
+                      int channel, struct TemperSketch *sketch);
+
+// Answer raw queries from the rings of the collector's live file (see
+// live.h) for as far back as they go, and from the database before that.
+// live must stay open while q uses it, NULL detaches.
+struct TemperLive;
+void TemperQueryAttachLive(TemperQueryDb *q, const struct TemperLive *live);
+
+const char *TemperQueryError(TemperQueryDb *q);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef TEMPER_READING_H
+#define TEMPER_READING_H
+
+/*
+ * One row of sensor data as it travels from the USB read to the database.
+ */
+
+#include <stdint.h>
+
+#define TEMPER_CHANNELS 2	/* inner_temp / outer_temp columns */
+
+#if !defined TEMPER_MAX_DEVICES
+#define TEMPER_MAX_DEVICES 32	/* sensors tracked per collector */
+#endif
+
+struct TemperReading
+{
+	int64_t timestamp;		/* nanoseconds since the epoch */
+	int sensor;			/* device number, the Id column */
+	float value[TEMPER_CHANNELS];
+	unsigned char unit[TEMPER_CHANNELS];	/* enum Unit from comm.h */
+};
+typedef struct TemperReading TemperReading;
+
+#endif
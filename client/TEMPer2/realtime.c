@@ -0,0 +1,170 @@
+// CPU affinity is a GNU extension.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Low jitter sampling, see realtime.h.
+ */
+
+#include "realtime.h"
+#include "timestamp.h"
+
+#define JITTER_BASE 1e-3	/* ms, top of bucket 0 */
+
+
+
+int RealtimeSpec(Realtime *rt, const char *spec)
+{
+	char *end;
+
+	rt->priority = strtol(spec, &end, 10);
+	rt->cpu = -1;
+	rt->active = 0;
+	rt->raised = 0;
+	if (*end == ':')
+		rt->cpu = strtol(end + 1, &end, 10);
+
+	if (*end || end == spec || rt->cpu < -1 || rt->cpu >= CPU_SETSIZE ||
+	    rt->priority < sched_get_priority_min(SCHED_FIFO) ||
+	    rt->priority > sched_get_priority_max(SCHED_FIFO))
+		return -EINVAL;
+	return 0;
+}
+
+
+
+int RealtimeReserve(const Realtime *rt)
+{
+	cpu_set_t set;
+
+	if (rt->cpu < 0)
+		return 0;
+	if (sched_getaffinity(0, sizeof(set), &set) < 0)
+		return -errno;
+
+	// With one core there is nothing to keep the others off.
+	if (!CPU_ISSET(rt->cpu, &set) || CPU_COUNT(&set) < 2)
+		return -EINVAL;
+	CPU_CLR(rt->cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) < 0 ? -errno : 0;
+}
+
+
+
+// Touch the stack the loop will grow into, so it doesn't fault there.
+static void RealtimeFaultStack(void)
+{
+	volatile unsigned char stack[REALTIME_STACK];
+
+	for (size_t i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+
+
+int RealtimeEnter(Realtime *rt)
+{
+	int ret = 0;
+
+	if (rt->cpu >= 0)
+        {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(rt->cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) < 0)
+			ret = -errno;
+	}
+
+	// Pages are locked as they are first touched, so the thread stacks
+	// and heap nobody uses don't take memory.  The loop's own stack is
+	// touched now, its buffers during the first sweeps.
+	int locked = -1;
+#if defined MCL_ONFAULT
+	locked = mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT);
+#endif
+	if (locked < 0)
+		locked = mlockall(MCL_CURRENT | MCL_FUTURE);
+	if (locked < 0 && !ret)
+		ret = -errno;
+	RealtimeFaultStack();
+
+	rt->active = 1;
+	RealtimeRaise(rt, 1);
+	if (!rt->raised)
+        {
+		rt->active = 0;
+		if (!ret)
+			ret = -EPERM;
+	}
+
+	return ret;
+}
+
+
+
+// mlock() faults in writable private pages for writing, so even pages
+// never touched before are backed and locked when it returns.
+int RealtimeLock(const void *p, size_t size)
+{
+	return mlock(p, size) < 0 ? -errno : 0;
+}
+
+
+
+void RealtimeRaise(Realtime *rt, int raise)
+{
+	struct sched_param param = { 0 };
+
+	if (!rt->active || rt->raised == raise)
+		return;
+
+	param.sched_priority = raise ? rt->priority : 0;
+	if (!pthread_setschedparam(pthread_self(),
+	                           raise ? SCHED_FIFO : SCHED_OTHER, &param))
+		rt->raised = raise;
+}
+
+
+
+void JitterRecord(Jitter *j, int64_t ns)
+{
+	const double ms = ns > 0 ? (double)ns / TEMPER_NS_PER_MS : 0;
+	int i = 0;
+
+	if (ms > JITTER_BASE)
+		i = (int)ceil(4.0 * log2(ms / JITTER_BASE));
+	if (i >= JITTER_BUCKETS)
+		i = JITTER_BUCKETS - 1;
+
+	++j->bucket[i];
+	++j->count;
+	if (ns > 0)
+		j->total += ns;
+	if (ns > j->longest)
+		j->longest = ns;
+}
+
+
+
+double JitterQuantile(const Jitter *j, double q)
+{
+	const double wanted = q * j->count;
+	uint64_t seen = 0;
+
+	for (int i = 0; i < JITTER_BUCKETS; ++i)
+        {
+		seen += j->bucket[i];
+		if (seen && seen >= wanted)
+			return fmin(JITTER_BASE * exp2(i / 4.0),
+			            (double)j->longest / TEMPER_NS_PER_MS);
+	}
+	return 0;
+}
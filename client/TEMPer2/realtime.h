@@ -0,0 +1,77 @@
+#ifndef TEMPER_REALTIME_H
+#define TEMPER_REALTIME_H
+
+/*
+ * Low jitter sampling: the sampling loop under SCHED_FIFO, optionally on a
+ * core of its own, with its memory locked, and how late sweeps run.
+ *
+ * Only the sampling loop is raised.  It drops back to normal scheduling
+ * for the work between sweeps (device notes, hotplug rescans, checkpoints,
+ * backups) and is raised again before it sleeps, so it wakes on time and
+ * never starves the rest.  The pipeline, with SQLite in it, and the logger
+ * run on threads of their own at normal priority, kept off the reserved
+ * core.
+ *
+ * Memory is locked as it is touched (MCL_ONFAULT, Linux 4.4 and later),
+ * older kernels lock everything mapped, thread stacks included, which
+ * comes to several MB per thread.  Buffers the loop writes are faulted in
+ * up front with RealtimeLock().  All of it needs root or CAP_SYS_NICE and
+ * CAP_IPC_LOCK.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define REALTIME_STACK (256 * 1024)	/* bytes of stack to fault in */
+
+#if !defined JITTER_BUCKETS
+#define JITTER_BUCKETS 96		/* 1 us to 16 s, four per octave */
+#endif
+
+struct Realtime
+{
+	int priority;			/* SCHED_FIFO, 1 to 99 */
+	int cpu;			/* core for the loop, -1 for any */
+	int active;			/* RealtimeEnter() got SCHED_FIFO */
+	int raised;			/* and the loop runs under it now */
+};
+typedef struct Realtime Realtime;
+
+// How far behind schedule something happened.
+struct Jitter
+{
+	uint64_t count;
+	int64_t total;			/* ns */
+	int64_t longest;		/* ns */
+	uint64_t bucket[JITTER_BUCKETS];
+};
+typedef struct Jitter Jitter;
+
+// Parse "priority" or "priority:cpu".  Returns 0 or -EINVAL.
+int RealtimeSpec(Realtime *rt, const char *spec);
+
+// Keep the threads the calling thread starts from now on off rt's core.
+// Call before any are started.  Returns 0 or a negative errno.
+int RealtimeReserve(const Realtime *rt);
+
+// Pin the calling thread to rt's core, lock all memory, fault in its
+// stack and raise it.  Carries on past what fails and returns the first
+// negative errno, or 0.
+int RealtimeEnter(Realtime *rt);
+
+// Fault in and lock the size bytes at p, so the loop's first writes there
+// don't fault.  Returns 0 or a negative errno.
+int RealtimeLock(const void *p, size_t size);
+
+// Raise the calling thread to SCHED_FIFO, or drop it back to normal
+// scheduling.  Does nothing unless RealtimeEnter() raised it.
+void RealtimeRaise(Realtime *rt, int raise);
+
+// Count something that happened ns after it was due, early counts as 0.
+void JitterRecord(Jitter *j, int64_t ns);
+
+// Lateness in ms that a fraction q of the records stayed within, to the
+// top of its bucket.
+double JitterQuantile(const Jitter *j, double q);
+
+#endif
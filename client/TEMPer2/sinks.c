@@ -0,0 +1,532 @@
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Where the collector's pipeline can send readings, see sinks.h.
+ */
+
+#include "logger.h"
+#include "publish.h"
+#include "sinks.h"
+#include "timestamp.h"
+
+struct Sqlite
+{
+	sqlite3 *db;
+	sqlite3_stmt *begin;
+	sqlite3_stmt *insert;
+	sqlite3_stmt *commit;
+	sqlite3_stmt *rollback;
+	TemperReading *held;		/* rows waiting out a busy database */
+	unsigned held_count;
+	uint64_t lost;			/* rows the backlog had no room for */
+	int64_t stored[TEMPER_MAX_DEVICES];	/* ns, newest row stored */
+	int64_t skip[TEMPER_MAX_DEVICES];	/* ns, stored before a restart */
+	uint64_t skipped;		/* rows not stored again */
+};
+
+struct Binlog
+{
+	FILE *file;
+};
+
+struct Udp
+{
+	int fd;
+};
+
+
+
+// Keep rows the database was too busy to take, dropping the oldest when
+// the backlog is full.
+static void SqliteHold(struct Sqlite *s, const TemperReading *rows,
+                       unsigned count)
+{
+	if (!count)
+		return;
+	if (count > SINK_SQLITE_BACKLOG)
+        {
+		s->lost += count - SINK_SQLITE_BACKLOG;
+		rows += count - SINK_SQLITE_BACKLOG;
+		count = SINK_SQLITE_BACKLOG;
+	}
+	if (s->held_count + count > SINK_SQLITE_BACKLOG)
+        {
+		unsigned drop = s->held_count + count - SINK_SQLITE_BACKLOG;
+
+		memmove(s->held, s->held + drop,
+		        (s->held_count - drop) * sizeof(*s->held));
+		s->held_count -= drop;
+		s->lost += drop;
+	}
+	memcpy(s->held + s->held_count, rows, count * sizeof(*rows));
+	s->held_count += count;
+}
+
+
+
+static int SqliteInsert(struct Sqlite *s, const TemperReading *rows,
+                        unsigned count)
+{
+	int rc = SQLITE_DONE;
+
+	for (unsigned i = 0; i < count && rc == SQLITE_DONE; ++i)
+        {
+		const TemperReading *r = &rows[i];
+		const int known = r->sensor >= 0 &&
+		                  r->sensor < TEMPER_MAX_DEVICES;
+
+		// Rows a restored stage emits again after a crash.
+		if (known && r->timestamp <= s->skip[r->sensor])
+                {
+			++s->skipped;
+			continue;
+		}
+		if (known && r->timestamp > s->stored[r->sensor])
+			s->stored[r->sensor] = r->timestamp;
+
+		// timestamp stays in whole seconds for existing readers,
+		// timestamp_ns keeps the sub-second order of a sweep.
+		sqlite3_bind_int(s->insert, 1, r->sensor);
+		sqlite3_bind_int64(s->insert, 2, r->timestamp / TEMPER_NS_PER_SEC);
+		sqlite3_bind_double(s->insert, 3, r->value[0]);
+		sqlite3_bind_double(s->insert, 4, r->value[1]);
+		sqlite3_bind_int64(s->insert, 5, r->timestamp);
+
+		rc = sqlite3_step(s->insert);
+		sqlite3_reset(s->insert);
+	}
+	return rc;
+}
+
+
+
+// Insert the batch in one transaction, so it costs one journal sync
+// rather than one per row.  When another connection holds the database
+// past the busy timeout the rows wait in the backlog and go in with the
+// next batch, the sampling loop carries on.
+static int SqliteProcess(void *state, const TemperReading *rows,
+                         unsigned count, PipelineNode *out)
+{
+	struct Sqlite *s = state;
+	const uint64_t skipped = s->skipped;
+	int rc;
+
+	rc = sqlite3_step(s->begin);
+	sqlite3_reset(s->begin);
+	if (rc == SQLITE_DONE)
+		rc = SqliteInsert(s, s->held, s->held_count);
+	if (rc == SQLITE_DONE)
+		rc = SqliteInsert(s, rows, count);
+	if (rc == SQLITE_DONE)
+        {
+		rc = sqlite3_step(s->commit);
+		sqlite3_reset(s->commit);
+	}
+	if (rc != SQLITE_DONE)
+		goto failed;
+
+	if (s->held_count)
+		LogMessage(TEMPER_LOG_INFO, -1, "sqlite: %u held rows stored",
+		           s->held_count);
+	if (s->skipped != skipped)
+		LogMessage(TEMPER_LOG_INFO, -1, "sqlite: %llu rows already stored",
+		           (unsigned long long)(s->skipped - skipped));
+	for (unsigned i = 0; i < s->held_count; ++i)
+		LogStored(&s->held[i]);
+	for (unsigned i = 0; i < count; ++i)
+		LogStored(&rows[i]);
+	s->held_count = 0;
+	return 0;
+
+failed:
+	if (!sqlite3_get_autocommit(s->db))
+        {
+		sqlite3_step(s->rollback);
+		sqlite3_reset(s->rollback);
+	}
+	if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+        {
+		SqliteHold(s, rows, count);
+		LogMessage(TEMPER_LOG_WARN, -1, "sqlite busy, %u rows held",
+		           s->held_count);
+		return 0;
+	}
+	LogMessage(TEMPER_LOG_ERROR, -1, "SQL error: %s", sqlite3_errmsg(s->db));
+	return rc;
+}
+
+
+
+// Last chance for the backlog.
+static int SqliteFlush(void *state, PipelineNode *out)
+{
+	struct Sqlite *s = state;
+
+	if (s->held_count)
+		SqliteProcess(s, NULL, 0, out);
+	if (s->held_count || s->lost)
+		LogMessage(TEMPER_LOG_WARN, -1, "sqlite: %llu rows lost",
+		           (unsigned long long)(s->held_count + s->lost));
+	return 0;
+}
+
+
+
+// The checkpoint keeps when it was written, the newest row stored of every
+// sensor by then and the backlog, which is not flushed once saved.
+static int SqliteSave(void *state, FILE *f)
+{
+	const struct Sqlite *s = state;
+	const int64_t now = TemperClockNow();
+
+	if (fwrite(&now, sizeof(now), 1, f) != 1 ||
+	    fwrite(s->stored, sizeof(s->stored), 1, f) != 1 ||
+	    fwrite(&s->held_count, sizeof(s->held_count), 1, f) != 1 ||
+	    fwrite(s->held, sizeof(*s->held), s->held_count, f) !=
+	    s->held_count)
+		return errno ? -errno : -EIO;
+	return 0;
+}
+
+
+
+// What the stages held back when the checkpoint was written is older than
+// it, and may have been stored after it before the collector went down.
+// Those rows are skipped, up to the newest the database has of each
+// sensor but no later than the checkpoint.
+static int SqliteRestore(void *state, FILE *f)
+{
+	struct Sqlite *s = state;
+	sqlite3_stmt *newest;
+	int64_t saved;
+
+	if (fread(&saved, sizeof(saved), 1, f) != 1 ||
+	    fread(s->skip, sizeof(s->skip), 1, f) != 1 ||
+	    fread(&s->held_count, sizeof(s->held_count), 1, f) != 1 ||
+	    s->held_count > SINK_SQLITE_BACKLOG ||
+	    fread(s->held, sizeof(*s->held), s->held_count, f) !=
+	    s->held_count)
+        {
+		for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+			s->skip[i] = INT64_MIN;
+		s->held_count = 0;
+		return -EPROTO;
+	}
+
+	if (sqlite3_prepare_v2(s->db, "SELECT MAX(timestamp_ns) FROM sensors"
+	                       " WHERE Id = ?1;", -1, &newest, NULL) != SQLITE_OK)
+		return 0;
+	for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+        {
+		sqlite3_bind_int(newest, 1, i);
+		if (sqlite3_step(newest) == SQLITE_ROW &&
+		    sqlite3_column_type(newest, 0) != SQLITE_NULL)
+                {
+			int64_t t = sqlite3_column_int64(newest, 0);
+
+			if (t > saved)
+				t = saved;
+			if (t > s->skip[i])
+				s->skip[i] = t;
+		}
+		sqlite3_reset(newest);
+	}
+	sqlite3_finalize(newest);
+	return 0;
+}
+
+
+
+static void SqliteClose(void *state)
+{
+	struct Sqlite *s = state;
+
+	sqlite3_finalize(s->begin);
+	sqlite3_finalize(s->insert);
+	sqlite3_finalize(s->commit);
+	sqlite3_finalize(s->rollback);
+	free(s->held);
+	free(s);
+}
+
+
+
+static struct Sqlite *SqliteOpen(sqlite3 *db, int *err)
+{
+	struct Sqlite *s = calloc(1, sizeof(*s));
+
+	if (!s)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	s->db = db;
+	for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+		s->skip[i] = s->stored[i] = INT64_MIN;
+	if (!(s->held = malloc(SINK_SQLITE_BACKLOG * sizeof(*s->held))))
+        {
+		SqliteClose(s);
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	// IMMEDIATE takes the write lock up front, so a busy database shows
+	// at BEGIN and not halfway through the inserts.
+	if (sqlite3_prepare_v2(db, "BEGIN IMMEDIATE;", -1, &s->begin, NULL) ||
+	    sqlite3_prepare_v2(db, "INSERT INTO sensors(Id, timestamp,"
+	                       " inner_temp, outer_temp, timestamp_ns)"
+	                       " VALUES(?,?,?,?,?);", -1, &s->insert, NULL) ||
+	    sqlite3_prepare_v2(db, "COMMIT;", -1, &s->commit, NULL) ||
+	    sqlite3_prepare_v2(db, "ROLLBACK;", -1, &s->rollback, NULL))
+        {
+		LogMessage(TEMPER_LOG_ERROR, -1, "SQL error: %s",
+		           sqlite3_errmsg(db));
+		SqliteClose(s);
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	return s;
+}
+
+
+
+static int StdoutProcess(void *state, const TemperReading *rows,
+                         unsigned count, PipelineNode *out)
+{
+	for (unsigned i = 0; i < count; ++i)
+		printf("%d,%lld,%g,%g\n", rows[i].sensor,
+		       (long long)rows[i].timestamp, rows[i].value[0],
+		       rows[i].value[1]);
+
+	return fflush(stdout) ? -errno : 0;
+}
+
+
+
+static int BinlogProcess(void *state, const TemperReading *rows,
+                         unsigned count, PipelineNode *out)
+{
+	struct Binlog *b = state;
+
+	if (fwrite(rows, sizeof(*rows), count, b->file) != count ||
+	    fflush(b->file))
+		return -errno;
+	return 0;
+}
+
+
+
+static void BinlogClose(void *state)
+{
+	struct Binlog *b = state;
+
+	fclose(b->file);
+	free(b);
+}
+
+
+
+static struct Binlog *BinlogOpen(const char *path, int *err)
+{
+	struct Binlog *b = calloc(1, sizeof(*b));
+	const uint32_t size = sizeof(TemperReading);
+
+	if (!b || !(b->file = fopen(path, "ab")))
+        {
+		*err = b ? -errno : -ENOMEM;
+		free(b);
+		return NULL;
+	}
+
+	// A new file starts with what a reader needs to check the records.
+	if (ftell(b->file) == 0 &&
+	    (fwrite(SINK_BINLOG_MAGIC, 4, 1, b->file) != 1 ||
+	     fwrite(&size, sizeof(size), 1, b->file) != 1))
+        {
+		*err = -errno;
+		BinlogClose(b);
+		return NULL;
+	}
+
+	return b;
+}
+
+
+
+// Somebody not listening is not our problem, the loss is logged.
+static int UdpProcess(void *state, const TemperReading *rows, unsigned count,
+                      PipelineNode *out)
+{
+	struct Udp *u = state;
+
+	if (send(u->fd, rows, count * sizeof(*rows), MSG_DONTWAIT) < 0)
+		LogError(-1, -errno, "udp sink send failed");
+	return 0;
+}
+
+
+
+static void UdpClose(void *state)
+{
+	struct Udp *u = state;
+
+	close(u->fd);
+	free(u);
+}
+
+
+
+static int LiveProcess(void *state, const TemperReading *rows,
+                       unsigned count, PipelineNode *out)
+{
+	for (unsigned i = 0; i < count; ++i)
+		TemperLivePublish(state, &rows[i]);
+	return 0;
+}
+
+
+
+static struct Udp *UdpOpen(const char *address, int *err)
+{
+	struct addrinfo hints = { 0 }, *res, *ai;
+	char host[128];
+	const char *port = strrchr(address, ':');
+	struct Udp *u;
+
+	if (!port || port == address || (size_t)(port - address) >= sizeof(host))
+        {
+		*err = -EINVAL;
+		return NULL;
+	}
+	memcpy(host, address, port - address);
+	host[port - address] = '\0';
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port + 1, &hints, &res))
+        {
+		*err = -EHOSTUNREACH;
+		return NULL;
+	}
+
+	if (!(u = calloc(1, sizeof(*u))))
+        {
+		freeaddrinfo(res);
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	*err = -EHOSTUNREACH;
+	u->fd = -1;
+	for (ai = res; ai && u->fd < 0; ai = ai->ai_next)
+        {
+		u->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (u->fd >= 0 && connect(u->fd, ai->ai_addr, ai->ai_addrlen) < 0)
+                {
+			*err = -errno;
+			close(u->fd);
+			u->fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+
+	if (u->fd < 0)
+        {
+		free(u);
+		return NULL;
+	}
+
+	*err = 0;
+	return u;
+}
+
+
+
+static const PipelineOps SqliteOps = {
+	"sqlite", SqliteProcess, SqliteFlush, SqliteClose, SqliteSave,
+	SqliteRestore
+};
+
+static const PipelineOps StdoutOps = {
+	"stdout", StdoutProcess, NULL, NULL, NULL, NULL
+};
+
+static const PipelineOps BinlogOps = {
+	"binlog", BinlogProcess, NULL, BinlogClose, NULL, NULL
+};
+
+static const PipelineOps UdpOps = {
+	"udp", UdpProcess, NULL, UdpClose, NULL, NULL
+};
+
+static const PipelineOps LiveOps = {
+	"live", LiveProcess, NULL, NULL, NULL, NULL
+};
+
+
+
+int SinkAdd(Pipeline *p, const char *spec, sqlite3 *db)
+{
+	char name[256];
+	const PipelineOps *ops;
+	void *state = NULL;
+	int flags;
+	int ret = 0;
+
+	if (strlen(spec) >= sizeof(name))
+		return -EINVAL;
+	strcpy(name, spec);
+	flags = PipelineSpecFlags(name);
+
+	if (!strcmp(name, "sqlite"))
+        {
+		ops = &SqliteOps;
+		state = SqliteOpen(db, &ret);
+	}
+	else if (!strcmp(name, "stdout"))
+        {
+		ops = &StdoutOps;
+	}
+	else if (!strncmp(name, "binlog:", 7))
+        {
+		ops = &BinlogOps;
+		state = BinlogOpen(name + 7, &ret);
+	}
+	else if (!strncmp(name, "udp:", 4))
+        {
+		ops = &UdpOps;
+		state = UdpOpen(name + 4, &ret);
+	}
+	else if (!strncmp(name, "publish:", 8))
+        {
+		ops = &PublishOps;
+		state = PublishOpen(name + 8, &ret);
+	}
+	else
+        {
+		return -EINVAL;
+	}
+
+	if (ret < 0)
+		return ret;
+
+	ret = PipelineAdd(p, 1, ops, state, flags);
+	if (ret < 0 && ops->close)
+		ops->close(state);
+	return ret;
+}
+
+
+
+int SinkAddLive(Pipeline *p, TemperLive *live)
+{
+	return PipelineAdd(p, 1, &LiveOps, live, 0);
+}
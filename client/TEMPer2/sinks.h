@@ -0,0 +1,42 @@
+#ifndef TEMPER_SINKS_H
+#define TEMPER_SINKS_H
+
+/*
+ * Where the collector's pipeline can send readings, see pipeline.h.
+ *
+ *   sqlite                     the sensors table, one transaction per batch,
+ *                              rows wait in a backlog of SINK_SQLITE_BACKLOG
+ *                              while another connection keeps the database
+ *                              busy past its busy timeout
+ *   stdout                     CSV lines: sensor,timestamp_ns,inner,outer
+ *   binlog:path                raw TemperReading records appended to path,
+ *                              after a "TRDG" and record size header
+ *   udp:host:port              every batch as one datagram of raw
+ *                              TemperReading records, send errors ignored
+ *   publish:path               a stream to each subscriber on the Unix
+ *                              socket path, see publish.h
+ */
+
+#include <sqlite3.h>
+
+#include "live.h"
+#include "pipeline.h"
+
+#define SINK_BINLOG_MAGIC "TRDG"
+
+#if !defined SINK_SQLITE_BACKLOG
+#define SINK_SQLITE_BACKLOG 4096	/* rows held while the database is busy */
+#endif
+
+// Add the sink described by spec, "+" or "+drop" at the end runs it on its
+// own thread.  db is only used by the sqlite sink, which must be the only
+// user of db while the pipeline runs.  Returns 0 or a negative errno,
+// -EINVAL for a bad spec.
+int SinkAdd(Pipeline *p, const char *spec, sqlite3 *db);
+
+// Add a sink that publishes every row to live, see live.h, so its rings
+// hold what the other sinks store.  live stays the caller's and must
+// outlive the pipeline.  Returns 0 or a negative errno.
+int SinkAddLive(Pipeline *p, TemperLive *live);
+
+#endif
@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Mergeable quantile sketch, see sketch.h.
+ *
+ * Encoded layout, host byte order:
+ *
+ *   uint32 magic, uint32 version, uint64 zero, double min, double max,
+ *   then positive and negative store: int32 low, uint32 n, uint32 count[n]
+ */
+
+#include "sketch.h"
+
+#define TEMPER_SKETCH_MAGIC 0x4b534454	/* "TDSK" */
+#define TEMPER_SKETCH_VERSION 1
+
+#define TEMPER_SKETCH_GAMMA \
+	((1 + TEMPER_SKETCH_ALPHA) / (1 - TEMPER_SKETCH_ALPHA))
+
+
+
+static void TemperSketchStoreInit(struct TemperSketchStore *st)
+{
+	memset(st, 0, sizeof(*st));
+	st->low = 1;
+	st->high = 0;
+}
+
+
+
+void TemperSketchInit(TemperSketch *s)
+{
+	s->count = 0;
+	s->zero = 0;
+	s->min = INFINITY;
+	s->max = -INFINITY;
+	TemperSketchStoreInit(&s->positive);
+	TemperSketchStoreInit(&s->negative);
+}
+
+
+
+// Slide the window of bins to cover low..high, folding the lowest bins
+// into one if they don't fit.
+static void TemperSketchRebase(struct TemperSketchStore *st, int32_t low,
+                               int32_t high)
+{
+	uint64_t count[TEMPER_SKETCH_BINS] = { 0 };
+	int32_t base;
+
+	if (high - low + 1 > TEMPER_SKETCH_BINS)
+		base = high - TEMPER_SKETCH_BINS + 1;
+	else
+		base = low - (TEMPER_SKETCH_BINS - (high - low + 1)) / 2;
+
+	for (int32_t i = st->low; i <= st->high; ++i)
+		count[(i > base ? i : base) - base] += st->count[i - st->base];
+
+	memcpy(st->count, count, sizeof(count));
+	st->base = base;
+	if (st->low < base)
+		st->low = base;
+}
+
+
+
+static void TemperSketchStoreAdd(struct TemperSketchStore *st, int32_t i,
+                                 uint64_t n)
+{
+	if (st->low > st->high)
+        {
+		st->base = i - TEMPER_SKETCH_BINS / 2;
+		st->low = st->high = i;
+	}
+	else if (i < st->base || i >= st->base + TEMPER_SKETCH_BINS)
+        {
+		TemperSketchRebase(st, i < st->low ? i : st->low,
+		                   i > st->high ? i : st->high);
+	}
+
+	if (i < st->base)
+		i = st->base;
+	st->count[i - st->base] += n;
+	if (i < st->low)
+		st->low = i;
+	if (i > st->high)
+		st->high = i;
+}
+
+
+
+static int32_t TemperSketchIndex(double magnitude)
+{
+	return (int32_t)ceil(log(magnitude) / log(TEMPER_SKETCH_GAMMA));
+}
+
+
+
+// Middle of bin i, within alpha of everything in it.
+static double TemperSketchValue(int32_t i)
+{
+	return 2 * pow(TEMPER_SKETCH_GAMMA, i) / (TEMPER_SKETCH_GAMMA + 1);
+}
+
+
+
+void TemperSketchAdd(TemperSketch *s, double v)
+{
+	if (isnan(v))
+		return;
+
+	if (v > TEMPER_SKETCH_MIN)
+		TemperSketchStoreAdd(&s->positive, TemperSketchIndex(v), 1);
+	else if (v < -TEMPER_SKETCH_MIN)
+		TemperSketchStoreAdd(&s->negative, TemperSketchIndex(-v), 1);
+	else
+		++s->zero;
+
+	++s->count;
+	if (v < s->min)
+		s->min = v;
+	if (v > s->max)
+		s->max = v;
+}
+
+
+
+static void TemperSketchStoreMerge(struct TemperSketchStore *into,
+                                   const struct TemperSketchStore *from)
+{
+	// Widen once for the whole range rather than bin by bin.
+	if (from->low <= from->high && into->low <= into->high &&
+	    (from->low < into->base ||
+	     from->high >= into->base + TEMPER_SKETCH_BINS))
+		TemperSketchRebase(into,
+		                   from->low < into->low ? from->low : into->low,
+		                   from->high > into->high ? from->high
+		                                           : into->high);
+
+	for (int32_t i = from->low; i <= from->high; ++i)
+		if (from->count[i - from->base])
+			TemperSketchStoreAdd(into, i,
+			                     from->count[i - from->base]);
+}
+
+
+
+void TemperSketchMerge(TemperSketch *into, const TemperSketch *from)
+{
+	TemperSketchStoreMerge(&into->positive, &from->positive);
+	TemperSketchStoreMerge(&into->negative, &from->negative);
+	into->zero += from->zero;
+	into->count += from->count;
+	if (from->min < into->min)
+		into->min = from->min;
+	if (from->max > into->max)
+		into->max = from->max;
+}
+
+
+
+double TemperSketchQuantile(const TemperSketch *s, double q)
+{
+	const struct TemperSketchStore *neg = &s->negative, *pos = &s->positive;
+	double value;
+	uint64_t seen = 0;
+
+	if (!s->count || isnan(q))
+		return NAN;
+	if (q <= 0)
+		return s->min;
+	if (q >= 1)
+		return s->max;
+
+	// Walk up from the most negative bin to the one holding the rank.
+	const uint64_t rank = (uint64_t)(q * (s->count - 1));
+
+	for (int32_t i = neg->high; i >= neg->low; --i)
+		if ((seen += neg->count[i - neg->base]) > rank)
+                {
+			value = -TemperSketchValue(i);
+			goto found;
+		}
+	if ((seen += s->zero) > rank)
+        {
+		value = 0;
+		goto found;
+	}
+	for (int32_t i = pos->low; i <= pos->high; ++i)
+		if ((seen += pos->count[i - pos->base]) > rank)
+                {
+			value = TemperSketchValue(i);
+			goto found;
+		}
+	value = s->max;
+
+found:
+	return value < s->min ? s->min : value > s->max ? s->max : value;
+}
+
+
+
+static unsigned char *TemperSketchPut(unsigned char *p, const void *v,
+                                      size_t size)
+{
+	memcpy(p, v, size);
+	return p + size;
+}
+
+
+
+static unsigned char *TemperSketchStoreEncode(
+	const struct TemperSketchStore *st, unsigned char *p)
+{
+	const uint32_t n = st->low <= st->high ? st->high - st->low + 1 : 0;
+
+	p = TemperSketchPut(p, &st->low, 4);
+	p = TemperSketchPut(p, &n, 4);
+	for (uint32_t i = 0; i < n; ++i)
+        {
+		const uint64_t c = st->count[st->low - st->base + i];
+		const uint32_t c32 = c > UINT32_MAX ? UINT32_MAX : c;
+
+		p = TemperSketchPut(p, &c32, 4);
+	}
+	return p;
+}
+
+
+
+size_t TemperSketchEncode(const TemperSketch *s, void *buf)
+{
+	const uint32_t magic = TEMPER_SKETCH_MAGIC;
+	const uint32_t version = TEMPER_SKETCH_VERSION;
+	unsigned char *p = buf;
+
+	p = TemperSketchPut(p, &magic, 4);
+	p = TemperSketchPut(p, &version, 4);
+	p = TemperSketchPut(p, &s->zero, 8);
+	p = TemperSketchPut(p, &s->min, 8);
+	p = TemperSketchPut(p, &s->max, 8);
+	p = TemperSketchStoreEncode(&s->positive, p);
+	p = TemperSketchStoreEncode(&s->negative, p);
+	return p - (unsigned char *)buf;
+}
+
+
+
+// Read a store into st, which must be empty.  Returns the bytes used, 0
+// if they don't make one.
+static size_t TemperSketchStoreDecode(struct TemperSketchStore *st,
+                                      uint64_t *count,
+                                      const unsigned char *p, size_t size)
+{
+	int32_t low;
+	uint32_t n, c;
+
+	if (size < 8)
+		return 0;
+	memcpy(&low, p, 4);
+	memcpy(&n, p + 4, 4);
+	if (n > TEMPER_SKETCH_BINS || size - 8 < 4 * (size_t)n ||
+	    low < INT32_MIN / 2 || low > INT32_MAX / 2)
+		return 0;
+
+	for (uint32_t i = 0; i < n; ++i)
+        {
+		memcpy(&c, p + 8 + 4 * i, 4);
+		if (c)
+			TemperSketchStoreAdd(st, low + (int32_t)i, c);
+		*count += c;
+	}
+	return 8 + 4 * (size_t)n;
+}
+
+
+
+int TemperSketchDecode(TemperSketch *s, const void *buf, size_t size)
+{
+	const unsigned char *p = buf;
+	uint32_t magic, version;
+	TemperSketch t;
+	size_t used;
+
+	if (size < 32)
+		return -EINVAL;
+	memcpy(&magic, p, 4);
+	memcpy(&version, p + 4, 4);
+	if (magic != TEMPER_SKETCH_MAGIC || version != TEMPER_SKETCH_VERSION)
+		return -EINVAL;
+
+	TemperSketchInit(&t);
+	memcpy(&t.zero, p + 8, 8);
+	memcpy(&t.min, p + 16, 8);
+	memcpy(&t.max, p + 24, 8);
+	t.count = t.zero;
+	p += 32;
+	size -= 32;
+
+	if (!(used = TemperSketchStoreDecode(&t.positive, &t.count, p, size)))
+		return -EINVAL;
+	if (!TemperSketchStoreDecode(&t.negative, &t.count, p + used,
+	                             size - used))
+		return -EINVAL;
+
+	TemperSketchMerge(s, &t);
+	return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef TEMPER_SKETCH_H
+#define TEMPER_SKETCH_H
+
+/*
+ * Mergeable quantile sketch of a stream of readings (DDSketch).
+ *
+ * Values are counted in logarithmic bins, bin i holding magnitudes in
+ * (gamma^(i-1), gamma^i] with gamma = (1 + alpha) / (1 - alpha).  Any
+ * quantile comes back within a relative error of alpha of a value that is
+ * really at that rank, however many readings went in.  Sketches of
+ * different sensors or time buckets merge by adding their bins, so a
+ * month's p95 is the merge of its hourly sketches, never the raw rows.
+ *
+ * Memory is fixed: TEMPER_SKETCH_BINS bins each for positive and negative
+ * values, which with alpha 1% covers magnitudes up to 160 times apart,
+ * e.g. 0.25 to 40 degrees.  Past that the bins closest to zero are folded
+ * together, losing precision only there.  Magnitudes under
+ * TEMPER_SKETCH_MIN count as zero.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEMPER_SKETCH_ALPHA 0.01
+#define TEMPER_SKETCH_BINS 256
+#define TEMPER_SKETCH_MIN 1e-3
+
+// Largest TemperSketchEncode() result.
+#define TEMPER_SKETCH_MAX_SIZE (32 + 2 * (8 + 4 * TEMPER_SKETCH_BINS))
+
+struct TemperSketchStore
+{
+	int32_t base;			/* bin index of count[0] */
+	int32_t low, high;		/* bins in use, low > high if none */
+	uint64_t count[TEMPER_SKETCH_BINS];
+};
+
+struct TemperSketch
+{
+	uint64_t count;
+	uint64_t zero;
+	double min;
+	double max;
+	struct TemperSketchStore positive;
+	struct TemperSketchStore negative;	/* of -value */
+};
+typedef struct TemperSketch TemperSketch;
+
+void TemperSketchInit(TemperSketch *s);
+
+// Count v, NAN is ignored.
+void TemperSketchAdd(TemperSketch *s, double v);
+
+// Add everything counted in from to into.
+void TemperSketchMerge(TemperSketch *into, const TemperSketch *from);
+
+// Value at quantile q in [0, 1], NAN when the sketch is empty.
+double TemperSketchQuantile(const TemperSketch *s, double q);
+
+// Serialize s into buf, which needs at most TEMPER_SKETCH_MAX_SIZE bytes,
+// in host byte order.  Returns the size.
+size_t TemperSketchEncode(const TemperSketch *s, void *buf);
+
+// Merge an encoded sketch into s.  Returns 0 or -EINVAL if buf isn't one,
+// leaving s untouched.
+int TemperSketchDecode(TemperSketch *s, const void *buf, size_t size);
+
+#endif
@@ -0,0 +1,649 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The pipeline stages the collector knows, see stages.h.
+ */
+
+#include "logger.h"
+#include "sketch.h"
+#include "stages.h"
+#include "timestamp.h"
+
+struct Filter
+{
+	float low;
+	float high;
+};
+
+struct Calibrate
+{
+	int sensor;			/* -1 for every sensor */
+	int channel;
+	float scale;
+	float offset;
+};
+
+struct Compress
+{
+	CompressConfig config;
+	Compressor sensor[TEMPER_MAX_DEVICES];
+};
+
+struct Aggregate
+{
+	int64_t window;			/* ns */
+	struct
+	{
+		int64_t bucket;		/* timestamp / window, rounded down */
+		int64_t timestamps;	/* sum of offsets into the window */
+		double sum[TEMPER_CHANNELS];
+		unsigned values[TEMPER_CHANNELS];	/* summed, NANs aren't */
+		unsigned count;
+		TemperReading last;
+	} sensor[TEMPER_MAX_DEVICES];
+};
+
+
+struct Sketches
+{
+	sqlite3 *db;			/* own connection */
+	sqlite3_stmt *load;
+	sqlite3_stmt *save;
+	sqlite3_stmt *begin;
+	sqlite3_stmt *commit;
+	int in_transaction;
+	int64_t width;			/* ns per bucket */
+	int64_t saved;			/* ns, newest reading at the last save */
+	uint64_t lost;			/* saves that failed */
+	struct
+	{
+		int64_t bucket;		/* start in ns, INT64_MIN for none */
+		int dirty;
+		TemperSketch sketch;
+	} cell[TEMPER_MAX_DEVICES][TEMPER_CHANNELS];
+	unsigned char blob[TEMPER_SKETCH_MAX_SIZE];
+};
+
+
+
+// Bucket of width that t falls in, rounding down also before the epoch.
+static int64_t StageBucket(int64_t t, int64_t width)
+{
+	return t / width - (t % width < 0);
+}
+
+
+
+static int FilterProcess(void *state, const TemperReading *rows,
+                         unsigned count, PipelineNode *out)
+{
+	const struct Filter *f = state;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		TemperReading r = rows[i];
+		int keep = 0;
+
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                {
+			if (r.value[c] >= f->low && r.value[c] <= f->high)
+				keep = 1;
+			else
+				r.value[c] = NAN;
+		}
+		if (keep)
+			PipelineEmit(out, &r);
+	}
+	return 0;
+}
+
+
+
+static int CalibrateProcess(void *state, const TemperReading *rows,
+                            unsigned count, PipelineNode *out)
+{
+	const struct Calibrate *cal = state;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		TemperReading r = rows[i];
+
+		if (cal->sensor < 0 || cal->sensor == r.sensor)
+			r.value[cal->channel] = r.value[cal->channel] *
+			                        cal->scale + cal->offset;
+		PipelineEmit(out, &r);
+	}
+	return 0;
+}
+
+
+
+static int CompressProcess(void *state, const TemperReading *rows,
+                           unsigned count, PipelineNode *out)
+{
+	struct Compress *c = state;
+	TemperReading stored[2];
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		if (rows[i].sensor < 0 || rows[i].sensor >= TEMPER_MAX_DEVICES)
+                {
+			PipelineEmit(out, &rows[i]);
+			continue;
+		}
+
+		int n = CompressPush(&c->sensor[rows[i].sensor], &rows[i],
+		                     stored);
+		for (int k = 0; k < n; ++k)
+			PipelineEmit(out, &stored[k]);
+	}
+	return 0;
+}
+
+
+
+static int CompressStageFlush(void *state, PipelineNode *out)
+{
+	struct Compress *c = state;
+	TemperReading held;
+
+	for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+		if (CompressFlush(&c->sensor[i], &held))
+			PipelineEmit(out, &held);
+	return 0;
+}
+
+
+
+static int CompressSave(void *state, FILE *f)
+{
+	const struct Compress *c = state;
+
+	if (fwrite(&c->config, sizeof(c->config), 1, f) != 1 ||
+	    fwrite(c->sensor, sizeof(c->sensor), 1, f) != 1)
+		return errno ? -errno : -EIO;
+	return 0;
+}
+
+
+
+// Only carry on from state kept with the same settings.
+static int CompressRestore(void *state, FILE *f)
+{
+	struct Compress *c = state;
+	CompressConfig config;
+	Compressor sensor;
+
+	if (fread(&config, sizeof(config), 1, f) != 1)
+		return -EPROTO;
+	if (config.mode != c->config.mode ||
+	    config.deviation != c->config.deviation ||
+	    config.heartbeat != c->config.heartbeat)
+		return -ESTALE;
+
+	for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+        {
+		if (fread(&sensor, sizeof(sensor), 1, f) != 1)
+			return -EPROTO;
+		sensor.config = &c->config;
+		c->sensor[i] = sensor;
+	}
+	return 0;
+}
+
+
+
+// Emit the mean of a sensor's window, stamped with the mean time of the
+// readings in it.  A channel the filter left no number in stays NAN.
+static void AggregateEmit(struct Aggregate *a, int sensor, PipelineNode *out)
+{
+	TemperReading r = a->sensor[sensor].last;
+	const unsigned count = a->sensor[sensor].count;
+
+	if (!count)
+		return;
+
+	r.timestamp = a->sensor[sensor].bucket * a->window +
+	              a->sensor[sensor].timestamps / count;
+	for (int c = 0; c < TEMPER_CHANNELS; ++c)
+        {
+		const unsigned values = a->sensor[sensor].values[c];
+
+		r.value[c] = values ? a->sensor[sensor].sum[c] / values : NAN;
+		a->sensor[sensor].sum[c] = 0;
+		a->sensor[sensor].values[c] = 0;
+	}
+	a->sensor[sensor].timestamps = 0;
+	a->sensor[sensor].count = 0;
+	PipelineEmit(out, &r);
+}
+
+
+
+static int AggregateProcess(void *state, const TemperReading *rows,
+                            unsigned count, PipelineNode *out)
+{
+	struct Aggregate *a = state;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		const int s = rows[i].sensor;
+
+		if (s < 0 || s >= TEMPER_MAX_DEVICES)
+                {
+			PipelineEmit(out, &rows[i]);
+			continue;
+		}
+
+		const int64_t bucket = StageBucket(rows[i].timestamp,
+		                                   a->window);
+		if (bucket != a->sensor[s].bucket)
+                {
+			AggregateEmit(a, s, out);
+			a->sensor[s].bucket = bucket;
+		}
+
+		a->sensor[s].timestamps += rows[i].timestamp - bucket * a->window;
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                {
+			if (isnan(rows[i].value[c]))
+				continue;
+			a->sensor[s].sum[c] += rows[i].value[c];
+			++a->sensor[s].values[c];
+		}
+		a->sensor[s].last = rows[i];
+		++a->sensor[s].count;
+	}
+	return 0;
+}
+
+
+
+static int AggregateFlush(void *state, PipelineNode *out)
+{
+	for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+		AggregateEmit(state, i, out);
+	return 0;
+}
+
+
+
+// Store one sketch, inside a transaction that lasts until SketchesCommit().
+static void SketchesSave(struct Sketches *k, int sensor, int channel)
+{
+	TemperSketch *sketch = &k->cell[sensor][channel].sketch;
+	int rc = SQLITE_DONE;
+
+	if (!k->in_transaction)
+        {
+		rc = sqlite3_step(k->begin);
+		sqlite3_reset(k->begin);
+		k->in_transaction = rc == SQLITE_DONE;
+	}
+	if (rc == SQLITE_DONE)
+        {
+		sqlite3_bind_int(k->save, 1, sensor);
+		sqlite3_bind_int(k->save, 2, channel);
+		sqlite3_bind_int64(k->save, 3, k->cell[sensor][channel].bucket);
+		sqlite3_bind_int64(k->save, 4, k->width);
+		sqlite3_bind_int64(k->save, 5, sketch->count);
+		sqlite3_bind_blob(k->save, 6, k->blob,
+		                  TemperSketchEncode(sketch, k->blob),
+		                  SQLITE_STATIC);
+		rc = sqlite3_step(k->save);
+		sqlite3_reset(k->save);
+	}
+
+	if (rc != SQLITE_DONE)
+        {
+		++k->lost;
+		LogMessage(TEMPER_LOG_WARN, sensor, "sketch: %s",
+		           sqlite3_errmsg(k->db));
+	}
+	k->cell[sensor][channel].dirty = 0;
+}
+
+
+
+static void SketchesCommit(struct Sketches *k)
+{
+	if (!k->in_transaction)
+		return;
+
+	if (sqlite3_step(k->commit) != SQLITE_DONE)
+        {
+		++k->lost;
+		LogMessage(TEMPER_LOG_WARN, -1, "sketch: %s",
+		           sqlite3_errmsg(k->db));
+		sqlite3_exec(k->db, "ROLLBACK;", 0, 0, NULL);
+	}
+	sqlite3_reset(k->commit);
+	k->in_transaction = 0;
+}
+
+
+
+static void SketchesSaveAll(struct Sketches *k)
+{
+	for (int s = 0; s < TEMPER_MAX_DEVICES; ++s)
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+			if (k->cell[s][c].dirty)
+				SketchesSave(k, s, c);
+	SketchesCommit(k);
+}
+
+
+
+// Start a sketch on bucket, carrying on from what an earlier run stored.
+static void SketchesLoad(struct Sketches *k, int sensor, int channel,
+                         int64_t bucket)
+{
+	TemperSketch *sketch = &k->cell[sensor][channel].sketch;
+
+	TemperSketchInit(sketch);
+	k->cell[sensor][channel].bucket = bucket;
+
+	sqlite3_bind_int(k->load, 1, sensor);
+	sqlite3_bind_int(k->load, 2, channel);
+	sqlite3_bind_int64(k->load, 3, bucket);
+	if (sqlite3_step(k->load) == SQLITE_ROW)
+		TemperSketchDecode(sketch, sqlite3_column_blob(k->load, 0),
+		                   sqlite3_column_bytes(k->load, 0));
+	sqlite3_reset(k->load);
+}
+
+
+
+static int SketchesProcess(void *state, const TemperReading *rows,
+                           unsigned count, PipelineNode *out)
+{
+	struct Sketches *k = state;
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		const int s = rows[i].sensor;
+		const int64_t t = rows[i].timestamp;
+
+		PipelineEmit(out, &rows[i]);
+		if (s < 0 || s >= TEMPER_MAX_DEVICES)
+			continue;
+
+		const int64_t bucket = StageBucket(t, k->width) * k->width;
+
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+                {
+			if (k->cell[s][c].bucket != bucket)
+                        {
+				if (k->cell[s][c].dirty)
+					SketchesSave(k, s, c);
+				SketchesLoad(k, s, c, bucket);
+			}
+			TemperSketchAdd(&k->cell[s][c].sketch, rows[i].value[c]);
+			k->cell[s][c].dirty = 1;
+		}
+
+		if (k->saved == INT64_MIN)
+			k->saved = t;
+		if (t - k->saved >= STAGE_SKETCH_SAVE * TEMPER_NS_PER_SEC)
+                {
+			SketchesSaveAll(k);
+			k->saved = t;
+		}
+	}
+	SketchesCommit(k);
+	return 0;
+}
+
+
+
+static int SketchesFlush(void *state, PipelineNode *out)
+{
+	struct Sketches *k = state;
+
+	SketchesSaveAll(k);
+	if (k->lost)
+		LogMessage(TEMPER_LOG_WARN, -1, "sketch: %llu saves failed",
+		           (unsigned long long)k->lost);
+	return 0;
+}
+
+
+
+static void SketchesClose(void *state)
+{
+	struct Sketches *k = state;
+
+	sqlite3_finalize(k->load);
+	sqlite3_finalize(k->save);
+	sqlite3_finalize(k->begin);
+	sqlite3_finalize(k->commit);
+	sqlite3_close(k->db);
+	free(k);
+}
+
+
+
+static struct Sketches *SketchesOpen(sqlite3 *db, double seconds, int *err)
+{
+	struct Sketches *k = calloc(1, sizeof(*k));
+	const char *filename = sqlite3_db_filename(db, "main");
+
+	if (!k)
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+
+	k->width = (int64_t)(seconds * TEMPER_NS_PER_SEC);
+	k->saved = INT64_MIN;
+	for (int s = 0; s < TEMPER_MAX_DEVICES; ++s)
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+			k->cell[s][c].bucket = INT64_MIN;
+
+	// A connection of our own, so a save never lands inside a batch the
+	// sqlite sink has open on another thread.
+	if (!filename || !*filename ||
+	    sqlite3_open(filename, &k->db) != SQLITE_OK ||
+	    sqlite3_busy_timeout(k->db, STAGE_SKETCH_BUSY_TIMEOUT) != SQLITE_OK ||
+	    sqlite3_exec(k->db, "PRAGMA cache_size = 16;"
+	                 "CREATE TABLE IF NOT EXISTS sketches"
+	                 "(Id INT, channel INT, bucket INT, width INT,"
+	                 " count INT, sketch BLOB,"
+	                 " PRIMARY KEY (Id, channel, bucket)) WITHOUT ROWID;",
+	                 0, 0, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(k->db, "SELECT sketch FROM sketches"
+	                       " WHERE Id = ?1 AND channel = ?2 AND bucket = ?3;",
+	                       -1, &k->load, NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(k->db, "INSERT OR REPLACE INTO sketches"
+	                       " VALUES(?1, ?2, ?3, ?4, ?5, ?6);", -1, &k->save,
+	                       NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(k->db, "BEGIN IMMEDIATE;", -1, &k->begin,
+	                       NULL) != SQLITE_OK ||
+	    sqlite3_prepare_v2(k->db, "COMMIT;", -1, &k->commit,
+	                       NULL) != SQLITE_OK)
+        {
+		LogMessage(TEMPER_LOG_ERROR, -1, "sketch: %s",
+		           k->db ? sqlite3_errmsg(k->db) : "no database file");
+		SketchesClose(k);
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	return k;
+}
+
+
+
+static int AggregateSave(void *state, FILE *f)
+{
+	const struct Aggregate *a = state;
+
+	if (fwrite(a, sizeof(*a), 1, f) != 1)
+		return errno ? -errno : -EIO;
+	return 0;
+}
+
+
+
+static int AggregateRestore(void *state, FILE *f)
+{
+	struct Aggregate *a = state;
+	struct Aggregate *saved = malloc(sizeof(*saved));
+	int ret = 0;
+
+	if (!saved)
+		return -ENOMEM;
+	if (fread(saved, sizeof(*saved), 1, f) != 1)
+		ret = -EPROTO;
+	else if (saved->window != a->window)
+		ret = -ESTALE;
+	else
+		*a = *saved;
+	free(saved);
+	return ret;
+}
+
+
+
+// The sketches table is where sketches are kept, a checkpoint only makes
+// sure it is up to date.
+static int SketchesCheckpoint(void *state, FILE *f)
+{
+	SketchesSaveAll(state);
+	return 0;
+}
+
+
+
+static const PipelineOps FilterOps = {
+	"filter", FilterProcess, NULL, free, NULL, NULL
+};
+
+static const PipelineOps CalibrateOps = {
+	"calibrate", CalibrateProcess, NULL, free, NULL, NULL
+};
+
+static const PipelineOps CompressOps = {
+	"compress", CompressProcess, CompressStageFlush, free,
+	CompressSave, CompressRestore
+};
+
+static const PipelineOps AggregateOps = {
+	"aggregate", AggregateProcess, AggregateFlush, free,
+	AggregateSave, AggregateRestore
+};
+
+static const PipelineOps SketchesOps = {
+	"sketch", SketchesProcess, SketchesFlush, SketchesClose,
+	SketchesCheckpoint, NULL
+};
+
+
+
+int StageAdd(Pipeline *p, const char *spec, const CompressConfig *compression,
+             Derive **derive, sqlite3 *db)
+{
+	char name[128];
+	const PipelineOps *ops = NULL;
+	void *state = NULL;
+	char extra;
+	int flags;
+	int ret = -ENOMEM;
+
+	if (strlen(spec) >= sizeof(name))
+		return -EINVAL;
+	strcpy(name, spec);
+	flags = PipelineSpecFlags(name);
+
+	if (!strncmp(name, "filter:", 7))
+        {
+		struct Filter *f = calloc(1, sizeof(*f));
+
+		if (f && sscanf(name, "filter:%f:%f%c", &f->low, &f->high,
+		                &extra) != 2)
+                {
+			free(f);
+			return -EINVAL;
+		}
+		ops = &FilterOps;
+		state = f;
+	}
+	else if (!strncmp(name, "calibrate:", 10))
+        {
+		struct Calibrate *cal = calloc(1, sizeof(*cal));
+
+		if (cal && (sscanf(name, "calibrate:%d:%d:%f:%f%c",
+		                   &cal->sensor, &cal->channel, &cal->scale,
+		                   &cal->offset, &extra) != 4 ||
+		            cal->channel < 0 || cal->channel >= TEMPER_CHANNELS))
+                {
+			free(cal);
+			return -EINVAL;
+		}
+		ops = &CalibrateOps;
+		state = cal;
+	}
+	else if (!strcmp(name, "compress"))
+        {
+		struct Compress *c = calloc(1, sizeof(*c));
+
+		if (c)
+                {
+			c->config = *compression;
+			for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+				CompressInit(&c->sensor[i], &c->config);
+		}
+		ops = &CompressOps;
+		state = c;
+	}
+	else if (!strncmp(name, "aggregate:", 10))
+        {
+		struct Aggregate *a = calloc(1, sizeof(*a));
+		double seconds;
+
+		if (a && (sscanf(name, "aggregate:%lf%c", &seconds,
+		                 &extra) != 1 || seconds <= 0))
+                {
+			free(a);
+			return -EINVAL;
+		}
+		if (a)
+			a->window = (int64_t)(seconds * TEMPER_NS_PER_SEC);
+		ops = &AggregateOps;
+		state = a;
+	}
+	else if (!strcmp(name, "sketch") || !strncmp(name, "sketch:", 7))
+        {
+		double seconds = 3600;
+
+		if (name[6] && (sscanf(name, "sketch:%lf%c", &seconds,
+		                       &extra) != 1 || seconds < 1))
+			return -EINVAL;
+		ops = &SketchesOps;
+		state = SketchesOpen(db, seconds, &ret);
+	}
+	else if (!strcmp(name, "derive"))
+        {
+		if (!*derive)
+			return -EINVAL;
+		ops = &DeriveOps;
+		state = *derive;
+		*derive = NULL;
+	}
+	else
+        {
+		return -EINVAL;
+	}
+
+	if (!state)
+		return ret;
+
+	ret = PipelineAdd(p, 0, ops, state, flags);
+	if (ret < 0)
+		ops->close(state);
+	return ret;
+}
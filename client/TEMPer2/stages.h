@@ -0,0 +1,47 @@
+#ifndef TEMPER_STAGES_H
+#define TEMPER_STAGES_H
+
+/*
+ * The pipeline stages the collector knows, see pipeline.h.
+ *
+ *   filter:low:high            channels outside [low, high] or not a
+ *                              number become NAN, readings left with
+ *                              none are dropped
+ *   calibrate:sensor:channel:scale:offset
+ *                              value * scale + offset, sensor -1 for all
+ *   compress                   the -c/-e/-b compression, see compress.h
+ *   aggregate:seconds          one mean row per sensor and window, NAN
+ *                              channels left out of the mean
+ *   sketch[:seconds]           passes rows on unchanged and keeps a quantile
+ *                              sketch per sensor, channel and bucket of
+ *                              seconds (an hour by default) in the
+ *                              sketches table, see sketch.h
+ *   derive                     passes rows on and adds the -D derived
+ *                              sensors, see derive.h
+ *
+ * Readings of sensors past TEMPER_MAX_DEVICES, derived ones among them,
+ * pass compress, aggregate and sketch untouched.
+ */
+
+#include <sqlite3.h>
+
+#include "compress.h"
+#include "derive.h"
+#include "pipeline.h"
+
+#if !defined STAGE_SKETCH_SAVE
+#define STAGE_SKETCH_SAVE 60	/* seconds of readings between sketch saves */
+#endif
+
+#if !defined STAGE_SKETCH_BUSY_TIMEOUT
+#define STAGE_SKETCH_BUSY_TIMEOUT 250	/* ms a save waits on the database */
+#endif
+
+// Add the stage described by spec, "+" or "+drop" at the end runs it on
+// its own thread.  The sketch stage writes through its own connection to
+// db's file, the derive stage takes *derive over and clears it.  Returns 0
+// or a negative errno, -EINVAL for a bad spec.
+int StageAdd(Pipeline *p, const char *spec, const CompressConfig *compression,
+             Derive **derive, sqlite3 *db);
+
+#endif
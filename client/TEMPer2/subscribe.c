@@ -0,0 +1,278 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Readings as the collector takes them, see subscribe.h.
+ */
+
+#include "subscribe.h"
+
+#define TEMPER_SUB_HELLO_TIMEOUT 2000	/* ms for the collector to answer */
+
+static const char *const TemperSubFormats[] = { "binary", "json" };
+static const char *const TemperSubChannels[] = { "inner", "outer" };
+
+struct TemperSub
+{
+	int fd;
+	int format;
+	size_t start;			/* first byte not handed out yet */
+	size_t length;			/* bytes in buffer */
+	char buffer[4096];
+};
+
+
+
+int TemperSubRequest(const TemperSubscription *s, char *buf, size_t size)
+{
+	size_t at;
+
+	if (s->format < TEMPER_SUB_BINARY || s->format > TEMPER_SUB_JSON)
+		return -EINVAL;
+	at = snprintf(buf, size, "%s ", TemperSubFormats[s->format]);
+
+	if (!s->sensors)
+		at += snprintf(buf + at, at < size ? size - at : 0, "*");
+	for (unsigned i = 0; s->sensors && i < s->sensor_count; ++i)
+		at += snprintf(buf + at, at < size ? size - at : 0, "%s%d",
+		               i ? "," : "", s->sensors[i]);
+
+	if (!s->channels || s->channels == TEMPER_QUERY_ALL)
+		at += snprintf(buf + at, at < size ? size - at : 0, " *");
+	else
+		at += snprintf(buf + at, at < size ? size - at : 0, " %s",
+		               TemperSubChannels[s->channels ==
+		                                 TEMPER_QUERY_OUTER]);
+
+	at += snprintf(buf + at, at < size ? size - at : 0, "\n");
+	return at < size ? (int)at : -EINVAL;
+}
+
+
+
+int TemperSubParse(const char *line, TemperSubscription *s, int *sensors)
+{
+	char format[16], list[TEMPER_SUB_REQUEST_MAX], channels[32];
+	char *item, *save;
+
+	memset(s, 0, sizeof(*s));
+	if (strlen(line) >= TEMPER_SUB_REQUEST_MAX ||
+	    sscanf(line, "%15s %255s %31s", format, list, channels) != 3)
+		return -EINVAL;
+
+	s->format = -1;
+	for (int i = 0; i <= TEMPER_SUB_JSON; ++i)
+		if (!strcmp(format, TemperSubFormats[i]))
+			s->format = i;
+	if (s->format < 0)
+		return -EINVAL;
+
+	if (strcmp(list, "*"))
+        {
+		for (item = strtok_r(list, ",", &save); item;
+		     item = strtok_r(NULL, ",", &save))
+                {
+			char *end;
+			long sensor = strtol(item, &end, 10);
+
+			if (*end || sensor < 0 ||
+			    s->sensor_count == TEMPER_SUB_SENSORS)
+				return -EINVAL;
+			sensors[s->sensor_count++] = sensor;
+		}
+		s->sensors = sensors;
+	}
+
+	if (strcmp(channels, "*"))
+        {
+		for (item = strtok_r(channels, ",", &save); item;
+		     item = strtok_r(NULL, ",", &save))
+                {
+			if (!strcmp(item, "inner"))
+				s->channels |= TEMPER_QUERY_INNER;
+			else if (!strcmp(item, "outer"))
+				s->channels |= TEMPER_QUERY_OUTER;
+			else
+				return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+
+
+// Wait up to timeout ms for more bytes.  Returns how many came, 0 after
+// the timeout or a negative errno, -EPIPE at the end of the stream.
+static int TemperSubFill(TemperSub *sub, int timeout)
+{
+	struct pollfd p = { sub->fd, POLLIN, 0 };
+	ssize_t got;
+	int ret;
+
+	if (sub->start)
+        {
+		sub->length -= sub->start;
+		memmove(sub->buffer, sub->buffer + sub->start, sub->length);
+		sub->start = 0;
+	}
+	if (sub->length == sizeof(sub->buffer))
+		return -EPROTO;
+
+	while ((ret = poll(&p, 1, timeout)) < 0 && errno == EINTR)
+		;
+	if (ret <= 0)
+		return ret < 0 ? -errno : 0;
+
+	got = recv(sub->fd, sub->buffer + sub->length,
+	           sizeof(sub->buffer) - sub->length, 0);
+	if (got < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : -errno;
+	if (got == 0)
+		return -EPIPE;
+
+	sub->length += got;
+	return got;
+}
+
+
+
+TemperSub *TemperSubOpen(const char *path, const TemperSubscription *s,
+                         int *err)
+{
+	struct sockaddr_un addr = { 0 };
+	char request[TEMPER_SUB_REQUEST_MAX];
+	TemperSub *sub;
+	int length = TemperSubRequest(s, request, sizeof(request));
+
+	if (length < 0 || strlen(path) >= sizeof(addr.sun_path))
+        {
+		*err = -EINVAL;
+		return NULL;
+	}
+	if (!(sub = calloc(1, sizeof(*sub))))
+        {
+		*err = -ENOMEM;
+		return NULL;
+	}
+	sub->format = s->format;
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	sub->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sub->fd < 0 ||
+	    connect(sub->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    send(sub->fd, request, length, MSG_NOSIGNAL) != length)
+        {
+		*err = -errno;
+		TemperSubClose(sub);
+		return NULL;
+	}
+
+	// Binary streams start with the magic, version and record size.
+	while (sub->format == TEMPER_SUB_BINARY && sub->length < 12)
+        {
+		*err = TemperSubFill(sub, TEMPER_SUB_HELLO_TIMEOUT);
+		if (*err <= 0)
+                {
+			*err = *err ? *err : -ETIMEDOUT;
+			TemperSubClose(sub);
+			return NULL;
+		}
+	}
+	if (sub->format == TEMPER_SUB_BINARY)
+        {
+		uint32_t version, size;
+
+		memcpy(&version, sub->buffer + 4, sizeof(version));
+		memcpy(&size, sub->buffer + 8, sizeof(size));
+		if (memcmp(sub->buffer, TEMPER_SUB_MAGIC, 4) ||
+		    version != TEMPER_SUB_VERSION ||
+		    size != sizeof(TemperReading))
+                {
+			*err = -EPROTO;
+			TemperSubClose(sub);
+			return NULL;
+		}
+		sub->start = 12;
+	}
+
+	*err = 0;
+	return sub;
+}
+
+
+
+int TemperSubFd(const TemperSub *sub)
+{
+	return sub->fd;
+}
+
+
+
+int TemperSubRead(TemperSub *sub, TemperReading *rows, unsigned max,
+                  int timeout)
+{
+	const size_t record = sizeof(TemperReading);
+	int ret;
+
+	if (sub->format != TEMPER_SUB_BINARY)
+		return -EINVAL;
+
+	while (sub->length - sub->start < record)
+        {
+		if ((ret = TemperSubFill(sub, timeout)) <= 0)
+			return ret;
+	}
+
+	unsigned count = (sub->length - sub->start) / record;
+	if (count > max)
+		count = max;
+	memcpy(rows, sub->buffer + sub->start, count * record);
+	sub->start += count * record;
+	return count;
+}
+
+
+
+const char *TemperSubReadLine(TemperSub *sub, int timeout, int *err)
+{
+	char *line, *end;
+
+	if (sub->format != TEMPER_SUB_JSON)
+        {
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	while (!(end = memchr(sub->buffer + sub->start, '\n',
+	                      sub->length - sub->start)))
+        {
+		if ((*err = TemperSubFill(sub, timeout)) <= 0)
+			return NULL;
+	}
+
+	line = sub->buffer + sub->start;
+	*end = '\0';
+	sub->start = end + 1 - sub->buffer;
+	*err = 0;
+	return line;
+}
+
+
+
+void TemperSubClose(TemperSub *sub)
+{
+	if (sub)
+        {
+		if (sub->fd >= 0)
+			close(sub->fd);
+		free(sub);
+	}
+}
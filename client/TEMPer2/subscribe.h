@@ -0,0 +1,83 @@
+#ifndef TEMPER_SUBSCRIBE_H
+#define TEMPER_SUBSCRIBE_H
+
+/*
+ * Readings as the collector takes them, from its publish sink.
+ *
+ * A subscriber connects to the collector's Unix socket and sends one line
+ * naming a format, the sensors and the channels it wants:
+ *
+ *     binary 0,3 inner
+ *     json * *
+ *
+ * A binary subscription then gets "TSUB", a version and the record size,
+ * all uint32 but the magic, followed by TemperReading records in the
+ * collector's byte order.  A JSON one gets lines like
+ *
+ *     {"ts":1700000000000000000,"sensor":3,"values":[21.5,null]}
+ *
+ * Channels not asked for are NAN, or null as is any value that isn't
+ * finite in JSON, and units are not sent.
+ * Readings come after every sweep.  A subscriber that doesn't keep up
+ * loses its oldest readings and is told how many with a record of sensor
+ * TEMPER_SUB_DROPPED and the count as timestamp, or {"dropped":count}.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "query.h"
+#include "reading.h"
+
+#define TEMPER_SUB_MAGIC "TSUB"
+#define TEMPER_SUB_VERSION 1
+#define TEMPER_SUB_DROPPED -1		/* sensor of a drop notice */
+#define TEMPER_SUB_REQUEST_MAX 256	/* bytes, the request line */
+#define TEMPER_SUB_SENSORS 64		/* sensors one request may name */
+
+enum TemperSubFormat
+{
+	TEMPER_SUB_BINARY,
+	TEMPER_SUB_JSON,
+};
+
+struct TemperSubscription
+{
+	int format;			/* enum TemperSubFormat */
+	const int *sensors;		/* NULL for every sensor */
+	unsigned sensor_count;
+	unsigned channels;		/* TEMPER_QUERY_* mask, 0 means all */
+};
+typedef struct TemperSubscription TemperSubscription;
+
+typedef struct TemperSub TemperSub;
+
+// Write the request line for s into buf.  Returns its length or -EINVAL
+// when it doesn't fit.
+int TemperSubRequest(const TemperSubscription *s, char *buf, size_t size);
+
+// Parse a request line, without the newline, into s and sensors, which
+// must have room for TEMPER_SUB_SENSORS.  Returns 0 or -EINVAL.
+int TemperSubParse(const char *line, TemperSubscription *s, int *sensors);
+
+// Subscribe at the collector's socket path.  Returns NULL and sets *err on
+// failure, -EPROTO when the collector doesn't speak this version.
+TemperSub *TemperSubOpen(const char *path, const TemperSubscription *s,
+                         int *err);
+
+// For poll() alongside other descriptors.
+int TemperSubFd(const TemperSub *sub);
+
+// Binary subscriptions: wait up to timeout ms, -1 for ever, for readings
+// and copy up to max of them into rows.  Returns how many, 0 after the
+// timeout, -EPIPE once the collector has gone, or a negative errno.
+int TemperSubRead(TemperSub *sub, TemperReading *rows, unsigned max,
+                  int timeout);
+
+// JSON subscriptions: the next line, without its newline, valid until the
+// next call.  NULL sets *err like TemperSubRead() would return it.
+const char *TemperSubReadLine(TemperSub *sub, int timeout, int *err);
+
+void TemperSubClose(TemperSub *sub);
+
+#endif
@@ -3,6 +3,8 @@
 #include <errno.h>
 #include <sqlite3.h>
 #include <time.h>
+#include <signal.h>
+#include <string.h>
 
 /*
  * Temper.c by Robert Kavaler (c) 2009 (relavak.com)
@@ -36,21 +38,129 @@
  * 
  */
 
+#include "alloc.h"
+#include "backup.h"
+#include "checkpoint.h"
 #include "comm.h"
+#include "compress.h"
+#include "derive.h"
+#include "health.h"
+#include "hotplug.h"
+#include "latency.h"
+#include "live.h"
+#include "logger.h"
+#include "pipeline.h"
+#include "predict.h"
+#include "realtime.h"
+#include "sinks.h"
+#include "stages.h"
+#include "timestamp.h"
 
 #if !defined TEMPER_TIMEOUT
 #define TEMPER_TIMEOUT 1000	/* milliseconds */
 #endif
 
+#if !defined TEMPER_BUSY_TIMEOUT
+#define TEMPER_BUSY_TIMEOUT 250	/* ms to wait on another connection */
+#endif
+
 #if !defined TEMPER_DEBUG
 #define TEMPER_DEBUG 0
 #endif
 
+#if PIPELINE_BATCH < TEMPER_MAX_DEVICES
+#error "A sweep must fit in one PIPELINE_BATCH"
+#endif
+
+
 
 
+int store_compression(sqlite3 *db, const CompressConfig *config, int64_t since,
+                      char **err_msg);
 
-char * create_timestamp_human_readable();
-int create_timestamp();
+// Everything the collector keeps per device.
+struct Sensor
+{
+     Temper *t;                  // Kept open from sweep to sweep.
+     PredictModel model;         // Per sensor forecasts.
+     DeviceHealth health;        // Per sensor circuit breaker.
+     DeviceLatency latency;      // Per sensor USB timeouts.
+     char serial[80];            // Read each time the device is opened.
+     const char *product;        // Its product name, set with the serial.
+     char restored[80];          // Serial the state is from, until opened.
+     int plugged;                // Present at the last scan.
+};
+typedef struct Sensor Sensor;
+
+int store_identity(sqlite3 *db, int id, const char *serial,
+                   const char *product);
+int has_column(sqlite3 *db, const char *table, const char *column);
+int store_device(sqlite3 *db, int device, const Sensor *s);
+
+// Records of the checkpoint, see checkpoint.h.
+enum { SAVED_SCHEDULE = 1, SAVED_SENSOR, SAVED_PIPELINE };
+
+struct SavedSchedule
+{
+     int64_t sweep_time;         // When the last sweep started.
+     int64_t interval;
+};
+
+struct SavedSensor
+{
+     int32_t device;
+     char serial[80];
+     PredictModel model;         // Raised alerts stay raised.
+     DeviceHealth health;        // A dead device stays skipped.
+     DeviceLatency latency;      // And the timeouts stay learned.
+};
+
+// What restore_record() found, and the configs to point it at.
+struct Restored
+{
+     const PredictConfig *prediction;
+     const HealthConfig *health;
+     const LatencyConfig *latency;
+     struct SavedSchedule schedule;
+     int sensors;
+     int stages;
+};
+
+// Sweep durations, to compare sequential and pipelined sweeps.
+struct SweepStats
+{
+     uint64_t count;
+     int64_t total;              // ns
+     int64_t longest;            // ns
+     uint64_t steady;            // Sweeps that opened no device.
+     uint64_t allocations;       // Heap allocations in those after warm-up.
+     Jitter wake;                // Sweep starts after their slot.
+     Jitter read;                // Readings after their sweep's slot.
+};
+
+int start_read(TemperContext *ctx, int device, Sensor *s);
+int finish_read(int device, Sensor *s, TemperReading *reading);
+void report_prediction(const TemperReading *r, const PredictResult *result);
+void report_health(int sensor, const DeviceHealth *h, const DeviceLatency *l);
+void report_status(const struct SweepStats *sweeps);
+void sweep_record(struct SweepStats *sweeps, int64_t ns, int opened,
+                  uint64_t allocations);
+void close_device(Sensor *s);
+void identify_device(int device, Sensor *s);
+void update_devices(TemperContext *ctx);
+int save_checkpoint(const char *path, int64_t sweep_time, int64_t interval);
+int restore_record(void *arg, uint32_t tag, const void *data, uint32_t size);
+uint64_t stored_rows(const Pipeline *p);
+int read_with_retry(Temper *t, TemperData *data, unsigned count,
+                    DeviceLatency *l, int64_t *answered);
+void request_status(int signum);
+void request_stop(int signum);
+
+static volatile sig_atomic_t status_requested = 0; // Set by SIGUSR1.
+static volatile sig_atomic_t stop_requested = 0;   // Set by SIGTERM, SIGINT.
+static Sensor sensors[TEMPER_MAX_DEVICES];
+static TemperLive *live = NULL; // Latest readings for other processes.
+static Pipeline pipeline;       // Where the readings go after a sweep.
 
 
 
@@ -60,40 +170,252 @@ int main(int argc, char *argv[])
    // This is a proof of concept of creating a sqlite3 database table in C code 
    //   and updating the table with individual sensor data.
    //***************************************************************************
-    if ( argc < 3 )
+    CompressConfig compression = { COMPRESS_NONE, 0.0, 0 };
+    PredictConfig prediction = PREDICT_CONFIG_DEFAULT;
+    HealthConfig health_config = HEALTH_CONFIG_DEFAULT;
+    LatencyConfig latency_config = LATENCY_CONFIG_DEFAULT;
+    latency_config.ceiling = TEMPER_TIMEOUT;
+    int64_t interval = 0;               // Time between sweeps in ns.
+    int pipelined = 0;                  // Command every device, then read.
+    int log_level = TEMPER_LOG_INFO;
+    int log_format = LOG_FORMAT_TEXT;
+    const char *live_path = NULL;       // Where to share the latest readings.
+    unsigned live_depth = TEMPER_LIVE_DEPTH; // Recent readings per sensor.
+    const char *backup_spec = NULL;     // -B path[:seconds].
+    const char *checkpoint_spec = NULL; // -k path[:seconds].
+    const char *events_path = NULL;     // Simulated hotplug events.
+    const char *realtime_spec = NULL;   // -r priority[:cpu].
+    const char *stage_specs[PIPELINE_MAX_NODES]; // -s, in order.
+    const char *sink_specs[PIPELINE_MAX_NODES];  // -S, in order.
+    const char *derived_specs[DERIVE_MAX];       // -D, in order.
+    int derived_count = 0;
+    int stage_count = 0;
+    int sink_count = 0;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "c:e:b:v:f:T:U:H:i:m:M:pL:R:B:k:E:r:s:S:D:")) != -1 )
     {
-         printf ("%s\n","Usage: temper <db_filename> <hours>");
+         switch (opt)
+         {
+         case 'c': // Compression mode.
+              if ( CompressModeFromString(optarg) < 0 )
+              {
+                   fprintf(stderr, "Unknown compression: %s\n", optarg);
+                   return 1;
+              }
+              compression.mode = CompressModeFromString(optarg);
+              break;
+         case 'e': // Compression error bound.
+              compression.deviation = atof(optarg);
+              break;
+         case 'b': // Heartbeat row interval in seconds.
+              compression.heartbeat = atol(optarg);
+              break;
+         case 'T': // Temperature limit to forecast.
+              prediction.temp_limit = atof(optarg);
+              break;
+         case 'U': // Humidity limit to forecast.
+              prediction.humidity_limit = atof(optarg);
+              break;
+         case 'H': // Warning horizon in seconds.
+              prediction.horizon = atof(optarg);
+              break;
+         case 'i': // Seconds between the start of each sweep.
+              interval = (int64_t)(atof(optarg) * TEMPER_NS_PER_SEC);
+              break;
+         case 'm': // Floor of the learned USB timeouts in ms.
+              latency_config.floor = atoi(optarg);
+              break;
+         case 'M': // Ceiling of the learned USB timeouts in ms.
+              latency_config.ceiling = atoi(optarg);
+              break;
+         case 'p': // Pipelined sweeps.
+              pipelined = 1;
+              break;
+         case 'L': // Shared file of the latest readings.
+              live_path = optarg;
+              break;
+         case 'R': // Readings kept per sensor in the live file.
+              live_depth = atoi(optarg);
+              break;
+         case 'B': // Online backup file and period.
+              backup_spec = optarg;
+              break;
+         case 'k': // Checkpoint file and period.
+              checkpoint_spec = optarg;
+              break;
+         case 'E': // Hotplug events from a file instead of the kernel.
+              events_path = optarg;
+              break;
+         case 'r': // Real-time priority and core of the sampling loop.
+              realtime_spec = optarg;
+              break;
+         case 's': // Pipeline stage.
+              if ( stage_count == PIPELINE_MAX_NODES )
+              {
+                   fprintf(stderr, "Too many stages\n");
+                   return 1;
+              }
+              stage_specs[stage_count++] = optarg;
+              break;
+         case 'S': // Pipeline sink.
+              if ( sink_count == PIPELINE_MAX_NODES )
+              {
+                   fprintf(stderr, "Too many sinks\n");
+                   return 1;
+              }
+              sink_specs[sink_count++] = optarg;
+              break;
+         case 'D': // Derived sensor.
+              if ( derived_count == DERIVE_MAX )
+              {
+                   fprintf(stderr, "Too many derived sensors\n");
+                   return 1;
+              }
+              derived_specs[derived_count++] = optarg;
+              break;
+         case 'v': // Log level.
+              log_level = LogLevelFromString(optarg);
+              if ( log_level < 0 )
+              {
+                   fprintf(stderr, "Unknown log level: %s\n", optarg);
+                   return 1;
+              }
+              break;
+         case 'f': // Log format.
+              log_format = LogFormatFromString(optarg);
+              if ( log_format < 0 )
+              {
+                   fprintf(stderr, "Unknown log format: %s\n", optarg);
+                   return 1;
+              }
+              break;
+         default:
+              argc = 0; // Fall through to the usage message.
+              break;
+         }
+    }
+
+    if ( argc - optind < 2 )
+    {
+         printf ("%s\n","Usage: temper [-c none|deadband|swing] [-e deviation]"
+                       " [-b heartbeat_seconds]\n"
+                       "              [-T temp_limit] [-U humidity_limit]"
+                       " [-H horizon_seconds]\n"
+                       "              [-i interval_seconds]"
+                       " [-m timeout_floor_ms] [-M timeout_ceiling_ms] [-p]\n"
+                       "              [-L live_file] [-R live_depth]"
+                       " [-B backup_file[:seconds]]\n"
+                       "              [-k checkpoint_file[:seconds]]"
+                       " [-E event_file] [-r priority[:cpu]]\n"
+                       "              [-s stage]... [-S sink]..."
+                       " [-D name[devices]=expression]...\n"
+                       "              [-v error|warn|info|debug]"
+                       " [-f text|json|binary] <db_filename> <hours>");
 
          return 1; // Not enough command line arguments...
     }
 
-    char * filename = argv[1]; // Name of the database file.
+    char * filename = argv[optind]; // Name of the database file.
+
+    int hours=atoi(argv[optind+1]); // How many hours to gather data.
+
+    char checkpoint[256];               // Where the runtime state is kept.
+    int64_t checkpoint_period = 0;
+    if ( checkpoint_spec &&
+         CheckpointSpec(checkpoint_spec, checkpoint, sizeof(checkpoint),
+                        &checkpoint_period) < 0 )
+    {
+         fprintf(stderr, "Bad checkpoint: %s\n", checkpoint_spec);
+         return 1;
+    }
+
+    Realtime realtime = { 0, -1, 0, 0 }; // Sampling loop scheduling.
+    if ( realtime_spec && RealtimeSpec(&realtime, realtime_spec) < 0 )
+    {
+         fprintf(stderr, "Bad real-time spec: %s\n", realtime_spec);
+         return 1;
+    }
+
+    // Every thread but the sampling loop stays off its core, the logger
+    // started next included.
+    int reserved = realtime_spec ? RealtimeReserve(&realtime) : 0;
+
+    // Anchor the reading clock before any other thread looks at it.
+    TemperClockInit();
 
-    int hours=atoi(argv[2]); // How many hours to gather data.
+    // Readings are logged from a background thread so a slow terminal or
+    // journal never holds up the sampling loop.
+    if ( LogStart(stdout, log_level, log_format) != 0 )
+    {
+         perror("LogStart");
+         return 1;
+    }
 
-    printf("%s %s %s %d\n","filename:",filename,"hours:",hours);
+    LogMessage(TEMPER_LOG_INFO, -1, "filename: %s hours: %d", filename, hours);
+    LogMessage(TEMPER_LOG_INFO, -1, "%s sweeps",
+               pipelined ? "pipelined" : "sequential");
+    // Derived sensors are compiled up front, a typo stops here rather
+    // than after the database is set up.
+    Derive *derive = NULL;
+    int derive_err = 0;
+    if (derived_count &&
+        !(derive = DeriveOpen(derived_specs, derived_count, &derive_err)))
+    {
+        fprintf(stderr, "Bad derived sensors: %s\n",
+                TemperStrError(derive_err));
+        return 1;
+    }
+
+    if (reserved < 0)
+    {
+        LogMessage(TEMPER_LOG_WARN, -1, "cpu %d not reserved: %s",
+                   realtime.cpu, TemperStrError(reserved));
+    }
 
     // Got the database filename and hours from the command line...
     //**************************************************************************
 
     //--------------------------------------------------------------------------
-    Temper *t=NULL;                     // A temper2 temperature sensing device.
-
-    int ret=0;                          // Return value from TemperGetData.
-    long current_time=0;                // Unintelligable time in seconds.
-    long start_time=create_timestamp(); // Need to remember start for timing.
-    long end_time=start_time;           // Future timestamp we need to reach.
+    int64_t current_time=0;             // Time of the last reading in ns.
+    int64_t start_time=TemperClockNow(); // Need to remember start for timing.
+    int64_t end_time=start_time;        // Future timestamp we need to reach.
+    int64_t sweep_time=0;               // When the current sweep started.
     sqlite3 *db=NULL;                   // Handle for the sqlite3 database.
     char *err_msg = 0;                  // An error string.
-    char sql[160];                      // For Structured Query Language commands.
-    unsigned char buf[8];
-    char sn[80];                        // Temper device serial number.
+    char sql[256];                      // For Structured Query Language commands.
+    TemperReading batch[TEMPER_MAX_DEVICES]; // This sweep's readings.
+    struct SweepStats sweeps = { 0 };   // How long sweeps take.
+
+    for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+    {
+         PredictInit(&sensors[i].model, &prediction);
+         HealthInit(&sensors[i].health, &health_config);
+         LatencyInit(&sensors[i].latency, &latency_config);
+    }
+
+    // kill -USR1 logs the state of every device, kill stops after the
+    // current sweep so the stages and the checkpoint get written.
+    signal(SIGUSR1, request_status);
+    signal(SIGTERM, request_stop);
+    signal(SIGINT, request_stop);
 
     // Set the end time based on number of hours to run.
-    end_time = end_time + (hours * 60 * 60);
+    end_time = end_time + (int64_t)hours * 60 * 60 * TEMPER_NS_PER_SEC;
+
+    // SQLite recycles its memory instead of going back to malloc, so a
+    // sweep allocates nothing once the first few have warmed it up.
+    int rc = TemperSqliteHeapInit();
+    if (rc != SQLITE_OK)
+    {
+        fprintf(stderr, "Cannot set up SQLite memory: %s\n",
+                sqlite3_errstr(rc));
+
+        return 2;
+    }
 
     // Create database.
-    int rc = sqlite3_open(filename, &db);  
+    rc = sqlite3_open(filename, &db);  
     if (rc != SQLITE_OK) 
     {
         fprintf(stderr, "Cannot open db: %s\n", sqlite3_errmsg(db));
@@ -101,15 +423,55 @@ int main(int argc, char *argv[])
 
         return 2;
     }
+
+    // Keep the page cache inside what TemperSqliteHeapInit() set aside.
+    sprintf(sql, "PRAGMA cache_size = %d;", TEMPER_SQLITE_PAGES);
+    sqlite3_exec(db, sql, 0, 0, 0);
+
+    // In WAL mode readers and backups work from a snapshot and never
+    // block the inserts, nor the inserts them.  Whoever still holds the
+    // database, e.g. a writer like temper_import, gets waited on for a
+    // while and after that the sqlite sink holds the rows back.
+    sqlite3_busy_timeout(db, TEMPER_BUSY_TIMEOUT);
+    int wal = 0;
+    sqlite3_stmt *mode;
+    if (sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL;", -1, &mode,
+                           NULL) == SQLITE_OK)
+    {
+        if (sqlite3_step(mode) == SQLITE_ROW)
+        {
+            wal = !strcmp((const char *)sqlite3_column_text(mode, 0), "wal");
+        }
+        sqlite3_finalize(mode);
+    }
+    if (!wal)
+    {
+        LogMessage(TEMPER_LOG_WARN, -1, "no WAL, readers may block inserts");
+    }
     // Defined some variables and created the database...
     //--------------------------------------------------------------------------
    
     // *************************************************************************
     // Build the table if it doesn't yet exist
-    sprintf( sql,"%s%s","CREATE TABLE sensors"
-                ,"(Id INT, timestamp INT,inner_temp FLOAT, outer_temp FLOAT);");
+    sprintf( sql,"%s%s","CREATE TABLE IF NOT EXISTS sensors"
+                ,"(Id INT, timestamp INT,inner_temp FLOAT, outer_temp FLOAT,"
+                 " timestamp_ns INT);");
     
     rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+
+    // A file from before nanosecond timestamps gets them from its seconds.
+    if (rc == SQLITE_OK && !has_column(db, "sensors", "timestamp_ns"))
+    {
+        LogMessage(TEMPER_LOG_INFO, -1, "adding timestamp_ns to sensors");
+        rc = sqlite3_exec(db, "ALTER TABLE sensors ADD COLUMN timestamp_ns INT;"
+                              "UPDATE sensors SET timestamp_ns ="
+                              " timestamp * 1000000000;", 0, 0, &err_msg);
+    }
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS sensors_id_timestamp_ns"
+                              " ON sensors(Id, timestamp_ns);", 0, 0, &err_msg);
+    }
     if (rc != SQLITE_OK ) 
     {
         fprintf(stderr, "SQL error: %s\n", err_msg);
@@ -119,123 +481,982 @@ int main(int argc, char *argv[])
 
         return 3;
     }
+
+    // Record how the rows were compressed so readers can rebuild them, and
+    // which device had which sensor number so archives can be merged.
+    rc = store_compression(db, &compression, start_time, &err_msg);
+    if (rc == SQLITE_OK)
+    {
+        rc = sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS devices"
+                              "(Id INT, serial TEXT, product TEXT, since INT);",
+                          0, 0, &err_msg);
+    }
+    if (rc != SQLITE_OK )
+    {
+        fprintf(stderr, "SQL error: %s\n", err_msg);
+
+        sqlite3_free(err_msg);
+        sqlite3_close(db);
+
+        return 3;
+    }
+
+    // Derived sensors are in the devices table too, so readers can tell
+    // what a number stood for.  A new definition gets a new row.
+    for (unsigned i = 0; derive && i < DeriveCount(derive); ++i)
+    {
+        const char *name, *definition;
+        char serial[256];
+        int id = DeriveSensor(derive, i, &name, &definition);
+
+        snprintf(serial, sizeof(serial), "derived:%s", definition);
+        store_identity(db, id, serial, name);
+        LogMessage(TEMPER_LOG_INFO, id, "derived: %.40s", name);
+    }
+
+    // Readings go from the sweep through the stages to the sinks.  With no
+    // -s or -S that is the -c compression, if any, into the database.
+    PipelineInit(&pipeline);
+    int compressing = 0;
+    int deriving = 0;
+    int reducing = stage_count; // First stage that drops or merges rows.
+    for (int i = stage_count - 1; i >= 0; --i)
+    {
+        compressing |= !strncmp(stage_specs[i], "compress", 8);
+        deriving |= !strncmp(stage_specs[i], "derive", 6);
+        if (!strncmp(stage_specs[i], "compress", 8) ||
+            !strncmp(stage_specs[i], "aggregate", 9))
+        { reducing = i; }
+    }
+    if (compression.mode != COMPRESS_NONE && !compressing &&
+        stage_count < PIPELINE_MAX_NODES)
+    { stage_specs[stage_count++] = "compress"; }
+
+    // Derived sensors come from every reading, a whole sweep at a time,
+    // not from what compression keeps.
+    if (derive && !deriving && stage_count < PIPELINE_MAX_NODES)
+    {
+        memmove(&stage_specs[reducing + 1], &stage_specs[reducing],
+                (stage_count - reducing) * sizeof(stage_specs[0]));
+        stage_specs[reducing] = "derive";
+        ++stage_count;
+    }
+
+    int to_sqlite = 0;
+    for (int i = 0; i < sink_count; ++i)
+    { to_sqlite |= !strncmp(sink_specs[i], "sqlite", 6); }
+    if (!to_sqlite && sink_count < PIPELINE_MAX_NODES)
+    { sink_specs[sink_count++] = "sqlite"; }
+
+    for (int i = 0; i < stage_count + sink_count; ++i)
+    {
+        const char *spec = i < stage_count ? stage_specs[i]
+                                           : sink_specs[i - stage_count];
+
+        rc = i < stage_count ? StageAdd(&pipeline, spec, &compression,
+                                        &derive, db)
+                             : SinkAdd(&pipeline, spec, db);
+        if (rc < 0)
+        {
+            fprintf(stderr, "Cannot add %s: %s\n", spec, TemperStrError(rc));
+            PipelineClose(&pipeline);
+            sqlite3_close(db);
+
+            return 3;
+        }
+    }
+    if (derive)
+    {
+        LogMessage(TEMPER_LOG_WARN, -1, "no room for the derive stage");
+        DeriveOps.close(derive);
+    }
     // *************************************************************************
 
+    // Carry on where the last run stopped: same devices, same alerts, the
+    // stages' open windows and the same sweep schedule.
+    struct Restored restored = { &prediction, &health_config, &latency_config,
+                                 { 0, 0 }, 0, 0 };
+    if (checkpoint_spec)
+    {
+        rc = CheckpointLoad(checkpoint, restore_record, &restored);
+        if (rc < 0 && rc != -ENOENT)
+        {
+            LogMessage(TEMPER_LOG_WARN, -1, "checkpoint not read: %s",
+                       TemperStrError(rc));
+        }
+        else if (rc == 0)
+        {
+            LogMessage(TEMPER_LOG_INFO, -1, "restored %d sensors, %d stages",
+                       restored.sensors, restored.stages);
+        }
+    }
+
+    // Copies of the database are made between sweeps, a few pages at a
+    // time.  Without WAL the copy would hold off the inserts.
+    Backup backup;
+    if (backup_spec)
+    {
+        if (!wal)
+        {
+            fprintf(stderr, "-B needs the database in WAL mode\n");
+            PipelineClose(&pipeline);
+            sqlite3_close(db);
+
+            return 2;
+        }
+        if (BackupInit(&backup, filename, backup_spec, start_time) < 0)
+        {
+            fprintf(stderr, "Bad backup: %s\n", backup_spec);
+            PipelineClose(&pipeline);
+            sqlite3_close(db);
+
+            return 1;
+        }
+    }
+
+    // Other processes read the latest and recent values from here without
+    // touching the database.  It is fed after the stages, as a sink, so
+    // the rings hold the same rows as the database.
+    if (live_path)
+    {
+        live = TemperLiveCreate(live_path, live_depth, &rc);
+        if (!live || (rc = SinkAddLive(&pipeline, live)) < 0)
+        {
+            fprintf(stderr, "Cannot create %s: %s\n", live_path,
+                    TemperStrError(rc));
+            PipelineClose(&pipeline);
+            TemperLiveClose(live);
+            sqlite3_close(db);
+
+            return 2;
+        }
+    }
+
+    // Listen for devices coming and going before the first scan, so none
+    // slips in between.  Without events the devices found now are it.
+    Hotplug hotplug;
+    rc = HotplugOpen(&hotplug, events_path);
+    if (rc < 0)
+    {
+        LogMessage(TEMPER_LOG_WARN, -1, "no hotplug events: %s",
+                   TemperStrError(rc));
+    }
+
     // Initialize the USB bus...
     usb_set_debug(0);
-    usb_init();
-    usb_find_busses();
-    usb_find_devices();
+    TemperContext *ctx = TemperContextCreate(&rc);
+    if (!ctx)
+    {
+        fprintf(stderr, "Cannot scan USB: %s\n", TemperStrError(rc));
+        HotplugClose(&hotplug);
+        PipelineClose(&pipeline);
+        TemperLiveClose(live);
+        sqlite3_close(db);
+
+        return 5;
+    }
 
-    do
+    // In real-time mode the sampling loop only queues the sweep, the
+    // stages and sinks, SQLite among them, take it from a thread of their
+    // own.
+    if (realtime_spec && pipeline.first_stage)
+    { pipeline.first_stage->flags |= PIPELINE_THREAD; }
+    for (unsigned i = 0; realtime_spec && !pipeline.first_stage &&
+                         i < pipeline.count; ++i)
+    { pipeline.nodes[i].flags |= PIPELINE_THREAD; }
+
+    rc = PipelineStart(&pipeline);
+    if (rc < 0)
     {
-        int device_count = TemperCount(); // Number of devices to loop through.
-  
-        do
-        {
-            --device_count; // Loop from max device to least device.
-            current_time = create_timestamp();
+        fprintf(stderr, "Cannot start the pipeline: %s\n", TemperStrError(rc));
+        HotplugClose(&hotplug);
+        TemperContextFree(ctx);
+        PipelineClose(&pipeline);
+        TemperLiveClose(live);
+        sqlite3_close(db);
+
+        return 5;
+    }
 
-            // WARNING, if existing temper device need to deallocate it.
-            if(t)
+    // Every other thread is running, now raise this one.  Memory is only
+    // locked as it is touched, so what a sweep writes is faulted in now
+    // rather than during one.
+    if (realtime_spec)
+    {
+        rc = RealtimeEnter(&realtime);
+        if (rc == 0)
+        { rc = RealtimeLock(batch, sizeof(batch)); }
+        if (rc == 0)
+        { rc = RealtimeLock(sensors, sizeof(sensors)); }
+        if (rc == 0)
+        { rc = RealtimeLock(&pipeline, sizeof(pipeline)); }
+        for (unsigned i = 0; rc == 0 && i < pipeline.count; ++i)
+        {
+            if (pipeline.nodes[i].queue)
             {
-                TemperFree(t);
-                t=NULL;
+                rc = RealtimeLock(pipeline.nodes[i].queue,
+                                  PIPELINE_QUEUE * sizeof(PipelineBatch));
             }
+        }
+        if (rc < 0)
+        {
+            LogMessage(TEMPER_LOG_WARN, -1, "real-time mode incomplete: %s",
+                       TemperStrError(rc));
+        }
+        if (realtime.active)
+        {
+            LogMessage(TEMPER_LOG_INFO, -1, "sampling at SCHED_FIFO %d, cpu %d",
+                       realtime.priority, realtime.cpu);
+        }
+    }
 
-	    t = TemperCreateFromDeviceNumber
-                (device_count, TEMPER_TIMEOUT, TEMPER_DEBUG);
+    // Devices opened while sampling are noted through a connection of
+    // their own, as db is the sqlite sink's and it may be on its thread.
+    sqlite3 *devices_db = NULL;
+    if (sqlite3_open(filename, &devices_db) != SQLITE_OK ||
+        sqlite3_busy_timeout(devices_db, TEMPER_BUSY_TIMEOUT) != SQLITE_OK ||
+        sqlite3_exec(devices_db, "PRAGMA cache_size = 16;", 0, 0, 0)
+            != SQLITE_OK)
+    {
+        LogMessage(TEMPER_LOG_WARN, -1, "devices not noted: %s",
+                   sqlite3_errmsg(devices_db));
+        sqlite3_close(devices_db);
+        devices_db = NULL;
+    }
 
-	    if(!t) 
-            {
-                if (db) // Don't forget to close the database if open.
-                { sqlite3_close(db); }
-		perror("TemperCreate");
-		return -1;
-	    }
+    // A restart on the same interval sweeps on the old schedule, the slot
+    // after the last sweep or straight away if that has gone by.
+    int64_t due = 0;            // When this sweep should start.
+    if (restored.schedule.interval == interval && interval > 0 &&
+        restored.schedule.sweep_time + interval > TemperClockNow())
+    {
+        sweep_time = restored.schedule.sweep_time;
+        due = sweep_time + interval;
+        while (TemperClockSleepUntil(due) == -EINTR && !stop_requested)
+        { continue; }
+    }
+
+    for (int n = 0; n < TEMPER_MAX_DEVICES; ++n)
+    { sensors[n].plugged = TemperContextPresent(ctx, n); }
 
-	    TemperSendCommand8
-            (t, 0x01, 0x80, 0x33, 0x01, 0x00, 0x00, 0x00, 0x00);
+    int64_t checkpoint_due = TemperClockNow() + checkpoint_period;
+    int64_t first_stored = 0;   // When the first rows reached the sinks.
 
-            if (0)
+    while (!stop_requested)
+    {
+        int device_count = TemperContextCount(ctx); // Devices to loop through.
+        int started[TEMPER_MAX_DEVICES];  // Devices with a read in flight.
+        int tried = 0;                    // Devices we talked to this sweep.
+        int opened = 0;                   // Devices (re)opened this sweep.
+        int fresh[TEMPER_MAX_DEVICES];    // Which, to store once read.
+        unsigned batched = 0;             // Readings in batch.
+        uint64_t allocations = TemperAllocCount();
+
+        sweep_time = TemperClockNow();
+        if (due)
+        { JitterRecord(&sweeps.wake, sweep_time - due); }
+
+        if (device_count > TEMPER_MAX_DEVICES)
+        {
+            LogError(-1, ERANGE, "Devices not read, over TEMPER_MAX_DEVICES");
+            device_count = TEMPER_MAX_DEVICES;
+        }
+
+        // Loop from max device to least device.  Pipelined, every device
+        // is told to measure first and the reports are collected after, so
+        // their conversion times overlap instead of adding up.
+        for (int n = device_count - 1; n >= 0; --n)
+        {
+            const int was_open = sensors[n].t != NULL;
+
+            if (!sensors[n].plugged || !start_read(ctx, n, &sensors[n]))
+            { continue; }
+            started[tried++] = n;
+            if (!was_open)
             {
-	        TemperInterruptRead(t, buf, sizeof(buf));
+                identify_device(n, &sensors[n]);
+                fresh[opened++] = n;
             }
-            else
+
+            if (!pipelined)
+            { batched += finish_read(n, &sensors[n], &batch[batched]); }
+        }
+
+        for (int i = 0; pipelined && i < tried; ++i)
+        {
+            batched += finish_read(started[i], &sensors[started[i]],
+                                   &batch[batched]);
+        }
+
+        // The whole sweep goes down the pipeline as one batch.
+        rc = batched ? PipelineSubmit(&pipeline, batch, batched)
+                     : pipeline.error;
+
+        // The rest of the sweep can wait on others.
+        RealtimeRaise(&realtime, 0);
+        for (unsigned i = 0; due && i < batched; ++i)
+        { JitterRecord(&sweeps.read, batch[i].timestamp - due); }
+        for (int i = 0; i < opened; ++i)
+        { store_device(devices_db, fresh[i], &sensors[fresh[i]]); }
+
+        if (rc != 0) // A sink failed for good, e.g. a full disk, give up.
+        {
+            for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+            { close_device(&sensors[i]); }
+            HotplugClose(&hotplug);
+            TemperContextFree(ctx);
+            PipelineClose(&pipeline);
+            TemperLiveClose(live);
+            if (backup_spec)
+            { BackupClose(&backup); }
+            sqlite3_close(devices_db);
+            sqlite3_close(db);
+
+            return 4;
+        }
+
+        current_time = TemperClockNow();
+        allocations = TemperAllocCount() - allocations;
+        if (!first_stored && stored_rows(&pipeline))
+        {
+            first_stored = current_time;
+            LogMessage(TEMPER_LOG_INFO, -1, "first rows stored after %.1f ms",
+                       (double)(first_stored - start_time) / TEMPER_NS_PER_MS);
+        }
+        if (tried)
+        {
+            sweep_record(&sweeps, current_time - sweep_time, opened,
+                         allocations);
+        }
+        LogMessage(TEMPER_LOG_DEBUG, -1, "sweep took %.3f ms",
+                   (double)(current_time - sweep_time) / TEMPER_NS_PER_MS);
+
+        // The bus is only walked again when a TEMPer came or went, after
+        // the sweep so that real-time mode does it at normal priority.
+        if (HotplugPoll(&hotplug) > 0)
+        { update_devices(ctx); }
+
+        if (status_requested)
+        {
+            status_requested = 0;
+            report_status(&sweeps);
+        }
+
+        if (checkpoint_spec && current_time >= checkpoint_due)
+        {
+            rc = save_checkpoint(checkpoint, sweep_time, interval);
+            if (rc < 0)
             {
-	        TemperData data[2];
-	        const unsigned int count = sizeof(data)/sizeof(TemperData);
-	        ret = TemperGetData(t,data,count);
-	        printf("RET: %d", ret);
-
-	        for (unsigned i = 0; i < count; ++i) 
-                {
-	             printf(";%f %s", 
-				data[i].value, 
-				TemperUnitToString(data[i].unit)
-                           );
-                }
-
-                // Build the SQL insert string:
-	        sprintf(sql, "INSERT INTO sensors VALUES(%d,%ld,%f,%f);",
-                              device_count,
-                              current_time,
-                              data[0].value,
-                              data[1].value
-                       );
-
-                // Save data to database.
-                rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
-	        if (rc != SQLITE_OK ) 
-                {
-	            fprintf(stderr, "SQL error: %s\n", err_msg);	
-        	    sqlite3_free(err_msg);
-        	    sqlite3_close(db);
-                    if (t)
-                    { TemperFree(t); }
-
-                    return 4;
-	        }
-
-	        printf("\nsql: %s\n",sql);
-
-                sql[0]='\0';
-	        TemperGetSerialNumber(t, sn, sizeof(sn));
-	        printf(";%s;%s\n", t->product->name, sn);
-	        printf("%s\n",create_timestamp_human_readable());
+                LogMessage(TEMPER_LOG_WARN, -1, "checkpoint not saved: %s",
+                           TemperStrError(rc));
             }
+            checkpoint_due = current_time + checkpoint_period;
+        }
+
+        // Keep to the schedule even if a sweep ran long, and don't spin
+        // when every device is resting.  A backup gets the time in between.
+        if (interval > 0)
+        {
+            due = sweep_time + interval;
+            while (due <= current_time)
+            { due += interval; }
+            if (backup_spec)
+            { BackupStep(&backup, current_time, due); }
+
+            // Only a stop cuts the wait short, a status request waits.
+            while (TemperClockSleepUntil(due) == -EINTR && !stop_requested)
+            { continue; }
+        }
+        else if (backup_spec)
+        {
+            BackupStep(&backup, current_time, current_time);
+        }
+        if (interval <= 0 && !tried && !stop_requested)
+        {
+            sleep(1);
+        }
+        RealtimeRaise(&realtime, 1);
 
-        } while ( device_count > 0 );
+        if (current_time >= end_time)
+        { break; }
+   }
 
-   } while ( current_time < end_time );
+   report_status(&sweeps);
 
-   sleep(10);
+   // Store what the stages are still holding back, unless the checkpoint
+   // has it for the next run.  Should the checkpoint fail, they store it.
+   if (checkpoint_spec)
+   {
+       rc = save_checkpoint(checkpoint, sweep_time, interval);
+       if (rc < 0)
+       {
+           fprintf(stderr, "Checkpoint error: %s\n", TemperStrError(rc));
+           for (unsigned i = 0; i < pipeline.count; ++i)
+           { pipeline.nodes[i].saved = 0; }
+       }
+   }
+   for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+   { close_device(&sensors[i]); }
+   rc = PipelineClose(&pipeline);
+   if (rc != 0)
+   { fprintf(stderr, "Pipeline error: %s\n", TemperStrError(rc)); }
+
+   if (backup_spec)
+   { BackupClose(&backup); }
+
+   sqlite3_close(devices_db);
    sqlite3_close(db);
+   HotplugClose(&hotplug);
+   TemperContextFree(ctx);
+   TemperLiveClose(live);
 
-   if (t)
-   { TemperFree(t); }
+   // An ALLOC_COUNT build checks the sampling loop stayed off the heap.
+   if (sweeps.allocations)
+   { return 6; }
 
    return 0;
 }
 
 
 
-// Return human readable current date and time...
-char * create_timestamp_human_readable()
+
+// Tell a device to measure, opening it first unless it is still open from
+// the last sweep.  Returns 1 when the report can be collected, 0 when the
+// device is resting or failed...
+int start_read(TemperContext *ctx, int device, Sensor *s)
+{
+     DeviceHealth *h = &s->health;
+     DeviceLatency *l = &s->latency;
+
+     // Leave a failing device alone until its backoff has passed.
+     if (!HealthShouldTry(h, TemperClockNow()))
+     { return 0; }
+
+     int ret;
+
+     // Opening allocates, so a device stays open until it fails.
+     if (s->t)
+     {
+          TemperSetTimeout(s->t, HealthTimeout(h, l->timeout));
+     }
+     else if (!(s->t = TemperContextOpen(ctx, device,
+                                         HealthTimeout(h, l->timeout),
+                                         TEMPER_DEBUG, &ret)))
+     {
+          LogError(device, ret, "TemperContextOpen failed");
+          if (HealthFailure(h, TemperClockNow(), ret))
+          { report_health(device, h, l); }
+          return 0;
+     }
+
+     ret = TemperSendCommand8
+           (s->t, 0x01, 0x80, 0x33, 0x01, 0x00, 0x00, 0x00, 0x00);
+     if (ret < 0)
+     {
+          LogError(device, ret, "TemperSendCommand8 failed");
+          if (HealthFailure(h, TemperClockNow(), ret))
+          { report_health(device, h, l); }
+          close_device(s);
+          return 0;
+     }
+
+     return 1;
+}
+
+
+
+// Collect the report of a started read into *reading and forecast from
+// it.  Closes the device if it failed.  Returns 1 when the reading is good
+// enough for the pipeline, 0 if not...
+int finish_read(int device, Sensor *s, TemperReading *reading)
+{
+     DeviceHealth *h = &s->health;
+     DeviceLatency *l = &s->latency;
+     TemperData data[2];
+     const unsigned int count = sizeof(data)/sizeof(TemperData);
+     PredictResult predicted[TEMPER_CHANNELS];
+     char sn[80];                // Temper device serial number.
+
+     // reading->timestamp is when the report came in.
+     int ret = read_with_retry(s->t, data, count,
+                               h->state == HEALTH_CLOSED ? l : NULL,
+                               &reading->timestamp);
+
+     reading->sensor = device;
+     for (unsigned i = 0; i < count; ++i)
+     {
+          reading->value[i] = data[i].value;
+          reading->unit[i] = data[i].unit;
+     }
+     LogReading(TEMPER_LOG_INFO, reading, ret);
+
+     // A short or failed report has nothing worth storing.
+     if (ret < (int)(2 * count + 2))
+     {
+          LogError(device, ret, "TemperGetData failed");
+          if (HealthFailure(h, reading->timestamp, ret))
+          { report_health(device, h, l); }
+          close_device(s); // Reopened when the breaker lets us try again.
+          return 0;
+     }
+
+     if (HealthSuccess(h, reading->timestamp))
+     { report_health(device, h, l); }
+
+     // Warn before the rack gets too hot, not after.
+     if (PredictUpdate(&s->model, reading, predicted))
+     { report_prediction(reading, predicted); }
+
+     // Asking for the serial number is another USB transfer, only do it
+     // when somebody will see the answer.
+     if (LogEnabled(TEMPER_LOG_DEBUG))
+     {
+          TemperGetSerialNumber(s->t, sn, sizeof(sn));
+          LogDevice(device, TemperGetProductName(s->t), sn);
+     }
+
+     return 1;
+}
+
+
+
+// Close a device so the next sweep opens it again...
+void close_device(Sensor *s)
+{
+     TemperFree(s->t);
+     s->t = NULL;
+}
+
+
+
+// Read the serial of a device just opened.  When it isn't the one the
+// checkpoint knew under this number, what was learned about that one
+// doesn't apply...
+void identify_device(int device, Sensor *s)
+{
+     if (TemperGetSerialNumber(s->t, s->serial, sizeof(s->serial)) < 0)
+     { s->serial[0] = '\0'; }
+     s->product = TemperGetProductName(s->t);
+
+     if (s->restored[0] && strcmp(s->restored, s->serial))
+     {
+          LogMessage(TEMPER_LOG_INFO, device, "not %s, state reset",
+                     s->restored);
+          PredictInit(&s->model, s->model.config);
+          HealthInit(&s->health, s->health.config);
+          LatencyInit(&s->latency, s->latency.config);
+     }
+     s->restored[0] = '\0';
+}
+
+
+
+// Rescan after a hotplug event.  Devices that stayed keep their numbers,
+// so only the ones that came or went are opened or closed...
+void update_devices(TemperContext *ctx)
+{
+     int rc = TemperContextRescan(ctx);
+     if (rc < 0)
+     {
+          LogError(-1, rc, "TemperContextRescan failed");
+          return;
+     }
+
+     for (int n = 0; n < TEMPER_MAX_DEVICES; ++n)
+     {
+          Sensor *s = &sensors[n];
+          const int present = TemperContextPresent(ctx, n);
+
+          if (present == s->plugged)
+          { continue; }
+          s->plugged = present;
+
+          if (present)
+          {
+               LogMessage(TEMPER_LOG_INFO, n, "plugged in");
+
+               // Nothing to tell whether it is the one that was here.
+               if (!s->restored[0])
+               {
+                    PredictInit(&s->model, s->model.config);
+                    HealthInit(&s->health, s->health.config);
+                    LatencyInit(&s->latency, s->latency.config);
+               }
+               continue;
+          }
+
+          // Should it come back, it gets its state back.
+          LogMessage(TEMPER_LOG_INFO, n, "unplugged");
+          close_device(s);
+          if (s->serial[0])
+          { strcpy(s->restored, s->serial); }
+          s->serial[0] = '\0';
+     }
+}
+
+
+
+// Remember the compression settings of this run...
+int store_compression(sqlite3 *db, const CompressConfig *config, int64_t since,
+                      char **err_msg)
+{
+     char sql[200]; // For Structured Query Language commands.
+
+     sprintf(sql, "%s%s%s%lld,'%s',%f,%ld);",
+                  "CREATE TABLE IF NOT EXISTS compression"
+                 ,"(since INT, mode TEXT, deviation FLOAT, heartbeat INT);"
+                 ,"INSERT INTO compression VALUES("
+                 ,(long long)since
+                 ,CompressModeToString(config->mode)
+                 ,config->deviation
+                 ,config->heartbeat
+            );
+
+     return sqlite3_exec(db, sql, 0, 0, err_msg);
+}
+
+
+
+// Does the table have the column?  Files from before timestamp_ns lack
+// it...
+int has_column(sqlite3 *db, const char *table, const char *column)
+{
+     char sql[128];
+     sqlite3_stmt *stmt;
+     int found = 0;
+
+     snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+     { return 0; }
+     while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+     { found = !strcmp((const char *)sqlite3_column_text(stmt, 1), column); }
+     sqlite3_finalize(stmt);
+
+     return found;
+}
+
+
+
+// Note which device answers as sensor number `device` from now on, only
+// when that changed since the last note.  One closed again by a failed
+// first read is noted when it next opens...
+int store_device(sqlite3 *db, int device, const Sensor *s)
+{
+     if (!db || !s->t || !s->serial[0])
+     { return SQLITE_OK; }
+
+     return store_identity(db, device, s->serial, s->product);
+}
+
+
+
+// Note that sensor number `id` is serial, a product, from now on, unless
+// it already was...
+int store_identity(sqlite3 *db, int id, const char *serial,
+                   const char *product)
+{
+     sqlite3_stmt *stmt;
+
+     int rc = sqlite3_prepare_v2(db,
+                    "INSERT INTO devices SELECT ?1, ?2, ?3, ?4"
+                    " WHERE ?2 IS NOT (SELECT serial FROM devices WHERE Id = ?1"
+                    " ORDER BY since DESC LIMIT 1);", -1, &stmt, NULL);
+     if (rc != SQLITE_OK)
+     { return rc; }
+
+     sqlite3_bind_int(stmt, 1, id);
+     sqlite3_bind_text(stmt, 2, serial, -1, SQLITE_STATIC);
+     sqlite3_bind_text(stmt, 3, product, -1, SQLITE_STATIC);
+     sqlite3_bind_int64(stmt, 4, TemperClockNow());
+
+     rc = sqlite3_step(stmt);
+     sqlite3_finalize(stmt);
+     if (rc != SQLITE_DONE)
+     {
+          LogMessage(TEMPER_LOG_WARN, id, "devices: %s",
+                     sqlite3_errmsg(db));
+          return rc;
+     }
+
+     return SQLITE_OK;
+}
+
+
+
+// Write the schedule, every device seen and the stages to path.  The
+// stages are drained first, so this waits for any threaded ones...
+int save_checkpoint(const char *path, int64_t sweep_time, int64_t interval)
+{
+     struct SavedSchedule schedule = { sweep_time, interval };
+     struct SavedSensor saved;
+     Checkpoint c;
+
+     int rc = CheckpointBegin(&c, path);
+     if (rc < 0)
+     { return rc; }
+
+     CheckpointRecord(&c, SAVED_SCHEDULE, &schedule, sizeof(schedule));
+
+     for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+     {
+          const Sensor *s = &sensors[i];
+
+          if (!s->health.reads) // Never tried, nothing learned.
+          { continue; }
+
+          memset(&saved, 0, sizeof(saved));
+          saved.device = i;
+          strcpy(saved.serial, s->serial[0] ? s->serial : s->restored);
+          saved.model = s->model;
+          saved.health = s->health;
+          saved.latency = s->latency;
+          CheckpointRecord(&c, SAVED_SENSOR, &saved, sizeof(saved));
+     }
+
+     CheckpointRecordBegin(&c, SAVED_PIPELINE);
+     rc = PipelineSave(&pipeline, CheckpointFile(&c));
+     CheckpointRecordEnd(&c);
+     if (rc < 0)
+     {
+          CheckpointAbort(&c);
+          return rc;
+     }
+
+     return CheckpointCommit(&c);
+}
+
+
+
+// CheckpointLoad() callback.  A record of the wrong size is from another
+// build and left alone...
+int restore_record(void *arg, uint32_t tag, const void *data, uint32_t size)
+{
+     struct Restored *r = arg;
+     struct SavedSensor saved;
+
+     switch (tag)
+     {
+     case SAVED_SCHEDULE:
+          if (size == sizeof(r->schedule))
+          { memcpy(&r->schedule, data, size); }
+          break;
+     case SAVED_SENSOR:
+          if (size != sizeof(saved))
+          { break; }
+          memcpy(&saved, data, size);
+          if (saved.device < 0 || saved.device >= TEMPER_MAX_DEVICES)
+          { break; }
+
+          Sensor *s = &sensors[saved.device];
+          s->model = saved.model;
+          s->model.config = r->prediction;
+          s->health = saved.health;
+          s->health.config = r->health;
+          s->latency = saved.latency;
+          s->latency.config = r->latency;
+          saved.serial[sizeof(saved.serial) - 1] = '\0';
+          strcpy(s->restored, saved.serial);
+          ++r->sensors;
+          break;
+     case SAVED_PIPELINE:
+          r->stages = PipelineRestore(&pipeline, data, size);
+          if (r->stages < 0)
+          { r->stages = 0; }
+          break;
+     }
+
+     return 0;
+}
+
+
+
+// Rows taken by the sinks so far, to time the first ones stored...
+uint64_t stored_rows(const Pipeline *p)
+{
+     uint64_t rows = 0;
+
+     for (unsigned i = 0; i < p->count; ++i)
+     {
+          if (p->nodes[i].sink)
+          { rows += __atomic_load_n(&p->nodes[i].stats.rows_in,
+                                    __ATOMIC_RELAXED); }
+     }
+
+     return rows;
+}
+
+
+
+// Log the forecast and outlier flags that changed with this reading...
+void report_prediction(const TemperReading *r, const PredictResult *result)
+{
+     for (int i = 0; i < TEMPER_CHANNELS; ++i)
+     {
+          for (unsigned flag = 1; flag <= PREDICT_INVALID; flag <<= 1)
+          {
+               if (result[i].raised & flag)
+               {
+                    LogMessage(TEMPER_LOG_WARN, r->sensor,
+                               "channel %d %s %.2f limit %.1f eta %.0fs", i,
+                               PredictFlagToString(flag), r->value[i],
+                               result[i].limit, result[i].eta);
+               }
+               else if (result[i].cleared & flag)
+               {
+                    LogMessage(TEMPER_LOG_INFO, r->sensor,
+                               "channel %d %s cleared", i,
+                               PredictFlagToString(flag));
+               }
+          }
+     }
+}
+
+
+
+// Log where a device's circuit breaker and timeouts stand...
+void report_health(int sensor, const DeviceHealth *h, const DeviceLatency *l)
+{
+     const enum LogLevel level = h->state == HEALTH_CLOSED ? TEMPER_LOG_INFO
+                                                           : TEMPER_LOG_WARN;
+
+     LogMessage(level, sensor, "circuit %s, %llu/%llu failed, last error %d",
+                HealthStateToString(h->state),
+                (unsigned long long)h->failures,
+                (unsigned long long)h->reads, h->last_error);
+     LogMessage(level, sensor, "timeout %d ms, p%.0f %.2f ms, %llu timed out",
+                l->timeout, l->config->quantile * 100,
+                LatencyQuantile(l, l->config->quantile),
+                (unsigned long long)l->timeouts);
+     LogMessage(level, sensor, "%llu retried, %llu needlessly timed out",
+                (unsigned long long)l->retries,
+                (unsigned long long)l->false_timeouts);
+}
+
+
+
+// Read a report with the device's learned timeout.  If that times out, try
+// once more at the ceiling in case the device was only slow.  Pass l NULL
+// to just read with the timeout the device already has...
+int read_with_retry(Temper *t, TemperData *data, unsigned count,
+                    DeviceLatency *l, int64_t *answered)
+{
+     const int64_t asked = TemperClockNow();
+     int ret = TemperGetData(t, data, count);
+
+     *answered = TemperClockNow();
+     if (!l)
+     { return ret; }
+
+     if (ret == -ETIMEDOUT)
+     {
+          ++l->timeouts;
+          if (TemperGetTimeout(t) >= l->config->ceiling)
+          { return ret; }
+
+          ++l->retries;
+          TemperSetTimeout(t, l->config->ceiling);
+          ret = TemperGetData(t, data, count);
+          *answered = TemperClockNow();
+          if (ret == -ETIMEDOUT)
+          { ++l->timeouts; }
+          else if (ret > 0)
+          { ++l->false_timeouts; }
+     }
+
+     if (ret > 0)
+     { LatencyRecord(l, *answered - asked); }
+
+     return ret;
+}
+
+
+
+// Log every device's state, how long sweeps take and how the pipeline
+// keeps up...
+void report_status(const struct SweepStats *sweeps)
+{
+     for (int i = 0; i < TEMPER_MAX_DEVICES; ++i)
+     {
+          if (sensors[i].health.reads)
+          { report_health(i, &sensors[i].health, &sensors[i].latency); }
+     }
+
+     if (sweeps->count)
+     {
+          LogMessage(TEMPER_LOG_INFO, -1,
+                     "%llu sweeps, mean %.3f ms, longest %.3f ms",
+                     (unsigned long long)sweeps->count,
+                     (double)sweeps->total / sweeps->count / TEMPER_NS_PER_MS,
+                     (double)sweeps->longest / TEMPER_NS_PER_MS);
+     }
+
+     // How far the sweeps and their readings ran behind the schedule,
+     // compare with and without -r.
+     if (sweeps->wake.count)
+     {
+          LogMessage(TEMPER_LOG_INFO, -1,
+                     "sweeps late p50 %.2f p99 %.2f max %.2f ms",
+                     JitterQuantile(&sweeps->wake, 0.5),
+                     JitterQuantile(&sweeps->wake, 0.99),
+                     (double)sweeps->wake.longest / TEMPER_NS_PER_MS);
+     }
+     if (sweeps->read.count)
+     {
+          LogMessage(TEMPER_LOG_INFO, -1,
+                     "reads late p50 %.2f p99 %.2f max %.2f ms",
+                     JitterQuantile(&sweeps->read, 0.5),
+                     JitterQuantile(&sweeps->read, 0.99),
+                     (double)sweeps->read.longest / TEMPER_NS_PER_MS);
+     }
+
+     PipelineReport(&pipeline);
+
+     // Only meaningful in an ALLOC_COUNT build, see alloc.h.
+     if (sweeps->allocations)
+     {
+          LogMessage(TEMPER_LOG_ERROR, -1,
+                     "%llu heap allocations in %llu steady sweeps",
+                     (unsigned long long)sweeps->allocations,
+                     (unsigned long long)sweeps->steady);
+     }
+}
+
+
+
+// Add one sweep's duration to the statistics.  Opening a device allocates,
+// the sweeps that opened none should not have...
+void sweep_record(struct SweepStats *sweeps, int64_t ns, int opened,
+                  uint64_t allocations)
+{
+     ++sweeps->count;
+     sweeps->total += ns;
+     if (ns > sweeps->longest)
+     { sweeps->longest = ns; }
+
+     // SQLite's free lists fill up over the first few.
+     if (!opened && ++sweeps->steady > TEMPER_ALLOC_WARMUP)
+     {
+          sweeps->allocations += allocations;
+          if (allocations)
+          {
+               LogMessage(TEMPER_LOG_DEBUG, -1, "sweep allocated %llu times",
+                          (unsigned long long)allocations);
+          }
+     }
+}
+
+
+
+// SIGUSR1 handler, the sampling loop does the reporting...
+void request_status(int signum)
 {
-       time_t current_time;
-       char * buffer;
-       current_time = time(NULL);
-       buffer = ctime(&current_time);
-       return buffer;
+     status_requested = 1;
 }
 
 
 
-// Return integer non human readable date and time...
-int create_timestamp()
+// SIGTERM and SIGINT handler, the sampling loop stops after this sweep...
+void request_stop(int signum)
 {
-     time_t current_time;
-     current_time = time(NULL);
-     return current_time;
+     stop_requested = 1;
 }
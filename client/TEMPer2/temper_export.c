@@ -0,0 +1,502 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+/*
+ * temper_export: write a range of TEMPer history to a CSV or columnar file.
+ *
+ * The range is cut into chunks of -w seconds.  A pool of threads, each
+ * with its own connection, reads chunks through the (Id, timestamp_ns)
+ * index and encodes them in memory, as CSV text or as columnar batches
+ * (see export.h).  The main thread writes the finished chunks in order,
+ * one write() each, and threads only start a chunk when fewer than two
+ * per thread are waiting, so memory stays at a few chunks per thread.
+ */
+
+#include "comm.h"
+#include "export.h"
+#include "query.h"
+#include "timestamp.h"
+
+#define MAX_SENSORS 256
+#define EXPORT_CHUNK 3600	/* seconds per chunk by default */
+#define EXPORT_CSV_ROW 128	/* most bytes of one CSV line */
+#define EXPORT_MAX_CHUNKS 10000000
+#define EXPORT_CSV_HEADER "sensor,timestamp_ns,inner_temp,outer_temp\n"
+
+enum ExportFormat
+{
+	FORMAT_CSV,
+	FORMAT_COLUMNS,
+};
+
+struct Chunk
+{
+	int done;		/* read and encoded, waiting to be written */
+	int rc;			/* SQLite result of reading it */
+	uint64_t rows;
+	uint8_t *data;
+	size_t length;
+	size_t size;
+};
+
+// Chunk i is read into slots[i % slot_count], which is free again once
+// chunk i is written.
+struct Export
+{
+	TemperQuery query;	/* sensors and channels, the range per chunk */
+	int format;
+	int64_t from;
+	int64_t to;
+	int64_t span;		/* ns per chunk */
+	unsigned chunk_count;
+	unsigned next_chunk;
+	unsigned written;
+	struct Chunk *slots;
+	unsigned slot_count;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+struct Reader
+{
+	struct Export *ex;
+	TemperQueryDb *q;
+	struct Chunk *chunk;
+	TemperReading rows[TEMPER_EXPORT_BATCH];	/* for the next batch */
+	unsigned count;
+	int rc;
+	pthread_t tid;
+};
+
+
+
+static double seconds_since(int64_t start)
+{
+     return (double)(TemperClockNow() - start) / TEMPER_NS_PER_SEC;
+}
+
+
+
+// Make room for bytes more at the end of the chunk...
+static int reserve(struct Chunk *c, size_t bytes)
+{
+     if (c->length + bytes <= c->size)
+     { return 0; }
+
+     size_t size = c->size ? c->size : 1 << 20;
+     while (size < c->length + bytes)
+     { size *= 2; }
+
+     uint8_t *data = realloc(c->data, size);
+     if (!data)
+     { return -ENOMEM; }
+     c->data = data;
+     c->size = size;
+     return 0;
+}
+
+
+
+// Encode the rows held as one columnar batch...
+static int flush_rows(struct Reader *r)
+{
+     struct Chunk *c = r->chunk;
+
+     if (!r->count)
+     { return 0; }
+     if (reserve(c, TemperExportBound(r->count)))
+     { return -ENOMEM; }
+
+     c->length += TemperExportEncode(r->rows, r->count,
+                                     r->ex->query.channels,
+                                     c->data + c->length);
+     r->count = 0;
+     return 0;
+}
+
+
+
+// Append rows to the chunk being read, as CSV lines...
+static int append_csv(struct Chunk *c, const TemperReading *rows,
+                      unsigned count)
+{
+     if (reserve(c, (size_t)count * EXPORT_CSV_ROW))
+     { return -ENOMEM; }
+
+     for (unsigned i = 0; i < count; ++i)
+     {
+          char *p = (char *)c->data + c->length;
+          char *line = p;
+
+          p += sprintf(p, "%d,%lld", rows[i].sensor,
+                       (long long)rows[i].timestamp);
+          for (int ch = 0; ch < TEMPER_CHANNELS; ++ch)
+          {
+               if (isnan(rows[i].value[ch]))
+               { *p++ = ','; }
+               else
+               { p += sprintf(p, ",%f", rows[i].value[ch]); }
+          }
+          *p++ = '\n';
+          c->length += p - line;
+     }
+
+     return 0;
+}
+
+
+
+// TemperQueryRun() callback, stops the chunk when memory runs out...
+static int collect(void *arg, const TemperReading *rows, unsigned count)
+{
+     struct Reader *r = arg;
+
+     r->chunk->rows += count;
+     if (r->ex->format == FORMAT_CSV)
+     {
+          r->rc = append_csv(r->chunk, rows, count);
+          return r->rc;
+     }
+
+     while (count)
+     {
+          unsigned n = TEMPER_EXPORT_BATCH - r->count;
+          if (n > count)
+          { n = count; }
+
+          memcpy(&r->rows[r->count], rows, n * sizeof(*rows));
+          r->count += n;
+          rows += n;
+          count -= n;
+
+          if (r->count == TEMPER_EXPORT_BATCH && (r->rc = flush_rows(r)))
+          { return r->rc; }
+     }
+
+     return 0;
+}
+
+
+
+static void *reader(void *arg)
+{
+     struct Reader *r = arg;
+     struct Export *ex = r->ex;
+
+     for (;;)
+     {
+          pthread_mutex_lock(&ex->lock);
+          while (!ex->stop && ex->next_chunk < ex->chunk_count &&
+                 ex->next_chunk >= ex->written + ex->slot_count)
+          { pthread_cond_wait(&ex->changed, &ex->lock); }
+          if (ex->stop || ex->next_chunk >= ex->chunk_count)
+          {
+               pthread_mutex_unlock(&ex->lock);
+               break;
+          }
+          unsigned i = ex->next_chunk++;
+          pthread_mutex_unlock(&ex->lock);
+
+          TemperQuery query = ex->query;
+          struct Chunk *c = &ex->slots[i % ex->slot_count];
+
+          query.from = ex->from + (int64_t)i * ex->span;
+          query.to = ex->to - query.from > ex->span ? query.from + ex->span
+                                                    : ex->to;
+          r->chunk = c;
+          r->count = 0;
+          r->rc = 0;
+          c->length = 0;
+          c->rows = 0;
+
+          c->rc = TemperQueryRun(r->q, &query, collect, r);
+          if (c->rc == SQLITE_OK && !r->rc)
+          { r->rc = flush_rows(r); }
+          if (c->rc == SQLITE_OK && r->rc)
+          { c->rc = SQLITE_NOMEM; }
+
+          pthread_mutex_lock(&ex->lock);
+          c->done = 1;
+          pthread_cond_broadcast(&ex->changed);
+          pthread_mutex_unlock(&ex->lock);
+     }
+
+     return NULL;
+}
+
+
+
+static int write_all(int fd, const uint8_t *data, size_t length)
+{
+     while (length)
+     {
+          ssize_t n = write(fd, data, length);
+          if (n < 0 && errno == EINTR)
+          { continue; }
+          if (n < 0)
+          { return -errno; }
+          data += n;
+          length -= n;
+     }
+
+     return 0;
+}
+
+
+
+// Write the chunks out in order as the readers finish them.  Returns 0,
+// a negative errno or an SQLite error...
+static int write_chunks(struct Export *ex, int fd, uint64_t *rows,
+                        uint64_t *bytes)
+{
+     int rc = 0;
+
+     for (unsigned i = 0; i < ex->chunk_count && !rc; ++i)
+     {
+          struct Chunk *c = &ex->slots[i % ex->slot_count];
+
+          pthread_mutex_lock(&ex->lock);
+          while (!c->done)
+          { pthread_cond_wait(&ex->changed, &ex->lock); }
+          pthread_mutex_unlock(&ex->lock);
+
+          if (c->rc != SQLITE_OK)
+          {
+               fprintf(stderr, "SQL error: %s\n", sqlite3_errstr(c->rc));
+               rc = c->rc;
+          }
+          else if ((rc = write_all(fd, c->data, c->length)) != 0)
+          {
+               fprintf(stderr, "Cannot write: %s\n", TemperStrError(rc));
+          }
+          *rows += c->rows;
+          *bytes += c->length;
+
+          pthread_mutex_lock(&ex->lock);
+          c->done = 0;
+          ex->written = i + 1;
+          ex->stop = rc != 0;
+          pthread_cond_broadcast(&ex->changed);
+          pthread_mutex_unlock(&ex->lock);
+     }
+
+     return rc;
+}
+
+
+
+// Seconds since the epoch, fractions allowed, to ns...
+static int64_t parse_time(const char *s)
+{
+     return (int64_t)(atof(s) * TEMPER_NS_PER_SEC);
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    struct Export ex = { 0 };
+    int sensors[MAX_SENSORS];
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double chunk_seconds = EXPORT_CHUNK;
+    int opt;
+
+    ex.query.from = INT64_MIN;
+    ex.query.to = INT64_MAX;
+    while ( (opt = getopt(argc, argv, "f:t:s:c:j:w:F:")) != -1 )
+    {
+         switch (opt)
+         {
+         case 'f': // From, seconds since the epoch.
+              ex.query.from = parse_time(optarg);
+              break;
+         case 't': // To, seconds since the epoch.
+              ex.query.to = parse_time(optarg);
+              break;
+         case 's': // Comma separated sensor numbers.
+              ex.query.sensors = sensors;
+              for (char *s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+              {
+                   char *end;
+                   const long id = strtol(s, &end, 10);
+
+                   if (end == s || *end || id < INT_MIN || id > INT_MAX)
+                   {
+                        fprintf(stderr, "Unknown sensor: %s\n", s);
+                        return 1;
+                   }
+                   if (ex.query.sensor_count == MAX_SENSORS)
+                   {
+                        fprintf(stderr, "Too many sensors, at most %d\n",
+                                MAX_SENSORS);
+                        return 1;
+                   }
+                   sensors[ex.query.sensor_count++] = id;
+              }
+              break;
+         case 'c': // Channel.
+              if (strcmp(optarg, "inner") == 0)
+              { ex.query.channels = TEMPER_QUERY_INNER; }
+              else if (strcmp(optarg, "outer") == 0)
+              { ex.query.channels = TEMPER_QUERY_OUTER; }
+              else
+              {
+                   fprintf(stderr, "Unknown channel: %s\n", optarg);
+                   return 1;
+              }
+              break;
+         case 'j': // Reader threads.
+              threads = atoi(optarg);
+              break;
+         case 'w': // Seconds of history per chunk.
+              chunk_seconds = atof(optarg);
+              break;
+         case 'F': // Output format.
+              if (strcmp(optarg, "csv") == 0)
+              { ex.format = FORMAT_CSV; }
+              else if (strcmp(optarg, "columns") == 0)
+              { ex.format = FORMAT_COLUMNS; }
+              else
+              { argc = 0; }
+              break;
+         default:
+              argc = 0;
+              break;
+         }
+    }
+
+    if ( argc - optind < 2 || chunk_seconds < 1 )
+    {
+         printf("%s\n", "Usage: temper_export [-f from] [-t to] [-s id,id,...]"
+                        " [-c inner|outer] [-j threads]\n"
+                        "                     [-w chunk_seconds]"
+                        " [-F csv|columns] <db_filename> <output|->");
+         return 1;
+    }
+
+    if (threads < 1)
+    { threads = 1; }
+
+    const char *output = argv[optind + 1];
+    int64_t start = TemperClockNow();
+    int rc;
+
+    // The range ends where the rows do now, so the last chunk doesn't
+    // pick up what the collector inserts while we export.
+    TemperQueryDb *q = TemperQueryOpen(argv[optind], &rc);
+    if (q)
+    { rc = TemperQueryBounds(q, &ex.query, &ex.from, &ex.to); }
+    TemperQueryClose(q);
+    if (rc != SQLITE_OK && rc != SQLITE_DONE)
+    {
+         fprintf(stderr, "Cannot read db: %s\n", sqlite3_errstr(rc));
+         return 2;
+    }
+
+    ex.span = (int64_t)(chunk_seconds * TEMPER_NS_PER_SEC);
+    if (rc == SQLITE_OK)
+    {
+         uint64_t chunks = ((uint64_t)ex.to - ex.from) / ex.span + 1;
+         if (chunks > EXPORT_MAX_CHUNKS)
+         {
+              fprintf(stderr, "Too many chunks, raise -w\n");
+              return 1;
+         }
+         ex.chunk_count = chunks;
+         ++ex.to;
+    }
+    if ((unsigned)threads > ex.chunk_count)
+    { threads = ex.chunk_count ? ex.chunk_count : 1; }
+
+    // Two chunks per reader, one being filled and one being written.
+    struct Reader *readers = calloc(threads, sizeof(*readers));
+    ex.slot_count = 2 * threads;
+    ex.slots = calloc(ex.slot_count, sizeof(*ex.slots));
+    if (!readers || !ex.slots)
+    {
+         fprintf(stderr, "Out of memory\n");
+         return 2;
+    }
+    pthread_mutex_init(&ex.lock, NULL);
+    pthread_cond_init(&ex.changed, NULL);
+
+    for (int i = 0; i < threads; ++i)
+    {
+         readers[i].ex = &ex;
+         readers[i].q = TemperQueryOpen(argv[optind], &rc);
+         if (!readers[i].q)
+         {
+              fprintf(stderr, "Cannot open db: %s\n", sqlite3_errstr(rc));
+              return 2;
+         }
+    }
+
+    int fd = strcmp(output, "-") ? open(output, O_WRONLY | O_CREAT | O_TRUNC |
+                                                O_CLOEXEC, 0644)
+                                 : STDOUT_FILENO;
+    if (fd < 0)
+    {
+         fprintf(stderr, "Cannot open %s: %s\n", output,
+                 TemperStrError(-errno));
+         return 2;
+    }
+
+    uint8_t header[TEMPER_EXPORT_HEADER];
+    if (ex.format == FORMAT_COLUMNS)
+    {
+         TemperExportHeader(ex.query.channels, header);
+         rc = write_all(fd, header, sizeof(header));
+    }
+    else
+    {
+         rc = write_all(fd, (const uint8_t *)EXPORT_CSV_HEADER,
+                        strlen(EXPORT_CSV_HEADER));
+    }
+
+    // Read and encode in parallel, write from here.
+    uint64_t rows = 0, bytes = 0;
+    for (int i = 0; i < threads; ++i)
+    { pthread_create(&readers[i].tid, NULL, reader, &readers[i]); }
+    if (rc == 0)
+    { rc = write_chunks(&ex, fd, &rows, &bytes); }
+    else
+    { fprintf(stderr, "Cannot write: %s\n", TemperStrError(rc)); }
+    pthread_mutex_lock(&ex.lock);
+    ex.stop = 1;
+    pthread_cond_broadcast(&ex.changed);
+    pthread_mutex_unlock(&ex.lock);
+    for (int i = 0; i < threads; ++i)
+    {
+         pthread_join(readers[i].tid, NULL);
+         TemperQueryClose(readers[i].q);
+    }
+
+    if (fd != STDOUT_FILENO && close(fd) < 0 && rc == 0)
+    {
+         rc = -errno;
+         fprintf(stderr, "Cannot write: %s\n", TemperStrError(rc));
+    }
+    for (unsigned i = 0; i < ex.slot_count; ++i)
+    { free(ex.slots[i].data); }
+    free(ex.slots);
+    free(readers);
+    if (rc != 0)
+    { return 3; }
+
+    double seconds = seconds_since(start);
+    fprintf(stderr, "exported %llu rows in %u chunks with %d threads in"
+            " %.2f s, %llu bytes, %.1f per row, %.1f MB/s\n",
+            (unsigned long long)rows, ex.chunk_count, threads, seconds,
+            (unsigned long long)bytes, rows ? (double)bytes / rows : 0.0,
+            seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+    return 0;
+}
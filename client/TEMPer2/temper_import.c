@@ -0,0 +1,751 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+/*
+ * temper_import: merge TEMPer databases into one.
+ *
+ * Sources are read by a pool of threads, each with its own connection, and
+ * handed in batches to the main thread.  It loads them into a TEMP staging
+ * table in one transaction.  The staged rows are then merged into the
+ * target, keeping one row per (Id, timestamp_ns): the target's if it has
+ * one, otherwise the first source's to be staged.  A target smaller than
+ * what was staged is rebuilt sorted and indexed afterwards; a bigger one
+ * is merged through its index.
+ *
+ * Sensor numbers are bus positions, so the same number can be a different
+ * device in another file.  Where a source has a devices table, its rows
+ * are renumbered to the number the target uses for that serial.
+ */
+
+#include "timestamp.h"
+
+#define IMPORT_BATCH 4096	/* rows per batch */
+#define IMPORT_SERIAL 80
+
+struct ImportRow
+{
+	int id;
+	int64_t timestamp;	/* seconds, as stored */
+	double inner;		/* NAN for NULL */
+	double outer;
+	int64_t timestamp_ns;
+};
+
+struct ImportBatch
+{
+	struct ImportBatch *next;
+	unsigned count;
+	struct ImportRow rows[IMPORT_BATCH];
+};
+
+// One row of a source's devices table, and the target number it maps to.
+struct DeviceSpan
+{
+	int id;
+	int64_t since;
+	char serial[IMPORT_SERIAL];
+	char product[IMPORT_SERIAL];
+	int target;
+};
+
+struct Source
+{
+	const char *filename;
+	struct DeviceSpan *spans;	/* by id, then since */
+	unsigned span_count;
+	uint64_t rows;
+	int rc;
+};
+
+// Batches flow from the readers to the writer through `full`, and back
+// through `empty`, so memory stays at a few batches per reader.
+struct Import
+{
+	struct Source *sources;
+	unsigned source_count;
+	unsigned next_source;
+	unsigned readers_left;
+	struct ImportBatch *full;
+	struct ImportBatch *empty;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+};
+
+// What the target already calls each serial, plus what this run adds.
+struct SerialMap
+{
+	struct DeviceSpan *known;
+	unsigned count;
+	unsigned size;
+	int next_id;
+};
+
+
+
+static double seconds_since(int64_t start)
+{
+     return (double)(TemperClockNow() - start) / TEMPER_NS_PER_SEC;
+}
+
+
+
+static int compare_spans(const void *a, const void *b)
+{
+     const struct DeviceSpan *x = a, *y = b;
+
+     if (x->id != y->id)
+     { return x->id < y->id ? -1 : 1; }
+     return x->since < y->since ? -1 : x->since > y->since;
+}
+
+
+
+// Does the table have the column?  Legacy files lack timestamp_ns and
+// devices...
+static int has_column(sqlite3 *db, const char *table, const char *column)
+{
+     char sql[128];
+     sqlite3_stmt *stmt;
+     int found = 0;
+
+     snprintf(sql, sizeof(sql), "PRAGMA table_info(%s);", table);
+     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+     { return 0; }
+     while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+     { found = !strcmp((const char *)sqlite3_column_text(stmt, 1), column); }
+     sqlite3_finalize(stmt);
+
+     return found;
+}
+
+
+
+// Read a devices table, sorted by id and since...
+static int load_spans(sqlite3 *db, struct DeviceSpan **spans, unsigned *count)
+{
+     sqlite3_stmt *stmt;
+     unsigned size = 0;
+
+     *spans = NULL;
+     *count = 0;
+     if (!has_column(db, "devices", "serial"))
+     { return SQLITE_OK; }
+
+     int rc = sqlite3_prepare_v2(db, "SELECT Id, since, serial, product"
+                                     " FROM devices WHERE serial IS NOT NULL;",
+                                 -1, &stmt, NULL);
+     while (rc == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+     {
+          if (*count == size)
+          {
+               size = size ? size * 2 : 16;
+               struct DeviceSpan *more = realloc(*spans, size * sizeof(**spans));
+               if (!more)
+               {
+                    rc = SQLITE_NOMEM;
+                    break;
+               }
+               *spans = more;
+          }
+
+          struct DeviceSpan *d = &(*spans)[(*count)++];
+          const char *product = (const char *)sqlite3_column_text(stmt, 3);
+
+          d->id = sqlite3_column_int(stmt, 0);
+          d->since = sqlite3_column_int64(stmt, 1);
+          snprintf(d->serial, sizeof(d->serial), "%s",
+                   (const char *)sqlite3_column_text(stmt, 2));
+          snprintf(d->product, sizeof(d->product), "%s",
+                   product ? product : "");
+          d->target = d->id;
+     }
+     sqlite3_finalize(stmt);
+
+     if (*count)
+     { qsort(*spans, *count, sizeof(**spans), compare_spans); }
+
+     return rc;
+}
+
+
+
+static struct DeviceSpan *serial_find(struct SerialMap *map, const char *serial)
+{
+     for (unsigned i = 0; i < map->count; ++i)
+     {
+          if (!strcmp(map->known[i].serial, serial))
+          { return &map->known[i]; }
+     }
+     return NULL;
+}
+
+
+
+static int id_taken(struct SerialMap *map, int id, const char *serial)
+{
+     for (unsigned i = 0; i < map->count; ++i)
+     {
+          if (map->known[i].target == id && strcmp(map->known[i].serial, serial))
+          { return 1; }
+     }
+     return 0;
+}
+
+
+
+// The target number of a serial: the one the target already uses, else the
+// source's own number if nobody else has it, else a new one...
+static int serial_target(struct SerialMap *map, const struct DeviceSpan *d)
+{
+     struct DeviceSpan *known = serial_find(map, d->serial);
+
+     if (known)
+     { return known->target; }
+
+     if (map->count == map->size)
+     {
+          map->size = map->size ? map->size * 2 : 16;
+          known = realloc(map->known, map->size * sizeof(*known));
+          if (!known)
+          { return -1; }
+          map->known = known;
+     }
+
+     known = &map->known[map->count];
+     *known = *d;
+     known->target = id_taken(map, d->id, d->serial) ? map->next_id++ : d->id;
+     ++map->count;
+     if (known->target >= map->next_id)
+     { map->next_id = known->target + 1; }
+
+     return known->target;
+}
+
+
+
+// Number of a source row's sensor in the target: that of the device which
+// had the number at the time, or the number itself if nothing is known...
+static int remap(const struct Source *s, int id, int64_t timestamp_ns)
+{
+     const struct DeviceSpan *match = NULL;
+
+     for (unsigned i = 0; i < s->span_count && s->spans[i].id <= id; ++i)
+     {
+          if (s->spans[i].id != id)
+          { continue; }
+          if (!match || s->spans[i].since <= timestamp_ns)
+          { match = &s->spans[i]; }
+     }
+
+     return match ? match->target : id;
+}
+
+
+
+static struct ImportBatch *take_empty(struct Import *im)
+{
+     pthread_mutex_lock(&im->lock);
+     while (!im->empty)
+     { pthread_cond_wait(&im->changed, &im->lock); }
+     struct ImportBatch *b = im->empty;
+     im->empty = b->next;
+     pthread_mutex_unlock(&im->lock);
+
+     b->count = 0;
+     return b;
+}
+
+
+
+static void put_full(struct Import *im, struct ImportBatch *b)
+{
+     pthread_mutex_lock(&im->lock);
+     b->next = im->full;
+     im->full = b;
+     pthread_cond_broadcast(&im->changed);
+     pthread_mutex_unlock(&im->lock);
+}
+
+
+
+// A temperature column, NAN where it is NULL...
+static double column_value(sqlite3_stmt *stmt, int column)
+{
+     if (sqlite3_column_type(stmt, column) == SQLITE_NULL)
+     { return NAN; }
+     return sqlite3_column_double(stmt, column);
+}
+
+
+
+// ...and back, so a NULL stays NULL rather than becoming 0.
+static void bind_value(sqlite3_stmt *stmt, int column, double value)
+{
+     if (isnan(value))
+     { sqlite3_bind_null(stmt, column); }
+     else
+     { sqlite3_bind_double(stmt, column, value); }
+}
+
+
+
+// Read one source into batches...
+static int read_source(struct Import *im, struct Source *s)
+{
+     sqlite3 *db;
+     sqlite3_stmt *stmt;
+     struct ImportBatch *b;
+
+     int rc = sqlite3_open_v2(s->filename, &db, SQLITE_OPEN_READONLY, NULL);
+     if (rc != SQLITE_OK)
+     {
+          sqlite3_close(db);
+          return rc;
+     }
+
+     // Legacy rows only have whole seconds.
+     rc = sqlite3_prepare_v2(db, has_column(db, "sensors", "timestamp_ns")
+              ? "SELECT Id, timestamp, inner_temp, outer_temp,"
+                " IFNULL(timestamp_ns, timestamp * 1000000000) FROM sensors;"
+              : "SELECT Id, timestamp, inner_temp, outer_temp,"
+                " timestamp * 1000000000 FROM sensors;",
+              -1, &stmt, NULL);
+     if (rc != SQLITE_OK)
+     {
+          sqlite3_close(db);
+          return rc;
+     }
+
+     b = take_empty(im);
+     while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+     {
+          struct ImportRow *r = &b->rows[b->count++];
+
+          r->timestamp = sqlite3_column_int64(stmt, 1);
+          r->inner = column_value(stmt, 2);
+          r->outer = column_value(stmt, 3);
+          r->timestamp_ns = sqlite3_column_int64(stmt, 4);
+          r->id = remap(s, sqlite3_column_int(stmt, 0), r->timestamp_ns);
+          ++s->rows;
+
+          if (b->count == IMPORT_BATCH)
+          {
+               put_full(im, b);
+               b = take_empty(im);
+          }
+     }
+     put_full(im, b);
+
+     sqlite3_finalize(stmt);
+     sqlite3_close(db);
+     return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+
+
+static void *reader(void *arg)
+{
+     struct Import *im = arg;
+
+     for (;;)
+     {
+          pthread_mutex_lock(&im->lock);
+          unsigned i = im->next_source++;
+          pthread_mutex_unlock(&im->lock);
+          if (i >= im->source_count)
+          { break; }
+
+          im->sources[i].rc = read_source(im, &im->sources[i]);
+     }
+
+     pthread_mutex_lock(&im->lock);
+     --im->readers_left;
+     pthread_cond_broadcast(&im->changed);
+     pthread_mutex_unlock(&im->lock);
+
+     return NULL;
+}
+
+
+
+// Insert batches into staging as the readers fill them...
+static int write_staging(sqlite3 *db, struct Import *im, uint64_t *staged)
+{
+     sqlite3_stmt *insert;
+     int rc = sqlite3_prepare_v2(db, "INSERT INTO temp.staging"
+                                     " VALUES(?,?,?,?,?);", -1, &insert, NULL);
+
+     for (;;)
+     {
+          pthread_mutex_lock(&im->lock);
+          while (!im->full && im->readers_left)
+          { pthread_cond_wait(&im->changed, &im->lock); }
+          struct ImportBatch *b = im->full;
+          if (b)
+          { im->full = b->next; }
+          pthread_mutex_unlock(&im->lock);
+          if (!b)
+          { break; }
+
+          for (unsigned i = 0; rc == SQLITE_OK && i < b->count; ++i)
+          {
+               const struct ImportRow *r = &b->rows[i];
+
+               sqlite3_bind_int(insert, 1, r->id);
+               sqlite3_bind_int64(insert, 2, r->timestamp);
+               bind_value(insert, 3, r->inner);
+               bind_value(insert, 4, r->outer);
+               sqlite3_bind_int64(insert, 5, r->timestamp_ns);
+               rc = sqlite3_step(insert);
+               sqlite3_reset(insert);
+               rc = rc == SQLITE_DONE ? SQLITE_OK : rc;
+          }
+          *staged += b->count;
+
+          // Keep draining on error so no reader waits forever.
+          pthread_mutex_lock(&im->lock);
+          b->next = im->empty;
+          im->empty = b;
+          pthread_cond_broadcast(&im->changed);
+          pthread_mutex_unlock(&im->lock);
+     }
+
+     sqlite3_finalize(insert);
+     return rc;
+}
+
+
+
+static int exec(sqlite3 *db, const char *sql)
+{
+     char *err_msg = NULL;
+     int rc = sqlite3_exec(db, sql, 0, 0, &err_msg);
+
+     if (rc != SQLITE_OK)
+     {
+          fprintf(stderr, "SQL error: %s\n", err_msg);
+          sqlite3_free(err_msg);
+     }
+     return rc;
+}
+
+
+
+static int64_t count_rows(sqlite3 *db, const char *sql)
+{
+     sqlite3_stmt *stmt;
+     int64_t count = -1;
+
+     if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK &&
+         sqlite3_step(stmt) == SQLITE_ROW)
+     { count = sqlite3_column_int64(stmt, 0); }
+     sqlite3_finalize(stmt);
+
+     return count;
+}
+
+
+
+// Bring a target of any age up to the current schema...
+static int prepare_target(sqlite3 *db)
+{
+     int rc = exec(db, "PRAGMA cache_size = -65536;"
+                       "PRAGMA temp_store = FILE;"
+                       "CREATE TABLE IF NOT EXISTS sensors(Id INT, timestamp INT,"
+                       " inner_temp FLOAT, outer_temp FLOAT, timestamp_ns INT);"
+                       "CREATE TABLE IF NOT EXISTS devices"
+                       "(Id INT, serial TEXT, product TEXT, since INT);");
+
+     if (rc == SQLITE_OK && !has_column(db, "sensors", "timestamp_ns"))
+     {
+          rc = exec(db, "ALTER TABLE sensors ADD COLUMN timestamp_ns INT;"
+                        "UPDATE sensors SET timestamp_ns ="
+                        " timestamp * 1000000000;");
+     }
+
+     if (rc == SQLITE_OK)
+     {
+          rc = exec(db, "CREATE TEMP TABLE staging(Id INT, timestamp INT,"
+                        " inner_temp FLOAT, outer_temp FLOAT,"
+                        " timestamp_ns INT);"
+                        "CREATE TEMP TABLE staged_devices(Id INT, serial TEXT,"
+                        " product TEXT, since INT);");
+     }
+
+     return rc;
+}
+
+
+
+// Work out every source's renumbering before the readers start...
+static int plan_remap(sqlite3 *target, struct Source *sources, unsigned count)
+{
+     struct SerialMap map = { NULL, 0, 0, 0 };
+     sqlite3_stmt *insert = NULL;
+     int rc = load_spans(target, &map.known, &map.count);
+
+     map.size = map.count;
+     for (unsigned i = 0; i < map.count; ++i)
+     {
+          if (map.known[i].id >= map.next_id)
+          { map.next_id = map.known[i].id + 1; }
+     }
+     int64_t top = count_rows(target, "SELECT MAX(Id) FROM sensors;");
+     if (top >= map.next_id)
+     { map.next_id = top + 1; }
+
+     if (rc == SQLITE_OK)
+     {
+          rc = sqlite3_prepare_v2(target, "INSERT INTO temp.staged_devices"
+                                          " VALUES(?,?,?,?);", -1, &insert, NULL);
+     }
+
+     for (unsigned i = 0; rc == SQLITE_OK && i < count; ++i)
+     {
+          sqlite3 *db;
+          struct Source *s = &sources[i];
+
+          rc = sqlite3_open_v2(s->filename, &db, SQLITE_OPEN_READONLY, NULL);
+          if (rc == SQLITE_OK)
+          { rc = load_spans(db, &s->spans, &s->span_count); }
+          if (rc != SQLITE_OK)
+          { fprintf(stderr, "%s: %s\n", s->filename, sqlite3_errmsg(db)); }
+          sqlite3_close(db);
+
+          for (unsigned k = 0; rc == SQLITE_OK && k < s->span_count; ++k)
+          {
+               struct DeviceSpan *d = &s->spans[k];
+
+               d->target = serial_target(&map, d);
+               if (d->target < 0)
+               {
+                    rc = SQLITE_NOMEM;
+                    break;
+               }
+
+               sqlite3_bind_int(insert, 1, d->target);
+               sqlite3_bind_text(insert, 2, d->serial, -1, SQLITE_STATIC);
+               sqlite3_bind_text(insert, 3, d->product, -1, SQLITE_STATIC);
+               sqlite3_bind_int64(insert, 4, d->since);
+               rc = sqlite3_step(insert);
+               sqlite3_reset(insert);
+               rc = rc == SQLITE_DONE ? SQLITE_OK : rc;
+
+               if (d->target != d->id)
+               {
+                    printf("%s: sensor %d (%s) is %d\n", s->filename, d->id,
+                           d->serial, d->target);
+               }
+          }
+     }
+
+     sqlite3_finalize(insert);
+     free(map.known);
+     return rc;
+}
+
+
+
+// Move what was staged into sensors, one row per (Id, timestamp_ns), the
+// target's before any staged one...
+static int merge(sqlite3 *db, int rebuild)
+{
+     int rc;
+
+     if (rebuild)
+     {
+          // Cheaper to sort everything once and index afterwards than to
+          // keep the index up to date row by row.  The target's rows go in
+          // below the staged rowids, so MIN(rowid) keeps them.
+          rc = exec(db, "DROP INDEX IF EXISTS sensors_id_timestamp_ns;"
+                        "INSERT INTO temp.staging(rowid, Id, timestamp,"
+                        " inner_temp, outer_temp, timestamp_ns) SELECT -rowid,"
+                        " Id, timestamp, inner_temp, outer_temp, timestamp_ns"
+                        " FROM sensors;"
+                        "DELETE FROM sensors;"
+                        "INSERT INTO sensors SELECT Id, timestamp, inner_temp,"
+                        " outer_temp, timestamp_ns FROM (SELECT *, MIN(rowid)"
+                        " FROM temp.staging GROUP BY Id, timestamp_ns);"
+                        "CREATE INDEX sensors_id_timestamp_ns"
+                        " ON sensors(Id, timestamp_ns);");
+     }
+     else
+     {
+          rc = exec(db, "CREATE INDEX IF NOT EXISTS sensors_id_timestamp_ns"
+                        " ON sensors(Id, timestamp_ns);"
+                        "INSERT INTO sensors SELECT Id, timestamp, inner_temp,"
+                        " outer_temp, timestamp_ns FROM (SELECT *, MIN(rowid)"
+                        " FROM temp.staging s WHERE NOT EXISTS (SELECT 1"
+                        " FROM sensors t WHERE t.Id = s.Id"
+                        " AND t.timestamp_ns = s.timestamp_ns)"
+                        " GROUP BY Id, timestamp_ns);");
+     }
+
+     if (rc == SQLITE_OK)
+     {
+          rc = exec(db, "INSERT INTO devices SELECT Id, serial, product,"
+                        " MIN(since) FROM temp.staged_devices s"
+                        " WHERE NOT EXISTS (SELECT 1 FROM devices d"
+                        " WHERE d.Id = s.Id AND d.serial = s.serial)"
+                        " GROUP BY Id, serial;");
+     }
+
+     return rc;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "j:")) != -1 )
+    {
+         switch (opt)
+         {
+         case 'j': // Reader threads.
+              threads = atoi(optarg);
+              break;
+         default:
+              argc = 0;
+              break;
+         }
+    }
+
+    if ( argc - optind < 2 )
+    {
+         printf("%s\n", "Usage: temper_import [-j threads] <target_db>"
+                        " <source_db>...");
+         return 1;
+    }
+
+    if (threads < 1)
+    { threads = 1; }
+
+    struct Import im = { 0 };
+    const char *target = argv[optind];
+    sqlite3 *db;
+    uint64_t staged = 0;
+    int64_t start = TemperClockNow();
+    int64_t phase;
+
+    im.source_count = argc - optind - 1;
+    if ((unsigned)threads > im.source_count)
+    { threads = im.source_count; }
+    im.sources = calloc(im.source_count, sizeof(*im.sources));
+    for (unsigned i = 0; im.sources && i < im.source_count; ++i)
+    { im.sources[i].filename = argv[optind + 1 + i]; }
+    pthread_mutex_init(&im.lock, NULL);
+    pthread_cond_init(&im.changed, NULL);
+
+    // Two batches per reader, one being filled and one being written.
+    for (int i = 0; im.sources && i < 2 * threads; ++i)
+    {
+         struct ImportBatch *b = malloc(sizeof(*b));
+         if (b)
+         {
+              b->next = im.empty;
+              im.empty = b;
+         }
+    }
+    if (!im.sources || !im.empty)
+    {
+         fprintf(stderr, "Out of memory\n");
+         return 2;
+    }
+
+    int rc = sqlite3_open(target, &db);
+    if (rc != SQLITE_OK)
+    {
+         fprintf(stderr, "Cannot open db: %s\n", sqlite3_errmsg(db));
+         sqlite3_close(db);
+         return 2;
+    }
+
+    rc = prepare_target(db);
+    if (rc == SQLITE_OK)
+    { rc = exec(db, "BEGIN;"); }
+    if (rc == SQLITE_OK)
+    { rc = plan_remap(db, im.sources, im.source_count); }
+    if (rc != SQLITE_OK)
+    {
+         sqlite3_close(db);
+         return 3;
+    }
+
+    // Read in parallel, write staging from here.  Readers take sources
+    // until none are left, so fewer threads than asked still read all.
+    pthread_t tid[threads];
+    int started = 0;
+    im.readers_left = threads;
+    for (int i = 0; i < threads; ++i)
+    {
+         if (pthread_create(&tid[started], NULL, reader, &im) == 0)
+         { ++started; }
+    }
+    if (!started)
+    {
+         fprintf(stderr, "Cannot start a reader thread\n");
+         sqlite3_close(db);
+         return 2;
+    }
+    pthread_mutex_lock(&im.lock);
+    im.readers_left -= threads - started;
+    pthread_mutex_unlock(&im.lock);
+    phase = TemperClockNow();
+    rc = write_staging(db, &im, &staged);
+    for (int i = 0; i < started; ++i)
+    { pthread_join(tid[i], NULL); }
+
+    for (unsigned i = 0; i < im.source_count; ++i)
+    {
+         const struct Source *s = &im.sources[i];
+
+         if (s->rc != SQLITE_OK)
+         {
+              fprintf(stderr, "%s: %s\n", s->filename, sqlite3_errstr(s->rc));
+              rc = s->rc;
+         }
+         else
+         {
+              printf("%s: %llu rows\n", s->filename, (unsigned long long)s->rows);
+         }
+    }
+    if (rc != SQLITE_OK)
+    {
+         fprintf(stderr, "Nothing imported\n");
+         sqlite3_close(db); // Rolls back.
+         return 3;
+    }
+    printf("staged %llu rows from %u files with %d threads in %.2f s\n",
+           (unsigned long long)staged, im.source_count, started,
+           seconds_since(phase));
+
+    phase = TemperClockNow();
+    int64_t before = count_rows(db, "SELECT COUNT(*) FROM sensors;");
+    rc = merge(db, (uint64_t)before < staged);
+    if (rc == SQLITE_OK)
+    { rc = exec(db, "COMMIT;"); }
+    if (rc != SQLITE_OK)
+    {
+         sqlite3_close(db);
+         return 3;
+    }
+
+    int64_t after = count_rows(db, "SELECT COUNT(*) FROM sensors;");
+    printf("merged in %.2f s: %lld rows added, %lld duplicates dropped,"
+           " %lld rows in %s\n", seconds_since(phase),
+           (long long)(after - before), (long long)(staged - (after - before)),
+           (long long)after, target);
+    printf("total %.2f s\n", seconds_since(start));
+
+    sqlite3_close(db);
+    return 0;
+}
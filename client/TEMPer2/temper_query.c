@@ -0,0 +1,213 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+/*
+ * temper_query: print a range of TEMPer history as CSV.
+ */
+
+#include "comm.h"
+#include "live.h"
+#include "query.h"
+#include "sketch.h"
+#include "timestamp.h"
+
+#define MAX_SENSORS 256
+#define MAX_PERCENTILES 32
+
+
+
+// Print a batch of rows, one line each...
+static int print_rows(void *arg, const TemperReading *rows, unsigned count)
+{
+     FILE *out = arg;
+
+     for (unsigned i = 0; i < count; ++i)
+     {
+          fprintf(out, "%d,%lld", rows[i].sensor, (long long)rows[i].timestamp);
+          for (int c = 0; c < TEMPER_CHANNELS; ++c)
+          {
+               if (isnan(rows[i].value[c]))
+               { fputs(",", out); }
+               else
+               { fprintf(out, ",%f", rows[i].value[c]); }
+          }
+          fputc('\n', out);
+     }
+
+     return 0;
+}
+
+
+
+// Merge the sketches of each channel and print the percentiles asked for,
+// one line per channel...
+static int print_percentiles(TemperQueryDb *q, const TemperQuery *query,
+                             const double *percentiles, int count)
+{
+     static const char *const names[TEMPER_CHANNELS] =
+     { "inner_temp", "outer_temp" };
+
+     printf("channel,count");
+     for (int i = 0; i < count; ++i)
+     { printf(",p%g", percentiles[i]); }
+     printf("\n");
+
+     for (int c = 0; c < TEMPER_CHANNELS; ++c)
+     {
+          TemperSketch sketch;
+
+          if (query->channels && !(query->channels & (1u << c)))
+          { continue; }
+
+          TemperSketchInit(&sketch);
+          int rc = TemperQuerySketch(q, query, c, &sketch);
+          if (rc != 0)
+          { return rc; }
+
+          printf("%s,%llu", names[c], (unsigned long long)sketch.count);
+          for (int i = 0; i < count; ++i)
+          {
+               printf(",%f", TemperSketchQuantile(&sketch,
+                                                  percentiles[i] / 100));
+          }
+          printf("\n");
+     }
+
+     return 0;
+}
+
+
+
+// Seconds since the epoch, fractions allowed, to ns...
+static int64_t parse_time(const char *s)
+{
+     return (int64_t)(atof(s) * TEMPER_NS_PER_SEC);
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    TemperQuery query = { INT64_MIN, INT64_MAX, NULL, 0, 0, 0 };
+    int sensors[MAX_SENSORS];
+    const char *live_path = NULL;
+    double percentiles[MAX_PERCENTILES];
+    int percentile_count = 0;
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "f:t:s:c:n:L:p:")) != -1 )
+    {
+         switch (opt)
+         {
+         case 'f': // From, seconds since the epoch.
+              query.from = parse_time(optarg);
+              break;
+         case 't': // To, seconds since the epoch.
+              query.to = parse_time(optarg);
+              break;
+         case 's': // Comma separated sensor numbers.
+              query.sensors = sensors;
+              for (char *s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+              {
+                   char *end;
+                   const long id = strtol(s, &end, 10);
+
+                   if (end == s || *end || id < INT_MIN || id > INT_MAX)
+                   {
+                        fprintf(stderr, "Unknown sensor: %s\n", s);
+                        return 1;
+                   }
+                   if (query.sensor_count == MAX_SENSORS)
+                   {
+                        fprintf(stderr, "Too many sensors, at most %d\n",
+                                MAX_SENSORS);
+                        return 1;
+                   }
+                   sensors[query.sensor_count++] = id;
+              }
+              break;
+         case 'c': // Channel.
+              if (strcmp(optarg, "inner") == 0)
+              { query.channels = TEMPER_QUERY_INNER; }
+              else if (strcmp(optarg, "outer") == 0)
+              { query.channels = TEMPER_QUERY_OUTER; }
+              else
+              {
+                   fprintf(stderr, "Unknown channel: %s\n", optarg);
+                   return 1;
+              }
+              break;
+         case 'n': // Downsample to this many points per sensor.
+              query.points = atoi(optarg);
+              break;
+         case 'L': // The collector's live file, for recent rows.
+              live_path = optarg;
+              break;
+         case 'p': // Comma separated percentiles, from the sketches.
+              for (char *s = strtok(optarg, ","); s &&
+                   percentile_count < MAX_PERCENTILES; s = strtok(NULL, ","))
+              { percentiles[percentile_count++] = atof(s); }
+              break;
+         default:
+              argc = 0;
+              break;
+         }
+    }
+
+    if ( argc - optind < 1 )
+    {
+         printf("%s\n", "Usage: temper_query [-f from] [-t to] [-s id,id,...]"
+                        " [-c inner|outer] [-n points]\n"
+                        "                    [-L live_file] [-p pct,pct,...]"
+                        " <db_filename>");
+         return 1;
+    }
+
+    int rc;
+    TemperQueryDb *q = TemperQueryOpen(argv[optind], &rc);
+    if (!q)
+    {
+         fprintf(stderr, "Cannot open db: %s\n", sqlite3_errstr(rc));
+         return 2;
+    }
+
+    TemperLive *live = NULL;
+    if (live_path)
+    {
+         live = TemperLiveOpen(live_path, &rc);
+         if (!live)
+         {
+              fprintf(stderr, "Cannot open %s: %s\n", live_path,
+                      TemperStrError(rc));
+              TemperQueryClose(q);
+              return 2;
+         }
+         TemperQueryAttachLive(q, live);
+    }
+
+    if (percentile_count)
+    {
+         rc = print_percentiles(q, &query, percentiles, percentile_count);
+    }
+    else
+    {
+         printf("sensor,timestamp_ns,inner_temp,outer_temp\n");
+         rc = TemperQueryRun(q, &query, print_rows, stdout);
+    }
+    if (rc != SQLITE_OK)
+    {
+         fprintf(stderr, "SQL error: %s\n", TemperQueryError(q));
+         TemperQueryClose(q);
+         TemperLiveClose(live);
+         return 3;
+    }
+
+    TemperQueryClose(q);
+    TemperLiveClose(live);
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * temper_sub: print the collector's readings as they are taken.
+ */
+
+#include "comm.h"
+#include "subscribe.h"
+
+#define BATCH 256
+
+
+
+// Print a batch of readings as CSV, drop notices to stderr.  Returns how
+// many readings were printed...
+static unsigned print_rows(const TemperReading *rows, unsigned count)
+{
+     unsigned printed = 0;
+
+     for (unsigned i = 0; i < count; ++i)
+     {
+          if (rows[i].sensor == TEMPER_SUB_DROPPED)
+          {
+               fprintf(stderr, "dropped %lld\n", (long long)rows[i].timestamp);
+               continue;
+          }
+
+          printf("%d,%lld", rows[i].sensor, (long long)rows[i].timestamp);
+          for (int c = 0; c < TEMPER_CHANNELS; ++c)
+          {
+               if (isnan(rows[i].value[c]))
+               { fputs(",", stdout); }
+               else
+               { printf(",%f", rows[i].value[c]); }
+          }
+          fputc('\n', stdout);
+          ++printed;
+     }
+
+     fflush(stdout);
+     return printed;
+}
+
+
+
+int main(int argc, char *argv[])
+{
+    TemperSubscription request = { TEMPER_SUB_BINARY, NULL, 0, 0 };
+    int sensors[TEMPER_SUB_SENSORS];
+    long limit = -1;                    // Readings to print, -1 for ever.
+    int opt;
+
+    while ( (opt = getopt(argc, argv, "js:c:n:")) != -1 )
+    {
+         switch (opt)
+         {
+         case 'j': // JSON lines as the collector sends them.
+              request.format = TEMPER_SUB_JSON;
+              break;
+         case 's': // Comma separated sensor numbers.
+              request.sensors = sensors;
+              for (char *s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+              {
+                   char *end;
+                   const long id = strtol(s, &end, 10);
+
+                   if (end == s || *end || id < INT_MIN || id > INT_MAX)
+                   {
+                        fprintf(stderr, "Unknown sensor: %s\n", s);
+                        return 1;
+                   }
+                   if (request.sensor_count == TEMPER_SUB_SENSORS)
+                   {
+                        fprintf(stderr, "Too many sensors, at most %d\n",
+                                TEMPER_SUB_SENSORS);
+                        return 1;
+                   }
+                   sensors[request.sensor_count++] = id;
+              }
+              break;
+         case 'c': // Channel.
+              if (strcmp(optarg, "inner") == 0)
+              { request.channels = TEMPER_QUERY_INNER; }
+              else if (strcmp(optarg, "outer") == 0)
+              { request.channels = TEMPER_QUERY_OUTER; }
+              else
+              {
+                   fprintf(stderr, "Unknown channel: %s\n", optarg);
+                   return 1;
+              }
+              break;
+         case 'n': // Stop after this many readings.
+              limit = atol(optarg);
+              break;
+         default:
+              argc = 0;
+              break;
+         }
+    }
+
+    if ( argc - optind < 1 )
+    {
+         printf("%s\n", "Usage: temper_sub [-j] [-s id,id,...]"
+                        " [-c inner|outer] [-n count] <socket>");
+         return 1;
+    }
+
+    int rc;
+    TemperSub *sub = TemperSubOpen(argv[optind], &request, &rc);
+    if (!sub)
+    {
+         fprintf(stderr, "Cannot subscribe: %s\n", TemperStrError(rc));
+         return 2;
+    }
+
+    if (request.format == TEMPER_SUB_BINARY)
+    {
+         printf("sensor,timestamp_ns,inner_temp,outer_temp\n");
+    }
+
+    // JSON drop notices are lines like any other and count towards -n.
+    while (limit != 0)
+    {
+         if (request.format == TEMPER_SUB_JSON)
+         {
+              const char *line = TemperSubReadLine(sub, -1, &rc);
+              if (!line)
+              { break; }
+              printf("%s\n", line);
+              fflush(stdout);
+              --limit;
+              continue;
+         }
+
+         TemperReading rows[BATCH];
+         unsigned max = limit > 0 && limit < BATCH ? limit : BATCH;
+
+         rc = TemperSubRead(sub, rows, max, -1);
+         if (rc < 0)
+         { break; }
+         limit -= print_rows(rows, rc);
+    }
+
+    TemperSubClose(sub);
+    if (rc < 0 && rc != -EPIPE)
+    {
+         fprintf(stderr, "Subscription lost: %s\n", TemperStrError(rc));
+         return 3;
+    }
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Reading timestamps in nanoseconds since the epoch, see timestamp.h.
+ */
+
+#include "timestamp.h"
+
+static int64_t anchor;		/* wall clock minus monotonic clock */
+static pthread_once_t anchored = PTHREAD_ONCE_INIT;
+
+
+
+static int64_t TemperClockRead(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	return (int64_t)ts.tv_sec * TEMPER_NS_PER_SEC + ts.tv_nsec;
+}
+
+
+
+static void TemperClockAnchor(void)
+{
+	anchor = TemperClockRead(CLOCK_REALTIME) -
+	         TemperClockRead(CLOCK_MONOTONIC);
+}
+
+
+
+void TemperClockInit(void)
+{
+	pthread_once(&anchored, TemperClockAnchor);
+}
+
+
+
+int64_t TemperClockNow(void)
+{
+	// Whichever thread asks first takes the anchor, the others wait for it.
+	pthread_once(&anchored, TemperClockAnchor);
+	return anchor + TemperClockRead(CLOCK_MONOTONIC);
+}
+
+
+
+int TemperClockSleepUntil(int64_t timestamp)
+{
+	int64_t mono;
+	struct timespec ts;
+
+	pthread_once(&anchored, TemperClockAnchor);
+	mono = timestamp - anchor;
+
+	ts.tv_sec = mono / TEMPER_NS_PER_SEC;
+	ts.tv_nsec = mono % TEMPER_NS_PER_SEC;
+	return -clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+
+
+char *TemperClockFormat(int64_t timestamp, char *buf, size_t len)
+{
+	time_t seconds = (time_t)(timestamp / TEMPER_NS_PER_SEC);
+	long micros = (long)(timestamp % TEMPER_NS_PER_SEC) / 1000;
+	char when[24];
+	struct tm tm;
+
+	localtime_r(&seconds, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(buf, len, "%s.%06ld", when, micros);
+	return buf;
+}
@@ -0,0 +1,34 @@
+#ifndef TEMPER_TIMESTAMP_H
+#define TEMPER_TIMESTAMP_H
+
+/*
+ * Reading timestamps in nanoseconds since the epoch.
+ *
+ * Time is taken from CLOCK_MONOTONIC and placed on the wall clock by an
+ * anchor taken once in TemperClockInit().  NTP or an admin stepping the
+ * wall clock therefore can't reorder readings or stretch a sweep.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TEMPER_NS_PER_SEC 1000000000LL
+#define TEMPER_NS_PER_MS  1000000LL
+
+// Take the anchor now rather than at the first TemperClockNow().  Safe to
+// call from any thread, only the first call counts.
+void TemperClockInit(void);
+
+// Nanoseconds since the epoch, never going backwards.
+int64_t TemperClockNow(void);
+
+// Sleep until TemperClockNow() reaches timestamp, immune to wall clock
+// steps like the timestamps themselves.  Returns 0, or -EINTR when a
+// signal handler ran first, so the caller can see what it asked for.
+int TemperClockSleepUntil(int64_t timestamp);
+
+// Local "YYYY-MM-DD HH:MM:SS.uuuuuu" into buf, which is returned.  Safe to
+// call from any thread.
+char *TemperClockFormat(int64_t timestamp, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,30 @@
+# Python binding of the TEMPer2 history and live readings.
+#
+#   python3 setup.py build_ext --inplace
+#
+# Only the parts of libtemper that don't talk USB are compiled in, so the
+# module builds on any machine with the SQLite headers, no libusb needed.
+
+from setuptools import setup, Extension
+
+LIBTEMPER = '../TEMPer2/'
+
+setup(
+    name='temper',
+    version='1.0.0',
+    description='TEMPer2 rack monitor history and live readings',
+    ext_modules=[
+        Extension(
+            'temper',
+            sources=['tempermodule.c',
+                     LIBTEMPER + 'live.c',
+                     LIBTEMPER + 'query.c',
+                     LIBTEMPER + 'sketch.c',
+                     LIBTEMPER + 'timestamp.c'],
+            include_dirs=[LIBTEMPER],
+            define_macros=[('_DEFAULT_SOURCE', None)],
+            extra_compile_args=['-std=c99'],
+            libraries=['sqlite3', 'm'],
+        ),
+    ],
+)
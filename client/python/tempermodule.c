@@ -0,0 +1,967 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sqlite3.h>
+
+/*
+ * Python binding of the TEMPer2 history and live readings.
+ *
+ * Database.range() runs a TemperQuery with the GIL released and copies the
+ * rows straight into one C array per column.  The arrays are handed to
+ * Python as Column objects that export the buffer protocol, so
+ * numpy.asarray() or memoryview() use them without a copy and no Python
+ * object is created per row.
+ */
+
+#include "live.h"
+#include "query.h"
+#include "sketch.h"
+
+static PyObject *TemperError;
+
+
+
+/* A contiguous column of one C type, owned by the object. */
+typedef struct
+{
+	PyObject_HEAD
+	void *data;
+	Py_ssize_t count;
+	Py_ssize_t itemsize;
+	char format[2];
+} Column;
+
+
+
+static void Column_dealloc(Column *self)
+{
+	free(self->data);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+
+static int Column_getbuffer(Column *self, Py_buffer *view, int flags)
+{
+	int ret = PyBuffer_FillInfo(view, (PyObject *)self, self->data,
+	                            self->count * self->itemsize, 1, flags);
+
+	if (ret < 0)
+		return ret;
+
+	view->itemsize = self->itemsize;
+	view->format = (flags & PyBUF_FORMAT) ? self->format : NULL;
+	view->ndim = 1;
+	view->shape = (flags & PyBUF_ND) ? &self->count : NULL;
+	view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ?
+	                &view->itemsize : NULL;
+	return 0;
+}
+
+
+
+static Py_ssize_t Column_length(Column *self)
+{
+	return self->count;
+}
+
+
+
+static PyObject *Column_repr(Column *self)
+{
+	return PyUnicode_FromFormat("<temper.Column '%s' of %zd>",
+	                            self->format, self->count);
+}
+
+
+
+static PyBufferProcs Column_as_buffer = {
+	.bf_getbuffer = (getbufferproc)Column_getbuffer,
+};
+
+static PySequenceMethods Column_as_sequence = {
+	.sq_length = (lenfunc)Column_length,
+};
+
+static PyTypeObject ColumnType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "temper.Column",
+	.tp_doc = "One column of a range, use numpy.asarray() or memoryview().",
+	.tp_basicsize = sizeof(Column),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_dealloc = (destructor)Column_dealloc,
+	.tp_repr = (reprfunc)Column_repr,
+	.tp_as_buffer = &Column_as_buffer,
+	.tp_as_sequence = &Column_as_sequence,
+};
+
+
+
+// Wrap data, taking ownership even on failure.
+static PyObject *ColumnWrap(void *data, Py_ssize_t count, Py_ssize_t itemsize,
+                            char format)
+{
+	Column *c = PyObject_New(Column, &ColumnType);
+
+	if (!c)
+        {
+		free(data);
+		return NULL;
+	}
+
+	c->data = data;
+	c->count = count;
+	c->itemsize = itemsize;
+	c->format[0] = format;
+	c->format[1] = '\0';
+	return (PyObject *)c;
+}
+
+
+
+/* Columns being filled by TemperQueryRun, without the GIL. */
+struct Fill
+{
+	int32_t *sensor;
+	int64_t *timestamp;
+	float *value[TEMPER_CHANNELS];
+	size_t count;
+	size_t capacity;
+	int nomem;
+};
+
+
+
+static int FillGrow(struct Fill *f, size_t need)
+{
+	size_t capacity = f->capacity ? f->capacity : 4096;
+	void *p;
+
+	while (capacity < need)
+		capacity *= 2;
+
+	if (!(p = realloc(f->sensor, capacity * sizeof(*f->sensor))))
+		return -ENOMEM;
+	f->sensor = p;
+	if (!(p = realloc(f->timestamp, capacity * sizeof(*f->timestamp))))
+		return -ENOMEM;
+	f->timestamp = p;
+	for (int c = 0; c < TEMPER_CHANNELS; ++c)
+        {
+		if (!(p = realloc(f->value[c], capacity * sizeof(float))))
+			return -ENOMEM;
+		f->value[c] = p;
+	}
+
+	f->capacity = capacity;
+	return 0;
+}
+
+
+
+static int FillRows(void *arg, const TemperReading *rows, unsigned count)
+{
+	struct Fill *f = arg;
+
+	if (f->count + count > f->capacity &&
+	    FillGrow(f, f->count + count) < 0)
+        {
+		f->nomem = 1;
+		return 1;
+	}
+
+	for (unsigned i = 0; i < count; ++i)
+        {
+		size_t n = f->count + i;
+
+		f->sensor[n] = rows[i].sensor;
+		f->timestamp[n] = rows[i].timestamp;
+		for (int c = 0; c < TEMPER_CHANNELS; ++c)
+			f->value[c][n] = rows[i].value[c];
+	}
+	f->count += count;
+	return 0;
+}
+
+
+
+static void FillFree(struct Fill *f)
+{
+	free(f->sensor);
+	free(f->timestamp);
+	for (int c = 0; c < TEMPER_CHANNELS; ++c)
+		free(f->value[c]);
+}
+
+
+
+// Give back what doubling left unused, the columns may live long.
+static void *FillShrink(void *p, size_t size)
+{
+	void *q = realloc(p, size ? size : 1);
+
+	return q ? q : p;
+}
+
+
+
+// Take lock, letting other threads run while someone else holds it.
+static void Acquire(PyThread_type_lock lock)
+{
+	if (!PyThread_acquire_lock(lock, NOWAIT_LOCK))
+        {
+		Py_BEGIN_ALLOW_THREADS
+		PyThread_acquire_lock(lock, WAIT_LOCK);
+		Py_END_ALLOW_THREADS
+	}
+}
+
+
+
+// A Database is one TemperQueryDb, one SQLite connection.  Its methods run
+// without the GIL, so lock serialises them and keeps close() or another
+// __init__() from freeing q under a query.
+typedef struct
+{
+	PyObject_HEAD
+	TemperQueryDb *q;
+	PyThread_type_lock lock;
+} Database;
+
+
+
+static PyObject *Database_new(PyTypeObject *type, PyObject *args,
+                              PyObject *kwds)
+{
+	Database *self = (Database *)type->tp_alloc(type, 0);
+
+	if (self && !(self->lock = PyThread_allocate_lock()))
+        {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+	return (PyObject *)self;
+}
+
+
+
+static int Database_init(Database *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "filename", NULL };
+	PyObject *path;
+	int rc;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
+	                                 PyUnicode_FSConverter, &path))
+		return -1;
+
+	Acquire(self->lock);
+	TemperQueryClose(self->q);
+	self->q = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	self->q = TemperQueryOpen(PyBytes_AS_STRING(path), &rc);
+	Py_END_ALLOW_THREADS
+	PyThread_release_lock(self->lock);
+
+	if (!self->q)
+        {
+		PyErr_Format(TemperError, "%s: %s", PyBytes_AS_STRING(path),
+		             sqlite3_errstr(rc));
+		Py_DECREF(path);
+		return -1;
+	}
+
+	Py_DECREF(path);
+	return 0;
+}
+
+
+
+static void Database_dealloc(Database *self)
+{
+	TemperQueryClose(self->q);
+	if (self->lock)
+		PyThread_free_lock(self->lock);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+
+// Take the lock and check the database is open.  Returns 0 holding the
+// lock, or -1 with an exception set and without it.
+static int DatabaseCheck(Database *self)
+{
+	Acquire(self->lock);
+	if (!self->q)
+        {
+		PyThread_release_lock(self->lock);
+		PyErr_SetString(TemperError, "database is closed");
+		return -1;
+	}
+	return 0;
+}
+
+
+
+// Raise the last SQLite error of q and let go of the lock.
+static void *DatabaseError(Database *self)
+{
+	PyErr_SetString(TemperError, TemperQueryError(self->q));
+	PyThread_release_lock(self->lock);
+	return NULL;
+}
+
+
+
+static PyObject *Database_close(Database *self, PyObject *unused)
+{
+	Acquire(self->lock);
+	TemperQueryClose(self->q);
+	self->q = NULL;
+	PyThread_release_lock(self->lock);
+	Py_RETURN_NONE;
+}
+
+
+
+static PyObject *Database_sensors(Database *self, PyObject *unused)
+{
+	int buffer[TEMPER_MAX_DEVICES];
+	int *ids = buffer;
+	unsigned size = TEMPER_MAX_DEVICES;
+	int count;
+
+	if (DatabaseCheck(self) < 0)
+		return NULL;
+
+	// Derived sensors are numbered from 1000, so there can be more than
+	// TEMPER_MAX_DEVICES.  Ask again with room for all of them.
+	for (;;)
+        {
+		Py_BEGIN_ALLOW_THREADS
+		count = TemperQuerySensors(self->q, ids, size);
+		Py_END_ALLOW_THREADS
+		if (count < 0 || (unsigned)count <= size)
+			break;
+
+		if (ids != buffer)
+			PyMem_Free(ids);
+		size = count;
+		if (!(ids = PyMem_Malloc(size * sizeof(*ids))))
+                {
+			PyThread_release_lock(self->lock);
+			return PyErr_NoMemory();
+		}
+	}
+	if (count < 0)
+        {
+		if (ids != buffer)
+			PyMem_Free(ids);
+		return DatabaseError(self);
+	}
+	PyThread_release_lock(self->lock);
+
+	PyObject *list = PyList_New(0);
+	for (int i = 0; list && i < count; ++i)
+        {
+		PyObject *id = PyLong_FromLong(ids[i]);
+
+		if (!id || PyList_Append(list, id) < 0)
+			Py_CLEAR(list);
+		Py_XDECREF(id);
+	}
+	if (ids != buffer)
+		PyMem_Free(ids);
+	return list;
+}
+
+
+
+// Sensor ids from None or an iterable of ints.
+static int ParseSensors(PyObject *obj, int *ids, unsigned *count)
+{
+	PyObject *seq, *item;
+
+	*count = 0;
+	if (obj == Py_None)
+		return 0;
+
+	if (!(seq = PySequence_Fast(obj, "sensors must be a sequence")))
+		return -1;
+
+	if (PySequence_Fast_GET_SIZE(seq) > TEMPER_MAX_DEVICES)
+        {
+		PyErr_SetString(PyExc_ValueError, "too many sensors");
+		Py_DECREF(seq);
+		return -1;
+	}
+
+	for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); ++i)
+        {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+		ids[i] = (int)PyLong_AsLong(item);
+		if (ids[i] == -1 && PyErr_Occurred())
+                {
+			Py_DECREF(seq);
+			return -1;
+		}
+	}
+
+	*count = (unsigned)PySequence_Fast_GET_SIZE(seq);
+	Py_DECREF(seq);
+	return 0;
+}
+
+
+
+// TEMPER_QUERY_* mask from NULL, "all", "inner" or "outer".
+static int ParseChannels(const char *channels, unsigned *mask)
+{
+	if (!channels || !strcmp(channels, "all"))
+		*mask = TEMPER_QUERY_ALL;
+	else if (!strcmp(channels, "inner"))
+		*mask = TEMPER_QUERY_INNER;
+	else if (!strcmp(channels, "outer"))
+		*mask = TEMPER_QUERY_OUTER;
+	else
+        {
+		PyErr_Format(PyExc_ValueError, "unknown channels: %s",
+		             channels);
+		return -1;
+	}
+	return 0;
+}
+
+
+
+static PyObject *Database_range(Database *self, PyObject *args,
+                                PyObject *kwds)
+{
+	static char *kwlist[] = { "start", "end", "sensors", "channels",
+	                          "points", NULL };
+	PyObject *start = Py_None, *end = Py_None, *sensors = Py_None;
+	const char *channels = NULL;
+	unsigned points = 0;
+	int ids[TEMPER_MAX_DEVICES];
+	TemperQuery query = { INT64_MIN, INT64_MAX, NULL, 0, 0, 0 };
+	struct Fill f = { NULL };
+	int rc;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOOzI", kwlist,
+	                                 &start, &end, &sensors, &channels,
+	                                 &points))
+		return NULL;
+
+	if (start != Py_None &&
+	    (query.from = PyLong_AsLongLong(start)) == -1 && PyErr_Occurred())
+		return NULL;
+	if (end != Py_None &&
+	    (query.to = PyLong_AsLongLong(end)) == -1 && PyErr_Occurred())
+		return NULL;
+	if (ParseSensors(sensors, ids, &query.sensor_count) < 0)
+		return NULL;
+	if (query.sensor_count)
+		query.sensors = ids;
+
+	if (ParseChannels(channels, &query.channels) < 0)
+		return NULL;
+	query.points = points;
+
+	if (DatabaseCheck(self) < 0)
+		return NULL;
+	Py_BEGIN_ALLOW_THREADS
+	rc = TemperQueryRun(self->q, &query, FillRows, &f);
+	Py_END_ALLOW_THREADS
+
+	if (f.nomem || rc != SQLITE_OK)
+        {
+		FillFree(&f);
+		if (!f.nomem)
+			return DatabaseError(self);
+		PyThread_release_lock(self->lock);
+		return PyErr_NoMemory();
+	}
+	PyThread_release_lock(self->lock);
+
+	// Every ColumnWrap owns its array from here, even when it fails.
+	PyObject *sensor = ColumnWrap(FillShrink(f.sensor, f.count * 4),
+	                              f.count, 4, 'i');
+	PyObject *timestamp = ColumnWrap(FillShrink(f.timestamp, f.count * 8),
+	                                 f.count, 8, 'q');
+	PyObject *inner = ColumnWrap(FillShrink(f.value[0], f.count * 4),
+	                             f.count, 4, 'f');
+	PyObject *outer = ColumnWrap(FillShrink(f.value[1], f.count * 4),
+	                             f.count, 4, 'f');
+	PyObject *result = NULL;
+
+	if (sensor && timestamp && inner && outer)
+		result = Py_BuildValue("{sOsOsOsO}", "sensor", sensor,
+		                       "timestamp", timestamp,
+		                       "inner_temp", inner,
+		                       "outer_temp", outer);
+
+	Py_XDECREF(sensor);
+	Py_XDECREF(timestamp);
+	Py_XDECREF(inner);
+	Py_XDECREF(outer);
+	return result;
+}
+
+
+
+static PyObject *Database_quantiles(Database *self, PyObject *args,
+                                    PyObject *kwds)
+{
+	static char *kwlist[] = { "q", "start", "end", "sensors", "channels",
+	                          NULL };
+	static const char *const names[TEMPER_CHANNELS] =
+		{ "inner_temp", "outer_temp" };
+	PyObject *qs, *start = Py_None, *end = Py_None, *sensors = Py_None;
+	const char *channels = NULL;
+	int ids[TEMPER_MAX_DEVICES];
+	TemperQuery query = { INT64_MIN, INT64_MAX, NULL, 0, 0, 0 };
+	TemperSketch sketch[TEMPER_CHANNELS];
+	int rc = SQLITE_OK;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OOOz", kwlist, &qs,
+	                                 &start, &end, &sensors, &channels))
+		return NULL;
+
+	if (!(qs = PySequence_Fast(qs, "q must be a sequence")))
+		return NULL;
+
+	if ((start != Py_None &&
+	     (query.from = PyLong_AsLongLong(start)) == -1 && PyErr_Occurred()) ||
+	    (end != Py_None &&
+	     (query.to = PyLong_AsLongLong(end)) == -1 && PyErr_Occurred()) ||
+	    ParseSensors(sensors, ids, &query.sensor_count) < 0 ||
+	    ParseChannels(channels, &query.channels) < 0)
+        {
+		Py_DECREF(qs);
+		return NULL;
+	}
+	if (query.sensor_count)
+		query.sensors = ids;
+
+	if (DatabaseCheck(self) < 0)
+        {
+		Py_DECREF(qs);
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	for (int c = 0; c < TEMPER_CHANNELS && rc == SQLITE_OK; ++c)
+        {
+		TemperSketchInit(&sketch[c]);
+		if (query.channels & (1u << c))
+			rc = TemperQuerySketch(self->q, &query, c, &sketch[c]);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (rc != SQLITE_OK)
+        {
+		Py_DECREF(qs);
+		return DatabaseError(self);
+	}
+	PyThread_release_lock(self->lock);
+
+	PyObject *result = PyDict_New();
+	for (int c = 0; result && c < TEMPER_CHANNELS; ++c)
+        {
+		if (!(query.channels & (1u << c)))
+			continue;
+
+		PyObject *values = PyList_New(PySequence_Fast_GET_SIZE(qs));
+		for (Py_ssize_t i = 0; values && i < PyList_GET_SIZE(values); ++i)
+                {
+			double q = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(qs, i));
+			PyObject *v = (q == -1 && PyErr_Occurred()) ? NULL :
+				PyFloat_FromDouble(TemperSketchQuantile(&sketch[c], q));
+
+			if (!v)
+				Py_CLEAR(values);
+			else
+				PyList_SET_ITEM(values, i, v);
+		}
+		if (!values || PyDict_SetItemString(result, names[c], values) < 0)
+			Py_CLEAR(result);
+		Py_XDECREF(values);
+	}
+
+	Py_DECREF(qs);
+	return result;
+}
+
+
+
+static PyMethodDef Database_methods[] = {
+	{ "range", (PyCFunction)(void (*)(void))Database_range,
+	  METH_VARARGS | METH_KEYWORDS,
+	  "range(start=None, end=None, sensors=None, channels='all', points=0)\n"
+	  "\n"
+	  "Readings with start <= timestamp < end in ns since the epoch, as a\n"
+	  "dict of Columns: sensor (int32), timestamp (int64 ns), inner_temp\n"
+	  "and outer_temp (float32, NaN when not asked for).  points > 0\n"
+	  "averages every sensor down to that many rows." },
+	{ "quantiles", (PyCFunction)(void (*)(void))Database_quantiles,
+	  METH_VARARGS | METH_KEYWORDS,
+	  "quantiles(q, start=None, end=None, sensors=None, channels='all')\n"
+	  "\n"
+	  "Quantiles q (each in [0, 1]) of the readings of all the sensors\n"
+	  "together, from the stored sketches, as {'inner_temp': [...],\n"
+	  "'outer_temp': [...]}.  Within 1% of a true value, the range is\n"
+	  "rounded to the collector's sketch buckets." },
+	{ "sensors", (PyCFunction)Database_sensors, METH_NOARGS,
+	  "Sensor numbers present in the database." },
+	{ "close", (PyCFunction)Database_close, METH_NOARGS,
+	  "Close the database." },
+	{ NULL }
+};
+
+static PyTypeObject DatabaseType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "temper.Database",
+	.tp_doc = "Database(filename), history written by temper.",
+	.tp_basicsize = sizeof(Database),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = Database_new,
+	.tp_init = (initproc)Database_init,
+	.tp_dealloc = (destructor)Database_dealloc,
+	.tp_methods = Database_methods,
+};
+
+
+
+// Like Database, range() reads the mapping without the GIL, so lock keeps
+// __init__() from unmapping it meanwhile.
+typedef struct
+{
+	PyObject_HEAD
+	TemperLive *live;
+	PyThread_type_lock lock;
+} Live;
+
+
+
+static PyObject *Live_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	Live *self = (Live *)type->tp_alloc(type, 0);
+
+	if (self && !(self->lock = PyThread_allocate_lock()))
+        {
+		Py_DECREF(self);
+		return PyErr_NoMemory();
+	}
+	return (PyObject *)self;
+}
+
+
+
+static int Live_init(Live *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "path", NULL };
+	PyObject *path;
+	int err;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", kwlist,
+	                                 PyUnicode_FSConverter, &path))
+		return -1;
+
+	Acquire(self->lock);
+	TemperLiveClose(self->live);
+	self->live = TemperLiveOpen(PyBytes_AS_STRING(path), &err);
+	PyThread_release_lock(self->lock);
+	if (!self->live)
+        {
+		PyErr_Format(TemperError, "%s: %s", PyBytes_AS_STRING(path),
+		             strerror(-err));
+		Py_DECREF(path);
+		return -1;
+	}
+
+	Py_DECREF(path);
+	return 0;
+}
+
+
+
+static void Live_dealloc(Live *self)
+{
+	TemperLiveClose(self->live);
+	if (self->lock)
+		PyThread_free_lock(self->lock);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+
+// Take the lock and check the file is open, like DatabaseCheck().
+static int LiveCheck(Live *self)
+{
+	Acquire(self->lock);
+	if (!self->live)
+        {
+		PyThread_release_lock(self->lock);
+		PyErr_SetString(TemperError, "live file is not open");
+		return -1;
+	}
+	return 0;
+}
+
+
+
+// Copy the latest reading of sensor, raising for a slot left half written.
+// Returns 1, 0 without a reading or -1.
+static int LiveRead(Live *self, int sensor, TemperReading *r)
+{
+	int ret = TemperLiveRead(self->live, sensor, r);
+
+	if (ret < 0)
+        {
+		PyErr_Format(TemperError, "sensor %d: %s", sensor,
+		             strerror(-ret));
+		return -1;
+	}
+	return ret;
+}
+
+
+
+static PyObject *ReadingTuple(const TemperReading *r)
+{
+	return Py_BuildValue("(Ldd)", (long long)r->timestamp,
+	                     (double)r->value[0], (double)r->value[1]);
+}
+
+
+
+static PyObject *Live_read(Live *self, PyObject *args)
+{
+	TemperReading r;
+	int sensor;
+
+	if (!PyArg_ParseTuple(args, "i", &sensor) || LiveCheck(self) < 0)
+		return NULL;
+
+	int ret = LiveRead(self, sensor, &r);
+	PyThread_release_lock(self->lock);
+	if (ret < 0)
+		return NULL;
+	if (!ret)
+		Py_RETURN_NONE;
+
+	return ReadingTuple(&r);
+}
+
+
+
+static PyObject *Live_readings(Live *self, PyObject *unused)
+{
+	PyObject *dict;
+	TemperReading r;
+	int ret;
+
+	if (LiveCheck(self) < 0)
+		return NULL;
+
+	dict = PyDict_New();
+	for (int i = 0; dict && i < TemperLiveSlots(self->live); ++i)
+        {
+		if ((ret = LiveRead(self, i, &r)) < 0)
+			Py_CLEAR(dict);
+		if (ret <= 0)
+			continue;
+
+		PyObject *key = PyLong_FromLong(i);
+		PyObject *value = ReadingTuple(&r);
+
+		if (!key || !value || PyDict_SetItem(dict, key, value) < 0)
+			Py_CLEAR(dict);
+		Py_XDECREF(key);
+		Py_XDECREF(value);
+	}
+	PyThread_release_lock(self->lock);
+	return dict;
+}
+
+
+
+// Optional start and end in ns, None for open ended.
+static int ParseWindow(PyObject *start, PyObject *end, int64_t *from,
+                       int64_t *to)
+{
+	*from = INT64_MIN;
+	*to = INT64_MAX;
+	if (start != Py_None &&
+	    (*from = PyLong_AsLongLong(start)) == -1 && PyErr_Occurred())
+		return -1;
+	if (end != Py_None &&
+	    (*to = PyLong_AsLongLong(end)) == -1 && PyErr_Occurred())
+		return -1;
+	return 0;
+}
+
+
+
+static PyObject *Live_range(Live *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "sensor", "start", "end", NULL };
+	PyObject *start = Py_None, *end = Py_None;
+	int64_t from, to;
+	unsigned depth, n;
+	int sensor;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|OO", kwlist, &sensor,
+	                                 &start, &end) ||
+	    ParseWindow(start, end, &from, &to) < 0 || LiveCheck(self) < 0)
+		return NULL;
+
+	depth = TemperLiveDepth(self->live);
+	TemperReading *rows = malloc((depth ? depth : 1) * sizeof(*rows));
+	int64_t *timestamp = malloc((depth ? depth : 1) * 8);
+	float *inner = malloc((depth ? depth : 1) * 4);
+	float *outer = malloc((depth ? depth : 1) * 4);
+
+	if (!rows || !timestamp || !inner || !outer)
+        {
+		free(rows);
+		free(timestamp);
+		free(inner);
+		free(outer);
+		PyThread_release_lock(self->lock);
+		return PyErr_NoMemory();
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	n = TemperLiveRange(self->live, sensor, from, to, rows, depth);
+	for (unsigned i = 0; i < n; ++i)
+        {
+		timestamp[i] = rows[i].timestamp;
+		inner[i] = rows[i].value[0];
+		outer[i] = rows[i].value[1];
+	}
+	Py_END_ALLOW_THREADS
+	PyThread_release_lock(self->lock);
+	free(rows);
+
+	PyObject *ts = ColumnWrap(FillShrink(timestamp, n * 8), n, 8, 'q');
+	PyObject *in = ColumnWrap(FillShrink(inner, n * 4), n, 4, 'f');
+	PyObject *out = ColumnWrap(FillShrink(outer, n * 4), n, 4, 'f');
+	PyObject *result = NULL;
+
+	if (ts && in && out)
+		result = Py_BuildValue("{sOsOsO}", "timestamp", ts,
+		                       "inner_temp", in, "outer_temp", out);
+
+	Py_XDECREF(ts);
+	Py_XDECREF(in);
+	Py_XDECREF(out);
+	return result;
+}
+
+
+
+static PyObject *Live_stats(Live *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = { "sensor", "start", "end", NULL };
+	PyObject *start = Py_None, *end = Py_None;
+	TemperLiveStats stats;
+	int64_t from, to;
+	int sensor;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|OO", kwlist, &sensor,
+	                                 &start, &end) ||
+	    ParseWindow(start, end, &from, &to) < 0 || LiveCheck(self) < 0)
+		return NULL;
+
+	unsigned count = TemperLiveSummary(self->live, sensor, from, to, &stats);
+	PyThread_release_lock(self->lock);
+	if (!count)
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("{sIsLsLs(dd)s(dd)s(dd)}",
+	                     "count", stats.count,
+	                     "first", (long long)stats.first,
+	                     "last", (long long)stats.last,
+	                     "min", (double)stats.min[0], (double)stats.min[1],
+	                     "max", (double)stats.max[0], (double)stats.max[1],
+	                     "mean", (double)stats.mean[0],
+	                     (double)stats.mean[1]);
+}
+
+
+
+static PyMethodDef Live_methods[] = {
+	{ "read", (PyCFunction)Live_read, METH_VARARGS,
+	  "read(sensor) -> (timestamp_ns, inner_temp, outer_temp) or None" },
+	{ "readings", (PyCFunction)Live_readings, METH_NOARGS,
+	  "Latest reading of every sensor, {sensor: (timestamp_ns, inner, "
+	  "outer)}" },
+	{ "range", (PyCFunction)(void (*)(void))Live_range,
+	  METH_VARARGS | METH_KEYWORDS,
+	  "range(sensor, start=None, end=None)\n"
+	  "\n"
+	  "Recent readings of sensor still in the ring, as a dict of Columns:\n"
+	  "timestamp (int64 ns), inner_temp and outer_temp (float32)." },
+	{ "stats", (PyCFunction)(void (*)(void))Live_stats,
+	  METH_VARARGS | METH_KEYWORDS,
+	  "stats(sensor, start=None, end=None) -> {count, first, last, min,\n"
+	  "max, mean} of the ring readings, (inner, outer) pairs, or None." },
+	{ NULL }
+};
+
+static PyTypeObject LiveType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "temper.Live",
+	.tp_doc = "Live(path), the latest and recent readings of a collector\n"
+	          "run with -L.",
+	.tp_basicsize = sizeof(Live),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_new = Live_new,
+	.tp_init = (initproc)Live_init,
+	.tp_dealloc = (destructor)Live_dealloc,
+	.tp_methods = Live_methods,
+};
+
+
+
+static struct PyModuleDef TemperModule = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "temper",
+	.m_doc = "TEMPer2 rack monitor history and live readings.",
+	.m_size = -1,
+};
+
+
+
+PyMODINIT_FUNC PyInit_temper(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&ColumnType) < 0 || PyType_Ready(&DatabaseType) < 0 ||
+	    PyType_Ready(&LiveType) < 0)
+		return NULL;
+
+	if (!(m = PyModule_Create(&TemperModule)))
+		return NULL;
+
+	TemperError = PyErr_NewException("temper.Error", NULL, NULL);
+	Py_XINCREF(TemperError);
+	Py_INCREF(&ColumnType);
+	Py_INCREF(&DatabaseType);
+	Py_INCREF(&LiveType);
+	if (PyModule_AddObject(m, "Error", TemperError) < 0 ||
+	    PyModule_AddObject(m, "Column", (PyObject *)&ColumnType) < 0 ||
+	    PyModule_AddObject(m, "Database", (PyObject *)&DatabaseType) < 0 ||
+	    PyModule_AddObject(m, "Live", (PyObject *)&LiveType) < 0)
+        {
+		Py_DECREF(m);
+		return NULL;
+	}
+
+	return m;
+}
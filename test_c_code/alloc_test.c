@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+#include "alloc.h"
+#include "sinks.h"
+#include "timestamp.h"
+
+// Store steady sweeps the way the collector does, through the sqlite and
+// live sinks on the calling thread, and check that once warmed up they
+// don't allocate, see alloc.h.  Built with TEMPER_ALLOC_COUNT.
+
+#define DB "alloc_test.db"
+#define LIVE "alloc_test.live"
+#define DEVICES 4
+#define SWEEPS 500
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void sweep(Pipeline *p, TemperReading *rows, int n)
+{
+    for (int i = 0; i < DEVICES; ++i)
+    {
+        rows[i].sensor = i;
+        rows[i].timestamp = (int64_t)n * TEMPER_NS_PER_SEC + i;
+        rows[i].value[0] = 21.5f + 0.01f * (n % 50);
+        rows[i].value[1] = 36.5f;
+    }
+    PipelineSubmit(p, rows, DEVICES);
+}
+
+static int count_rows(sqlite3 *db)
+{
+    sqlite3_stmt *stmt;
+    int rows = -1;
+
+    if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM sensors;", -1, &stmt,
+                           NULL) == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        { rows = sqlite3_column_int(stmt, 0); }
+        sqlite3_finalize(stmt);
+    }
+    return rows;
+}
+
+int main(void)
+{
+    TemperReading rows[DEVICES];
+    Pipeline pipeline;
+    sqlite3 *db;
+    char sql[64];
+    int err;
+
+    // The counter counts, through a pointer the compiler can't drop.
+    uint64_t before = TemperAllocCount();
+    void *volatile block = malloc(16);
+    free(block);
+    check(TemperAllocCount() == before + 1, "allocations counted");
+
+    unlink(DB);
+    check(TemperSqliteHeapInit() == SQLITE_OK, "heap set up");
+    if (sqlite3_open(DB, &db) != SQLITE_OK)
+    {
+        fprintf(stderr, "alloc_test: %s\n", sqlite3_errmsg(db));
+        return 1;
+    }
+    snprintf(sql, sizeof(sql), "PRAGMA cache_size = %d;", TEMPER_SQLITE_PAGES);
+    check(sqlite3_exec(db, sql, NULL, NULL, NULL) == SQLITE_OK &&
+          sqlite3_exec(db, "PRAGMA journal_mode = WAL;"
+                       "CREATE TABLE sensors(Id INT, timestamp INT,"
+                       " inner_temp FLOAT, outer_temp FLOAT, timestamp_ns INT);"
+                       "CREATE INDEX sensors_id_timestamp_ns"
+                       " ON sensors(Id, timestamp_ns);",
+                       NULL, NULL, NULL) == SQLITE_OK, "database set up");
+
+    TemperLive *live = TemperLiveCreate(LIVE, 64, &err);
+    check(live != NULL, "live file created");
+
+    PipelineInit(&pipeline);
+    check(SinkAdd(&pipeline, "sqlite", db) == 0, "sqlite sink");
+    check(!live || SinkAddLive(&pipeline, live) == 0, "live sink");
+    check(PipelineStart(&pipeline) == 0, "pipeline started");
+    memset(rows, 0, sizeof(rows));
+
+    int n = 0;
+    while (n < TEMPER_ALLOC_WARMUP)
+    { sweep(&pipeline, rows, n++); }
+
+    uint64_t steady = 0;
+    while (n < TEMPER_ALLOC_WARMUP + SWEEPS)
+    {
+        before = TemperAllocCount();
+        sweep(&pipeline, rows, n++);
+        steady += TemperAllocCount() - before;
+    }
+    if (steady)
+    {
+        fprintf(stderr, "alloc_test: %llu allocations in %d sweeps\n",
+                (unsigned long long)steady, SWEEPS);
+    }
+    check(steady == 0, "steady sweeps don't allocate");
+
+    check(PipelineClose(&pipeline) == 0, "pipeline closed");
+    check(count_rows(db) == n * DEVICES, "every row stored");
+    sqlite3_close(db);
+    if (live)
+    { TemperLiveClose(live); }
+    unlink(DB);
+    unlink(DB "-wal");
+    unlink(DB "-shm");
+    unlink(LIVE);
+
+    if (failures)
+    {
+        fprintf(stderr, "alloc_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("alloc_test: ok, %d sweeps\n", SWEEPS);
+    return 0;
+}
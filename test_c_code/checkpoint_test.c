@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "stages.h"
+#include "timestamp.h"
+
+// Write checkpoints, read them back and carry an aggregate stage's window
+// over into a new pipeline, see checkpoint.h and PipelineSave().  Also the
+// aggregate's means of filtered readings.
+
+#define PATH "checkpoint_test.ckp"
+#define TAG_NUMBER 1
+#define TAG_PIPELINE 2
+#define MAX_ROWS 16
+
+static int failures = 0;
+static TemperReading got[MAX_ROWS];
+static unsigned got_count = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+// A sink that keeps what reaches it.
+static int keep(void *state, const TemperReading *rows, unsigned count,
+                PipelineNode *out)
+{
+    for (unsigned i = 0; i < count && got_count < MAX_ROWS; ++i)
+    { got[got_count++] = rows[i]; }
+    return 0;
+}
+
+static const PipelineOps KeepOps = { "keep", keep, NULL, NULL, NULL, NULL };
+
+struct Loaded
+{
+    int records;
+    int number;
+    Pipeline *pipeline;
+    int restored;
+};
+
+static int load(void *arg, uint32_t tag, const void *data, uint32_t size)
+{
+    struct Loaded *l = arg;
+
+    ++l->records;
+    if (tag == TAG_NUMBER && size == sizeof(l->number))
+    { memcpy(&l->number, data, size); }
+    if (tag == TAG_PIPELINE && l->pipeline)
+    { l->restored = PipelineRestore(l->pipeline, data, size); }
+    return 0;
+}
+
+static void build(Pipeline *p, const char *aggregate)
+{
+    PipelineInit(p);
+    check(StageAdd(p, aggregate, NULL, NULL, NULL) == 0, "aggregate stage");
+    check(PipelineAdd(p, 1, &KeepOps, NULL, 0) == 0, "sink added");
+}
+
+static void submit(Pipeline *p, int seconds, float value)
+{
+    TemperReading r;
+
+    memset(&r, 0, sizeof(r));
+    r.timestamp = (int64_t)seconds * TEMPER_NS_PER_SEC;
+    r.value[0] = value;
+    r.value[1] = value + 10;
+    PipelineSubmit(p, &r, 1);
+}
+
+static void file_format(void)
+{
+    Checkpoint c;
+    struct Loaded l;
+    const int number = 42, other = 7;
+    FILE *f;
+
+    unlink(PATH);
+    memset(&l, 0, sizeof(l));
+    check(CheckpointLoad(PATH, load, &l) == -ENOENT, "no checkpoint yet");
+
+    check(CheckpointBegin(&c, PATH) == 0, "begin");
+    CheckpointRecord(&c, TAG_NUMBER, &number, sizeof(number));
+    CheckpointRecordBegin(&c, 99);
+    fputs("written in place", CheckpointFile(&c));
+    CheckpointRecordEnd(&c);
+    check(CheckpointCommit(&c) == 0, "commit");
+
+    check(CheckpointLoad(PATH, load, &l) == 0, "load");
+    check(l.records == 2 && l.number == 42, "records read back");
+
+    // An aborted checkpoint leaves the last one in place.
+    check(CheckpointBegin(&c, PATH) == 0, "begin again");
+    CheckpointRecord(&c, TAG_NUMBER, &other, sizeof(other));
+    CheckpointAbort(&c);
+    memset(&l, 0, sizeof(l));
+    check(CheckpointLoad(PATH, load, &l) == 0 && l.number == 42,
+          "abort keeps the old checkpoint");
+    check(access(PATH ".new", F_OK) < 0, "abort removes the new one");
+
+    // A cut record and a file that isn't a checkpoint.
+    check(truncate(PATH, 8 + 8 + sizeof(number) + 8 + 3) == 0, "truncate");
+    check(CheckpointLoad(PATH, load, &l) == -EPROTO, "cut record rejected");
+    if ((f = fopen(PATH, "wb")))
+    {
+        fputs("not a checkpoint", f);
+        fclose(f);
+    }
+    check(CheckpointLoad(PATH, load, &l) == -EPROTO, "bad magic rejected");
+
+    char path[16];
+    int64_t period;
+    check(CheckpointSpec("state:30", path, sizeof(path), &period) == 0 &&
+          !strcmp(path, "state") && period == 30 * TEMPER_NS_PER_SEC,
+          "spec with a period");
+    check(CheckpointSpec("a:b", path, sizeof(path), &period) == 0 &&
+          !strcmp(path, "a:b") && period == CHECKPOINT_PERIOD_DEFAULT *
+          TEMPER_NS_PER_SEC, "spec without one");
+    check(CheckpointSpec(":5", path, sizeof(path), &period) == -EINVAL,
+          "spec without a path");
+}
+
+static void aggregate_window(void)
+{
+    Pipeline p;
+    Checkpoint c;
+    struct Loaded l;
+
+    // Half a window, saved, then closed: nothing is emitted.
+    build(&p, "aggregate:10");
+    check(PipelineStart(&p) == 0, "pipeline started");
+    submit(&p, 1, 20);
+    submit(&p, 2, 21);
+    submit(&p, 3, 22);
+    check(CheckpointBegin(&c, PATH) == 0, "begin");
+    CheckpointRecordBegin(&c, TAG_PIPELINE);
+    check(PipelineSave(&p, CheckpointFile(&c)) == 0, "pipeline saved");
+    CheckpointRecordEnd(&c);
+    check(CheckpointCommit(&c) == 0, "commit");
+    PipelineClose(&p);
+    check(got_count == 0, "saved window not flushed");
+
+    // The next run finishes it.
+    build(&p, "aggregate:10");
+    memset(&l, 0, sizeof(l));
+    l.pipeline = &p;
+    check(CheckpointLoad(PATH, load, &l) == 0 && l.restored == 1,
+          "pipeline restored");
+    check(PipelineStart(&p) == 0, "pipeline started");
+    submit(&p, 4, 23);
+    submit(&p, 12, 30);
+    check(got_count == 1 && got[0].value[0] == 21.5f &&
+          got[0].value[1] == 31.5f &&
+          got[0].timestamp == 2500 * TEMPER_NS_PER_MS,
+          "window mean over both runs");
+    PipelineClose(&p);
+    check(got_count == 2 && got[1].value[0] == 30, "last window flushed");
+
+    // A filtered channel is left out of its mean, not made NAN by it.
+    got_count = 0;
+    build(&p, "aggregate:10");
+    check(PipelineStart(&p) == 0, "pipeline started");
+    submit(&p, 1, 20);
+    submit(&p, 2, NAN);
+    submit(&p, 3, 23);
+    submit(&p, 11, NAN);
+    PipelineClose(&p);
+    check(got_count == 2 && got[0].value[0] == 21.5f &&
+          got[0].value[1] == 31.5f, "NAN left out of the mean");
+    check(got_count == 2 && isnan(got[1].value[0]) && isnan(got[1].value[1]),
+          "NAN without numbers");
+
+    // A differently sized window starts fresh.
+    got_count = 0;
+    build(&p, "aggregate:5");
+    memset(&l, 0, sizeof(l));
+    l.pipeline = &p;
+    check(CheckpointLoad(PATH, load, &l) == 0 && l.restored == 0,
+          "other window not restored");
+    PipelineClose(&p);
+    check(got_count == 0, "fresh stage holds nothing");
+
+    unlink(PATH);
+}
+
+int main(void)
+{
+    file_format();
+    aggregate_window();
+
+    if (failures)
+    {
+        fprintf(stderr, "checkpoint_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("checkpoint_test: ok\n");
+    return 0;
+}
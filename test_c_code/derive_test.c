@@ -0,0 +1,147 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "derive.h"
+#include "pipeline.h"
+
+// Compile derived sensor definitions and run them on a sweep, see derive.h.
+
+#define MAX_ROWS 64
+
+static int failures = 0;
+static TemperReading got[MAX_ROWS];
+static unsigned got_count = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+// A sink that keeps what reaches it.
+static int keep(void *state, const TemperReading *rows, unsigned count,
+                PipelineNode *out)
+{
+    for (unsigned i = 0; i < count && got_count < MAX_ROWS; ++i)
+    { got[got_count++] = rows[i]; }
+    return 0;
+}
+
+static const PipelineOps KeepOps = { "keep", keep, NULL, NULL, NULL, NULL };
+
+static const TemperReading *find(int sensor)
+{
+    for (unsigned i = 0; i < got_count; ++i)
+    {
+        if (got[i].sensor == sensor)
+        { return &got[i]; }
+    }
+    return NULL;
+}
+
+static int near(double a, double b)
+{
+    return fabs(a - b) < 1e-4;
+}
+
+static void check_value(int sensor, double value, const char *what)
+{
+    const TemperReading *r = find(sensor);
+
+    check(r && near(r->value[0], value), what);
+}
+
+static int rejects(const char *spec)
+{
+    int err = 0;
+    Derive *d = DeriveOpen(&spec, 1, &err);
+
+    if (d)
+    { DeriveOps.close(d); }
+    return !d && err == -EINVAL;
+}
+
+int main(void)
+{
+    const char *specs[] = {
+        "delta[3]=outer-inner",               // 1000
+        "rack[0-2]=mean(inner)",              // 1001
+        "diff=inner@1-inner@0",               // 1002
+        "dew[2]=dewpoint(inner,outer)",       // 1003
+        "calc=1+2*3-(4-2)/2",                 // 1004
+        "hot[0,2]=max(inner,outer)-abs(-1)",  // 1005, 1006
+        "missing[5]=inner",                   // 1007
+    };
+    const unsigned count = sizeof(specs) / sizeof(specs[0]);
+    TemperReading sweep[4];
+    Pipeline pipeline;
+    int err = 0;
+
+    Derive *d = DeriveOpen(specs, count, &err);
+    check(d != NULL, "definitions compile");
+    if (!d)
+    {
+        fprintf(stderr, "derive_test: DeriveOpen: %d\n", err);
+        return 1;
+    }
+    check(DeriveCount(d) == count + 1, "one sensor per device that varies");
+
+    const char *name, *definition;
+    check(DeriveSensor(d, 5, &name, &definition) == 1005 &&
+          strcmp(name, "hot[0]") == 0, "per device names");
+
+    // Devices 0, 2 and 3 were read this sweep, device 1 was not.
+    memset(sweep, 0, sizeof(sweep));
+    for (int i = 0; i < 3; ++i)
+    {
+        sweep[i].sensor = i == 0 ? 0 : i + 1;
+        sweep[i].timestamp = 1000000000LL * (i + 1);
+        sweep[i].value[0] = 20.0f + i;
+        sweep[i].value[1] = 50.0f + 10 * i;
+    }
+
+    PipelineInit(&pipeline);
+    check(PipelineAdd(&pipeline, 0, &DeriveOps, d, 0) == 0, "derive stage added");
+    check(PipelineAdd(&pipeline, 1, &KeepOps, NULL, 0) == 0, "sink added");
+    check(PipelineStart(&pipeline) == 0, "pipeline started");
+    PipelineSubmit(&pipeline, sweep, 3);
+
+    check(find(0) && find(2) && find(3), "readings pass through");
+    check_value(1000, 70.0 - 22.0, "outer minus inner");
+    check(find(1000) && find(1000)->timestamp == 3000000000LL,
+          "stamped like the device's reading");
+    check_value(1001, (20.0 + 21.0) / 2, "mean skips devices not read");
+    check(find(1001) && find(1001)->timestamp == 3000000000LL,
+          "group stamped with the newest reading");
+    check(find(1002) == NULL, "not emitted without device 1");
+
+    const double g = log(60.0 / 100) + 17.62 * 21.0 / (243.12 + 21.0);
+    check_value(1003, 243.12 * g / (17.62 - g), "dewpoint");
+    check_value(1004, 6.0, "precedence and parentheses");
+    check_value(1005, 50.0 - 1, "max and abs, device 0");
+    check_value(1006, 60.0 - 1, "max and abs, device 2");
+    check(find(1007) == NULL, "nothing for a device not read");
+
+    PipelineClose(&pipeline);
+
+    check(rejects("x=inner+"), "dangling operator");
+    check(rejects("x=(inner"), "open parenthesis");
+    check(rejects("x=foo(inner)"), "unknown function");
+    check(rejects("x=min(inner,outer,inner)"), "too many arguments");
+    check(rejects("=inner"), "no name");
+    check(rejects("x[0-]=inner"), "bad device range");
+    check(rejects("x=1+(1+(1+(1+(1+(1+(1+(1+(1+1))))))))"), "stack too deep");
+
+    if (failures)
+    {
+        fprintf(stderr, "derive_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("derive_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "export.h"
+#include "query.h"
+
+// Round trip batches through the export codecs, see export.h.
+
+#define ROWS 300
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static int same_value(float a, float b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// Three sensors, sensor by sensor in time order: a steady interval with a
+// late reading, values that sit still and then move, a NaN and a sensor
+// from before the epoch.
+static void make_rows(TemperReading *rows)
+{
+    for (int i = 0; i < ROWS; ++i)
+    {
+        TemperReading *r = &rows[i];
+        const int n = i % 100;
+
+        memset(r, 0, sizeof(*r));
+        r->sensor = i < 100 ? 0 : i < 200 ? 7 : 1000;
+        r->timestamp = (r->sensor == 7 ? -5000000000LL : 1792378000000000000LL)
+                       + (int64_t)n * 1000000000 + (n == 50 ? 1234567 : 0);
+        r->value[0] = n < 40 ? 21.5f : 21.5f + 0.0625f * (n - 40);
+        r->value[1] = n == 60 ? NAN : 36.5f - 0.25f * (n / 10);
+    }
+}
+
+static int round_trip(const TemperReading *rows, unsigned count, unsigned channels)
+{
+    static uint8_t buf[1 << 20];
+    static TemperReading back[TEMPER_EXPORT_BATCH];
+    size_t used = 0;
+    int ok = 1;
+
+    size_t size = TemperExportEncode(rows, count, channels, buf);
+    check(size <= TemperExportBound(count), "batch within its bound");
+
+    int got = TemperExportDecode(buf, size, channels, back, &used);
+    check(got == (int)count, "decoded row count");
+    check(used == size, "decoded batch size");
+    for (int i = 0; got == (int)count && i < got; ++i)
+    {
+        ok &= back[i].sensor == rows[i].sensor;
+        ok &= back[i].timestamp == rows[i].timestamp;
+        for (int c = 0; c < TEMPER_CHANNELS; ++c)
+        {
+            ok &= channels & (1u << c) ? same_value(back[i].value[c], rows[i].value[c])
+                                       : isnan(back[i].value[c]);
+        }
+    }
+    check(ok, "decoded rows match");
+
+    // Every prefix is incomplete, not corrupt.
+    for (size_t cut = 0; cut < size; cut += size / 7 + 1)
+    {
+        check(TemperExportDecode(buf, cut, channels, back, &used) == -EAGAIN,
+              "short batch asks for more");
+    }
+
+    // An unknown codec is corrupt.
+    buf[8] = 0xff;
+    check(TemperExportDecode(buf, size, channels, back, &used) == -EPROTO,
+          "unknown codec rejected");
+
+    return size;
+}
+
+int main(void)
+{
+    static TemperReading rows[ROWS];
+    uint8_t header[TEMPER_EXPORT_HEADER];
+
+    make_rows(rows);
+
+    TemperExportHeader(TEMPER_QUERY_OUTER, header);
+    check(TemperExportCheckHeader(header) == TEMPER_QUERY_OUTER, "header mask");
+    header[0] = 'X';
+    check(TemperExportCheckHeader(header) == -EPROTO, "bad magic rejected");
+
+    int all = round_trip(rows, ROWS, TEMPER_QUERY_ALL);
+    round_trip(rows, ROWS, TEMPER_QUERY_INNER);
+    round_trip(rows, 1, TEMPER_QUERY_ALL);
+    round_trip(rows, 0, TEMPER_QUERY_ALL);
+
+    // Steady runs are what the codecs are for.
+    check(all < ROWS * (4 + 8 + 4 * TEMPER_CHANNELS) / 3, "codecs shrink steady rows");
+
+    if (failures)
+    {
+        fprintf(stderr, "export_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("export_test: ok, %d bytes for %d rows\n", all, ROWS);
+    return 0;
+}
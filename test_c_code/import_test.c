@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+// Merge databases with temper_import and check that it keeps one row per
+// sensor and time, the target's first, and carries NULLs over, on both the
+// rebuild and the indexed merge.  Run from where temper_import was built.
+
+#define TARGET "import_test_target.db"
+#define SOURCE "import_test_source.db"
+#define LEGACY "import_test_legacy.db"
+
+#define SCHEMA "CREATE TABLE sensors(Id INT, timestamp INT, inner_temp FLOAT," \
+               " outer_temp FLOAT, timestamp_ns INT);"
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void create(const char *path, const char *sql)
+{
+    sqlite3 *db;
+
+    unlink(path);
+    if (sqlite3_open(path, &db) != SQLITE_OK ||
+        sqlite3_exec(db, sql, NULL, NULL, NULL) != SQLITE_OK)
+    { fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db)); }
+    sqlite3_close(db);
+}
+
+// First column of the first row of sql on the target, as text, "-" for no
+// row and "NULL" for NULL.
+static const char *value(const char *sql)
+{
+    static char text[64];
+    sqlite3 *db;
+    sqlite3_stmt *stmt;
+
+    strcpy(text, "-");
+    if (sqlite3_open(TARGET, &db) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const unsigned char *t = sqlite3_column_text(stmt, 0);
+            snprintf(text, sizeof(text), "%s", t ? (const char *)t : "NULL");
+        }
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+    return text;
+}
+
+static int import(const char *sources)
+{
+    char command[256];
+
+    snprintf(command, sizeof(command), "./temper_import -j 2 %s %s > /dev/null",
+             TARGET, sources);
+    return system(command);
+}
+
+// Staged rows outnumber the target's, so the target is rebuilt.
+static void rebuild(void)
+{
+    create(TARGET, SCHEMA
+           "INSERT INTO sensors VALUES(0, 1, 10.0, 20.0, 1000000000);");
+    create(SOURCE, SCHEMA
+           "INSERT INTO sensors VALUES(0, 1, 99.0, 99.0, 1000000000);"
+           "INSERT INTO sensors VALUES(0, 2, NULL, 21.0, 2000000000);"
+           "INSERT INTO sensors VALUES(0, 3, 12.0, 22.0, 3000000000);"
+           "INSERT INTO sensors VALUES(0, 3, 12.0, 22.0, 3000000000);"
+           "INSERT INTO sensors VALUES(1, 1, 30.0, NULL, 1000000000);");
+    create(LEGACY, "CREATE TABLE sensors(Id INT, timestamp INT,"
+           " inner_temp FLOAT, outer_temp FLOAT);"
+           "INSERT INTO sensors VALUES(0, 4, 13.0, 23.0);"
+           "INSERT INTO sensors VALUES(0, 1, 98.0, 98.0);");
+
+    check(import(SOURCE " " LEGACY) == 0, "rebuild import");
+    check(!strcmp(value("SELECT COUNT(*) FROM sensors;"), "5"),
+          "rebuild keeps one row per sensor and time");
+    check(!strcmp(value("SELECT inner_temp FROM sensors"
+                        " WHERE Id = 0 AND timestamp_ns = 1000000000;"), "10.0"),
+          "rebuild keeps the target's row");
+    check(!strcmp(value("SELECT inner_temp FROM sensors"
+                        " WHERE Id = 0 AND timestamp_ns = 2000000000;"), "NULL"),
+          "rebuild keeps NULL inner");
+    check(!strcmp(value("SELECT outer_temp FROM sensors WHERE Id = 1;"), "NULL"),
+          "rebuild keeps NULL outer");
+    check(!strcmp(value("SELECT timestamp_ns FROM sensors WHERE timestamp = 4;"),
+                  "4000000000"), "legacy rows get ns");
+    check(!strcmp(value("SELECT COUNT(*) FROM sqlite_master"
+                        " WHERE name = 'sensors_id_timestamp_ns';"), "1"),
+          "rebuild indexes the target");
+}
+
+// The target outnumbers the staged rows, so they go in through its index.
+static void indexed(void)
+{
+    create(TARGET, SCHEMA
+           "INSERT INTO sensors VALUES(0, 1, 10.0, 20.0, 1000000000);"
+           "INSERT INTO sensors VALUES(0, 2, 11.0, 21.0, 2000000000);"
+           "INSERT INTO sensors VALUES(0, 3, 12.0, NULL, 3000000000);"
+           "INSERT INTO sensors VALUES(0, 4, 13.0, 23.0, 4000000000);");
+    create(SOURCE, SCHEMA
+           "INSERT INTO sensors VALUES(0, 3, 99.0, 99.0, 3000000000);"
+           "INSERT INTO sensors VALUES(0, 5, NULL, 25.0, 5000000000);"
+           "INSERT INTO sensors VALUES(0, 5, NULL, 25.0, 5000000000);");
+
+    check(import(SOURCE) == 0, "indexed import");
+    check(!strcmp(value("SELECT COUNT(*) FROM sensors;"), "5"),
+          "indexed keeps one row per sensor and time");
+    check(!strcmp(value("SELECT inner_temp || ',' || IFNULL(outer_temp, 'NULL')"
+                        " FROM sensors WHERE timestamp_ns = 3000000000;"),
+                  "12.0,NULL"), "indexed keeps the target's row");
+    check(!strcmp(value("SELECT IFNULL(inner_temp, 'NULL') FROM sensors"
+                        " WHERE timestamp_ns = 5000000000;"), "NULL"),
+          "indexed keeps NULL inner");
+
+    // Importing the same file again adds nothing.
+    check(import(SOURCE) == 0 &&
+          !strcmp(value("SELECT COUNT(*) FROM sensors;"), "5"),
+          "second import adds nothing");
+}
+
+int main(void)
+{
+    if (access("./temper_import", X_OK) < 0)
+    {
+        fprintf(stderr, "import_test: no ./temper_import\n");
+        return 1;
+    }
+
+    rebuild();
+    indexed();
+    unlink(TARGET);
+    unlink(SOURCE);
+    unlink(LEGACY);
+
+    if (failures)
+    {
+        fprintf(stderr, "import_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("import_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "live.h"
+
+// Publish readings to a live file and read them back, while the writer is
+// busy and after it died half way through a reading, see live.h.
+
+#define PATH "live_test.live"
+#define DEPTH 8
+#define WRITES 200000
+#define SLOT_0 32	/* offset of sensor 0's sequence number in the file */
+
+static int failures = 0;
+
+static void check(int ok, const char *what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "FAIL: %s\n", what);
+        ++failures;
+    }
+}
+
+static void publish(TemperLive *live, int sensor, int64_t t, float value)
+{
+    TemperReading r;
+
+    memset(&r, 0, sizeof(r));
+    r.sensor = sensor;
+    r.timestamp = t;
+    r.value[0] = value;
+    r.value[1] = value;
+    TemperLivePublish(live, &r);
+}
+
+static void *writer(void *arg)
+{
+    for (int i = 1; i <= WRITES; ++i)
+    { publish(arg, 2, i, i); }
+    return NULL;
+}
+
+static void latest_and_rings(void)
+{
+    TemperReading r, rows[DEPTH];
+    TemperLiveStats stats;
+    int err;
+
+    TemperLive *w = TemperLiveCreate(PATH, DEPTH, &err);
+    check(w != NULL, "live file created");
+    if (!w)
+    { return; }
+    for (int i = 1; i <= 20; ++i)
+    { publish(w, 0, i, i); }
+
+    TemperLive *live = TemperLiveOpen(PATH, &err);
+    check(live != NULL, "live file opened");
+    if (!live)
+    { return; }
+    check(TemperLiveDepth(live) == DEPTH, "depth");
+    check(TemperLiveRead(live, 0, &r) == 1 && r.timestamp == 20 &&
+          r.value[0] == 20, "latest reading");
+    check(TemperLiveRead(live, 1, &r) == 0, "nothing published");
+    check(TemperLiveRead(live, TemperLiveSlots(live), &r) == 0, "past the slots");
+
+    // The one being overwritten next doesn't count.
+    check(TemperLiveOldest(live, 0) == 14, "oldest in the ring");
+    check(TemperLiveOldest(live, 1) == INT64_MAX, "empty ring");
+    unsigned n = TemperLiveRange(live, 0, 0, INT64_MAX, rows, DEPTH);
+    check(n == DEPTH - 1 && rows[0].timestamp == 14 &&
+          rows[n - 1].timestamp == 20 && rows[n - 1].value[1] == 20,
+          "whole ring, oldest first");
+    n = TemperLiveRange(live, 0, 16, 18, rows, DEPTH);
+    check(n == 2 && rows[0].timestamp == 16 && rows[1].timestamp == 17,
+          "window of the ring");
+    check(TemperLiveRange(live, 0, 0, INT64_MAX, rows, 3) == 3, "at most max");
+
+    check(TemperLiveSummary(live, 0, 15, 19, &stats) == 4 &&
+          stats.first == 15 && stats.last == 18 && stats.min[0] == 15 &&
+          stats.max[0] == 18 && stats.mean[1] == 16.5f, "summary");
+
+    // Filtered readings are NAN, the summary leaves them out.
+    publish(w, 4, 1, 1);
+    publish(w, 4, 2, NAN);
+    publish(w, 4, 3, 3);
+    check(TemperLiveSummary(live, 4, 0, 10, &stats) == 3 &&
+          stats.min[0] == 1 && stats.max[0] == 3 && stats.mean[0] == 2,
+          "NAN left out of the summary");
+    publish(w, 5, 1, NAN);
+    check(TemperLiveSummary(live, 5, 0, 10, &stats) == 1 &&
+          isnan(stats.min[1]) && isnan(stats.max[1]) && isnan(stats.mean[1]),
+          "NAN without numbers");
+
+    // Torn reads would mix a timestamp with another reading's values.
+    pthread_t thread;
+    int torn = 0, backwards = 0;
+    int64_t last = 0;
+    if (pthread_create(&thread, NULL, writer, w) == 0)
+    {
+        while (last < WRITES)
+        {
+            if (TemperLiveRead(live, 2, &r) != 1)
+            { continue; }
+            torn += r.value[0] != r.timestamp || r.value[1] != r.timestamp;
+            backwards += r.timestamp < last;
+            last = r.timestamp;
+        }
+        pthread_join(thread, NULL);
+    }
+    check(last == WRITES && !torn, "no torn reads");
+    check(!backwards, "readings in order");
+
+    // A new collector replaces the file, readers keep the old one.
+    TemperLiveClose(w);
+    w = TemperLiveCreate(PATH, DEPTH, &err);
+    check(w != NULL, "live file replaced");
+    check(TemperLiveRead(live, 0, &r) == 1 && r.timestamp == 20,
+          "old file still readable");
+    TemperLiveClose(live);
+    if (w)
+    { TemperLiveClose(w); }
+}
+
+static void died_while_writing(void)
+{
+    const uint32_t odd = 1;
+    TemperReading r;
+    int err;
+
+    int fd = open(PATH, O_WRONLY);
+    check(fd >= 0 && pwrite(fd, &odd, sizeof(odd), SLOT_0) == sizeof(odd),
+          "slot left half written");
+    if (fd >= 0)
+    { close(fd); }
+
+    TemperLive *live = TemperLiveOpen(PATH, &err);
+    check(live && TemperLiveRead(live, 0, &r) == -EAGAIN, "reader gives up");
+    if (live)
+    { TemperLiveClose(live); }
+}
+
+int main(void)
+{
+    latest_and_rings();
+    died_while_writing();
+    unlink(PATH);
+
+    if (failures)
+    {
+        fprintf(stderr, "live_test: %d failed\n", failures);
+        return 1;
+    }
+    printf("live_test: ok\n");
+    return 0;
+}
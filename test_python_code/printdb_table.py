@@ -29,7 +29,7 @@ try:
     f.write("<th>Outer Temperature</th>\n")
     f.write("</tr>\n")
 
-    cur.execute('SELECT * from sensors')
+    cur.execute('SELECT Id, timestamp, inner_temp, outer_temp from sensors')
     data = cur.fetchone()
     sensor,timeStamp,innerTemp,outerTemp=data
     while data: